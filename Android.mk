@@ -4,13 +4,19 @@ include $(CLEAR_VARS)
 LOCAL_ARM_MODE := arm
 
 LOCAL_SRC_FILES := \
+    src/arena.c \
+    src/cbor.c \
     src/dump.c \
     src/error.c \
     src/hashtable.c \
     src/hashtable_seed.c \
+    src/image.c \
     src/load.c \
     src/memory.c \
     src/pack_unpack.c \
+    src/pointer.c \
+    src/scan.c \
+    src/slab.c \
     src/strbuffer.c \
     src/strconv.c \
     src/utf.c \
@@ -1,7 +1,9 @@
 #cmakedefine HAVE_ENDIAN_H 1
 #cmakedefine HAVE_FCNTL_H 1
+#cmakedefine HAVE_PTHREAD_H 1
 #cmakedefine HAVE_SCHED_H 1
 #cmakedefine HAVE_UNISTD_H 1
+#cmakedefine HAVE_SYS_MMAN_H 1
 #cmakedefine HAVE_SYS_PARAM_H 1
 #cmakedefine HAVE_SYS_STAT_H 1
 #cmakedefine HAVE_SYS_TIME_H 1
@@ -11,12 +13,15 @@
 #cmakedefine HAVE_CLOSE 1
 #cmakedefine HAVE_GETPID 1
 #cmakedefine HAVE_GETTIMEOFDAY 1
+#cmakedefine HAVE_MMAP 1
 #cmakedefine HAVE_OPEN 1
+#cmakedefine HAVE_POSIX_MADVISE 1
 #cmakedefine HAVE_READ 1
 #cmakedefine HAVE_SCHED_YIELD 1
 
 #cmakedefine HAVE_SYNC_BUILTINS 1
 #cmakedefine HAVE_ATOMIC_BUILTINS 1
+#cmakedefine HAVE___THREAD 1
 
 #cmakedefine HAVE_LOCALE_H 1
 #cmakedefine HAVE_SETLOCALE 1
@@ -49,5 +54,12 @@
 
 #cmakedefine USE_URANDOM 1
 #cmakedefine USE_WINDOWS_CRYPTOAPI 1
+#cmakedefine USE_SLAB_ALLOCATOR 1
+#cmakedefine USE_MEMORY_STATS 1
 
 #define INITIAL_HASHTABLE_ORDER @JANSSON_INITIAL_HASHTABLE_ORDER@
+
+#cmakedefine USE_WYHASH 1
+
+#define SHARED_INT_MIN @JANSSON_SHARED_INT_MIN@
+#define SHARED_INT_MAX @JANSSON_SHARED_INT_MAX@
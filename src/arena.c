@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+
+/* Allocations are aligned for any member of a json_t subtype */
+typedef union {
+    void *pointer;
+    double real;
+    json_int_t integer;
+    size_t size;
+} arena_align_t;
+
+#define ARENA_ALIGN               sizeof(arena_align_t)
+#define arena_round(size_) (((size_) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    arena_align_t data[1];
+} arena_block_t;
+
+/* A reference to a value that was allocated outside the arena and
+   stored in one of its containers, or a buffer handed over to it */
+typedef struct arena_external {
+    struct arena_external *next;
+    json_t *value;
+    void *buffer;
+} arena_external_t;
+
+struct json_arena_t {
+    arena_block_t *blocks;
+    arena_external_t *externals;
+    size_t block_size;
+};
+
+static arena_block_t *arena_new_block(size_t size) {
+    arena_block_t *block;
+
+    if (size > (size_t)-1 - offsetof(arena_block_t, data))
+        return NULL;
+
+    block = jsonp_malloc(offsetof(arena_block_t, data) + size);
+    if (!block)
+        return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+json_arena_t *json_arena_create(size_t block_size) {
+    json_arena_t *arena;
+
+    if (block_size == 0)
+        block_size = ARENA_DEFAULT_BLOCK_SIZE;
+    block_size = arena_round(block_size);
+
+    arena = jsonp_malloc(sizeof(json_arena_t));
+    if (!arena)
+        return NULL;
+
+    arena->blocks = NULL;
+    arena->externals = NULL;
+    arena->block_size = block_size;
+    return arena;
+}
+
+void json_arena_reset(json_arena_t *arena) {
+    arena_block_t *block, *next, *keep = NULL;
+    arena_external_t *external;
+
+    if (!arena)
+        return;
+
+    /* The external list itself lives in the arena */
+    for (external = arena->externals; external; external = external->next) {
+        if (external->value)
+            json_decref(external->value);
+        else
+            jsonp_free_untracked(external->buffer);
+    }
+    arena->externals = NULL;
+
+    /* Keep one regular block around for the next document */
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        if (!keep && block->size == arena->block_size) {
+            keep = block;
+            keep->next = NULL;
+            keep->used = 0;
+        } else
+            jsonp_free(block);
+    }
+    arena->blocks = keep;
+}
+
+void json_arena_destroy(json_arena_t *arena) {
+    if (!arena)
+        return;
+
+    json_arena_reset(arena);
+    jsonp_free(arena->blocks);
+    jsonp_free(arena);
+}
+
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size) {
+    arena_block_t *block = arena->blocks;
+    void *result;
+
+    if (size == 0 || size > (size_t)-1 - ARENA_ALIGN)
+        return NULL;
+    size = arena_round(size);
+
+    if (!block || block->size - block->used < size) {
+        if (size > arena->block_size / 4) {
+            /* Give large allocations a block of their own, so that the
+               free space in the current block isn't wasted */
+            block = arena_new_block(size);
+            if (!block)
+                return NULL;
+
+            if (arena->blocks) {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            } else
+                arena->blocks = block;
+        } else {
+            block = arena_new_block(arena->block_size);
+            if (!block)
+                return NULL;
+
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    result = (char *)block->data + block->used;
+    block->used += size;
+    return result;
+}
+
+char *jsonp_arena_strndup(json_arena_t *arena, const char *str, size_t len) {
+    char *new_str;
+
+    if (len == (size_t)-1)
+        return NULL;
+
+    new_str = jsonp_arena_malloc(arena, len + 1);
+    if (!new_str)
+        return NULL;
+
+    memcpy(new_str, str, len);
+    new_str[len] = '\0';
+    return new_str;
+}
+
+int jsonp_arena_adopt(json_arena_t *arena, json_t *json) {
+    arena_external_t *external;
+
+    /* Nothing to release later for arena values and singletons */
+    if (json->refcount == (size_t)-1 || jsonp_is_arena(json))
+        return 0;
+
+    external = jsonp_arena_malloc(arena, sizeof(arena_external_t));
+    if (!external)
+        return -1;
+
+    external->value = json;
+    external->buffer = NULL;
+    external->next = arena->externals;
+    arena->externals = external;
+    return 0;
+}
+
+int json_arena_adopt_buffer(json_arena_t *arena, void *buffer) {
+    arena_external_t *external;
+
+    if (!arena || !buffer)
+        return -1;
+
+    external = jsonp_arena_malloc(arena, sizeof(arena_external_t));
+    if (!external)
+        return -1;
+
+    external->value = NULL;
+    external->buffer = buffer;
+    external->next = arena->externals;
+    arena->externals = external;
+    return 0;
+}
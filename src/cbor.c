@@ -0,0 +1,1096 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "jansson_private.h"
+
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "jansson.h"
+#include "utf.h"
+
+/* CBOR (RFC 8949) encoding of JSON values. Only the data items that
+   have a JSON equivalent are supported: integers, text strings,
+   arrays, maps with text string keys, floats, true, false and null.
+   Tags are skipped when decoding. */
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES    2
+#define CBOR_TEXT     3
+#define CBOR_ARRAY    4
+#define CBOR_MAP      5
+#define CBOR_TAG      6
+#define CBOR_SIMPLE   7
+
+/* Additional information values */
+#define CBOR_FALSE      20
+#define CBOR_TRUE       21
+#define CBOR_NULL       22
+#define CBOR_HALF       25
+#define CBOR_FLOAT      26
+#define CBOR_DOUBLE     27
+#define CBOR_INDEFINITE 31
+
+#define CBOR_BREAK 0xff
+
+#if JSON_INTEGER_IS_LONG_LONG
+#define CBOR_INT_MAX LLONG_MAX
+#else
+#define CBOR_INT_MAX LONG_MAX
+#endif
+
+#define CBOR_BUFFER_SIZE 4096
+#define CBOR_CHUNK_SIZE  65536
+
+/* True for finite values, as NaN and the infinities give NaN */
+#define is_finite(value_) ((value_) - (value_) == 0.0)
+
+/*** encoding ***/
+
+/* The output of the encoder, like the dumper of dump.c. Without a
+   callback, buffer is the final destination and the bytes that don't
+   fit are only counted. */
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t used;
+    size_t overflow;
+    json_dump_callback_t callback;
+    void *data;
+} encoder_t;
+
+static int encoder_flush(encoder_t *encoder) {
+    if (encoder->callback && encoder->used) {
+        if (encoder->callback(encoder->buffer, encoder->used, encoder->data))
+            return -1;
+        encoder->used = 0;
+    }
+    return 0;
+}
+
+static int encode_bytes_slow(encoder_t *encoder, const char *bytes, size_t len) {
+    if (!encoder->callback) {
+        encoder->size = encoder->used;
+        encoder->overflow += len;
+        return 0;
+    }
+
+    if (encoder_flush(encoder))
+        return -1;
+
+    if (len >= encoder->size)
+        return encoder->callback(bytes, len, encoder->data);
+
+    memcpy(encoder->buffer, bytes, len);
+    encoder->used = len;
+    return 0;
+}
+
+static int encode_bytes(encoder_t *encoder, const char *bytes, size_t len) {
+    if (len == 0)
+        return 0;
+    if (len > encoder->size - encoder->used)
+        return encode_bytes_slow(encoder, bytes, len);
+
+    memcpy(encoder->buffer + encoder->used, bytes, len);
+    encoder->used += len;
+    return 0;
+}
+
+/* Write the initial byte and the argument in the shortest form */
+static int encode_head(encoder_t *encoder, int major, uint64_t value) {
+    char head[9];
+    size_t len, i;
+
+    if (value < 24) {
+        head[0] = (char)(major << 5 | (int)value);
+        return encode_bytes(encoder, head, 1);
+    }
+
+    if (value <= 0xff)
+        len = 1;
+    else if (value <= 0xffff)
+        len = 2;
+    else if (value <= 0xffffffff)
+        len = 4;
+    else
+        len = 8;
+
+    head[0] = (char)(major << 5 | (len == 1 ? 24 : len == 2 ? 25 : len == 4 ? 26 : 27));
+    for (i = len; i > 0; i--) {
+        head[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+    return encode_bytes(encoder, head, len + 1);
+}
+
+/* Reals are written as single precision floats if that's exact */
+static int encode_real(encoder_t *encoder, double value) {
+    char bytes[9];
+    uint64_t bits;
+    size_t len, i;
+
+    if (value >= -FLT_MAX && value <= FLT_MAX && (double)(float)value == value) {
+        float single = (float)value;
+        uint32_t single_bits;
+
+        memcpy(&single_bits, &single, sizeof(single_bits));
+        bits = single_bits;
+        bytes[0] = (char)(CBOR_SIMPLE << 5 | CBOR_FLOAT);
+        len = 4;
+    } else {
+        memcpy(&bits, &value, sizeof(bits));
+        bytes[0] = (char)(CBOR_SIMPLE << 5 | CBOR_DOUBLE);
+        len = 8;
+    }
+
+    for (i = len; i > 0; i--) {
+        bytes[i] = (char)(bits & 0xff);
+        bits >>= 8;
+    }
+    return encode_bytes(encoder, bytes, len + 1);
+}
+
+static int encode_text(encoder_t *encoder, const char *text, size_t len) {
+    if (encode_head(encoder, CBOR_TEXT, len))
+        return -1;
+    return encode_bytes(encoder, text, len);
+}
+
+static int encode_simple(encoder_t *encoder, int value) {
+    char byte = (char)(CBOR_SIMPLE << 5 | value);
+    return encode_bytes(encoder, &byte, 1);
+}
+
+static int encode_value(const json_t *json, size_t flags, jsonp_parents_t *parents,
+                        encoder_t *encoder);
+
+static int encode_object(const json_t *json, size_t flags, jsonp_parents_t *parents,
+                         encoder_t *encoder) {
+    size_t size = json_object_size(json), i;
+
+    if (encode_head(encoder, CBOR_MAP, size))
+        return -1;
+
+    if (size > 1 && (flags & JSON_SORT_KEYS)) {
+        struct hashtable_pair *small[JSONP_SORTED_SMALL], **pairs;
+        int res = 0;
+
+        pairs = jsonp_sorted_pairs(json, flags, small);
+        if (!pairs)
+            return -1;
+
+        for (i = 0; i < size && !res; i++) {
+            res = encode_text(encoder, pairs[i]->key, pairs[i]->key_len) ||
+                  encode_value(json_object_iter_value(pairs[i]), flags, parents, encoder);
+        }
+
+        jsonp_release_sorted_pairs(json, pairs, small);
+        return res ? -1 : 0;
+    } else {
+        const char *key;
+        size_t key_len;
+        json_t *value;
+
+        json_object_keylen_foreach((json_t *)json, key, key_len, value) {
+            if (encode_text(encoder, key, key_len) ||
+                encode_value(value, flags, parents, encoder))
+                return -1;
+        }
+        return 0;
+    }
+}
+
+static int encode_value(const json_t *json, size_t flags, jsonp_parents_t *parents,
+                        encoder_t *encoder) {
+    json_int_t integer;
+    size_t i, size;
+    int res;
+
+    if (!json)
+        return -1;
+
+    switch (json_typeof(json)) {
+        case JSON_NULL:
+            return encode_simple(encoder, CBOR_NULL);
+
+        case JSON_TRUE:
+            return encode_simple(encoder, CBOR_TRUE);
+
+        case JSON_FALSE:
+            return encode_simple(encoder, CBOR_FALSE);
+
+        case JSON_INTEGER:
+            integer = json_integer_value(json);
+            if (integer >= 0)
+                return encode_head(encoder, CBOR_UNSIGNED, (uint64_t)integer);
+            return encode_head(encoder, CBOR_NEGATIVE, (uint64_t)(-(integer + 1)));
+
+        case JSON_REAL:
+            return encode_real(encoder, json_real_value(json));
+
+        case JSON_STRING:
+            return encode_text(encoder, json_string_value(json),
+                               json_string_length(json));
+
+        case JSON_ARRAY:
+            /* detect circular references */
+            if (parents && jsonp_parents_enter(parents, json))
+                return -1;
+
+            size = json_array_size(json);
+            if (encode_head(encoder, CBOR_ARRAY, size))
+                return -1;
+            for (i = 0; i < size; i++) {
+                if (encode_value(json_array_get(json, i), flags, parents, encoder))
+                    return -1;
+            }
+
+            if (parents)
+                jsonp_parents_leave(parents, json);
+            return 0;
+
+        case JSON_OBJECT:
+            if (parents && jsonp_parents_enter(parents, json))
+                return -1;
+
+            res = encode_object(json, flags, parents, encoder);
+
+            if (parents && !res)
+                jsonp_parents_leave(parents, json);
+            return res;
+
+        default:
+            /* not reached */
+            return -1;
+    }
+}
+
+static int encode_root(const json_t *json, encoder_t *encoder, size_t flags) {
+    jsonp_parents_t parents;
+    int res;
+
+    if (!(flags & JSON_ENCODE_ANY)) {
+        if (!json_is_array(json) && !json_is_object(json))
+            return -1;
+    }
+
+    if (flags & JSON_NO_CYCLE_CHECK)
+        res = encode_value(json, flags, NULL, encoder);
+    else {
+        jsonp_parents_init(&parents);
+        res = encode_value(json, flags, &parents, encoder);
+        jsonp_parents_close(&parents);
+    }
+
+    if (res)
+        return -1;
+    return encoder_flush(encoder);
+}
+
+size_t json_cbor_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
+    encoder_t encoder;
+
+    encoder.buffer = buffer;
+    encoder.size = buffer ? size : 0;
+    encoder.used = 0;
+    encoder.overflow = 0;
+    encoder.callback = NULL;
+    encoder.data = NULL;
+
+    if (encode_root(json, &encoder, flags))
+        return 0;
+
+    return encoder.used + encoder.overflow;
+}
+
+int json_cbor_dump_callback(const json_t *json, json_dump_callback_t callback,
+                            void *data, size_t flags) {
+    char buffer[CBOR_BUFFER_SIZE];
+    encoder_t encoder;
+
+    if (!callback)
+        return -1;
+
+    encoder.buffer = buffer;
+    encoder.size = sizeof(buffer);
+    encoder.used = 0;
+    encoder.overflow = 0;
+    encoder.callback = callback;
+    encoder.data = data;
+
+    return encode_root(json, &encoder, flags);
+}
+
+static int encode_to_file(const char *buffer, size_t size, void *data) {
+    if (fwrite(buffer, size, 1, (FILE *)data) != 1)
+        return -1;
+    return 0;
+}
+
+static int encode_to_fd(const char *buffer, size_t size, void *data) {
+#ifdef HAVE_UNISTD_H
+    int *dest = (int *)data;
+    if (write(*dest, buffer, size) == (ssize_t)size)
+        return 0;
+#else
+    (void)buffer;
+    (void)size;
+    (void)data;
+#endif
+    return -1;
+}
+
+int json_cbor_dumpf(const json_t *json, FILE *output, size_t flags) {
+    return json_cbor_dump_callback(json, encode_to_file, (void *)output, flags);
+}
+
+int json_cbor_dumpfd(const json_t *json, int output, size_t flags) {
+    return json_cbor_dump_callback(json, encode_to_fd, (void *)&output, flags);
+}
+
+int json_cbor_dump_file(const json_t *json, const char *path, size_t flags) {
+    int result;
+
+    FILE *output = fopen(path, "wb");
+    if (!output)
+        return -1;
+
+    result = json_cbor_dumpf(json, output, flags);
+
+    if (fclose(output) != 0)
+        return -1;
+
+    return result;
+}
+
+/*** decoding ***/
+
+/* The input is either the caller's buffer, or chunks read with fill.
+   With exact, no more is read than the value needs, so that the input
+   that follows it isn't consumed. */
+typedef struct {
+    const char *chunk;
+    size_t len;
+    size_t pos;
+    /* Offset of the chunk in the input */
+    size_t offset;
+    json_load_callback_t fill;
+    void *data;
+    char *fill_buffer;
+    int exact;
+    size_t flags;
+    size_t depth;
+    /* Strings that are split between chunks are collected here */
+    strbuffer_t scratch;
+    json_error_t *error;
+} decoder_t;
+
+static void decoder_error(decoder_t *decoder, size_t position, enum json_error_code code,
+                          const char *msg, ...) {
+    va_list ap;
+
+    va_start(ap, msg);
+    jsonp_error_vset(decoder->error, -1, -1, position, code, msg, ap);
+    va_end(ap);
+}
+
+#define decoder_position(decoder_) ((decoder_)->offset + (decoder_)->pos)
+
+static int decoder_init(decoder_t *decoder, json_load_callback_t fill, void *data,
+                        size_t flags, json_error_t *error) {
+    decoder->chunk = NULL;
+    decoder->len = 0;
+    decoder->pos = 0;
+    decoder->offset = 0;
+    decoder->fill = fill;
+    decoder->data = data;
+    decoder->fill_buffer = NULL;
+    decoder->exact = (flags & JSON_DISABLE_EOF_CHECK) != 0;
+    decoder->flags = flags;
+    decoder->depth = 0;
+    decoder->error = error;
+
+    if (strbuffer_init(&decoder->scratch))
+        goto oom;
+
+    if (fill) {
+        decoder->fill_buffer = jsonp_malloc_as(CBOR_CHUNK_SIZE, json_memory_parser);
+        if (!decoder->fill_buffer) {
+            strbuffer_close(&decoder->scratch);
+            goto oom;
+        }
+        decoder->chunk = decoder->fill_buffer;
+    }
+    return 0;
+
+oom:
+    decoder_error(decoder, 0, json_error_out_of_memory, "out of memory");
+    return -1;
+}
+
+static void decoder_close(decoder_t *decoder) {
+    jsonp_free(decoder->fill_buffer);
+    strbuffer_close(&decoder->scratch);
+}
+
+/* Read the next chunk when the current one has been used up. need is
+   the number of bytes wanted. Returns 0 at the end of the input. */
+static int decoder_fill(decoder_t *decoder, size_t need) {
+    size_t len;
+
+    if (!decoder->fill)
+        return 0;
+
+    if (!decoder->exact || need > CBOR_CHUNK_SIZE)
+        need = CBOR_CHUNK_SIZE;
+
+    len = decoder->fill(decoder->fill_buffer, need, decoder->data);
+    if (len == 0 || len == (size_t)-1)
+        return 0;
+
+    decoder->offset += decoder->len;
+    decoder->len = len;
+    decoder->pos = 0;
+    return 1;
+}
+
+static int decoder_eof(decoder_t *decoder) {
+    decoder_error(decoder, decoder_position(decoder), json_error_premature_end_of_input,
+                  "unexpected end of input");
+    return -1;
+}
+
+static int decoder_read(decoder_t *decoder, char *bytes, size_t len) {
+    while (len > 0) {
+        size_t count;
+
+        if (decoder->pos == decoder->len && !decoder_fill(decoder, len))
+            return decoder_eof(decoder);
+
+        count = decoder->len - decoder->pos;
+        if (count > len)
+            count = len;
+        memcpy(bytes, decoder->chunk + decoder->pos, count);
+        decoder->pos += count;
+        bytes += count;
+        len -= count;
+    }
+    return 0;
+}
+
+/* Append len bytes of input to the scratch buffer, a chunk at a time so
+   that a bogus length runs out of input before memory */
+static int decoder_append(decoder_t *decoder, uint64_t len) {
+    while (len > 0) {
+        size_t count;
+
+        if (decoder->pos == decoder->len &&
+            !decoder_fill(decoder, len < CBOR_CHUNK_SIZE ? (size_t)len : CBOR_CHUNK_SIZE))
+            return decoder_eof(decoder);
+
+        count = decoder->len - decoder->pos;
+        if (count > len)
+            count = (size_t)len;
+        if (strbuffer_append_bytes(&decoder->scratch, decoder->chunk + decoder->pos,
+                                   count)) {
+            decoder_error(decoder, decoder_position(decoder), json_error_out_of_memory,
+                          "out of memory");
+            return -1;
+        }
+        decoder->pos += count;
+        len -= count;
+    }
+    return 0;
+}
+
+/* Read the head of a data item. For an indefinite length item or a
+   break, *arg is 0 and *info is CBOR_INDEFINITE. */
+static int decode_head(decoder_t *decoder, int *major, int *info, uint64_t *arg) {
+    unsigned char bytes[8];
+    size_t len, i;
+    size_t position = decoder_position(decoder);
+
+    if (decoder_read(decoder, (char *)bytes, 1))
+        return -1;
+
+    *major = bytes[0] >> 5;
+    *info = bytes[0] & 0x1f;
+    *arg = 0;
+
+    if (*info < 24) {
+        *arg = (uint64_t)*info;
+        return 0;
+    }
+
+    if (*info == CBOR_INDEFINITE) {
+        if (*major == CBOR_UNSIGNED || *major == CBOR_NEGATIVE || *major == CBOR_TAG)
+            goto invalid;
+        return 0;
+    }
+
+    if (*info > 27)
+        goto invalid;
+
+    len = (size_t)1 << (*info - 24);
+    if (decoder_read(decoder, (char *)bytes, len))
+        return -1;
+    for (i = 0; i < len; i++)
+        *arg = *arg << 8 | bytes[i];
+    return 0;
+
+invalid:
+    decoder_error(decoder, position, json_error_invalid_syntax,
+                  "invalid initial byte 0x%02x", bytes[0]);
+    return -1;
+}
+
+/* Read a text string whose head has been read. The string is left in
+   *text, pointing either to the input or to the scratch buffer. */
+static int decode_text(decoder_t *decoder, int info, uint64_t arg, size_t position,
+                       const char **text, size_t *len) {
+    strbuffer_clear(&decoder->scratch);
+
+    if (info != CBOR_INDEFINITE) {
+        if (arg <= decoder->len - decoder->pos) {
+            /* The whole string is in the current chunk */
+            *text = decoder->chunk + decoder->pos;
+            *len = (size_t)arg;
+            decoder->pos += (size_t)arg;
+            goto check;
+        }
+        if (!decoder->fill)
+            return decoder_eof(decoder);
+        if (decoder_append(decoder, arg))
+            return -1;
+    } else {
+        while (1) {
+            int major;
+            size_t chunk_position = decoder_position(decoder);
+
+            if (decode_head(decoder, &major, &info, &arg))
+                return -1;
+            if (major == CBOR_SIMPLE && info == CBOR_INDEFINITE)
+                break;
+            if (major != CBOR_TEXT || info == CBOR_INDEFINITE) {
+                decoder_error(decoder, chunk_position, json_error_invalid_syntax,
+                              "invalid text string chunk");
+                return -1;
+            }
+            if (decoder_append(decoder, arg))
+                return -1;
+        }
+    }
+
+    *text = strbuffer_value(&decoder->scratch);
+    *len = decoder->scratch.length;
+
+check:
+    if (!utf8_check_string(*text, *len)) {
+        decoder_error(decoder, position, json_error_invalid_utf8,
+                      "invalid UTF-8 in text string");
+        return -1;
+    }
+    return 0;
+}
+
+static json_t *decode_value(decoder_t *decoder);
+
+static int decoder_enter(decoder_t *decoder, size_t position) {
+    if (++decoder->depth > JSON_PARSER_MAX_DEPTH) {
+        decoder_error(decoder, position, json_error_stack_overflow,
+                      "maximum parsing depth reached");
+        return -1;
+    }
+    return 0;
+}
+
+/* True if the next item is a break, which is then consumed */
+static int decoder_at_break(decoder_t *decoder) {
+    if (decoder->pos == decoder->len && !decoder_fill(decoder, 1))
+        return 0;
+
+    if ((unsigned char)decoder->chunk[decoder->pos] == CBOR_BREAK) {
+        decoder->pos++;
+        return 1;
+    }
+    return 0;
+}
+
+static json_t *decode_array(decoder_t *decoder, int info, uint64_t arg,
+                            size_t position) {
+    json_t *array, *value;
+    uint64_t i;
+
+    if (decoder_enter(decoder, position))
+        return NULL;
+
+    array = json_array();
+    if (!array) {
+        decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    for (i = 0; info == CBOR_INDEFINITE || i < arg; i++) {
+        if (info == CBOR_INDEFINITE && decoder_at_break(decoder))
+            break;
+
+        value = decode_value(decoder);
+        if (!value)
+            goto error;
+
+        if (json_array_append_new(array, value)) {
+            decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+            goto error;
+        }
+    }
+
+    decoder->depth--;
+    return array;
+
+error:
+    json_decref(array);
+    return NULL;
+}
+
+static json_t *decode_map(decoder_t *decoder, int info, uint64_t arg, size_t position) {
+    json_t *object, *value;
+    char key_buf[64], *key_copy;
+    uint64_t i;
+
+    if (decoder_enter(decoder, position))
+        return NULL;
+
+    object = json_object();
+    if (!object) {
+        decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    for (i = 0; info == CBOR_INDEFINITE || i < arg; i++) {
+        const char *key;
+        size_t key_len, key_position;
+        int key_major, key_info;
+        uint64_t key_arg;
+
+        if (info == CBOR_INDEFINITE && decoder_at_break(decoder))
+            break;
+
+        key_position = decoder_position(decoder);
+        if (decode_head(decoder, &key_major, &key_info, &key_arg))
+            goto error;
+        if (key_major != CBOR_TEXT) {
+            decoder_error(decoder, key_position, json_error_invalid_syntax,
+                          "map key must be a text string");
+            goto error;
+        }
+        if (decode_text(decoder, key_info, key_arg, key_position, &key, &key_len))
+            goto error;
+
+        if (memchr(key, '\0', key_len)) {
+            decoder_error(decoder, key_position, json_error_null_byte_in_key,
+                          "NUL byte in object key not supported");
+            goto error;
+        }
+
+        if ((decoder->flags & JSON_REJECT_DUPLICATES) &&
+            json_object_getn(object, key, key_len)) {
+            decoder_error(decoder, key_position, json_error_duplicate_key,
+                          "duplicate object key");
+            goto error;
+        }
+
+        /* Decoding the value may refill the chunk or reuse the scratch
+           buffer, only the caller's buffer stays */
+        key_copy = NULL;
+        if (decoder->fill || key == strbuffer_value(&decoder->scratch)) {
+            if (key_len < sizeof(key_buf)) {
+                memcpy(key_buf, key, key_len);
+                key = key_buf;
+            } else {
+                key_copy = jsonp_strndup_as(key, key_len, json_memory_parser);
+                if (!key_copy) {
+                    decoder_error(decoder, key_position, json_error_out_of_memory,
+                                  "out of memory");
+                    goto error;
+                }
+                key = key_copy;
+            }
+        }
+
+        value = decode_value(decoder);
+        if (!value) {
+            jsonp_free(key_copy);
+            goto error;
+        }
+
+        if (json_object_setn_new_nocheck(object, key, key_len, value)) {
+            jsonp_free(key_copy);
+            decoder_error(decoder, key_position, json_error_out_of_memory,
+                          "out of memory");
+            goto error;
+        }
+        jsonp_free(key_copy);
+    }
+
+    decoder->depth--;
+    return object;
+
+error:
+    json_decref(object);
+    return NULL;
+}
+
+static double decode_half(unsigned int half) {
+    int exponent = (half >> 10) & 0x1f;
+    double value = half & 0x3ff;
+    uint32_t single_bits;
+    float single;
+
+    if (exponent == 0x1f) {
+        /* Infinity or NaN, widened to single precision to keep it so */
+        single_bits = ((uint32_t)(half & 0x8000) << 16) | 0x7f800000 |
+                      ((uint32_t)(half & 0x3ff) << 13);
+        memcpy(&single, &single_bits, sizeof(single));
+        return single;
+    }
+    if (exponent == 0)
+        exponent = -24;
+    else {
+        value += 1024;
+        exponent -= 25;
+    }
+
+    /* Exact, as all the factors are powers of two */
+    for (; exponent > 0; exponent--)
+        value *= 2;
+    for (; exponent < 0; exponent++)
+        value /= 2;
+
+    return (half & 0x8000) ? -value : value;
+}
+
+static json_t *decode_real(decoder_t *decoder, double value, size_t position) {
+    json_t *json;
+
+    if (!is_finite(value)) {
+        decoder_error(decoder, position, json_error_numeric_overflow,
+                      "real number overflow");
+        return NULL;
+    }
+
+    json = json_real(value);
+    if (!json)
+        decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+    return json;
+}
+
+static json_t *decode_simple(decoder_t *decoder, int info, uint64_t arg,
+                             size_t position) {
+    uint32_t single_bits;
+    float single;
+    double value;
+
+    switch (info) {
+        case CBOR_FALSE:
+            return json_false();
+        case CBOR_TRUE:
+            return json_true();
+        case CBOR_NULL:
+            return json_null();
+        case CBOR_HALF:
+            return decode_real(decoder, decode_half((unsigned int)arg), position);
+        case CBOR_FLOAT:
+            single_bits = (uint32_t)arg;
+            memcpy(&single, &single_bits, sizeof(single));
+            return decode_real(decoder, single, position);
+        case CBOR_DOUBLE:
+            memcpy(&value, &arg, sizeof(value));
+            return decode_real(decoder, value, position);
+        case CBOR_INDEFINITE:
+            decoder_error(decoder, position, json_error_invalid_syntax,
+                          "unexpected break");
+            return NULL;
+        default:
+            decoder_error(decoder, position, json_error_invalid_syntax,
+                          "unsupported simple value %d", (int)arg);
+            return NULL;
+    }
+}
+
+static json_t *decode_integer(decoder_t *decoder, int negative, uint64_t arg,
+                              size_t position) {
+    json_int_t value;
+    json_t *json;
+
+    if (decoder->flags & JSON_DECODE_INT_AS_REAL)
+        return decode_real(decoder, negative ? -1.0 - (double)arg : (double)arg,
+                           position);
+
+    if (arg > (uint64_t)CBOR_INT_MAX) {
+        decoder_error(decoder, position, json_error_numeric_overflow,
+                      negative ? "too big negative integer" : "too big integer");
+        return NULL;
+    }
+
+    value = negative ? -(json_int_t)arg - 1 : (json_int_t)arg;
+    if (decoder->flags & JSON_SHARE_VALUES)
+        json = jsonp_shared_integer(NULL, value);
+    else
+        json = json_integer(value);
+
+    if (!json)
+        decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+    return json;
+}
+
+static json_t *decode_string(decoder_t *decoder, int info, uint64_t arg,
+                             size_t position) {
+    const char *text;
+    size_t len;
+    json_t *json;
+
+    if (decode_text(decoder, info, arg, position, &text, &len))
+        return NULL;
+
+    if (!(decoder->flags & JSON_ALLOW_NUL) && memchr(text, '\0', len)) {
+        decoder_error(decoder, position, json_error_null_character,
+                      "\\u0000 is not allowed without JSON_ALLOW_NUL");
+        return NULL;
+    }
+
+    if (len == 0 && (decoder->flags & JSON_SHARE_VALUES))
+        return jsonp_shared_empty_string();
+
+    json = json_stringn_nocheck(text, len);
+    if (!json)
+        decoder_error(decoder, position, json_error_out_of_memory, "out of memory");
+    return json;
+}
+
+static json_t *decode_item(decoder_t *decoder, int major, int info, uint64_t arg,
+                           size_t position) {
+    switch (major) {
+        case CBOR_UNSIGNED:
+        case CBOR_NEGATIVE:
+            return decode_integer(decoder, major == CBOR_NEGATIVE, arg, position);
+        case CBOR_TEXT:
+            return decode_string(decoder, info, arg, position);
+        case CBOR_ARRAY:
+            return decode_array(decoder, info, arg, position);
+        case CBOR_MAP:
+            return decode_map(decoder, info, arg, position);
+        case CBOR_SIMPLE:
+            return decode_simple(decoder, info, arg, position);
+        default:
+            decoder_error(decoder, position, json_error_invalid_syntax,
+                          "byte strings are not supported");
+            return NULL;
+    }
+}
+
+/* Read the head of the next item other than a tag, which are skipped */
+static int decode_untagged_head(decoder_t *decoder, int *major, int *info, uint64_t *arg,
+                                size_t *position) {
+    do {
+        *position = decoder_position(decoder);
+        if (decode_head(decoder, major, info, arg))
+            return -1;
+    } while (*major == CBOR_TAG);
+    return 0;
+}
+
+static json_t *decode_value(decoder_t *decoder) {
+    int major, info;
+    uint64_t arg;
+    size_t position;
+
+    if (decode_untagged_head(decoder, &major, &info, &arg, &position))
+        return NULL;
+    return decode_item(decoder, major, info, arg, position);
+}
+
+static json_t *decode_root(decoder_t *decoder) {
+    int major, info;
+    uint64_t arg;
+    size_t position;
+    json_t *result;
+
+    if (decode_untagged_head(decoder, &major, &info, &arg, &position))
+        return NULL;
+
+    if (!(decoder->flags & JSON_DECODE_ANY) && major != CBOR_ARRAY &&
+        major != CBOR_MAP) {
+        decoder_error(decoder, position, json_error_invalid_syntax,
+                      "array or map expected");
+        return NULL;
+    }
+
+    result = decode_item(decoder, major, info, arg, position);
+    if (!result)
+        return NULL;
+
+    if (!(decoder->flags & JSON_DISABLE_EOF_CHECK)) {
+        if (decoder->pos < decoder->len || decoder_fill(decoder, 1)) {
+            decoder_error(decoder, decoder_position(decoder),
+                          json_error_end_of_input_expected, "end of file expected");
+            json_decref(result);
+            return NULL;
+        }
+    }
+
+    if (decoder->error) {
+        /* Save the position even though there was no error */
+        decoder->error->position = (int)decoder_position(decoder);
+    }
+
+    return result;
+}
+
+static json_t *decode_input(json_load_callback_t fill, void *data, size_t flags,
+                            json_error_t *error) {
+    decoder_t decoder;
+    json_t *result;
+
+    if (decoder_init(&decoder, fill, data, flags, error))
+        return NULL;
+
+    result = decode_root(&decoder);
+
+    decoder_close(&decoder);
+    return result;
+}
+
+json_t *json_cbor_loadb(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) {
+    decoder_t decoder;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (decoder_init(&decoder, NULL, NULL, flags, error))
+        return NULL;
+    decoder.chunk = buffer;
+    decoder.len = buflen;
+
+    result = decode_root(&decoder);
+
+    decoder_close(&decoder);
+    return result;
+}
+
+static size_t file_fill_func(void *buffer, size_t buflen, void *data) {
+    size_t len = fread(buffer, 1, buflen, (FILE *)data);
+    if (len == 0 && ferror((FILE *)data))
+        return (size_t)-1;
+    return len;
+}
+
+json_t *json_cbor_loadf(FILE *input, size_t flags, json_error_t *error) {
+    jsonp_error_init(error, input == stdin ? "<stdin>" : "<stream>");
+
+    if (input == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    return decode_input(file_fill_func, input, flags, error);
+}
+
+static size_t fd_fill_func(void *buffer, size_t buflen, void *data) {
+#ifdef HAVE_UNISTD_H
+    ssize_t len;
+
+    do
+        len = read(*(int *)data, buffer, buflen);
+    while (len < 0 && errno == EINTR);
+
+    if (len >= 0)
+        return (size_t)len;
+#else
+    (void)buffer;
+    (void)buflen;
+    (void)data;
+#endif
+    return (size_t)-1;
+}
+
+json_t *json_cbor_loadfd(int input, size_t flags, json_error_t *error) {
+    const char *source;
+
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+    else
+#endif
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input < 0) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    return decode_input(fd_fill_func, &input, flags, error);
+}
+
+json_t *json_cbor_load_file(const char *path, size_t flags, json_error_t *error) {
+    json_t *result;
+    FILE *fp;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        jsonp_error_set(error, -1, -1, 0, json_error_cannot_open_file,
+                        "unable to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    result = decode_input(file_fill_func, fp, flags, error);
+
+    fclose(fp);
+    return result;
+}
+
+json_t *json_cbor_load_callback(json_load_callback_t callback, void *data, size_t flags,
+                                json_error_t *error) {
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    return decode_input(callback, data, flags, error);
+}
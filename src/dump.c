@@ -15,37 +15,73 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 
 #include "jansson.h"
-#include "strbuffer.h"
+#include "scan.h"
 #include "utf.h"
 
-#define MAX_INTEGER_STR_LENGTH 100
 #define MAX_REAL_STR_LENGTH    100
+#define DUMP_BUFFER_SIZE       4096
 
 #define FLAGS_TO_INDENT(f)    ((f)&0x1F)
 #define FLAGS_TO_PRECISION(f) (((f) >> 11) & 0x1F)
 
-struct buffer {
-    const size_t size;
+/* The output of the encoder. Writes are collected in buffer and passed
+   to callback when it fills up, so that the callback is called for
+   large chunks instead of every token. Without a callback, buffer is
+   the final destination and the bytes that don't fit are only
+   counted. */
+typedef struct {
+    char *buffer;
+    size_t size;
     size_t used;
-    char *data;
-};
-
-static int dump_to_strbuffer(const char *buffer, size_t size, void *data) {
-    return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+    size_t overflow;
+    json_dump_callback_t callback;
+    void *data;
+} dumper_t;
+
+static int dumper_flush(dumper_t *dumper) {
+    if (dumper->callback && dumper->used) {
+        if (dumper->callback(dumper->buffer, dumper->used, dumper->data))
+            return -1;
+        dumper->used = 0;
+    }
+    return 0;
 }
 
-static int dump_to_buffer(const char *buffer, size_t size, void *data) {
-    struct buffer *buf = (struct buffer *)data;
+static int dump_bytes_slow(dumper_t *dumper, const char *bytes, size_t len) {
+    if (!dumper->callback) {
+        /* Nothing more is written after the first write that doesn't fit */
+        dumper->size = dumper->used;
+        dumper->overflow += len;
+        return 0;
+    }
 
-    if (buf->used + size <= buf->size)
-        memcpy(&buf->data[buf->used], buffer, size);
+    if (dumper_flush(dumper))
+        return -1;
+
+    /* Pass large writes through without copying. A write is never split
+       so that multi-byte UTF-8 sequences stay in one chunk. */
+    if (len >= dumper->size)
+        return dumper->callback(bytes, len, dumper->data);
 
-    buf->used += size;
+    memcpy(dumper->buffer, bytes, len);
+    dumper->used = len;
+    return 0;
+}
+
+static int dump_bytes(dumper_t *dumper, const char *bytes, size_t len) {
+    if (len > dumper->size - dumper->used)
+        return dump_bytes_slow(dumper, bytes, len);
+
+    memcpy(dumper->buffer + dumper->used, bytes, len);
+    dumper->used += len;
     return 0;
 }
 
@@ -68,35 +104,40 @@ static int dump_to_fd(const char *buffer, size_t size, void *data) {
 /* 32 spaces (the maximum indentation size) */
 static const char whitespace[] = "                                ";
 
-static int dump_indent(size_t flags, int depth, int space, json_dump_callback_t dump,
-                       void *data) {
+static int dump_indent(size_t flags, int depth, int space, dumper_t *dumper) {
     if (FLAGS_TO_INDENT(flags) > 0) {
         unsigned int ws_count = FLAGS_TO_INDENT(flags), n_spaces = depth * ws_count;
 
-        if (dump("\n", 1, data))
+        if (dump_bytes(dumper, "\n", 1))
             return -1;
 
         while (n_spaces > 0) {
             int cur_n =
                 n_spaces < sizeof whitespace - 1 ? n_spaces : sizeof whitespace - 1;
 
-            if (dump(whitespace, cur_n, data))
+            if (dump_bytes(dumper, whitespace, cur_n))
                 return -1;
 
             n_spaces -= cur_n;
         }
     } else if (space && !(flags & JSON_COMPACT)) {
-        return dump(" ", 1, data);
+        return dump_bytes(dumper, " ", 1);
     }
     return 0;
 }
 
-static int dump_string(const char *str, size_t len, json_dump_callback_t dump, void *data,
-                       size_t flags) {
+static int dump_string(const char *str, size_t len, dumper_t *dumper, size_t flags) {
     const char *pos, *end, *lim;
     int32_t codepoint = 0;
 
-    if (dump("\"", 1, data))
+    /* non-ASCII characters are output as is unless JSON_ENSURE_ASCII
+       is used, so they don't need to be decoded one by one if the whole
+       string is valid */
+    int verbatim = !(flags & JSON_ENSURE_ASCII);
+    if (verbatim && !utf8_check_string(str, len))
+        return -1;
+
+    if (dump_bytes(dumper, "\"", 1))
         return -1;
 
     end = pos = str;
@@ -107,6 +148,22 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         int length;
 
         while (end < lim) {
+            /* skip plain characters in bulk unless slashes need
+               escaping */
+            if (!(flags & JSON_ESCAPE_SLASH)) {
+                while (1) {
+                    pos += scan_plain(pos, lim - pos);
+                    if (!verbatim || pos == lim || (unsigned char)*pos < 0x80)
+                        break;
+                    while (pos < lim && (unsigned char)*pos >= 0x80)
+                        pos++;
+                }
+                if (pos == lim) {
+                    end = pos;
+                    break;
+                }
+            }
+
             end = utf8_iterate(pos, lim - pos, &codepoint);
             if (!end)
                 return -1;
@@ -127,7 +184,7 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
         }
 
         if (pos != str) {
-            if (dump(str, pos - str, data))
+            if (dump_bytes(dumper, str, pos - str))
                 return -1;
         }
 
@@ -186,61 +243,423 @@ static int dump_string(const char *str, size_t len, json_dump_callback_t dump, v
             }
         }
 
-        if (dump(text, length, data))
+        if (dump_bytes(dumper, text, length))
             return -1;
 
         str = pos = end;
     }
 
-    return dump("\"", 1, data);
+    return dump_bytes(dumper, "\"", 1);
 }
 
-struct key_len {
-    const char *key;
-    int len;
+/* Objects of up to SORT_INSERTION_MAX keys are sorted by insertion.
+   Larger ones are sorted by radix on the key bytes, up to
+   SORT_RADIX_MAX_LEVEL levels of recursion. */
+#define SORT_INSERTION_MAX   JSONP_SORTED_SMALL
+#define SORT_RADIX_MAX_LEVEL 8
+
+/* Keys are compared bytewise, and a key comes before the longer keys
+   that it's a prefix of. Both keys are known to share the first depth
+   bytes. */
+static int compare_pairs_from(const struct hashtable_pair *pair1,
+                              const struct hashtable_pair *pair2, size_t depth) {
+    const size_t min_size = pair1->key_len < pair2->key_len ? pair1->key_len
+                                                            : pair2->key_len;
+    int res = memcmp(pair1->key + depth, pair2->key + depth, min_size - depth);
+
+    if (res)
+        return res;
+
+    return pair1->key_len < pair2->key_len ? -1 : pair1->key_len > pair2->key_len;
+}
+
+static int compare_pairs(const void *pair1, const void *pair2) {
+    return compare_pairs_from(*(const struct hashtable_pair *const *)pair1,
+                              *(const struct hashtable_pair *const *)pair2, 0);
+}
+
+/* The radix bucket of a key: 0 if it ends before depth */
+static unsigned int key_byte(const struct hashtable_pair *pair, size_t depth) {
+    return depth < pair->key_len ? (unsigned char)pair->key[depth] + 1 : 0;
+}
+
+static void sort_pairs(struct hashtable_pair **pairs, size_t n, size_t depth,
+                       struct hashtable_pair **tmp, int level) {
+    size_t count[257], i, j, start;
+    unsigned int b;
+
+    while (n > SORT_INSERTION_MAX) {
+        if (level == SORT_RADIX_MAX_LEVEL) {
+            qsort(pairs, n, sizeof(*pairs), compare_pairs);
+            return;
+        }
+
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < n; i++)
+            count[key_byte(pairs[i], depth)]++;
+
+        if (count[key_byte(pairs[0], depth)] == n) {
+            /* Common prefix, the keys are distinct so none ends here */
+            depth++;
+            continue;
+        }
+
+        start = 0;
+        for (b = 0; b < 257; b++) {
+            size_t bucket = count[b];
+            count[b] = start;
+            start += bucket;
+        }
+        for (i = 0; i < n; i++)
+            tmp[count[key_byte(pairs[i], depth)]++] = pairs[i];
+        memcpy(pairs, tmp, n * sizeof(*pairs));
+
+        /* count[b] is now the end of bucket b, and bucket 0 has at most
+           one key */
+        start = count[0];
+        for (b = 1; b < 257; b++) {
+            if (count[b] - start > 1)
+                sort_pairs(pairs + start, count[b] - start, depth + 1, tmp, level + 1);
+            start = count[b];
+        }
+        return;
+    }
+
+    for (i = 1; i < n; i++) {
+        struct hashtable_pair *pair = pairs[i];
+
+        for (j = i; j > 0 && compare_pairs_from(pairs[j - 1], pair, depth) > 0; j--)
+            pairs[j] = pairs[j - 1];
+        pairs[j] = pair;
+    }
+}
+
+/* The pairs of an object in key order. The result is the cached order,
+   small, or allocated and cached if JSON_CACHE_SORTED_KEYS is used. */
+struct hashtable_pair **jsonp_sorted_pairs(const json_t *json, size_t flags,
+                                           struct hashtable_pair **small) {
+    hashtable_t *hashtable = &json_to_object((json_t *)json)->hashtable;
+    struct hashtable_pair **pairs, **tmp = NULL;
+    size_t size, i, j = 0;
+    int cache;
+
+    if (jsonp_is_image(json)) {
+        /* Images have the key order stored */
+        size = json_object_size(json);
+        pairs = size <= SORT_INSERTION_MAX
+                    ? small
+                    : jsonp_malloc_as(size * sizeof(*pairs), json_memory_encoder);
+        if (pairs)
+            jsonp_image_sorted_pairs(json, pairs);
+        return pairs;
+    }
+
+    size = hashtable->size;
+    /* Frozen objects may be encoded by many threads at once */
+    cache = (flags & JSON_CACHE_SORTED_KEYS) && !hashtable->arena &&
+            !jsonp_is_immortal(json);
+    if (hashtable->sorted)
+        return hashtable->sorted;
+
+    if (size <= SORT_INSERTION_MAX && !cache)
+        pairs = small;
+    else if (cache)
+        /* The cache is released by the hashtable */
+        pairs = jsonp_alloc(hashtable->allocator, size * sizeof(*pairs),
+                            json_memory_bucket);
+    else
+        pairs = jsonp_malloc_as(size * sizeof(*pairs), json_memory_encoder);
+    if (!pairs)
+        return NULL;
+
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        if (hashtable->pairs[i])
+            pairs[j++] = hashtable->pairs[i];
+    }
+    assert(j == size);
+
+    if (size > SORT_INSERTION_MAX) {
+        tmp = jsonp_malloc_as(size * sizeof(*tmp), json_memory_encoder);
+        if (!tmp) {
+            if (cache)
+                jsonp_dealloc(hashtable->allocator, pairs, 0);
+            else
+                jsonp_free(pairs);
+            return NULL;
+        }
+    }
+    sort_pairs(pairs, size, 0, tmp, 0);
+    jsonp_free(tmp);
+
+    if (cache)
+        hashtable_set_sorted(hashtable, pairs);
+    return pairs;
+}
+
+void jsonp_release_sorted_pairs(const json_t *json, struct hashtable_pair **pairs,
+                                struct hashtable_pair **small) {
+    if (pairs == small)
+        return;
+    if (jsonp_is_image(json) || pairs != json_to_object((json_t *)json)->hashtable.sorted)
+        jsonp_free(pairs);
+}
+
+/* A container that do_dump() is encoding */
+struct dump_frame {
+    const json_t *json;
+    /* Position of the current element, or member with JSON_SORT_KEYS */
+    size_t index;
+    size_t size;
+    /* Next member of an object without JSON_SORT_KEYS */
+    void *iter;
+    /* Members of an object with JSON_SORT_KEYS, or NULL */
+    struct hashtable_pair **pairs;
+    struct hashtable_pair *small[SORT_INSERTION_MAX];
+    int embed;
 };
 
-static int compare_keys(const void *key1, const void *key2) {
-    const struct key_len *k1 = key1;
-    const struct key_len *k2 = key2;
-    const size_t min_size = k1->len < k2->len ? k1->len : k2->len;
-    int res = memcmp(k1->key, k2->key, min_size);
+/* Frames kept in do_dump()'s own stack frame before allocating */
+#define DUMP_INLINE_FRAMES 8
+
+typedef struct {
+    struct dump_frame *frames;
+    size_t depth;
+    size_t size;
+    struct dump_frame inline_frames[DUMP_INLINE_FRAMES];
+} dump_stack_t;
+
+static struct dump_frame *dump_push(dump_stack_t *stack, const json_t *json, int embed) {
+    struct dump_frame *frame;
+
+    if (stack->depth == stack->size) {
+        struct dump_frame *new_frames;
+        size_t i;
+
+        new_frames = jsonp_malloc_as(stack->size * 2 * sizeof(struct dump_frame),
+                                     json_memory_encoder);
+        if (!new_frames)
+            return NULL;
+        memcpy(new_frames, stack->frames, stack->depth * sizeof(struct dump_frame));
+
+        /* Few sorted members point into the frame */
+        for (i = 0; i < stack->depth; i++) {
+            if (stack->frames[i].pairs == stack->frames[i].small)
+                new_frames[i].pairs = new_frames[i].small;
+        }
 
-    if (res)
+        if (stack->frames != stack->inline_frames)
+            jsonp_free(stack->frames);
+        stack->frames = new_frames;
+        stack->size *= 2;
+    }
+
+    frame = &stack->frames[stack->depth++];
+    frame->json = json;
+    frame->index = 0;
+    frame->size = 0;
+    frame->iter = NULL;
+    frame->pairs = NULL;
+    frame->embed = embed;
+    return frame;
+}
+
+static void dump_stack_close(dump_stack_t *stack) {
+    struct dump_frame *frame;
+
+    while (stack->depth) {
+        frame = &stack->frames[--stack->depth];
+        if (frame->pairs)
+            jsonp_release_sorted_pairs(frame->json, frame->pairs, frame->small);
+    }
+    if (stack->frames != stack->inline_frames)
+        jsonp_free(stack->frames);
+}
+
+static int do_dump(const json_t *json, size_t flags, int depth, jsonp_parents_t *parents,
+                   dumper_t *dumper);
+
+/*
+ * With JSON_CACHE_FROZEN, the encoding of frozen arrays and objects is
+ * kept as a raw value, keyed by the value, the flags and the depth if
+ * indenting. Frozen values are never freed, so their addresses stay
+ * valid. A looked up text is referenced before releasing the lock, as
+ * json_dump_cache_clear() may release the cache meanwhile.
+ */
+typedef struct {
+    const json_t *json;
+    size_t flags;
+    size_t depth;
+} frozen_key_t;
+
+static hashtable_t frozen_cache;
+static int frozen_cache_ready = 0;
+static volatile char frozen_locked = 0;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define frozen_trylock() (__atomic_test_and_set(&frozen_locked, __ATOMIC_ACQUIRE) == 0)
+#define frozen_unlock()  __atomic_clear(&frozen_locked, __ATOMIC_RELEASE)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define frozen_trylock() (__sync_lock_test_and_set(&frozen_locked, 1) == 0)
+#define frozen_unlock()  __sync_lock_release(&frozen_locked)
+#else
+/* Not thread safe */
+#define frozen_trylock() 1
+#define frozen_unlock()  ((void)0)
+#endif
+
+static void frozen_lock(void) {
+    while (!frozen_trylock()) {
+#ifdef HAVE_SCHED_YIELD
+        sched_yield();
+#endif
+    }
+}
+
+/* Flags that don't change the output aren't part of the key */
+#define FROZEN_KEY_FLAGS                                                                 \
+    (~(size_t)(JSON_ENCODE_ANY | JSON_NO_CYCLE_CHECK | JSON_CACHE_SORTED_KEYS))
+
+static int is_frozen_container(const json_t *json) {
+    return (json_is_object(json) || json_is_array(json)) && jsonp_is_immortal(json) &&
+           !jsonp_is_image(json);
+}
+
+static int dump_to_strbuffer(const char *buffer, size_t size, void *data) {
+    return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+}
+
+/* Frozen values have no circular references, and the values in them
+   aren't looked up in the cache again */
+static json_t *frozen_encode(const json_t *json, size_t flags, int depth) {
+    char buffer[DUMP_BUFFER_SIZE];
+    strbuffer_t text;
+    dumper_t dumper;
+    json_t *raw = NULL;
+
+    if (strbuffer_init(&text))
+        return NULL;
+
+    dumper.buffer = buffer;
+    dumper.size = sizeof(buffer);
+    dumper.used = 0;
+    dumper.overflow = 0;
+    dumper.callback = dump_to_strbuffer;
+    dumper.data = &text;
+
+    if (!do_dump(json, flags & ~JSON_CACHE_FROZEN, depth, NULL, &dumper) &&
+        !dumper_flush(&dumper))
+        raw = json_rawn_nocheck(text.value, text.length);
+
+    strbuffer_close(&text);
+    return raw;
+}
+
+static int dump_frozen(const json_t *json, size_t flags, int depth, dumper_t *dumper) {
+    frozen_key_t key;
+    json_t *raw, *cached = NULL;
+    int res;
+
+    memset(&key, 0, sizeof(key));
+    key.json = json;
+    key.flags = flags & FROZEN_KEY_FLAGS;
+    key.depth = FLAGS_TO_INDENT(flags) ? (size_t)depth : 0;
+
+    frozen_lock();
+    if (frozen_cache_ready) {
+        cached = hashtable_get(&frozen_cache, (const char *)&key, sizeof(key));
+        json_incref(cached);
+    }
+    frozen_unlock();
+
+    if (cached) {
+        res = dump_bytes(dumper, json_raw_value(cached), json_raw_length(cached));
+        json_decref(cached);
         return res;
+    }
+
+    raw = frozen_encode(json, flags, depth);
+    if (!raw)
+        return -1;
 
-    return k1->len - k2->len;
+    frozen_lock();
+    if (!frozen_cache_ready)
+        frozen_cache_ready = !hashtable_init(&frozen_cache);
+    /* Another thread may have added it meanwhile. Not caching it on
+       allocation failure only makes the next encoding slower. */
+    if (frozen_cache_ready &&
+        !hashtable_get(&frozen_cache, (const char *)&key, sizeof(key)) &&
+        hashtable_set(&frozen_cache, (const char *)&key, sizeof(key), json_incref(raw)))
+        json_decref(raw);
+    frozen_unlock();
+
+    res = dump_bytes(dumper, json_raw_value(raw), json_raw_length(raw));
+    json_decref(raw);
+    return res;
+}
+
+void json_dump_cache_clear(void) {
+    frozen_lock();
+    if (frozen_cache_ready) {
+        hashtable_close(&frozen_cache);
+        frozen_cache_ready = 0;
+    }
+    frozen_unlock();
 }
 
-static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *parents,
-                   json_dump_callback_t dump, void *data) {
+/* Encode json. Nested containers are kept on an explicit stack instead
+   of recursing, so the depth of the value doesn't affect the C
+   stack. */
+static int do_dump(const json_t *json, size_t flags, int depth, jsonp_parents_t *parents,
+                   dumper_t *dumper) {
     int embed = flags & JSON_EMBED;
+    const char *separator = flags & JSON_COMPACT ? ":" : ": ";
+    int separator_length = flags & JSON_COMPACT ? 1 : 2;
+    dump_stack_t stack;
+    struct dump_frame *frame;
+    const char *key;
+    size_t key_len;
+    int more;
 
     flags &= ~JSON_EMBED;
 
+    stack.frames = stack.inline_frames;
+    stack.depth = 0;
+    stack.size = DUMP_INLINE_FRAMES;
+
+value:
     if (!json)
-        return -1;
+        goto error;
+
+    if ((flags & JSON_CACHE_FROZEN) && !embed && is_frozen_container(json)) {
+        if (dump_frozen(json, flags, depth, dumper))
+            goto error;
+        goto next;
+    }
 
     switch (json_typeof(json)) {
         case JSON_NULL:
-            return dump("null", 4, data);
+            if (dump_bytes(dumper, "null", 4))
+                goto error;
+            break;
 
         case JSON_TRUE:
-            return dump("true", 4, data);
+            if (dump_bytes(dumper, "true", 4))
+                goto error;
+            break;
 
         case JSON_FALSE:
-            return dump("false", 5, data);
+            if (dump_bytes(dumper, "false", 5))
+                goto error;
+            break;
 
         case JSON_INTEGER: {
-            char buffer[MAX_INTEGER_STR_LENGTH];
+            char buffer[JSONP_INT_STR_LENGTH];
             int size;
 
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH, "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if (size < 0 || size >= MAX_INTEGER_STR_LENGTH)
-                return -1;
-
-            return dump(buffer, size, data);
+            size = jsonp_inttostr(buffer, json_integer_value(json));
+            if (dump_bytes(dumper, buffer, size))
+                goto error;
+            break;
         }
 
         case JSON_REAL: {
@@ -250,202 +669,253 @@ static int do_dump(const json_t *json, size_t flags, int depth, hashtable_t *par
 
             size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value,
                                 FLAGS_TO_PRECISION(flags));
-            if (size < 0)
-                return -1;
-
-            return dump(buffer, size, data);
+            if (size < 0 || dump_bytes(dumper, buffer, size))
+                goto error;
+            break;
         }
 
         case JSON_STRING:
-            return dump_string(json_string_value(json), json_string_length(json), dump,
-                               data, flags);
+            if (dump_string(json_string_value(json), json_string_length(json), dumper,
+                            flags))
+                goto error;
+            break;
 
-        case JSON_ARRAY: {
-            size_t n;
-            size_t i;
-            /* Space for "0x", double the sizeof a pointer for the hex and a
-             * terminator. */
-            char key[2 + (sizeof(json) * 2) + 1];
-            size_t key_len;
+        case JSON_RAW:
+            if (dump_bytes(dumper, json_raw_value(json), json_raw_length(json)))
+                goto error;
+            break;
 
+        case JSON_ARRAY:
             /* detect circular references */
-            if (jsonp_loop_check(parents, json, key, sizeof(key), &key_len))
-                return -1;
-
-            n = json_array_size(json);
-
-            if (!embed && dump("[", 1, data))
-                return -1;
-            if (n == 0) {
-                hashtable_del(parents, key, key_len);
-                return embed ? 0 : dump("]", 1, data);
+            if (parents && jsonp_parents_enter(parents, json))
+                goto error;
+
+            if (!embed && dump_bytes(dumper, "[", 1))
+                goto error;
+            if (json_array_size(json) == 0) {
+                if (parents)
+                    jsonp_parents_leave(parents, json);
+                if (!embed && dump_bytes(dumper, "]", 1))
+                    goto error;
+                break;
             }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+            if (dump_indent(flags, depth + 1, 0, dumper))
+                goto error;
 
-            for (i = 0; i < n; ++i) {
-                if (do_dump(json_array_get(json, i), flags, depth + 1, parents, dump,
-                            data))
-                    return -1;
-
-                if (i < n - 1) {
-                    if (dump(",", 1, data) ||
-                        dump_indent(flags, depth + 1, 1, dump, data))
-                        return -1;
-                } else {
-                    if (dump_indent(flags, depth, 0, dump, data))
-                        return -1;
-                }
-            }
+            frame = dump_push(&stack, json, embed);
+            if (!frame)
+                goto error;
+            frame->size = json_array_size(json);
 
-            hashtable_del(parents, key, key_len);
-            return embed ? 0 : dump("]", 1, data);
-        }
+            depth++;
+            embed = 0;
+            json = json_array_get(json, 0);
+            goto value;
 
         case JSON_OBJECT: {
             void *iter;
-            const char *separator;
-            int separator_length;
-            char loop_key[LOOP_KEY_LEN];
-            size_t loop_key_len;
-
-            if (flags & JSON_COMPACT) {
-                separator = ":";
-                separator_length = 1;
-            } else {
-                separator = ": ";
-                separator_length = 2;
-            }
 
             /* detect circular references */
-            if (jsonp_loop_check(parents, json, loop_key, sizeof(loop_key),
-                                 &loop_key_len))
-                return -1;
+            if (parents && jsonp_parents_enter(parents, json))
+                goto error;
 
             iter = json_object_iter((json_t *)json);
 
-            if (!embed && dump("{", 1, data))
-                return -1;
+            if (!embed && dump_bytes(dumper, "{", 1))
+                goto error;
             if (!iter) {
-                hashtable_del(parents, loop_key, loop_key_len);
-                return embed ? 0 : dump("}", 1, data);
+                if (parents)
+                    jsonp_parents_leave(parents, json);
+                if (!embed && dump_bytes(dumper, "}", 1))
+                    goto error;
+                break;
             }
-            if (dump_indent(flags, depth + 1, 0, dump, data))
-                return -1;
+            if (dump_indent(flags, depth + 1, 0, dumper))
+                goto error;
 
+            frame = dump_push(&stack, json, embed);
+            if (!frame)
+                goto error;
             if (flags & JSON_SORT_KEYS) {
-                struct key_len *keys;
-                size_t size, i;
+                frame->size = json_object_size(json);
+                frame->pairs = jsonp_sorted_pairs(json, flags, frame->small);
+                if (!frame->pairs)
+                    goto error;
+            } else
+                frame->iter = iter;
+
+            depth++;
+            embed = 0;
+            goto member;
+        }
 
-                size = json_object_size(json);
-                keys = jsonp_malloc(size * sizeof(struct key_len));
-                if (!keys)
-                    return -1;
+        default:
+            /* not reached */
+            goto error;
+    }
 
-                i = 0;
-                while (iter) {
-                    struct key_len *keylen = &keys[i];
+next:
+    /* json is complete, continue with the innermost container */
+    if (stack.depth == 0) {
+        dump_stack_close(&stack);
+        return 0;
+    }
+    frame = &stack.frames[stack.depth - 1];
 
-                    keylen->key = json_object_iter_key(iter);
-                    keylen->len = json_object_iter_key_len(iter);
+    if (frame->pairs || json_is_array(frame->json))
+        more = ++frame->index < frame->size;
+    else
+        more = frame->iter != NULL;
+
+    if (more) {
+        if (dump_bytes(dumper, ",", 1) || dump_indent(flags, depth, 1, dumper))
+            goto error;
+        if (json_is_array(frame->json)) {
+            json = json_array_get(frame->json, frame->index);
+            goto value;
+        }
+        goto member;
+    }
 
-                    iter = json_object_iter_next((json_t *)json, iter);
-                    i++;
-                }
-                assert(i == size);
-
-                qsort(keys, size, sizeof(struct key_len), compare_keys);
-
-                for (i = 0; i < size; i++) {
-                    const struct key_len *key;
-                    json_t *value;
-
-                    key = &keys[i];
-                    value = json_object_getn(json, key->key, key->len);
-                    assert(value);
-
-                    dump_string(key->key, key->len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(value, flags, depth + 1, parents, dump, data)) {
-                        jsonp_free(keys);
-                        return -1;
-                    }
-
-                    if (i < size - 1) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data)) {
-                            jsonp_free(keys);
-                            return -1;
-                        }
-                    }
-                }
+    /* The container is complete */
+    depth--;
+    if (dump_indent(flags, depth, 0, dumper))
+        goto error;
+    if (frame->pairs) {
+        jsonp_release_sorted_pairs(frame->json, frame->pairs, frame->small);
+        frame->pairs = NULL;
+    }
+    if (parents)
+        jsonp_parents_leave(parents, frame->json);
+
+    json = frame->json;
+    embed = frame->embed;
+    stack.depth--;
+    if (!embed && dump_bytes(dumper, json_is_array(json) ? "]" : "}", 1))
+        goto error;
+    goto next;
+
+member:
+    if (frame->pairs) {
+        struct hashtable_pair *pair = frame->pairs[frame->index];
+
+        key = pair->key;
+        key_len = pair->key_len;
+        json = json_object_iter_value(pair);
+    } else {
+        key = json_object_iter_key(frame->iter);
+        key_len = json_object_iter_key_len(frame->iter);
+        json = json_object_iter_value(frame->iter);
+        frame->iter = json_object_iter_next((json_t *)frame->json, frame->iter);
+    }
 
-                jsonp_free(keys);
-            } else {
-                /* Don't sort keys */
-
-                while (iter) {
-                    void *next = json_object_iter_next((json_t *)json, iter);
-                    const char *key = json_object_iter_key(iter);
-                    const size_t key_len = json_object_iter_key_len(iter);
-
-                    dump_string(key, key_len, dump, data, flags);
-                    if (dump(separator, separator_length, data) ||
-                        do_dump(json_object_iter_value(iter), flags, depth + 1, parents,
-                                dump, data))
-                        return -1;
-
-                    if (next) {
-                        if (dump(",", 1, data) ||
-                            dump_indent(flags, depth + 1, 1, dump, data))
-                            return -1;
-                    } else {
-                        if (dump_indent(flags, depth, 0, dump, data))
-                            return -1;
-                    }
-
-                    iter = next;
-                }
-            }
+    if (dump_string(key, key_len, dumper, flags) ||
+        dump_bytes(dumper, separator, separator_length))
+        goto error;
+    goto value;
 
-            hashtable_del(parents, loop_key, loop_key_len);
-            return embed ? 0 : dump("}", 1, data);
-        }
+error:
+    dump_stack_close(&stack);
+    return -1;
+}
 
-        default:
-            /* not reached */
-            return -1;
-    }
+/* Like do_dump(), but check for circular references unless
+   check_cycles is 0 or JSON_NO_CYCLE_CHECK is used */
+static int dump_checked(const json_t *json, size_t flags, int depth, int check_cycles,
+                        dumper_t *dumper) {
+    int res;
+    jsonp_parents_t parents_set;
+
+    if (!check_cycles || (flags & JSON_NO_CYCLE_CHECK))
+        return do_dump(json, flags, depth, NULL, dumper);
+
+    jsonp_parents_init(&parents_set);
+    res = do_dump(json, flags, depth, &parents_set, dumper);
+    jsonp_parents_close(&parents_set);
+    return res;
+}
+
+/* Arrays, objects and raw values holding one can be encoded without
+   JSON_ENCODE_ANY */
+static int is_container(const json_t *json) {
+    const char *raw = json_raw_value(json);
+
+    if (raw)
+        return raw[0] == '[' || raw[0] == '{';
+    return json_is_array(json) || json_is_object(json);
+}
+
+/* Encode json to dumper. check_cycles is 0 if a previous pass over the
+   same value has already checked that it has no circular references. */
+static int dump_root(const json_t *json, dumper_t *dumper, size_t flags,
+                     int check_cycles) {
+    if (!(flags & JSON_ENCODE_ANY) && !is_container(json))
+        return -1;
+
+    if (dump_checked(json, flags, 0, check_cycles, dumper))
+        return -1;
+    return dumper_flush(dumper);
 }
 
 char *json_dumps(const json_t *json, size_t flags) {
-    strbuffer_t strbuff;
+    char stack_buffer[DUMP_BUFFER_SIZE];
+    dumper_t dumper;
+    size_t size;
     char *result;
 
-    if (strbuffer_init(&strbuff))
+    /* Most outputs fit in the stack buffer, and the exact size is known
+       after the first pass. Otherwise the first pass only counted the
+       bytes and the output is encoded again, this time without checking
+       for circular references. */
+    dumper.buffer = stack_buffer;
+    dumper.size = sizeof(stack_buffer);
+    dumper.used = 0;
+    dumper.overflow = 0;
+    dumper.callback = NULL;
+    dumper.data = NULL;
+
+    if (dump_root(json, &dumper, flags, 1))
         return NULL;
 
-    if (json_dump_callback(json, dump_to_strbuffer, (void *)&strbuff, flags))
-        result = NULL;
-    else
-        result = jsonp_strdup(strbuffer_value(&strbuff));
+    size = dumper.used + dumper.overflow;
+    result = jsonp_malloc_as(size + 1, json_memory_encoder);
+    if (!result)
+        return NULL;
 
-    strbuffer_close(&strbuff);
-    return result;
+    if (dumper.overflow) {
+        dumper.buffer = result;
+        dumper.size = size;
+        dumper.used = 0;
+        dumper.overflow = 0;
+        if (dump_root(json, &dumper, flags, 0) || dumper.overflow) {
+            jsonp_free(result);
+            return NULL;
+        }
+    } else
+        memcpy(result, stack_buffer, dumper.used);
+
+    result[dumper.used] = '\0';
+    return jsonp_disown(result);
+}
+
+size_t json_dump_size(const json_t *json, size_t flags) {
+    return json_dumpb(json, NULL, 0, flags);
 }
 
 size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
-    struct buffer buf = {size, 0, buffer};
+    dumper_t dumper;
 
-    if (json_dump_callback(json, dump_to_buffer, (void *)&buf, flags))
+    dumper.buffer = buffer;
+    dumper.size = buffer ? size : 0;
+    dumper.used = 0;
+    dumper.overflow = 0;
+    dumper.callback = NULL;
+    dumper.data = NULL;
+
+    if (dump_root(json, &dumper, flags, 1))
         return 0;
 
-    return buf.used;
+    return dumper.used + dumper.overflow;
 }
 
 int json_dumpf(const json_t *json, FILE *output, size_t flags) {
@@ -473,18 +943,330 @@ int json_dump_file(const json_t *json, const char *path, size_t flags) {
 
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags) {
+    return json_dump_callback_ex(json, callback, data, flags, 0);
+}
+
+int json_dump_callback_ex(const json_t *json, json_dump_callback_t callback, void *data,
+                          size_t flags, size_t buffer_size) {
+    char stack_buffer[DUMP_BUFFER_SIZE];
+    dumper_t dumper;
     int res;
-    hashtable_t parents_set;
 
-    if (!(flags & JSON_ENCODE_ANY)) {
-        if (!json_is_array(json) && !json_is_object(json))
+    if (!callback)
+        return -1;
+
+    if (buffer_size == 0)
+        buffer_size = DUMP_BUFFER_SIZE;
+
+    if (buffer_size <= DUMP_BUFFER_SIZE)
+        dumper.buffer = stack_buffer;
+    else {
+        dumper.buffer = jsonp_malloc_as(buffer_size, json_memory_encoder);
+        if (!dumper.buffer)
             return -1;
     }
+    dumper.size = buffer_size;
+    dumper.used = 0;
+    dumper.overflow = 0;
+    dumper.callback = callback;
+    dumper.data = data;
 
-    if (hashtable_init(&parents_set))
-        return -1;
-    res = do_dump(json, flags, 0, &parents_set, callback, data);
-    hashtable_close(&parents_set);
+    res = dump_root(json, &dumper, flags, 1);
 
+    if (dumper.buffer != stack_buffer)
+        jsonp_free(dumper.buffer);
     return res;
 }
+
+/*** streaming writer ***/
+
+/* Number of nesting levels that don't need an allocated stack */
+#define WRITER_INLINE_DEPTH 32
+
+struct json_writer_t {
+    dumper_t dumper;
+    size_t flags;
+    /* '[' or '{' for each open container */
+    char *stack;
+    size_t depth;
+    size_t size;
+    char inline_stack[WRITER_INLINE_DEPTH];
+    /* Nothing has been written to the innermost container yet */
+    int first;
+    /* A key has been written, and its value comes next */
+    int key;
+    /* The top level value is complete */
+    int done;
+    int failed;
+    char buffer[DUMP_BUFFER_SIZE];
+};
+
+static int writer_fail(json_writer_t *writer) {
+    writer->failed = 1;
+    return -1;
+}
+
+/* Write the separator and indentation before a member or element */
+static int writer_separator(json_writer_t *writer) {
+    int depth = (int)writer->depth;
+
+    if (writer->first) {
+        writer->first = 0;
+        return dump_indent(writer->flags, depth, 0, &writer->dumper);
+    }
+
+    if (dump_bytes(&writer->dumper, ",", 1) ||
+        dump_indent(writer->flags, depth, 1, &writer->dumper))
+        return -1;
+    return 0;
+}
+
+/* Check that a value can be written now, and write what precedes it */
+static int writer_begin_value(json_writer_t *writer, int container) {
+    if (writer->failed)
+        return -1;
+
+    if (writer->depth == 0) {
+        if (writer->done || (!container && !(writer->flags & JSON_ENCODE_ANY)))
+            return writer_fail(writer);
+        return 0;
+    }
+
+    if (writer->stack[writer->depth - 1] == '{') {
+        if (!writer->key)
+            return writer_fail(writer);
+        writer->key = 0;
+        return 0;
+    }
+
+    if (writer_separator(writer))
+        return writer_fail(writer);
+    return 0;
+}
+
+/* Finish a value, passing the output on if it's the top level value */
+static int writer_end_value(json_writer_t *writer, int res) {
+    if (res)
+        return writer_fail(writer);
+
+    if (writer->depth == 0) {
+        writer->done = 1;
+        if (dumper_flush(&writer->dumper))
+            return writer_fail(writer);
+    }
+    return 0;
+}
+
+static int writer_begin(json_writer_t *writer, char type) {
+    if (writer_begin_value(writer, 1))
+        return -1;
+
+    if (writer->depth == writer->size) {
+        size_t new_size = writer->size * 2;
+        char *new_stack = jsonp_malloc_as(new_size, json_memory_encoder);
+        if (!new_stack)
+            return writer_fail(writer);
+
+        memcpy(new_stack, writer->stack, writer->depth);
+        if (writer->stack != writer->inline_stack)
+            jsonp_free(writer->stack);
+        writer->stack = new_stack;
+        writer->size = new_size;
+    }
+
+    if ((writer->depth > 0 || !(writer->flags & JSON_EMBED)) &&
+        dump_bytes(&writer->dumper, &type, 1))
+        return writer_fail(writer);
+
+    writer->stack[writer->depth++] = type;
+    writer->first = 1;
+    return 0;
+}
+
+static int writer_end(json_writer_t *writer, char type) {
+    if (writer->failed)
+        return -1;
+    if (writer->depth == 0 || writer->stack[writer->depth - 1] != type || writer->key)
+        return writer_fail(writer);
+
+    writer->depth--;
+    if (!writer->first &&
+        dump_indent(writer->flags, (int)writer->depth, 0, &writer->dumper))
+        return writer_fail(writer);
+    writer->first = 0;
+
+    if (writer->depth > 0 || !(writer->flags & JSON_EMBED)) {
+        if (dump_bytes(&writer->dumper, type == '[' ? "]" : "}", 1))
+            return writer_fail(writer);
+    }
+    return writer_end_value(writer, 0);
+}
+
+json_writer_t *json_writer_create(json_dump_callback_t callback, void *data,
+                                  size_t flags) {
+    json_writer_t *writer;
+
+    if (!callback)
+        return NULL;
+
+    writer = jsonp_malloc_as(sizeof(json_writer_t), json_memory_encoder);
+    if (!writer)
+        return NULL;
+
+    writer->dumper.buffer = writer->buffer;
+    writer->dumper.size = sizeof(writer->buffer);
+    writer->dumper.used = 0;
+    writer->dumper.overflow = 0;
+    writer->dumper.callback = callback;
+    writer->dumper.data = data;
+    writer->flags = flags;
+    writer->stack = writer->inline_stack;
+    writer->depth = 0;
+    writer->size = WRITER_INLINE_DEPTH;
+    writer->first = 0;
+    writer->key = 0;
+    writer->done = 0;
+    writer->failed = 0;
+    return writer;
+}
+
+void json_writer_destroy(json_writer_t *writer) {
+    if (!writer)
+        return;
+
+    if (writer->stack != writer->inline_stack)
+        jsonp_free(writer->stack);
+    jsonp_free(writer);
+}
+
+int json_writer_flush(json_writer_t *writer) {
+    if (!writer || writer->failed)
+        return -1;
+    if (dumper_flush(&writer->dumper))
+        return writer_fail(writer);
+    return 0;
+}
+
+int json_writer_begin_object(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_begin(writer, '{');
+}
+
+int json_writer_end_object(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_end(writer, '{');
+}
+
+int json_writer_begin_array(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_begin(writer, '[');
+}
+
+int json_writer_end_array(json_writer_t *writer) {
+    if (!writer)
+        return -1;
+    return writer_end(writer, '[');
+}
+
+int json_writer_key(json_writer_t *writer, const char *key) {
+    if (!key)
+        return writer ? writer_fail(writer) : -1;
+    return json_writer_keyn(writer, key, strlen(key));
+}
+
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len) {
+    const char *separator = (writer && (writer->flags & JSON_COMPACT)) ? ":" : ": ";
+
+    if (!writer || writer->failed)
+        return -1;
+    if (!key || writer->depth == 0 || writer->stack[writer->depth - 1] != '{' ||
+        writer->key)
+        return writer_fail(writer);
+
+    if (writer_separator(writer) ||
+        dump_string(key, len, &writer->dumper, writer->flags) ||
+        dump_bytes(&writer->dumper, separator, strlen(separator)))
+        return writer_fail(writer);
+
+    writer->key = 1;
+    return 0;
+}
+
+int json_writer_string(json_writer_t *writer, const char *value) {
+    if (!value)
+        return writer ? writer_fail(writer) : -1;
+    return json_writer_stringn(writer, value, strlen(value));
+}
+
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len) {
+    if (!writer)
+        return -1;
+    if (!value)
+        return writer_fail(writer);
+    if (writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer,
+                            dump_string(value, len, &writer->dumper, writer->flags));
+}
+
+int json_writer_integer(json_writer_t *writer, json_int_t value) {
+    char buffer[JSONP_INT_STR_LENGTH];
+    int size;
+
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+
+    size = jsonp_inttostr(buffer, value);
+    return writer_end_value(writer, dump_bytes(&writer->dumper, buffer, size));
+}
+
+int json_writer_real(json_writer_t *writer, double value) {
+    char buffer[MAX_REAL_STR_LENGTH];
+    int size;
+
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+
+    size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value,
+                        FLAGS_TO_PRECISION(writer->flags));
+    if (size < 0)
+        return writer_fail(writer);
+    return writer_end_value(writer, dump_bytes(&writer->dumper, buffer, size));
+}
+
+int json_writer_boolean(json_writer_t *writer, int value) {
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+
+    if (value)
+        return writer_end_value(writer, dump_bytes(&writer->dumper, "true", 4));
+    return writer_end_value(writer, dump_bytes(&writer->dumper, "false", 5));
+}
+
+int json_writer_null(json_writer_t *writer) {
+    if (!writer || writer_begin_value(writer, 0))
+        return -1;
+    return writer_end_value(writer, dump_bytes(&writer->dumper, "null", 4));
+}
+
+int json_writer_value(json_writer_t *writer, const json_t *json) {
+    size_t flags;
+
+    if (!writer)
+        return -1;
+    if (!json)
+        return writer_fail(writer);
+    if (writer_begin_value(writer, is_container(json)))
+        return -1;
+
+    /* JSON_EMBED only applies to the top level value */
+    flags = writer->flags;
+    if (writer->depth > 0)
+        flags &= ~JSON_EMBED;
+
+    return writer_end_value(writer, dump_checked(json, flags, (int)writer->depth, 1,
+                                                 &writer->dumper));
+}
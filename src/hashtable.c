@@ -24,178 +24,336 @@
 #define INITIAL_HASHTABLE_ORDER 3
 #endif
 
-typedef struct hashtable_list list_t;
+/* Small tables have no slots, the order array is searched linearly */
+#ifndef HASHTABLE_FLAT_MAX
+#define HASHTABLE_FLAT_MAX 8
+#endif
+
 typedef struct hashtable_pair pair_t;
-typedef struct hashtable_bucket bucket_t;
+typedef struct hashtable_slot slot_t;
 
 extern volatile uint32_t hashtable_seed;
 
-/* Implementation of the hash function */
+/* Implementation of the hash function, selected at build time */
+#ifdef USE_WYHASH
+#include "wyhash.h"
+#define hash_str(key, len) ((size_t)wyhash((key), len, hashtable_seed))
+#else
 #include "lookup3.h"
+#define hash_str(key, len) ((size_t)hashlittle((key), len, hashtable_seed))
+#endif
+
+#ifndef hashsize
+#define hashsize(n) ((size_t)1 << (n))
+#define hashmask(n) (hashsize(n) - 1)
+#endif
+
+/* The table is grown when it would become more than 3/4 full */
+#define max_load(order_) (hashsize(order_) - hashsize(order_) / 4)
 
-#define list_to_pair(list_)         container_of(list_, pair_t, list)
-#define ordered_list_to_pair(list_) container_of(list_, pair_t, ordered_list)
-#define hash_str(key, len)          ((size_t)hashlittle((key), len, hashtable_seed))
+/* Distance of a slot from the position its hash maps to */
+#define probe_distance(hash_, index_, mask_) (((index_) - ((hash_) & (mask_))) & (mask_))
 
-static JSON_INLINE void list_init(list_t *list) {
-    list->next = list;
-    list->prev = list;
+/* Memory of arena hashtables is released with the arena, and so are
+   the values stored in them. Sizes are passed for the slab allocator
+   and sized frees. */
+static void *hashtable_malloc(hashtable_t *hashtable, size_t size) {
+    if (hashtable->arena)
+        return jsonp_arena_malloc(hashtable->arena, size);
+    return jsonp_node_malloc(hashtable->allocator, size, json_memory_bucket);
 }
 
-static JSON_INLINE void list_insert(list_t *list, list_t *node) {
-    node->next = list;
-    node->prev = list->prev;
-    list->prev->next = node;
-    list->prev = node;
+static void hashtable_free(hashtable_t *hashtable, void *ptr, size_t size) {
+    if (!hashtable->arena)
+        jsonp_node_free(hashtable->allocator, ptr, size, json_memory_bucket);
 }
 
-static JSON_INLINE void list_remove(list_t *list) {
-    list->prev->next = list->next;
-    list->next->prev = list->prev;
+#define pair_size(key_len_) (offsetof(pair_t, key) + (key_len_) + 1)
+
+static pair_t *pair_malloc(hashtable_t *hashtable, size_t key_len) {
+    if (hashtable->arena)
+        return jsonp_arena_malloc(hashtable->arena, pair_size(key_len));
+    return jsonp_node_malloc(hashtable->allocator, pair_size(key_len), json_memory_pair);
 }
 
-static JSON_INLINE int bucket_is_empty(hashtable_t *hashtable, bucket_t *bucket) {
-    return bucket->first == &hashtable->list && bucket->first == bucket->last;
+static void pair_free(hashtable_t *hashtable, pair_t *pair) {
+    if (!hashtable->arena)
+        jsonp_node_free(hashtable->allocator, pair, pair_size(pair->key_len),
+                        json_memory_pair);
 }
 
-static void insert_to_bucket(hashtable_t *hashtable, bucket_t *bucket, list_t *list) {
-    if (bucket_is_empty(hashtable, bucket)) {
-        list_insert(&hashtable->list, list);
-        bucket->first = bucket->last = list;
-    } else {
-        list_insert(bucket->first, list);
-        bucket->first = list;
-    }
+static void hashtable_release(hashtable_t *hashtable, json_t *value) {
+    if (!hashtable->arena)
+        json_decref(value);
 }
 
-static pair_t *hashtable_find_pair(hashtable_t *hashtable, bucket_t *bucket,
-                                   const char *key, size_t key_len, size_t hash) {
-    list_t *list;
-    pair_t *pair;
+static slot_t *alloc_slots(hashtable_t *hashtable, size_t order) {
+    slot_t *slots;
 
-    if (bucket_is_empty(hashtable, bucket))
-        return NULL;
+    slots = hashtable_malloc(hashtable, hashsize(order) * sizeof(slot_t));
+    if (slots)
+        memset(slots, 0, hashsize(order) * sizeof(slot_t));
+    return slots;
+}
+
+/* Robin Hood insertion: an entry that is closer to its home slot
+   gives way to the one being inserted. Keeps probe sequences short
+   and lets lookups stop early. The key must not be in the table. */
+static void insert_to_slots(slot_t *slots, size_t mask, size_t hash, pair_t *pair) {
+    size_t index = hash & mask, distance = 0, other;
+    slot_t entry, tmp;
+
+    entry.hash = hash;
+    entry.pair = pair;
+
+    while (slots[index].pair) {
+        other = probe_distance(slots[index].hash, index, mask);
+        if (other < distance) {
+            tmp = slots[index];
+            slots[index] = entry;
+            entry = tmp;
+            distance = other;
+        }
+        index = (index + 1) & mask;
+        distance++;
+    }
+    slots[index] = entry;
+}
+
+/* Returns the slot of the key, or NULL if it's not found */
+static slot_t *hashtable_find_slot(hashtable_t *hashtable, const char *key,
+                                   size_t key_len, size_t hash) {
+    size_t mask = hashmask(hashtable->order);
+    size_t index = hash & mask, distance = 0;
+    slot_t *slot;
 
-    list = bucket->first;
     while (1) {
-        pair = list_to_pair(list);
-        if (pair->hash == hash && pair->key_len == key_len &&
-            memcmp(pair->key, key, key_len) == 0)
-            return pair;
+        slot = &hashtable->slots[index];
+        if (!slot->pair || probe_distance(slot->hash, index, mask) < distance)
+            return NULL;
 
-        if (list == bucket->last)
-            break;
+        if (slot->hash == hash && slot->pair->key_len == key_len &&
+            memcmp(slot->pair->key, key, key_len) == 0)
+            return slot;
 
-        list = list->next;
+        index = (index + 1) & mask;
+        distance++;
     }
+}
 
-    return NULL;
+/* Backward shift deletion: move the following entries one slot back
+   until one is found in its home slot */
+static void remove_from_slots(hashtable_t *hashtable, slot_t *slot) {
+    size_t mask = hashmask(hashtable->order);
+    size_t index = (size_t)(slot - hashtable->slots), next;
+
+    while (1) {
+        next = (index + 1) & mask;
+        if (!hashtable->slots[next].pair ||
+            probe_distance(hashtable->slots[next].hash, next, mask) == 0)
+            break;
+        hashtable->slots[index] = hashtable->slots[next];
+        index = next;
+    }
+    hashtable->slots[index].pair = NULL;
 }
 
-/* returns 0 on success, -1 if key was not found */
-static int hashtable_do_del(hashtable_t *hashtable, const char *key, size_t key_len,
-                            size_t hash) {
+/* Linear search of a table without slots */
+static pair_t *hashtable_find_flat(hashtable_t *hashtable, const char *key,
+                                   size_t key_len) {
+    size_t i;
     pair_t *pair;
-    bucket_t *bucket;
-    size_t index;
 
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        pair = hashtable->pairs[i];
+        if (pair && pair->key_len == key_len && memcmp(pair->key, key, key_len) == 0)
+            return pair;
+    }
+    return NULL;
+}
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
-        return -1;
+static pair_t *hashtable_find_pair(hashtable_t *hashtable, const char *key,
+                                   size_t key_len) {
+    slot_t *slot;
 
-    if (&pair->list == bucket->first && &pair->list == bucket->last)
-        bucket->first = bucket->last = &hashtable->list;
+    if (!hashtable->slots)
+        return hashtable_find_flat(hashtable, key, key_len);
 
-    else if (&pair->list == bucket->first)
-        bucket->first = pair->list.next;
+    slot = hashtable_find_slot(hashtable, key, key_len, hash_str(key, key_len));
+    return slot ? slot->pair : NULL;
+}
 
-    else if (&pair->list == bucket->last)
-        bucket->last = pair->list.prev;
+/* Forget the cached key order, which changes with the keys */
+static void discard_sorted(hashtable_t *hashtable) {
+    if (hashtable->sorted) {
+        jsonp_dealloc(hashtable->allocator, hashtable->sorted, 0);
+        hashtable->sorted = NULL;
+    }
+}
 
-    list_remove(&pair->list);
-    list_remove(&pair->ordered_list);
-    json_decref(pair->value);
+/* Drop the holes left by deleted pairs from the order array */
+static void compact_pairs(hashtable_t *hashtable) {
+    size_t i, j = 0;
 
-    jsonp_free(pair);
-    hashtable->size--;
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        if (hashtable->pairs[i]) {
+            hashtable->pairs[j] = hashtable->pairs[i];
+            hashtable->pairs[j]->index = j;
+            j++;
+        }
+    }
+    hashtable->pairs_len = j;
+}
+
+static int resize_pairs(hashtable_t *hashtable, size_t new_size) {
+    pair_t **new_pairs;
+
+    if (new_size > (size_t)-1 / sizeof(pair_t *))
+        return -1;
+
+    new_pairs = hashtable_malloc(hashtable, new_size * sizeof(pair_t *));
+    if (!new_pairs)
+        return -1;
 
+    if (hashtable->pairs) {
+        memcpy(new_pairs, hashtable->pairs, hashtable->pairs_len * sizeof(pair_t *));
+        hashtable_free(hashtable, hashtable->pairs,
+                       hashtable->pairs_size * sizeof(pair_t *));
+    }
+    hashtable->pairs = new_pairs;
+    hashtable->pairs_size = new_size;
     return 0;
 }
 
-static void hashtable_do_clear(hashtable_t *hashtable) {
-    list_t *list, *next;
-    pair_t *pair;
+static int append_pair(hashtable_t *hashtable, pair_t *pair) {
+    size_t new_size;
 
-    for (list = hashtable->list.next; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        json_decref(pair->value);
-        jsonp_free(pair);
+    if (hashtable->pairs_len == hashtable->pairs_size) {
+        if (hashtable->pairs_size > (size_t)-1 / sizeof(pair_t *) / 2)
+            return -1;
+        new_size = hashtable->pairs_size ? hashtable->pairs_size * 2 : 4;
+        if (resize_pairs(hashtable, new_size))
+            return -1;
     }
+
+    discard_sorted(hashtable);
+    pair->index = hashtable->pairs_len;
+    hashtable->pairs[hashtable->pairs_len++] = pair;
+    return 0;
 }
 
-static int hashtable_do_rehash(hashtable_t *hashtable) {
-    list_t *list, *next;
-    pair_t *pair;
-    size_t i, index, new_size, new_order;
-    struct hashtable_bucket *new_buckets;
+static void remove_pair(hashtable_t *hashtable, pair_t *pair) {
+    discard_sorted(hashtable);
+    hashtable->pairs[pair->index] = NULL;
 
-    new_order = hashtable->order + 1;
-    new_size = hashsize(new_order);
+    /* Removing the last pairs is common, e.g. with the loop check sets */
+    while (hashtable->pairs_len && !hashtable->pairs[hashtable->pairs_len - 1])
+        hashtable->pairs_len--;
 
-    new_buckets = jsonp_malloc(new_size * sizeof(bucket_t));
-    if (!new_buckets)
-        return -1;
+    /* Compacting invalidates no iterators, as they point to pairs */
+    if (hashtable->pairs_len >= 16 &&
+        hashtable->pairs_len - hashtable->size > hashtable->pairs_len / 2)
+        compact_pairs(hashtable);
+}
 
-    jsonp_free(hashtable->buckets);
-    hashtable->buckets = new_buckets;
-    hashtable->order = new_order;
+static void hashtable_do_clear(hashtable_t *hashtable) {
+    size_t i;
+    pair_t *pair;
 
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+    discard_sorted(hashtable);
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        pair = hashtable->pairs[i];
+        if (!pair)
+            continue;
+        hashtable_release(hashtable, pair->value);
+        pair_free(hashtable, pair);
     }
+}
 
-    list = hashtable->list.next;
-    list_init(&hashtable->list);
+/* Smallest order of at least min_order that holds size pairs without
+   growing, or 0 if there is none */
+static size_t order_for(size_t min_order, size_t size) {
+    size_t order = min_order;
 
-    for (; list != &hashtable->list; list = next) {
-        next = list->next;
-        pair = list_to_pair(list);
-        index = pair->hash % new_size;
-        insert_to_bucket(hashtable, &hashtable->buckets[index], &pair->list);
+    while (size > max_load(order)) {
+        if (++order >= sizeof(size_t) * 8 - 5)
+            return 0;
     }
+    return order;
+}
+
+/* Switch a flat table to hashing when it outgrows HASHTABLE_FLAT_MAX */
+static int hashtable_build_slots(hashtable_t *hashtable, size_t order) {
+    size_t i;
+    pair_t *pair;
 
+    hashtable->slots = alloc_slots(hashtable, order);
+    if (!hashtable->slots)
+        return -1;
+    hashtable->order = order;
+
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        pair = hashtable->pairs[i];
+        if (pair)
+            insert_to_slots(hashtable->slots, hashmask(order),
+                            hash_str(pair->key, pair->key_len), pair);
+    }
     return 0;
 }
 
-int hashtable_init(hashtable_t *hashtable) {
+static int hashtable_do_rehash(hashtable_t *hashtable, size_t new_order) {
     size_t i;
+    slot_t *new_slots, *old_slots;
 
-    hashtable->size = 0;
-    hashtable->order = INITIAL_HASHTABLE_ORDER;
-    hashtable->buckets = jsonp_malloc(hashsize(hashtable->order) * sizeof(bucket_t));
-    if (!hashtable->buckets)
+    if (new_order >= sizeof(size_t) * 8 - 5)
         return -1;
 
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
+    new_slots = alloc_slots(hashtable, new_order);
+    if (!new_slots)
+        return -1;
 
+    old_slots = hashtable->slots;
     for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+        if (old_slots[i].pair)
+            insert_to_slots(new_slots, hashmask(new_order), old_slots[i].hash,
+                            old_slots[i].pair);
     }
 
+    hashtable_free(hashtable, old_slots, hashsize(hashtable->order) * sizeof(slot_t));
+    hashtable->slots = new_slots;
+    hashtable->order = new_order;
+
+    return 0;
+}
+
+int hashtable_init(hashtable_t *hashtable) { return hashtable_init_arena(hashtable, NULL); }
+
+int hashtable_init_arena(hashtable_t *hashtable, json_arena_t *arena) {
+    hashtable->size = 0;
+    hashtable->arena = arena;
+    hashtable->allocator = arena ? NULL : jsonp_current_allocator();
+    hashtable->order = 0;
+    hashtable->slots = NULL;
+    hashtable->pairs = NULL;
+    hashtable->pairs_len = 0;
+    hashtable->pairs_size = 0;
+    hashtable->sorted = NULL;
+
     return 0;
 }
 
 void hashtable_close(hashtable_t *hashtable) {
     hashtable_do_clear(hashtable);
-    jsonp_free(hashtable->buckets);
+    if (hashtable->slots)
+        hashtable_free(hashtable, hashtable->slots,
+                       hashsize(hashtable->order) * sizeof(slot_t));
+    if (hashtable->pairs)
+        hashtable_free(hashtable, hashtable->pairs,
+                       hashtable->pairs_size * sizeof(pair_t *));
 }
 
-static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t hash) {
+static pair_t *init_pair(hashtable_t *hashtable, json_t *value, const char *key,
+                         size_t key_len) {
     pair_t *pair;
 
     /* offsetof(...) returns the size of pair_t without the last,
@@ -207,134 +365,282 @@ static pair_t *init_pair(json_t *value, const char *key, size_t key_len, size_t
         return NULL;
     }
 
-    pair = jsonp_malloc(offsetof(pair_t, key) + key_len + 1);
+    pair = pair_malloc(hashtable, key_len);
 
     if (!pair)
         return NULL;
 
-    pair->hash = hash;
     memcpy(pair->key, key, key_len);
     pair->key[key_len] = '\0';
     pair->key_len = key_len;
     pair->value = value;
 
-    list_init(&pair->list);
-    list_init(&pair->ordered_list);
-
     return pair;
 }
 
+size_t hashtable_hash(const char *key, size_t key_len) { return hash_str(key, key_len); }
+
+size_t hashtable_current_seed(void) { return hashtable_seed; }
+
+/* The hash is computed here unless have_hash is set */
+static int hashtable_do_set(hashtable_t *hashtable, const char *key, size_t key_len,
+                            size_t hash, int have_hash, json_t *value) {
+    size_t order;
+    slot_t *slot;
+    pair_t *pair;
+
+    if (hashtable->slots) {
+        if (!have_hash)
+            hash = hash_str(key, key_len);
+        slot = hashtable_find_slot(hashtable, key, key_len, hash);
+        pair = slot ? slot->pair : NULL;
+    } else
+        pair = hashtable_find_flat(hashtable, key, key_len);
+
+    if (pair) {
+        hashtable_release(hashtable, pair->value);
+        pair->value = value;
+        return 0;
+    }
+
+    if (hashtable->slots) {
+        if (hashtable->size >= max_load(hashtable->order))
+            if (hashtable_do_rehash(hashtable, hashtable->order + 1))
+                return -1;
+    } else if (hashtable->size >= HASHTABLE_FLAT_MAX) {
+        order = order_for(INITIAL_HASHTABLE_ORDER, hashtable->size + 1);
+        if (hashtable_build_slots(hashtable, order))
+            return -1;
+        if (!have_hash)
+            hash = hash_str(key, key_len);
+    }
+
+    pair = init_pair(hashtable, value, key, key_len);
+    if (!pair)
+        return -1;
+
+    if (append_pair(hashtable, pair)) {
+        pair_free(hashtable, pair);
+        return -1;
+    }
+
+    if (hashtable->slots)
+        insert_to_slots(hashtable->slots, hashmask(hashtable->order), hash, pair);
+    hashtable->size++;
+    return 0;
+}
+
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len,
                   json_t *value) {
+    return hashtable_do_set(hashtable, key, key_len, 0, 0, value);
+}
+
+int hashtable_set_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                         size_t hash, json_t *value) {
+    return hashtable_do_set(hashtable, key, key_len, hash, 1, value);
+}
+
+/* The pairs keep their positions, including the holes of deleted
+   ones, so that the slots can be copied as they are */
+int hashtable_copy_keys(hashtable_t *hashtable, const hashtable_t *other) {
+    size_t i;
     pair_t *pair;
-    bucket_t *bucket;
-    size_t hash, index;
+    slot_t *slot;
+
+    if (!other->pairs_len)
+        return 0;
 
-    /* rehash if the load ratio exceeds 1 */
-    if (hashtable->size >= hashsize(hashtable->order))
-        if (hashtable_do_rehash(hashtable))
+    hashtable->pairs = hashtable_malloc(hashtable, other->pairs_len * sizeof(pair_t *));
+    if (!hashtable->pairs)
+        return -1;
+    hashtable->pairs_size = other->pairs_len;
+
+    for (i = 0; i < other->pairs_len; i++) {
+        pair = other->pairs[i];
+        if (pair) {
+            pair = init_pair(hashtable, NULL, pair->key, pair->key_len);
+            if (!pair)
+                return -1;
+            pair->index = i;
+            hashtable->size++;
+        }
+        hashtable->pairs[i] = pair;
+        hashtable->pairs_len++;
+    }
+
+    if (other->slots) {
+        hashtable->slots = alloc_slots(hashtable, other->order);
+        if (!hashtable->slots)
             return -1;
+        hashtable->order = other->order;
+
+        for (i = 0; i < hashsize(other->order); i++) {
+            slot = &other->slots[i];
+            if (slot->pair) {
+                hashtable->slots[i].hash = slot->hash;
+                hashtable->slots[i].pair = hashtable->pairs[slot->pair->index];
+            }
+        }
+    }
+    return 0;
+}
 
-    hash = hash_str(key, key_len);
-    index = hash & hashmask(hashtable->order);
-    bucket = &hashtable->buckets[index];
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
+int hashtable_reserve(hashtable_t *hashtable, size_t size) {
+    size_t order;
 
-    if (pair) {
-        json_decref(pair->value);
-        pair->value = value;
-    } else {
-        pair = init_pair(value, key, key_len, hash);
+    if (size <= hashtable->size)
+        return 0;
 
-        if (!pair)
+    /* Deleted pairs keep their places in the order array */
+    if (hashtable->pairs_len + (size - hashtable->size) > hashtable->pairs_size) {
+        if (size - hashtable->size > (size_t)-1 - hashtable->pairs_len)
+            return -1;
+        if (resize_pairs(hashtable, hashtable->pairs_len + (size - hashtable->size)))
             return -1;
+    }
 
-        insert_to_bucket(hashtable, bucket, &pair->list);
-        list_insert(&hashtable->ordered_list, &pair->ordered_list);
+    if (size <= HASHTABLE_FLAT_MAX)
+        return 0;
 
-        hashtable->size++;
-    }
+    order = order_for(hashtable->slots ? hashtable->order : INITIAL_HASHTABLE_ORDER,
+                      size);
+    if (!order)
+        return -1;
+    if (!hashtable->slots)
+        return hashtable_build_slots(hashtable, order);
+    if (order > hashtable->order)
+        return hashtable_do_rehash(hashtable, order);
     return 0;
 }
 
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len) {
     pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
-
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
+    pair = hashtable_find_pair(hashtable, key, key_len);
     if (!pair)
         return NULL;
 
     return pair->value;
 }
 
-int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len) {
-    size_t hash = hash_str(key, key_len);
-    return hashtable_do_del(hashtable, key, key_len, hash);
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash) {
+    slot_t *slot;
+    pair_t *pair;
+
+    if (!hashtable->slots) {
+        pair = hashtable_find_flat(hashtable, key, key_len);
+        return pair ? pair->value : NULL;
+    }
+
+    slot = hashtable_find_slot(hashtable, key, key_len, hash);
+    return slot ? slot->pair->value : NULL;
 }
 
-void hashtable_clear(hashtable_t *hashtable) {
-    size_t i;
+int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len) {
+    slot_t *slot;
+    pair_t *pair;
 
-    hashtable_do_clear(hashtable);
+    if (hashtable->slots) {
+        slot = hashtable_find_slot(hashtable, key, key_len, hash_str(key, key_len));
+        if (!slot)
+            return -1;
 
-    for (i = 0; i < hashsize(hashtable->order); i++) {
-        hashtable->buckets[i].first = hashtable->buckets[i].last = &hashtable->list;
+        pair = slot->pair;
+        remove_from_slots(hashtable, slot);
+    } else {
+        pair = hashtable_find_flat(hashtable, key, key_len);
+        if (!pair)
+            return -1;
     }
+    hashtable->size--;
+    remove_pair(hashtable, pair);
 
-    list_init(&hashtable->list);
-    list_init(&hashtable->ordered_list);
-    hashtable->size = 0;
+    hashtable_release(hashtable, pair->value);
+    pair_free(hashtable, pair);
+
+    return 0;
 }
 
-void *hashtable_iter(hashtable_t *hashtable) {
-    return hashtable_iter_next(hashtable, &hashtable->ordered_list);
+void hashtable_clear(hashtable_t *hashtable) {
+    hashtable_do_clear(hashtable);
+
+    if (hashtable->slots)
+        memset(hashtable->slots, 0, hashsize(hashtable->order) * sizeof(slot_t));
+    hashtable->pairs_len = 0;
+    hashtable->size = 0;
 }
 
-void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len) {
+json_t *hashtable_take_last(hashtable_t *hashtable) {
     pair_t *pair;
-    size_t hash;
-    bucket_t *bucket;
+    json_t *value;
 
-    hash = hash_str(key, key_len);
-    bucket = &hashtable->buckets[hash & hashmask(hashtable->order)];
+    discard_sorted(hashtable);
+    while (hashtable->pairs_len) {
+        pair = hashtable->pairs[--hashtable->pairs_len];
+        if (!pair)
+            continue;
 
-    pair = hashtable_find_pair(hashtable, bucket, key, key_len, hash);
-    if (!pair)
-        return NULL;
+        hashtable->size--;
+        value = pair->value;
+        pair_free(hashtable, pair);
+        return value;
+    }
+    return NULL;
+}
 
-    return &pair->ordered_list;
+static void *iter_from(hashtable_t *hashtable, size_t index) {
+    for (; index < hashtable->pairs_len; index++) {
+        if (hashtable->pairs[index])
+            return hashtable->pairs[index];
+    }
+    return NULL;
 }
 
-void *hashtable_iter_next(hashtable_t *hashtable, void *iter) {
-    list_t *list = (list_t *)iter;
-    if (list->next == &hashtable->ordered_list)
-        return NULL;
-    return list->next;
+void *hashtable_iter(hashtable_t *hashtable) { return iter_from(hashtable, 0); }
+
+void *hashtable_iter_at(hashtable_t *hashtable, const char *key, size_t key_len) {
+    return hashtable_find_pair(hashtable, key, key_len);
 }
 
-void *hashtable_iter_key(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
-    return pair->key;
+void *hashtable_iter_next(hashtable_t *hashtable, void *iter) {
+    return iter_from(hashtable, ((pair_t *)iter)->index + 1);
 }
 
-size_t hashtable_iter_key_len(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
-    return pair->key_len;
+void *hashtable_iter_key(void *iter) { return ((pair_t *)iter)->key; }
+
+size_t hashtable_iter_key_len(void *iter) { return ((pair_t *)iter)->key_len; }
+
+void *hashtable_iter_value(void *iter) { return ((pair_t *)iter)->value; }
+
+void hashtable_iter_set(hashtable_t *hashtable, void *iter, json_t *value) {
+    pair_t *pair = (pair_t *)iter;
+
+    hashtable_release(hashtable, pair->value);
+    pair->value = value;
 }
 
-void *hashtable_iter_value(void *iter) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
-    return pair->value;
+void hashtable_set_sorted(hashtable_t *hashtable, pair_t **sorted) {
+    discard_sorted(hashtable);
+    hashtable->sorted = sorted;
 }
 
-void hashtable_iter_set(void *iter, json_t *value) {
-    pair_t *pair = ordered_list_to_pair((list_t *)iter);
+size_t hashtable_memory_usage(const hashtable_t *hashtable) {
+    size_t size = 0, i;
 
-    json_decref(pair->value);
-    pair->value = value;
+    if (hashtable->arena)
+        return 0;
+
+    if (hashtable->slots)
+        size += hashsize(hashtable->order) * sizeof(slot_t);
+    if (hashtable->pairs)
+        size += hashtable->pairs_size * sizeof(pair_t *);
+    if (hashtable->sorted)
+        size += hashtable->size * sizeof(pair_t *);
+
+    for (i = 0; i < hashtable->pairs_len; i++) {
+        if (hashtable->pairs[i])
+            size += pair_size(hashtable->pairs[i]->key_len);
+    }
+    return size;
 }
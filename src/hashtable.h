@@ -11,38 +11,36 @@
 #include "jansson.h"
 #include <stdlib.h>
 
-struct hashtable_list {
-    struct hashtable_list *prev;
-    struct hashtable_list *next;
-};
-
 /* "pair" may be a bit confusing a name, but think of it as a
    key-value pair. In this case, it just encodes some extra data,
    too */
 struct hashtable_pair {
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
-    size_t hash;
     json_t *value;
+    size_t index; /* position in the insertion order array */
     size_t key_len;
     char key[1];
 };
 
-struct hashtable_bucket {
-    struct hashtable_list *first;
-    struct hashtable_list *last;
+/* A slot of the open addressing table. The hash is kept next to the
+   pair pointer so that probing doesn't touch the pairs. */
+struct hashtable_slot {
+    size_t hash;
+    struct hashtable_pair *pair;
 };
 
 typedef struct hashtable {
     size_t size;
-    struct hashtable_bucket *buckets;
-    size_t order; /* hashtable has pow(2, order) buckets */
-    struct hashtable_list list;
-    struct hashtable_list ordered_list;
+    struct hashtable_slot *slots;
+    size_t order; /* hashtable has pow(2, order) slots, or none if small */
+    struct hashtable_pair **pairs; /* in insertion order, NULL if deleted */
+    size_t pairs_len;
+    size_t pairs_size;
+    struct hashtable_pair **sorted; /* cached key order, or NULL */
+    json_arena_t *arena;
+    const json_allocator_t *allocator; /* NULL for the global one */
 } hashtable_t;
 
-#define hashtable_key_to_iter(key_)                                                      \
-    (&(container_of(key_, struct hashtable_pair, key)->ordered_list))
+#define hashtable_key_to_iter(key_) (container_of(key_, struct hashtable_pair, key))
 
 /**
  * hashtable_init - Initialize a hashtable object
@@ -51,11 +49,28 @@ typedef struct hashtable {
  *
  * Initializes a statically allocated hashtable object. The object
  * should be cleared with hashtable_close when it's no longer used.
+ * Nothing is allocated until the first key is added, and small
+ * tables are searched linearly without hashing.
  *
  * Returns 0 on success, -1 on error (out of memory).
  */
 int hashtable_init(hashtable_t *hashtable) JANSSON_ATTRS((warn_unused_result));
 
+/**
+ * hashtable_init_arena - Initialize a hashtable object in an arena
+ *
+ * @hashtable: The (statically allocated) hashtable object
+ * @arena: The arena, or NULL
+ *
+ * Like hashtable_init(), but the slots and pairs are allocated from
+ * @arena. The values are not released when they're removed from the
+ * hashtable, as they're owned by the arena.
+ *
+ * Returns 0 on success, -1 on error (out of memory).
+ */
+int hashtable_init_arena(hashtable_t *hashtable, json_arena_t *arena)
+    JANSSON_ATTRS((warn_unused_result));
+
 /**
  * hashtable_close - Release all resources used by a hashtable object
  *
@@ -83,6 +98,67 @@ void hashtable_close(hashtable_t *hashtable);
  */
 int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_t *value);
 
+/**
+ * hashtable_set_hashed - Add/modify value with a precomputed hash
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ * @hash: hashtable_hash() of the key
+ * @value: The value
+ *
+ * Like hashtable_set(), but doesn't hash the key again.
+ */
+int hashtable_set_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                         size_t hash, json_t *value);
+
+/**
+ * hashtable_copy_keys - Add the keys of another hashtable
+ *
+ * @hashtable: The empty hashtable object
+ * @other: The hashtable to copy the keys from
+ *
+ * Adds the keys of @other in the same order and without hashing them
+ * again. The values are NULL until they're set with
+ * hashtable_iter_set(), and a hashtable with NULL values may only be
+ * iterated or closed.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_copy_keys(hashtable_t *hashtable, const hashtable_t *other);
+
+/**
+ * hashtable_reserve - Make room for a number of pairs
+ *
+ * @hashtable: The hashtable object
+ * @size: The number of pairs the hashtable should hold
+ *
+ * Allocates the order array and the slots so that the hashtable can
+ * hold @size pairs without growing either of them.
+ *
+ * Returns 0 on success, -1 on failure (out of memory).
+ */
+int hashtable_reserve(hashtable_t *hashtable, size_t size);
+
+/**
+ * hashtable_hash - Hash a key
+ *
+ * @key: The key
+ * @key_len: The length of key
+ *
+ * Returns the hash of the key with the current seed, for
+ * hashtable_set_hashed().
+ */
+size_t hashtable_hash(const char *key, size_t key_len);
+
+/**
+ * hashtable_current_seed - Return the seed of hashtable_hash()
+ *
+ * The seed is 0 until json_object_seed() is called for the first
+ * time, and it doesn't change after that.
+ */
+size_t hashtable_current_seed(void);
+
 /**
  * hashtable_get - Get a value associated with a key
  *
@@ -94,6 +170,19 @@ int hashtable_set(hashtable_t *hashtable, const char *key, size_t key_len, json_
  */
 void *hashtable_get(hashtable_t *hashtable, const char *key, size_t key_len);
 
+/**
+ * hashtable_get_hashed - Get a value with a precomputed hash
+ *
+ * @hashtable: The hashtable object
+ * @key: The key
+ * @key_len: The length of key
+ * @hash: hashtable_hash() of the key
+ *
+ * Like hashtable_get(), but doesn't hash the key again.
+ */
+void *hashtable_get_hashed(hashtable_t *hashtable, const char *key, size_t key_len,
+                           size_t hash);
+
 /**
  * hashtable_del - Remove a value from the hashtable
  *
@@ -114,6 +203,18 @@ int hashtable_del(hashtable_t *hashtable, const char *key, size_t key_len);
  */
 void hashtable_clear(hashtable_t *hashtable);
 
+/**
+ * hashtable_take_last - Remove the last item for teardown
+ *
+ * @hashtable: The hashtable object
+ *
+ * Removes the last item in insertion order and returns its value with
+ * the reference that the hashtable held, or NULL if it's empty. The
+ * slots are not updated, so the hashtable can only be closed after
+ * this.
+ */
+json_t *hashtable_take_last(hashtable_t *hashtable);
+
 /**
  * hashtable_iter - Iterate over hashtable
  *
@@ -178,9 +279,32 @@ void *hashtable_iter_value(void *iter);
 /**
  * hashtable_iter_set - Set the value pointed by an iterator
  *
+ * @hashtable: The hashtable object
  * @iter: The iterator
  * @value: The value to set
  */
-void hashtable_iter_set(void *iter, json_t *value);
+void hashtable_iter_set(hashtable_t *hashtable, void *iter, json_t *value);
+
+/**
+ * hashtable_set_sorted - Cache the pairs of a hashtable in key order
+ *
+ * @hashtable: The hashtable object
+ * @sorted: The pairs, allocated with jsonp_alloc() from hashtable->allocator
+ *
+ * The hashtable takes ownership of @sorted. It's freed as soon as a
+ * key is added or removed, and until then hashtable->sorted points to
+ * it. Replacing the value of an existing key keeps the cache valid.
+ */
+void hashtable_set_sorted(hashtable_t *hashtable, struct hashtable_pair **sorted);
+
+/**
+ * hashtable_memory_usage - Heap memory used by a hashtable
+ *
+ * @hashtable: The hashtable object
+ *
+ * Returns the bytes allocated for the slots, the pairs and the cached
+ * key order, but not for the values. Arena hashtables use none.
+ */
+size_t hashtable_memory_usage(const hashtable_t *hashtable);
 
 #endif
@@ -0,0 +1,715 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "jansson_private.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define USE_MMAP 1
+#endif
+
+#include "jansson.h"
+
+/* A read-only image of a value is a header followed by the nodes of
+   the tree. The nodes have the same layout as heap values, with an
+   immortal refcount, so that the accessors work on them unchanged.
+   Containers and strings refer to their children and characters by
+   offsets from the node instead of by pointers, so that the image can
+   be mapped at any address and shared between processes. */
+
+#define IMAGE_MAGIC   "JSNI"
+#define IMAGE_VERSION 2
+#define IMAGE_ALIGN   8
+/* Written in native byte order, to detect the byte order of the image */
+#define IMAGE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[4];
+    unsigned char version;
+    unsigned char size_size;
+    unsigned char int_size;
+    unsigned char real_size;
+    uint32_t byte_order;
+    uint32_t reserved;
+    size_t size; /* of the whole image */
+    size_t root; /* offset of the root value */
+} image_header_t;
+
+typedef struct {
+    json_t json;
+    size_t mark; /* JSONP_IMAGE_MARK */
+    size_t size;
+    size_t hash; /* json_hash() of the array */
+    size_t offsets[1]; /* from the node */
+} image_array_t;
+
+/* The offsets of the pairs in insertion order, followed by the same
+   offsets in key order */
+typedef struct {
+    json_t json;
+    size_t mark; /* JSONP_IMAGE_MARK */
+    size_t size;
+    size_t hash;
+    size_t offsets[1];
+} image_object_t;
+
+/* Pairs are used as iterators like those of the hashtable, so the key
+   must be where it is in struct hashtable_pair */
+typedef struct {
+    size_t value; /* offset from the pair */
+    size_t index; /* in insertion order, with JSONP_IMAGE_PAIR set */
+    size_t key_len;
+    char key[1];
+} image_pair_t;
+
+#define same_offset(member_)                                                             \
+    (offsetof(image_pair_t, member_) == offsetof(struct hashtable_pair, member_))
+#define pair_layout_ok (same_offset(index) && same_offset(key_len) && same_offset(key))
+typedef char image_pair_check[pair_layout_ok ? 1 : -1];
+
+#define node_at(node_, offset_) ((void *)((char *)(node_) + (offset_)))
+
+struct json_image_t {
+    char *data;
+    size_t size;
+    int mapped;
+    json_t *root;
+};
+
+/*** accessors ***/
+
+size_t jsonp_image_size(const json_t *json) {
+    /* Arrays and objects both have the size after the mark */
+    return ((const image_array_t *)json)->size;
+}
+
+size_t jsonp_image_hash(const json_t *json) {
+    return ((const image_array_t *)json)->hash;
+}
+
+json_t *jsonp_image_array_get(const json_t *json, size_t index) {
+    const image_array_t *array = (const image_array_t *)json;
+
+    if (index >= array->size)
+        return NULL;
+    return node_at(array, array->offsets[index]);
+}
+
+static int compare_key(const image_pair_t *pair, const char *key, size_t key_len) {
+    size_t len = pair->key_len < key_len ? pair->key_len : key_len;
+    int res = memcmp(pair->key, key, len);
+
+    if (res)
+        return res;
+    return pair->key_len < key_len ? -1 : pair->key_len > key_len;
+}
+
+void *jsonp_image_object_iter_at(const json_t *json, const char *key, size_t key_len) {
+    const image_object_t *object = (const image_object_t *)json;
+    const size_t *sorted = object->offsets + object->size;
+    size_t low = 0, high = object->size;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        image_pair_t *pair = node_at(object, sorted[mid]);
+        int res = compare_key(pair, key, key_len);
+
+        if (res == 0)
+            return pair;
+        if (res < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+json_t *jsonp_image_object_getn(const json_t *json, const char *key, size_t key_len) {
+    void *pair = jsonp_image_object_iter_at(json, key, key_len);
+    return pair ? jsonp_image_iter_value(pair) : NULL;
+}
+
+void *jsonp_image_object_iter(const json_t *json) {
+    const image_object_t *object = (const image_object_t *)json;
+
+    if (!object->size)
+        return NULL;
+    return node_at(object, object->offsets[0]);
+}
+
+void *jsonp_image_object_iter_next(const json_t *json, void *iter) {
+    const image_object_t *object = (const image_object_t *)json;
+    size_t index = ((image_pair_t *)iter)->index & ~JSONP_IMAGE_PAIR;
+
+    if (index + 1 >= object->size)
+        return NULL;
+    return node_at(object, object->offsets[index + 1]);
+}
+
+json_t *jsonp_image_iter_value(void *iter) {
+    image_pair_t *pair = iter;
+    return node_at(pair, pair->value);
+}
+
+void jsonp_image_sorted_pairs(const json_t *json, struct hashtable_pair **pairs) {
+    const image_object_t *object = (const image_object_t *)json;
+    const size_t *sorted = object->offsets + object->size;
+    size_t i;
+
+    for (i = 0; i < object->size; i++)
+        pairs[i] = node_at(object, sorted[i]);
+}
+
+/*** writing ***/
+
+/* A scalar node that has been written, so that equal scalars are
+   written only once */
+typedef struct {
+    size_t hash;
+    size_t offset; /* 0 if the slot is free */
+    size_t size;
+} scalar_slot_t;
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t size;
+    size_t flags;
+    jsonp_parents_t parents;
+    scalar_slot_t *scalars;
+    size_t scalars_size; /* a power of two, or 0 */
+    size_t scalars_count;
+} writer_t;
+
+typedef struct {
+    const char *key;
+    size_t key_len;
+    size_t offset;
+} sort_entry_t;
+
+/* Reserve a zeroed node and return its offset, or 0 on error. The
+   buffer may move, so nodes are always addressed by offset. */
+static size_t writer_alloc(writer_t *writer, size_t size) {
+    size_t offset = writer->used, new_size;
+    char *data;
+
+    size = (size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+    if (size > (size_t)-1 - offset)
+        return 0;
+
+    if (offset + size > writer->size) {
+        new_size = writer->size * 2;
+        if (new_size < offset + size)
+            new_size = offset + size;
+        data = jsonp_malloc(new_size);
+        if (!data)
+            return 0;
+        memcpy(data, writer->data, writer->used);
+        jsonp_free(writer->data);
+        writer->data = data;
+        writer->size = new_size;
+    }
+
+    memset(writer->data + offset, 0, size);
+    writer->used += size;
+    return offset;
+}
+
+#define writer_node(writer_, offset_) ((void *)((writer_)->data + (offset_)))
+
+static void init_node(writer_t *writer, size_t offset, json_type type) {
+    json_t *json = writer_node(writer, offset);
+    json->type = type;
+    json->refcount = (size_t)-1;
+    if (type == JSON_OBJECT || type == JSON_ARRAY)
+        ((jsonp_image_node_t *)json)->mark = JSONP_IMAGE_MARK;
+}
+
+static int writer_grow_scalars(writer_t *writer) {
+    size_t size = writer->scalars_size ? writer->scalars_size * 2 : 256, i, j;
+    scalar_slot_t *scalars = jsonp_malloc(size * sizeof(scalar_slot_t));
+
+    if (!scalars)
+        return -1;
+    memset(scalars, 0, size * sizeof(scalar_slot_t));
+
+    for (i = 0; i < writer->scalars_size; i++) {
+        if (!writer->scalars[i].offset)
+            continue;
+        j = writer->scalars[i].hash & (size - 1);
+        while (scalars[j].offset)
+            j = (j + 1) & (size - 1);
+        scalars[j] = writer->scalars[i];
+    }
+
+    jsonp_free(writer->scalars);
+    writer->scalars = scalars;
+    writer->scalars_size = size;
+    return 0;
+}
+
+/* Return the offset of a scalar equal to the node, which must be the
+   last one written, and drop the node if there's one */
+static size_t writer_share(writer_t *writer, size_t node) {
+    size_t size = writer->used - node, hash, i;
+    const char *bytes = writer->data + node;
+
+    hash = hashtable_hash(bytes, size);
+    if (2 * (writer->scalars_count + 1) > writer->scalars_size &&
+        writer_grow_scalars(writer))
+        return node; /* not shared, which is fine */
+
+    i = hash & (writer->scalars_size - 1);
+    while (writer->scalars[i].offset) {
+        const scalar_slot_t *slot = &writer->scalars[i];
+        if (slot->hash == hash && slot->size == size &&
+            !memcmp(writer->data + slot->offset, bytes, size)) {
+            writer->used = node;
+            return slot->offset;
+        }
+        i = (i + 1) & (writer->scalars_size - 1);
+    }
+
+    writer->scalars[i].hash = hash;
+    writer->scalars[i].offset = node;
+    writer->scalars[i].size = size;
+    writer->scalars_count++;
+    return node;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const sort_entry_t *entry1 = a, *entry2 = b;
+    size_t len = entry1->key_len < entry2->key_len ? entry1->key_len : entry2->key_len;
+    int res = memcmp(entry1->key, entry2->key, len);
+
+    if (res)
+        return res;
+    return entry1->key_len < entry2->key_len ? -1 : entry1->key_len > entry2->key_len;
+}
+
+static size_t write_value(writer_t *writer, const json_t *json);
+
+static size_t write_object(writer_t *writer, const json_t *json) {
+    size_t size = json_object_size(json), node, pair, value, i = 0;
+    sort_entry_t *entries;
+    const char *key;
+    size_t key_len;
+    json_t *member;
+    image_pair_t *p;
+
+    if (size > ((size_t)-1 - sizeof(image_object_t)) / (2 * sizeof(size_t)))
+        return 0;
+
+    node = writer_alloc(writer, offsetof(image_object_t, offsets) +
+                                    2 * size * sizeof(size_t));
+    if (!node)
+        return 0;
+    init_node(writer, node, JSON_OBJECT);
+    ((image_object_t *)writer_node(writer, node))->size = size;
+
+    entries = jsonp_malloc(size ? size * sizeof(sort_entry_t) : 1);
+    if (!entries)
+        return 0;
+
+    json_object_keylen_foreach((json_t *)json, key, key_len, member) {
+        pair = writer_alloc(writer, offsetof(image_pair_t, key) + key_len + 1);
+        if (!pair)
+            goto error;
+        p = writer_node(writer, pair);
+        memcpy(p->key, key, key_len);
+        p->key_len = key_len;
+        p->index = JSONP_IMAGE_PAIR | i;
+        ((image_object_t *)writer_node(writer, node))->offsets[i] = pair - node;
+
+        value = write_value(writer, member);
+        if (!value)
+            goto error;
+        ((image_pair_t *)writer_node(writer, pair))->value = value - pair;
+
+        entries[i].key = key;
+        entries[i].key_len = key_len;
+        entries[i].offset = pair - node;
+        i++;
+    }
+
+    qsort(entries, size, sizeof(sort_entry_t), compare_entries);
+    for (i = 0; i < size; i++)
+        ((image_object_t *)writer_node(writer, node))->offsets[size + i] =
+            entries[i].offset;
+
+    /* The children are written, and their hashes are cached */
+    ((image_object_t *)writer_node(writer, node))->hash =
+        jsonp_hash_contents(writer_node(writer, node));
+
+    jsonp_free(entries);
+    return node;
+
+error:
+    jsonp_free(entries);
+    return 0;
+}
+
+static size_t write_array(writer_t *writer, const json_t *json) {
+    size_t size = json_array_size(json), node, value, i;
+
+    if (size > ((size_t)-1 - sizeof(image_array_t)) / sizeof(size_t))
+        return 0;
+
+    node = writer_alloc(writer, offsetof(image_array_t, offsets) + size * sizeof(size_t));
+    if (!node)
+        return 0;
+    init_node(writer, node, JSON_ARRAY);
+    ((image_array_t *)writer_node(writer, node))->size = size;
+
+    for (i = 0; i < size; i++) {
+        value = write_value(writer, json_array_get(json, i));
+        if (!value)
+            return 0;
+        ((image_array_t *)writer_node(writer, node))->offsets[i] = value - node;
+    }
+    ((image_array_t *)writer_node(writer, node))->hash =
+        jsonp_hash_contents(writer_node(writer, node));
+    return node;
+}
+
+/* Strings have no pointer to their value, which follows the node */
+static size_t write_string(writer_t *writer, const json_t *json) {
+    size_t length = json_string_length(json), node;
+    json_string_t *string;
+
+    if (length >= (size_t)-1 - offsetof(json_string_t, data) - IMAGE_ALIGN)
+        return 0;
+
+    node = writer_alloc(writer, offsetof(json_string_t, data) + length + 1);
+    if (!node)
+        return 0;
+    init_node(writer, node, JSON_STRING);
+    string = writer_node(writer, node);
+    string->length = length;
+    memcpy(string->data, json_string_value(json), length);
+    return writer_share(writer, node);
+}
+
+static size_t write_value(writer_t *writer, const json_t *json) {
+    size_t node;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+        case JSON_ARRAY:
+            if (!(writer->flags & JSON_NO_CYCLE_CHECK) &&
+                jsonp_parents_enter(&writer->parents, json))
+                return 0;
+            if (json_is_object(json))
+                node = write_object(writer, json);
+            else
+                node = write_array(writer, json);
+            if (!(writer->flags & JSON_NO_CYCLE_CHECK))
+                jsonp_parents_leave(&writer->parents, json);
+            return node;
+
+        case JSON_STRING:
+            return write_string(writer, json);
+
+        case JSON_INTEGER:
+            node = writer_alloc(writer, sizeof(json_integer_t));
+            if (node) {
+                init_node(writer, node, JSON_INTEGER);
+                json_to_integer((json_t *)writer_node(writer, node))->value =
+                    json_integer_value(json);
+                node = writer_share(writer, node);
+            }
+            return node;
+
+        case JSON_REAL:
+            node = writer_alloc(writer, sizeof(json_real_t));
+            if (node) {
+                init_node(writer, node, JSON_REAL);
+                json_to_real((json_t *)writer_node(writer, node))->value =
+                    json_real_value(json);
+                node = writer_share(writer, node);
+            }
+            return node;
+
+        case JSON_TRUE:
+        case JSON_FALSE:
+        case JSON_NULL:
+            node = writer_alloc(writer, sizeof(json_t));
+            if (node) {
+                init_node(writer, node, json_typeof(json));
+                node = writer_share(writer, node);
+            }
+            return node;
+
+        default:
+            return 0;
+    }
+}
+
+/* Return the image in an allocated buffer, or NULL on error */
+static char *write_image(const json_t *json, size_t flags, size_t *size) {
+    writer_t writer;
+    image_header_t *header;
+    size_t root;
+
+    if (!json || (!(flags & JSON_ENCODE_ANY) && !json_is_array(json) &&
+                  !json_is_object(json)))
+        return NULL;
+
+    /* The header is at offset 0, which no node can be */
+    writer.size = 4096;
+    writer.data = jsonp_malloc(writer.size);
+    if (!writer.data)
+        return NULL;
+    writer.used = (sizeof(image_header_t) + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+    memset(writer.data, 0, writer.used);
+    writer.flags = flags;
+    writer.scalars = NULL;
+    writer.scalars_size = 0;
+    writer.scalars_count = 0;
+
+    jsonp_parents_init(&writer.parents);
+    root = write_value(&writer, json);
+    jsonp_parents_close(&writer.parents);
+    jsonp_free(writer.scalars);
+    if (!root) {
+        jsonp_free(writer.data);
+        return NULL;
+    }
+
+    header = (image_header_t *)writer.data;
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version = IMAGE_VERSION;
+    header->size_size = sizeof(size_t);
+    header->int_size = sizeof(json_int_t);
+    header->real_size = sizeof(double);
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->size = writer.used;
+    header->root = root;
+
+    *size = writer.used;
+    return writer.data;
+}
+
+size_t json_image_dumpb(const json_t *json, char *buffer, size_t size, size_t flags) {
+    size_t image_size;
+    char *image = write_image(json, flags, &image_size);
+
+    if (!image)
+        return 0;
+
+    if (image_size <= size)
+        memcpy(buffer, image, image_size);
+
+    jsonp_free(image);
+    return image_size;
+}
+
+int json_image_dump_file(const json_t *json, const char *path, size_t flags) {
+    size_t size;
+    char *image;
+    FILE *output;
+    int result = 0;
+
+    if (!path)
+        return -1;
+
+    image = write_image(json, flags, &size);
+    if (!image)
+        return -1;
+
+    output = fopen(path, "wb");
+    if (!output) {
+        jsonp_free(image);
+        return -1;
+    }
+
+    if (fwrite(image, 1, size, output) != size)
+        result = -1;
+    if (fclose(output) != 0)
+        result = -1;
+
+    jsonp_free(image);
+    return result;
+}
+
+/*** loading ***/
+
+static json_t *image_root(const char *buffer, size_t size, json_error_t *error) {
+    const image_header_t *header = (const image_header_t *)buffer;
+
+    if ((size_t)buffer % IMAGE_ALIGN) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "image is not aligned to %d bytes", IMAGE_ALIGN);
+        return NULL;
+    }
+
+    if (size < sizeof(image_header_t) ||
+        memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic))) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_syntax, "not an image");
+        return NULL;
+    }
+
+    if (header->version != IMAGE_VERSION || header->size_size != sizeof(size_t) ||
+        header->int_size != sizeof(json_int_t) || header->real_size != sizeof(double) ||
+        header->byte_order != IMAGE_BYTE_ORDER) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_syntax,
+                        "image of an unsupported version or platform");
+        return NULL;
+    }
+
+    if (header->size != size || header->root < sizeof(image_header_t) ||
+        header->root >= size) {
+        jsonp_error_set(error, -1, -1, size, json_error_premature_end_of_input,
+                        "image size doesn't match");
+        return NULL;
+    }
+
+    if (error)
+        error->position = (int)size;
+    return (json_t *)(buffer + header->root);
+}
+
+json_t *json_image_load(const char *buffer, size_t size, json_error_t *error) {
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    return image_root(buffer, size, error);
+}
+
+/* Read a file that can't be mapped into an allocated buffer, which is
+   aligned for any node */
+static int read_image(FILE *fp, json_image_t *image) {
+    size_t size = 0, capacity = 4096, n;
+    char *data = jsonp_malloc(capacity), *new_data;
+
+    if (!data)
+        return -1;
+
+    while ((n = fread(data + size, 1, capacity - size, fp)) > 0) {
+        size += n;
+        if (size < capacity)
+            continue;
+
+        new_data = jsonp_malloc(capacity * 2);
+        if (!new_data) {
+            jsonp_free(data);
+            return -1;
+        }
+        memcpy(new_data, data, size);
+        jsonp_free(data);
+        data = new_data;
+        capacity *= 2;
+    }
+
+    if (ferror(fp)) {
+        jsonp_free(data);
+        return -1;
+    }
+
+    image->data = data;
+    image->size = size;
+    image->mapped = 0;
+    return 0;
+}
+
+static void release_image(json_image_t *image) {
+#ifdef USE_MMAP
+    if (image->mapped) {
+        munmap(image->data, image->size);
+        return;
+    }
+#endif
+    jsonp_free(image->data);
+}
+
+json_image_t *json_image_open(const char *path, json_error_t *error) {
+    json_image_t *image;
+    FILE *fp;
+#ifdef USE_MMAP
+    struct stat st;
+    void *map;
+#endif
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    image = jsonp_malloc(sizeof(json_image_t));
+    if (!image) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        jsonp_error_set(error, -1, -1, 0, json_error_cannot_open_file,
+                        "unable to open %s: %s", path, strerror(errno));
+        jsonp_free(image);
+        return NULL;
+    }
+
+    image->data = NULL;
+#ifdef USE_MMAP
+    /* A shared mapping of a regular file is backed by the page cache,
+       so the processes that open the same image share its memory */
+    if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (unsigned long long)st.st_size <= (size_t)-1) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+        if (map != MAP_FAILED) {
+            image->data = map;
+            image->size = (size_t)st.st_size;
+            image->mapped = 1;
+        }
+    }
+#endif
+    if (!image->data && read_image(fp, image)) {
+        jsonp_error_set(error, -1, -1, 0, json_error_cannot_open_file,
+                        "unable to read %s: %s", path, strerror(errno));
+        fclose(fp);
+        jsonp_free(image);
+        return NULL;
+    }
+    fclose(fp);
+
+    image->root = image_root(image->data, image->size, error);
+    if (!image->root) {
+        release_image(image);
+        jsonp_free(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+json_t *json_image_root(const json_image_t *image) { return image ? image->root : NULL; }
+
+void json_image_close(json_image_t *image) {
+    if (!image)
+        return;
+
+    release_image(image);
+    jsonp_free(image);
+}
@@ -55,7 +55,8 @@ typedef enum {
     JSON_REAL,
     JSON_TRUE,
     JSON_FALSE,
-    JSON_NULL
+    JSON_NULL,
+    JSON_RAW
 } json_type;
 
 typedef struct json_t {
@@ -89,6 +90,7 @@ typedef long json_int_t;
 #define json_boolean_value    json_is_true
 #define json_is_boolean(json) (json_is_true(json) || json_is_false(json))
 #define json_is_null(json)    ((json) && json_typeof(json) == JSON_NULL)
+#define json_is_raw(json)     ((json) && json_typeof(json) == JSON_RAW)
 
 /* construction, destruction, reference counting */
 
@@ -104,6 +106,9 @@ json_t *json_true(void);
 json_t *json_false(void);
 #define json_boolean(val) ((val) ? json_true() : json_false())
 json_t *json_null(void);
+json_t *json_raw(const char *text);
+json_t *json_rawn(const char *text, size_t len);
+json_t *json_rawn_nocheck(const char *text, size_t len);
 
 /* do not call JSON_INTERNAL_INCREF or JSON_INTERNAL_DECREF directly */
 #if JSON_HAVE_ATOMIC_BUILTINS
@@ -128,11 +133,19 @@ static JSON_INLINE json_t *json_incref(json_t *json) {
 /* do not call json_delete directly */
 void json_delete(json_t *json);
 
+/* set in the refcount of values from a per-call allocator */
+#define JSON_INTERNAL_ALLOCATED ((size_t)1 << (sizeof(size_t) * 8 - 2))
+
 static JSON_INLINE void json_decref(json_t *json) {
-    if (json && json->refcount != (size_t)-1 && JSON_INTERNAL_DECREF(json) == 0)
+    if (json && json->refcount != (size_t)-1 &&
+        (JSON_INTERNAL_DECREF(json) & ~JSON_INTERNAL_ALLOCATED) == 0)
         json_delete(json);
 }
 
+/* free the value later in json_reclaim() if this was the last reference */
+void json_decref_deferred(json_t *json);
+size_t json_reclaim(size_t budget);
+
 #if defined(__GNUC__) || defined(__clang__)
 static JSON_INLINE void json_decrefp(json_t **json) {
     if (json) {
@@ -175,7 +188,8 @@ enum json_error_code {
     json_error_duplicate_key,
     json_error_numeric_overflow,
     json_error_item_not_found,
-    json_error_index_out_of_range
+    json_error_index_out_of_range,
+    json_error_aborted
 };
 
 static JSON_INLINE enum json_error_code json_error_code(const json_error_t *e) {
@@ -198,10 +212,24 @@ int json_object_setn_new_nocheck(json_t *object, const char *key, size_t key_len
 int json_object_del(json_t *object, const char *key);
 int json_object_deln(json_t *object, const char *key, size_t key_len);
 int json_object_clear(json_t *object);
+int json_object_reserve(json_t *object, size_t size);
 int json_object_update(json_t *object, json_t *other);
 int json_object_update_existing(json_t *object, json_t *other);
 int json_object_update_missing(json_t *object, json_t *other);
 int json_object_update_recursive(json_t *object, json_t *other);
+json_t *json_object_update_recursive_copy(json_t *object, json_t *other)
+    JANSSON_ATTRS((warn_unused_result));
+
+typedef struct json_key_t json_key_t;
+
+json_key_t *json_key_create(const char *key) JANSSON_ATTRS((warn_unused_result));
+json_key_t *json_key_createn(const char *key, size_t key_len)
+    JANSSON_ATTRS((warn_unused_result));
+void json_key_destroy(json_key_t *key);
+json_t *json_object_get_key(const json_t *object, const json_key_t *key)
+    JANSSON_ATTRS((warn_unused_result));
+int json_object_set_key_new(json_t *object, const json_key_t *key, json_t *value);
+
 void *json_object_iter(json_t *object);
 void *json_object_iter_at(json_t *object, const char *key);
 void *json_object_key_to_iter(const char *key);
@@ -254,6 +282,11 @@ static JSON_INLINE int json_object_setn(json_t *object, const char *key, size_t
     return json_object_setn_new(object, key, key_len, json_incref(value));
 }
 
+static JSON_INLINE int json_object_set_key(json_t *object, const json_key_t *key,
+                                           json_t *value) {
+    return json_object_set_key_new(object, key, json_incref(value));
+}
+
 static JSON_INLINE int json_object_set_nocheck(json_t *object, const char *key,
                                                json_t *value) {
     return json_object_set_new_nocheck(object, key, json_incref(value));
@@ -295,6 +328,8 @@ int json_array_insert_new(json_t *array, size_t index, json_t *value);
 int json_array_remove(json_t *array, size_t index);
 int json_array_clear(json_t *array);
 int json_array_extend(json_t *array, json_t *other);
+int json_array_reserve(json_t *array, size_t size);
+int json_array_append_many_new(json_t *array, json_t **values, size_t count);
 
 static JSON_INLINE int json_array_set(json_t *array, size_t ind, json_t *value) {
     return json_array_set_new(array, ind, json_incref(value));
@@ -313,6 +348,8 @@ size_t json_string_length(const json_t *string);
 json_int_t json_integer_value(const json_t *integer);
 double json_real_value(const json_t *real);
 double json_number_value(const json_t *json);
+const char *json_raw_value(const json_t *raw);
+size_t json_raw_length(const json_t *raw);
 
 int json_string_set(json_t *string, const char *value);
 int json_string_setn(json_t *string, const char *value, size_t len);
@@ -337,6 +374,57 @@ int json_unpack_ex(json_t *root, json_error_t *error, size_t flags, const char *
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
                     va_list ap);
 
+typedef struct json_plan_t json_plan_t;
+
+json_plan_t *json_pack_compile(json_error_t *error, size_t flags, const char *fmt)
+    JANSSON_ATTRS((warn_unused_result));
+json_plan_t *json_unpack_compile(json_error_t *error, size_t flags, const char *fmt)
+    JANSSON_ATTRS((warn_unused_result));
+void json_plan_destroy(json_plan_t *plan);
+json_t *json_pack_plan(json_error_t *error, const json_plan_t *plan, ...)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_vpack_plan(json_error_t *error, const json_plan_t *plan, va_list ap)
+    JANSSON_ATTRS((warn_unused_result));
+int json_unpack_plan(json_t *root, json_error_t *error, const json_plan_t *plan, ...);
+int json_vunpack_plan(json_t *root, json_error_t *error, const json_plan_t *plan,
+                      va_list ap);
+
+/* JSON Pointer (RFC 6901) */
+
+json_t *json_pointer_get(const json_t *root, const char *pointer);
+int json_pointer_set_new(json_t *root, const char *pointer, json_t *value);
+int json_pointer_del(json_t *root, const char *pointer);
+
+static JSON_INLINE int json_pointer_set(json_t *root, const char *pointer,
+                                        json_t *value) {
+    return json_pointer_set_new(root, pointer, json_incref(value));
+}
+
+typedef struct json_pointer_t json_pointer_t;
+
+json_pointer_t *json_pointer_compile(const char *pointer, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_pointer_destroy(json_pointer_t *pointer);
+json_t *json_pointer_get_compiled(const json_t *root, const json_pointer_t *pointer);
+int json_pointer_set_compiled_new(json_t *root, const json_pointer_t *pointer,
+                                  json_t *value);
+int json_pointer_del_compiled(json_t *root, const json_pointer_t *pointer);
+
+static JSON_INLINE int json_pointer_set_compiled(json_t *root,
+                                                 const json_pointer_t *pointer,
+                                                 json_t *value) {
+    return json_pointer_set_compiled_new(root, pointer, json_incref(value));
+}
+
+typedef struct json_pointer_batch_t json_pointer_batch_t;
+
+json_pointer_batch_t *json_pointer_batch_compile(const char *const *pointers,
+                                                 size_t count, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+void json_pointer_batch_destroy(json_pointer_batch_t *batch);
+size_t json_pointer_batch_get(const json_t *root, const json_pointer_batch_t *batch,
+                              json_t **values);
+
 /* sprintf */
 
 json_t *json_sprintf(const char *fmt, ...)
@@ -347,12 +435,26 @@ json_t *json_vsprintf(const char *fmt, va_list ap)
 /* equality */
 
 int json_equal(const json_t *value1, const json_t *value2);
+size_t json_hash(const json_t *value);
 
 /* copying */
 
 json_t *json_copy(json_t *value) JANSSON_ATTRS((warn_unused_result));
 json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
 
+/* freezing */
+
+int json_freeze(json_t *value);
+
+/* arenas */
+
+typedef struct json_arena_t json_arena_t;
+
+json_arena_t *json_arena_create(size_t block_size) JANSSON_ATTRS((warn_unused_result));
+void json_arena_reset(json_arena_t *arena);
+void json_arena_destroy(json_arena_t *arena);
+int json_arena_adopt_buffer(json_arena_t *arena, void *buffer);
+
 /* decoding */
 
 #define JSON_REJECT_DUPLICATES  0x1
@@ -360,6 +462,8 @@ json_t *json_deep_copy(const json_t *value) JANSSON_ATTRS((warn_unused_result));
 #define JSON_DECODE_ANY         0x4
 #define JSON_DECODE_INT_AS_REAL 0x8
 #define JSON_ALLOW_NUL          0x10
+#define JSON_SHARE_VALUES       0x40
+#define JSON_MAX_DEPTH(n)       (((size_t)(n)&0xFFFF) << 16)
 
 typedef size_t (*json_load_callback_t)(void *buffer, size_t buflen, void *data);
 
@@ -367,6 +471,11 @@ json_t *json_loads(const char *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_arena(json_arena_t *arena, const char *buffer, size_t buflen,
+                         size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_insitu(json_arena_t *arena, char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadf(FILE *input, size_t flags, json_error_t *error)
     JANSSON_ATTRS((warn_unused_result));
 json_t *json_loadfd(int input, size_t flags, json_error_t *error)
@@ -376,6 +485,106 @@ json_t *json_load_file(const char *path, size_t flags, json_error_t *error)
 json_t *json_load_callback(json_load_callback_t callback, void *data, size_t flags,
                            json_error_t *error) JANSSON_ATTRS((warn_unused_result));
 
+/* event-based decoding */
+
+typedef struct json_sax_handler_t {
+    int (*start_object)(void *data);
+    int (*end_object)(void *data);
+    int (*start_array)(void *data);
+    int (*end_array)(void *data);
+    int (*key)(const char *key, size_t length, void *data);
+    int (*string)(const char *value, size_t length, void *data);
+    int (*integer)(json_int_t value, void *data);
+    int (*real)(double value, void *data);
+    int (*boolean)(int value, void *data);
+    int (*null)(void *data);
+} json_sax_handler_t;
+
+int json_sax_loadb(const char *buffer, size_t buflen, const json_sax_handler_t *handler,
+                   void *data, size_t flags, json_error_t *error);
+int json_sax_loadf(FILE *input, const json_sax_handler_t *handler, void *data,
+                   size_t flags, json_error_t *error);
+int json_sax_loadfd(int input, const json_sax_handler_t *handler, void *data,
+                    size_t flags, json_error_t *error);
+int json_sax_load_callback(json_load_callback_t callback, void *arg,
+                           const json_sax_handler_t *handler, void *data, size_t flags,
+                           json_error_t *error);
+
+/* push parsing */
+
+typedef struct json_parser_t json_parser_t;
+
+enum json_parser_status {
+    json_parser_need_more,
+    json_parser_complete,
+    json_parser_error
+};
+
+json_parser_t *json_parser_create(size_t flags) JANSSON_ATTRS((warn_unused_result));
+void json_parser_destroy(json_parser_t *parser);
+enum json_parser_status json_parser_feed(json_parser_t *parser, const char *buffer,
+                                         size_t buflen, json_error_t *error);
+enum json_parser_status json_parser_finish(json_parser_t *parser, json_error_t *error);
+json_t *json_parser_value(json_parser_t *parser) JANSSON_ATTRS((warn_unused_result));
+json_t *json_parser_loadb(json_parser_t *parser, const char *buffer, size_t buflen,
+                          json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+
+/* record reading */
+
+typedef struct json_reader_t json_reader_t;
+
+json_reader_t *json_reader_create_buffer(const char *buffer, size_t buflen, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_create_file(FILE *input, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_create_fd(int input, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+json_reader_t *json_reader_create_callback(json_load_callback_t callback, void *data,
+                                           size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+void json_reader_destroy(json_reader_t *reader);
+int json_reader_next(json_reader_t *reader, json_t **value, json_error_t *error);
+
+/* parallel loading */
+
+typedef void (*json_task_t)(void *arg, size_t index);
+typedef void (*json_task_runner_t)(json_task_t task, void *arg, size_t count, void *data);
+
+json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t flags, size_t jobs,
+                            json_task_runner_t runner, void *data, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_lines_parallel(const char *buffer, size_t buflen, size_t flags,
+                                  size_t jobs, json_task_runner_t runner, void *data,
+                                  json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* lazy documents */
+
+typedef struct json_doc_t json_doc_t;
+
+typedef struct json_lazy_t {
+    json_doc_t *doc;
+    size_t node;
+} json_lazy_t;
+
+#define json_lazy_found(value) ((value).doc != NULL)
+
+json_doc_t *json_doc_loadb(const char *buffer, size_t buflen, size_t flags,
+                           json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+void json_doc_destroy(json_doc_t *doc);
+json_lazy_t json_doc_root(json_doc_t *doc);
+json_type json_lazy_typeof(json_lazy_t value);
+json_lazy_t json_lazy_object_get(json_lazy_t object, const char *key);
+json_lazy_t json_lazy_array_get(json_lazy_t array, size_t index);
+size_t json_lazy_size(json_lazy_t value);
+json_t *json_lazy_value(json_lazy_t value, json_error_t *error);
+
+/* selective loading */
+
+int json_loadb_select(const char *buffer, size_t buflen, size_t flags,
+                      const char *const *pointers, json_t **values, size_t count,
+                      json_error_t *error);
+
 /* encoding */
 
 #define JSON_MAX_INDENT        0x1F
@@ -388,16 +597,84 @@ json_t *json_load_callback(json_load_callback_t callback, void *data, size_t fla
 #define JSON_ESCAPE_SLASH      0x400
 #define JSON_REAL_PRECISION(n) (((n)&0x1F) << 11)
 #define JSON_EMBED             0x10000
+#define JSON_NO_CYCLE_CHECK    0x20000
+#define JSON_CACHE_SORTED_KEYS 0x40000
+#define JSON_CACHE_FROZEN      0x80000
 
 typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data);
 
 char *json_dumps(const json_t *json, size_t flags) JANSSON_ATTRS((warn_unused_result));
 size_t json_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+size_t json_dump_size(const json_t *json, size_t flags);
 int json_dumpf(const json_t *json, FILE *output, size_t flags);
 int json_dumpfd(const json_t *json, int output, size_t flags);
 int json_dump_file(const json_t *json, const char *path, size_t flags);
 int json_dump_callback(const json_t *json, json_dump_callback_t callback, void *data,
                        size_t flags);
+int json_dump_callback_ex(const json_t *json, json_dump_callback_t callback, void *data,
+                          size_t flags, size_t buffer_size);
+void json_dump_cache_clear(void);
+
+/* streaming encoding */
+
+typedef struct json_writer_t json_writer_t;
+
+json_writer_t *json_writer_create(json_dump_callback_t callback, void *data, size_t flags)
+    JANSSON_ATTRS((warn_unused_result));
+void json_writer_destroy(json_writer_t *writer);
+int json_writer_flush(json_writer_t *writer);
+int json_writer_begin_object(json_writer_t *writer);
+int json_writer_end_object(json_writer_t *writer);
+int json_writer_begin_array(json_writer_t *writer);
+int json_writer_end_array(json_writer_t *writer);
+int json_writer_key(json_writer_t *writer, const char *key);
+int json_writer_keyn(json_writer_t *writer, const char *key, size_t len);
+int json_writer_string(json_writer_t *writer, const char *value);
+int json_writer_stringn(json_writer_t *writer, const char *value, size_t len);
+int json_writer_integer(json_writer_t *writer, json_int_t value);
+int json_writer_real(json_writer_t *writer, double value);
+int json_writer_boolean(json_writer_t *writer, int value);
+int json_writer_null(json_writer_t *writer);
+int json_writer_value(json_writer_t *writer, const json_t *json);
+int json_writer_pack(json_writer_t *writer, json_error_t *error, const char *fmt, ...);
+int json_writer_vpack(json_writer_t *writer, json_error_t *error, const char *fmt,
+                      va_list ap);
+char *json_pack_dumps(json_error_t *error, size_t flags, const char *fmt, ...)
+    JANSSON_ATTRS((warn_unused_result));
+char *json_vpack_dumps(json_error_t *error, size_t flags, const char *fmt, va_list ap)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* binary encoding (CBOR) */
+
+size_t json_cbor_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+int json_cbor_dumpf(const json_t *json, FILE *output, size_t flags);
+int json_cbor_dumpfd(const json_t *json, int output, size_t flags);
+int json_cbor_dump_file(const json_t *json, const char *path, size_t flags);
+int json_cbor_dump_callback(const json_t *json, json_dump_callback_t callback,
+                            void *data, size_t flags);
+
+json_t *json_cbor_loadb(const char *buffer, size_t buflen, size_t flags,
+                        json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_loadf(FILE *input, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_loadfd(int input, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_load_file(const char *path, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_cbor_load_callback(json_load_callback_t callback, void *data, size_t flags,
+                                json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+
+/* read-only images */
+
+typedef struct json_image_t json_image_t;
+
+size_t json_image_dumpb(const json_t *json, char *buffer, size_t size, size_t flags);
+int json_image_dump_file(const json_t *json, const char *path, size_t flags);
+json_t *json_image_load(const char *buffer, size_t size, json_error_t *error);
+json_image_t *json_image_open(const char *path, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_image_root(const json_image_t *image);
+void json_image_close(json_image_t *image);
 
 /* custom memory allocation */
 
@@ -407,6 +684,68 @@ typedef void (*json_free_t)(void *);
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn);
 void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn);
 
+typedef struct json_allocator_t {
+    void *(*malloc)(size_t size, void *ctx);
+    void (*free)(void *ptr, size_t size, void *ctx); /* size is 0 if unknown */
+    void *ctx;
+} json_allocator_t;
+
+void json_set_allocator(const json_allocator_t *allocator);
+void json_get_allocator(json_allocator_t *allocator);
+
+/* per-call allocators */
+
+json_t *json_loads_ex(const json_allocator_t *allocator, const char *input, size_t flags,
+                      json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadb_ex(const json_allocator_t *allocator, const char *buffer,
+                      size_t buflen, size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_loadf_ex(const json_allocator_t *allocator, FILE *input, size_t flags,
+                      json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_load_file_ex(const json_allocator_t *allocator, const char *path,
+                          size_t flags, json_error_t *error)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_load_callback_ex(const json_allocator_t *allocator,
+                              json_load_callback_t callback, void *data, size_t flags,
+                              json_error_t *error) JANSSON_ATTRS((warn_unused_result));
+json_t *json_copy_ex(const json_allocator_t *allocator, json_t *value)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_deep_copy_ex(const json_allocator_t *allocator, const json_t *value)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_pack_alloc(const json_allocator_t *allocator, json_error_t *error,
+                        size_t flags, const char *fmt, ...)
+    JANSSON_ATTRS((warn_unused_result));
+json_t *json_vpack_alloc(const json_allocator_t *allocator, json_error_t *error,
+                         size_t flags, const char *fmt, va_list ap)
+    JANSSON_ATTRS((warn_unused_result));
+
+/* memory statistics */
+
+enum json_memory_category {
+    json_memory_node,
+    json_memory_string,
+    json_memory_array,
+    json_memory_bucket,
+    json_memory_pair,
+    json_memory_parser,
+    json_memory_encoder,
+    json_memory_other
+};
+
+#define JSON_MEMORY_CATEGORIES 8
+
+typedef struct json_memory_stats_t {
+    size_t allocs[JSON_MEMORY_CATEGORIES];
+    size_t frees[JSON_MEMORY_CATEGORIES];
+    size_t bytes[JSON_MEMORY_CATEGORIES];
+    size_t live_bytes;
+    size_t peak_bytes;
+} json_memory_stats_t;
+
+int json_memory_stats(json_memory_stats_t *stats);
+void json_memory_stats_reset(void);
+size_t json_memory_usage(const json_t *json);
+
 /* runtime version checking */
 
 const char *jansson_version_str(void);
@@ -17,10 +17,13 @@
 #define container_of(ptr_, type_, member_)                                               \
     ((type_ *)((char *)ptr_ - offsetof(type_, member_)))
 
-/* On some platforms, max() may already be defined */
+/* On some platforms, max() and min() may already be defined */
 #ifndef max
 #define max(a, b) ((a) > (b) ? (a) : (b))
 #endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
 
 /* va_copy is a C99 feature. In C89 implementations, it's sometimes
    available as __va_copy. If not, memcpy() should do the trick. */
@@ -42,12 +45,20 @@ typedef struct {
     size_t size;
     size_t entries;
     json_t **table;
+    json_arena_t *arena;
 } json_array_t;
 
+/* Strings of up to this many bytes are stored in the node */
+#define JSON_STRING_INLINE_MAX 23
+
 typedef struct {
     json_t json;
-    char *value;
+    char *value; /* points to data if stored inline */
     size_t length;
+    json_arena_t *arena;
+    unsigned char capacity; /* size of data */
+    unsigned char borrowed; /* value points into a buffer of the caller */
+    char data[1];
 } json_string_t;
 
 typedef struct {
@@ -60,15 +71,67 @@ typedef struct {
     json_int_t value;
 } json_integer_t;
 
+/* Encoded JSON text, spliced into the output as is */
+typedef struct {
+    json_t json;
+    size_t length;
+    char value[1];
+} json_raw_t;
+
 #define json_to_object(json_)  container_of(json_, json_object_t, json)
 #define json_to_array(json_)   container_of(json_, json_array_t, json)
 #define json_to_string(json_)  container_of(json_, json_string_t, json)
 #define json_to_real(json_)    container_of(json_, json_real_t, json)
 #define json_to_integer(json_) container_of(json_, json_integer_t, json)
+#define json_to_raw(json_)     container_of(json_, json_raw_t, json)
 
 /* Create a string by taking ownership of an existing buffer */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len);
 
+/* Values allocated from an arena have this bit in their refcount, on
+   top of their references. The refcount never drops to zero, so they
+   are only released with the arena. */
+#define JSONP_ARENA_REFCOUNT ((size_t)1 << (sizeof(size_t) * 8 - 1))
+#define jsonp_is_immortal(json_) ((json_)->refcount == (size_t)-1)
+#define jsonp_is_arena(json_)                                                            \
+    ((json_)->refcount != (size_t)-1 && ((json_)->refcount & JSONP_ARENA_REFCOUNT))
+
+/* Values created during a call with its own allocator have
+   JSON_INTERNAL_ALLOCATED in their refcount and the allocator in front
+   of the node. Their strings, tables and pairs come from it too. */
+typedef union {
+    const json_allocator_t *allocator;
+    double align;
+    json_int_t integer;
+} jsonp_owner_t;
+
+#define jsonp_allocator_of(json_)                                                        \
+    (((json_)->refcount & (JSON_INTERNAL_ALLOCATED | JSONP_ARENA_REFCOUNT)) ==           \
+             JSON_INTERNAL_ALLOCATED                                                     \
+         ? ((const jsonp_owner_t *)(json_)-1)->allocator                                 \
+         : NULL)
+
+/* Arena allocation. Value constructors take NULL for the heap. */
+void *jsonp_arena_malloc(json_arena_t *arena, size_t size)
+    JANSSON_ATTRS((warn_unused_result));
+char *jsonp_arena_strndup(json_arena_t *arena, const char *str, size_t len)
+    JANSSON_ATTRS((warn_unused_result));
+int jsonp_arena_adopt(json_arena_t *arena, json_t *json);
+json_t *jsonp_object(json_arena_t *arena);
+json_t *jsonp_array(json_arena_t *arena);
+json_t *jsonp_array_sized(json_arena_t *arena, size_t size);
+/* Move the elements of other to the end of array, leaving other empty */
+int jsonp_array_move(json_t *array, json_t *other);
+/* The key of a handle */
+const char *jsonp_key_string(const json_key_t *key);
+json_t *jsonp_stringn(json_arena_t *arena, const char *value, size_t len);
+json_t *jsonp_stringn_own(json_arena_t *arena, const char *value, size_t len);
+json_t *jsonp_stringn_borrow(json_arena_t *arena, const char *value, size_t len);
+json_t *jsonp_integer(json_arena_t *arena, json_int_t value);
+json_t *jsonp_shared_integer(json_arena_t *arena, json_int_t value);
+json_t *jsonp_shared_empty_string(void);
+json_t *jsonp_real(json_arena_t *arena, double value);
+
 /* Error message formatting */
 void jsonp_error_init(json_error_t *error, const char *source);
 void jsonp_error_set_source(json_error_t *error, const char *source);
@@ -81,18 +144,114 @@ void jsonp_error_vset(json_error_t *error, int line, int column, size_t position
 int jsonp_strtod(strbuffer_t *strbuffer, double *out);
 int jsonp_dtostr(char *buffer, size_t size, double value, int prec);
 
-/* Wrappers for custom memory functions */
+/* string<->json_int_t conversions. The buffer of jsonp_inttostr()
+   needs JSONP_INT_STR_LENGTH bytes. */
+#define JSONP_INT_STR_LENGTH 24
+int jsonp_inttostr(char *buffer, json_int_t value);
+int jsonp_strtoint(const char *str, size_t length, json_int_t *out);
+
+/* Wrappers for custom memory functions. The category is counted for
+   json_memory_stats(), it's json_memory_other for jsonp_malloc().
+   These use the allocator of the current call, see
+   jsonp_use_allocator(). */
 void *jsonp_malloc(size_t size) JANSSON_ATTRS((warn_unused_result));
+void *jsonp_malloc_as(size_t size, enum json_memory_category category)
+    JANSSON_ATTRS((warn_unused_result));
 void jsonp_free(void *ptr);
+/* Memory from a given allocator, NULL for the global one. The size
+   passed to jsonp_dealloc() is 0 if unknown. */
+void *jsonp_alloc(const json_allocator_t *allocator, size_t size,
+                  enum json_memory_category category) JANSSON_ATTRS((warn_unused_result));
+void jsonp_dealloc(const json_allocator_t *allocator, void *ptr, size_t size);
+/* Nodes come from the slab allocator if allocator is NULL */
+void *jsonp_node_malloc(const json_allocator_t *allocator, size_t size,
+                        enum json_memory_category category)
+    JANSSON_ATTRS((warn_unused_result));
+void jsonp_node_free(const json_allocator_t *allocator, void *ptr, size_t size,
+                     enum json_memory_category category);
+/* Set the allocator of the current call in this thread, NULL for the
+   global one. Returns the previous allocator, to be restored when the
+   call returns. */
+const json_allocator_t *jsonp_use_allocator(const json_allocator_t *allocator);
+const json_allocator_t *jsonp_current_allocator(void);
 char *jsonp_strndup(const char *str, size_t length) JANSSON_ATTRS((warn_unused_result));
 char *jsonp_strdup(const char *str) JANSSON_ATTRS((warn_unused_result));
-char *jsonp_strndup(const char *str, size_t len) JANSSON_ATTRS((warn_unused_result));
+char *jsonp_strndup_as(const char *str, size_t len, enum json_memory_category category)
+    JANSSON_ATTRS((warn_unused_result));
+/* Memory that is never released or comes from the caller isn't
+   counted */
+void *jsonp_malloc_untracked(size_t size) JANSSON_ATTRS((warn_unused_result));
+void jsonp_free_untracked(void *ptr);
+/* Hand memory from jsonp_malloc() to a caller that releases it with
+   the free function */
+char *jsonp_disown(void *ptr);
+#ifdef USE_MEMORY_STATS
+void jsonp_memory_count(enum json_memory_category category, size_t size, int freed);
+#endif
+
+/* Circular reference check. The containers on the path of a recursive
+   walk are kept in a set of pointers, with open addressing and linear
+   probing. Shallow paths fit in the inline slots. */
+#define JSONP_PARENTS_INLINE 16
+
+typedef struct {
+    const json_t **slots;
+    size_t size;
+    size_t count;
+    const json_t *inline_slots[JSONP_PARENTS_INLINE];
+} jsonp_parents_t;
+
+void jsonp_parents_init(jsonp_parents_t *parents);
+void jsonp_parents_close(jsonp_parents_t *parents);
+/* Return -1 if json is already on the path or on allocation failure */
+int jsonp_parents_enter(jsonp_parents_t *parents, const json_t *json);
+void jsonp_parents_leave(jsonp_parents_t *parents, const json_t *json);
+
+/* The pairs of an object in key order, for JSON_SORT_KEYS. small must
+   have room for JSONP_SORTED_SMALL pairs. Returns NULL on allocation
+   failure. */
+#define JSONP_SORTED_SMALL 16
+
+struct hashtable_pair **jsonp_sorted_pairs(const json_t *json, size_t flags,
+                                           struct hashtable_pair **small);
+void jsonp_release_sorted_pairs(const json_t *json, struct hashtable_pair **pairs,
+                                struct hashtable_pair **small);
+
+/* json_hash() of a value whose child arrays and objects are in an
+   image, without checking for circular references */
+size_t jsonp_hash_contents(const json_t *json);
+
+/* Values of a read-only image (image.c). They're immortal, like frozen
+   values. Image arrays and objects have JSONP_IMAGE_MARK where heap
+   containers have their size, which is never that large. Scalars have
+   no such word, so only arrays and objects are checked for it. Image strings
+   have no pointer to their value, which follows the node. Image pairs
+   are iterators with JSONP_IMAGE_PAIR set in their index. */
+#define JSONP_IMAGE_MARK ((size_t)-1)
+#define JSONP_IMAGE_PAIR ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+typedef struct {
+    json_t json;
+    size_t mark;
+} jsonp_image_node_t;
+
+#define jsonp_is_image(json_)                                                            \
+    ((json_is_array(json_) || json_is_object(json_)) && jsonp_is_immortal(json_) &&      \
+     ((const jsonp_image_node_t *)(json_))->mark == JSONP_IMAGE_MARK)
+#define jsonp_is_image_pair(iter_)                                                       \
+    (((struct hashtable_pair *)(iter_))->index & JSONP_IMAGE_PAIR)
 
-/* Circular reference check*/
-/* Space for "0x", double the sizeof a pointer for the hex and a terminator. */
-#define LOOP_KEY_LEN (2 + (sizeof(json_t *) * 2) + 1)
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out);
+size_t jsonp_image_size(const json_t *json);
+/* The cached json_hash() of an image array or object */
+size_t jsonp_image_hash(const json_t *json);
+json_t *jsonp_image_array_get(const json_t *json, size_t index);
+json_t *jsonp_image_object_getn(const json_t *json, const char *key, size_t key_len);
+void *jsonp_image_object_iter(const json_t *json);
+void *jsonp_image_object_iter_at(const json_t *json, const char *key, size_t key_len);
+void *jsonp_image_object_iter_next(const json_t *json, void *iter);
+json_t *jsonp_image_iter_value(void *iter);
+/* pairs must have room for the size of the object */
+void jsonp_image_sorted_pairs(const json_t *json, struct hashtable_pair **pairs);
 
 /* Windows compatibility */
 #if defined(_WIN32) || defined(WIN32)
@@ -20,8 +20,14 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define USE_MMAP 1
+#endif
 
 #include "jansson.h"
+#include "scan.h"
 #include "strbuffer.h"
 #include "utf.h"
 
@@ -51,9 +57,28 @@
    behaviour of fgetc(). */
 typedef int (*get_func)(void *data);
 
+/* Read up to buflen bytes from stream to buffer. Return the number of
+   bytes read, 0 on end of file or (size_t)-1 on error. This
+   corresponds to the behaviour of json_load_callback_t. */
+typedef size_t (*fill_func)(void *buffer, size_t buflen, void *data);
+
+/* Size of the read buffer used with fill functions */
+#define STREAM_CHUNK_SIZE 65536
+
+/* Input is read from chunk, which is either the caller's buffer
+   (json_loadb(), json_loads()) or fill_buffer, refilled by the fill
+   function. get_func is only used when neither is available. */
 typedef struct {
     get_func get;
+    fill_func fill;
     void *data;
+    char *fill_buffer;
+    const char *chunk;
+    size_t chunk_len;
+    size_t chunk_pos;
+    /* Bytes of the chunk before this offset are known to be valid
+       UTF-8 */
+    size_t chunk_valid;
     char buffer[5];
     size_t buffer_pos;
     int state;
@@ -62,12 +87,31 @@ typedef struct {
     size_t position;
 } stream_t;
 
+/* Number of remembered container sizes, and the largest size that is
+   reserved from them, see lex_size_hint() */
+#define SIZE_CACHE_SIZE 64
+#define SIZE_HINT_MAX 1024
+
 typedef struct {
     stream_t stream;
     strbuffer_t saved_text;
+    /* Source text of the current token if it was scanned in place and
+       saved_text is empty */
+    const char *token_text;
+    size_t token_len;
+    /* Arena for the decoded strings and values, or NULL */
+    json_arena_t *arena;
+    /* Long strings are decoded in place, see json_loadb_insitu() */
+    int insitu;
     size_t flags;
     size_t depth;
+    /* Position of the next value in its parent, and the sizes of
+       recent containers */
+    size_t member;
+    size_t sizes[SIZE_CACHE_SIZE];
     int token;
+    /* Short decoded strings are kept here instead of allocating them */
+    char small[JSON_STRING_INLINE_MAX + 1];
     union {
         struct {
             char *val;
@@ -102,15 +146,21 @@ static void error_set(json_error_t *error, const lex_t *lex, enum json_error_cod
 
     if (lex) {
         const char *saved_text = strbuffer_value(&lex->saved_text);
+        size_t saved_len = lex->saved_text.length;
+
+        if (!saved_len && lex->token_text) {
+            saved_text = lex->token_text;
+            saved_len = lex->token_len;
+        }
 
         line = lex->stream.line;
         col = lex->stream.column;
         pos = lex->stream.position;
 
-        if (saved_text && saved_text[0]) {
-            if (lex->saved_text.length <= 20) {
-                snprintf(msg_with_context, JSON_ERROR_TEXT_LENGTH, "%s near '%s'",
-                         msg_text, saved_text);
+        if (saved_text && saved_len && saved_text[0]) {
+            if (saved_len <= 20) {
+                snprintf(msg_with_context, JSON_ERROR_TEXT_LENGTH, "%s near '%.*s'",
+                         msg_text, (int)saved_len, saved_text);
                 msg_with_context[JSON_ERROR_TEXT_LENGTH - 1] = '\0';
                 result = msg_with_context;
             }
@@ -136,9 +186,15 @@ static void error_set(json_error_t *error, const lex_t *lex, enum json_error_cod
 
 /*** lexical analyzer ***/
 
-static void stream_init(stream_t *stream, get_func get, void *data) {
+static int stream_init(stream_t *stream, get_func get, fill_func fill, void *data) {
     stream->get = get;
+    stream->fill = fill;
     stream->data = data;
+    stream->fill_buffer = NULL;
+    stream->chunk = NULL;
+    stream->chunk_len = 0;
+    stream->chunk_pos = 0;
+    stream->chunk_valid = 0;
     stream->buffer[0] = '\0';
     stream->buffer_pos = 0;
 
@@ -146,8 +202,68 @@ static void stream_init(stream_t *stream, get_func get, void *data) {
     stream->line = 1;
     stream->column = 0;
     stream->position = 0;
+
+    if (fill) {
+        stream->fill_buffer = jsonp_malloc_as(STREAM_CHUNK_SIZE, json_memory_parser);
+        if (!stream->fill_buffer)
+            return -1;
+        stream->chunk = stream->fill_buffer;
+    }
+    return 0;
+}
+
+/* Use the whole input buffer as the only chunk */
+static void stream_set_buffer(stream_t *stream, const char *buffer, size_t buflen) {
+    stream->chunk = buffer;
+    stream->chunk_len = buflen;
+    stream->chunk_pos = 0;
+    stream->chunk_valid = 0;
+}
+
+static void stream_close(stream_t *stream) {
+    jsonp_free(stream->fill_buffer);
+    stream->fill_buffer = NULL;
+    stream->chunk = NULL;
+}
+
+/* Return the next input byte like get_func does, refilling the read
+   buffer from the fill function when it runs empty */
+static int stream_read_byte(stream_t *stream) {
+    if (stream->chunk_pos < stream->chunk_len)
+        return (unsigned char)stream->chunk[stream->chunk_pos++];
+
+    if (stream->fill) {
+        size_t len = stream->fill(stream->fill_buffer, STREAM_CHUNK_SIZE, stream->data);
+        if (len == 0 || len == (size_t)-1) {
+            stream->chunk_len = stream->chunk_pos = 0;
+            return EOF;
+        }
+        stream->chunk_len = len;
+        stream->chunk_pos = 1;
+        stream->chunk_valid = 0;
+        return (unsigned char)stream->chunk[0];
+    }
+
+    if (stream->get)
+        return stream->get(stream->data);
+
+    return EOF;
+}
+
+/* Return the number of bytes starting at chunk offset pos, which must
+   be the first byte of a UTF-8 sequence, that are known to be valid
+   UTF-8. The rest of the chunk is validated in bulk when pos gets past
+   the previously validated bytes. */
+static size_t stream_utf8_run(stream_t *stream, size_t pos) {
+    if (pos >= stream->chunk_valid)
+        stream->chunk_valid =
+            pos + utf8_check_prefix(stream->chunk + pos, stream->chunk_len - pos);
+    return stream->chunk_valid - pos;
 }
 
+/* True if there's no more input after the current chunk */
+#define stream_chunk_is_last(stream) (!(stream)->fill && !(stream)->get)
+
 static int stream_get(stream_t *stream, json_error_t *error) {
     int c;
 
@@ -155,7 +271,7 @@ static int stream_get(stream_t *stream, json_error_t *error) {
         return stream->state;
 
     if (!stream->buffer[stream->buffer_pos]) {
-        c = stream->get(stream->data);
+        c = stream_read_byte(stream);
         if (c == EOF) {
             stream->state = STREAM_STATE_EOF;
             return STREAM_STATE_EOF;
@@ -174,11 +290,17 @@ static int stream_get(stream_t *stream, json_error_t *error) {
 
             assert(count >= 2);
 
-            for (i = 1; i < count; i++)
-                stream->buffer[i] = stream->get(stream->data);
+            if (stream->chunk &&
+                stream_utf8_run(stream, stream->chunk_pos - 1) >= count) {
+                memcpy(stream->buffer + 1, stream->chunk + stream->chunk_pos, count - 1);
+                stream->chunk_pos += count - 1;
+            } else {
+                for (i = 1; i < count; i++)
+                    stream->buffer[i] = stream_read_byte(stream);
 
-            if (!utf8_check_full(stream->buffer, count, NULL))
-                goto out;
+                if (!utf8_check_full(stream->buffer, count, NULL))
+                    goto out;
+            }
 
             stream->buffer[count] = '\0';
         } else
@@ -264,8 +386,33 @@ static void lex_save_cached(lex_t *lex) {
     }
 }
 
+/* Allocate memory for a decoded string */
+static void *lex_malloc(lex_t *lex, size_t size) {
+    if (lex->arena)
+        return jsonp_arena_malloc(lex->arena, size);
+    return jsonp_malloc_as(size, json_memory_string);
+}
+
+/* Whether a decoded string points into the input buffer */
+#define lex_is_insitu(lex, ptr)                                                          \
+    ((lex)->insitu && (const char *)(ptr) >= (lex)->stream.chunk &&                      \
+     (const char *)(ptr) < (lex)->stream.chunk + (lex)->stream.chunk_len)
+
+static void lex_free(lex_t *lex, void *ptr) {
+    if (!lex->arena && !lex_is_insitu(lex, ptr))
+        jsonp_free(ptr);
+}
+
+/* Buffer for a decoded string of at most size - 1 bytes */
+static char *lex_string_buffer(lex_t *lex, size_t size) {
+    if (size <= sizeof(lex->small))
+        return lex->small;
+    return lex_malloc(lex, size);
+}
+
 static void lex_free_string(lex_t *lex) {
-    jsonp_free(lex->value.string.val);
+    if (lex->value.string.val != lex->small)
+        lex_free(lex, lex->value.string.val);
     lex->value.string.val = NULL;
     lex->value.string.len = 0;
 }
@@ -293,78 +440,24 @@ static int32_t decode_unicode_escape(const char *str) {
     return value;
 }
 
-static void lex_scan_string(lex_t *lex, json_error_t *error) {
-    int c;
-    const char *p;
-    char *t;
-    int i;
-
-    lex->value.string.val = NULL;
-    lex->token = TOKEN_INVALID;
-
-    c = lex_get_save(lex, error);
-
-    while (c != '"') {
-        if (c == STREAM_STATE_ERROR)
-            goto out;
-
-        else if (c == STREAM_STATE_EOF) {
-            error_set(error, lex, json_error_premature_end_of_input,
-                      "premature end of input");
-            goto out;
-        }
-
-        else if (0 <= c && c <= 0x1F) {
-            /* control character */
-            lex_unget_unsave(lex, c);
-            if (c == '\n')
-                error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
-            else
-                error_set(error, lex, json_error_invalid_syntax, "control character 0x%x",
-                          c);
-            goto out;
-        }
-
-        else if (c == '\\') {
-            c = lex_get_save(lex, error);
-            if (c == 'u') {
-                c = lex_get_save(lex, error);
-                for (i = 0; i < 4; i++) {
-                    if (!l_isxdigit(c)) {
-                        error_set(error, lex, json_error_invalid_syntax,
-                                  "invalid escape");
-                        goto out;
-                    }
-                    c = lex_get_save(lex, error);
-                }
-            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
-                       c == 'n' || c == 'r' || c == 't')
-                c = lex_get_save(lex, error);
-            else {
-                error_set(error, lex, json_error_invalid_syntax, "invalid escape");
-                goto out;
-            }
-        } else
-            c = lex_get_save(lex, error);
-    }
-
-    /* the actual value is at most of the same length as the source
-       string, because:
-         - shortcut escapes (e.g. "\t") (length 2) are converted to 1 byte
-         - a single \uXXXX escape (length 6) is converted to at most 3 bytes
-         - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
-           are converted to 4 bytes
-    */
-    t = jsonp_malloc(lex->saved_text.length + 1);
+/* Decode the validated string token text at p, which starts after the
+   opening quote and ends with the closing quote. size is the length of
+   the token text. */
+/* Decode the string at p, just after the opening quote, to t. The
+   actual value is at most of the same length as the source string,
+   because:
+     - shortcut escapes (e.g. "\t") (length 2) are converted to 1 byte
+     - a single \uXXXX escape (length 6) is converted to at most 3 bytes
+     - two \uXXXX escapes (length 12) forming an UTF-16 surrogate pair
+       are converted to 4 bytes
+   so t may also be p itself. */
+static int lex_unescape_string(lex_t *lex, const char *p, char *t, json_error_t *error) {
     if (!t) {
         /* this is not very nice, since TOKEN_INVALID is returned */
         goto out;
     }
     lex->value.string.val = t;
 
-    /* + 1 to skip the " */
-    p = strbuffer_value(&lex->saved_text) + 1;
-
     while (*p != '"') {
         if (*p == '\\') {
             p++;
@@ -450,27 +543,76 @@ static void lex_scan_string(lex_t *lex, json_error_t *error) {
     *t = '\0';
     lex->value.string.len = t - lex->value.string.val;
     lex->token = TOKEN_STRING;
-    return;
+    return 0;
 
 out:
     lex_free_string(lex);
+    return -1;
 }
 
-#ifndef JANSSON_USING_CMAKE /* disabled if using cmake */
-#if JSON_INTEGER_IS_LONG_LONG
-#ifdef _MSC_VER /* Microsoft Visual Studio */
-#define json_strtoint _strtoi64
-#else
-#define json_strtoint strtoll
-#endif
-#else
-#define json_strtoint strtol
-#endif
-#endif
+static void lex_scan_string(lex_t *lex, json_error_t *error) {
+    int c;
+    int i;
+
+    lex->value.string.val = NULL;
+    lex->token = TOKEN_INVALID;
+
+    c = lex_get_save(lex, error);
+
+    while (c != '"') {
+        if (c == STREAM_STATE_ERROR)
+            goto out;
+
+        else if (c == STREAM_STATE_EOF) {
+            error_set(error, lex, json_error_premature_end_of_input,
+                      "premature end of input");
+            goto out;
+        }
+
+        else if (0 <= c && c <= 0x1F) {
+            /* control character */
+            lex_unget_unsave(lex, c);
+            if (c == '\n')
+                error_set(error, lex, json_error_invalid_syntax, "unexpected newline");
+            else
+                error_set(error, lex, json_error_invalid_syntax, "control character 0x%x",
+                          c);
+            goto out;
+        }
+
+        else if (c == '\\') {
+            c = lex_get_save(lex, error);
+            if (c == 'u') {
+                c = lex_get_save(lex, error);
+                for (i = 0; i < 4; i++) {
+                    if (!l_isxdigit(c)) {
+                        error_set(error, lex, json_error_invalid_syntax,
+                                  "invalid escape");
+                        goto out;
+                    }
+                    c = lex_get_save(lex, error);
+                }
+            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
+                       c == 'n' || c == 'r' || c == 't')
+                c = lex_get_save(lex, error);
+            else {
+                error_set(error, lex, json_error_invalid_syntax, "invalid escape");
+                goto out;
+            }
+        } else
+            c = lex_get_save(lex, error);
+    }
+
+    /* + 1 to skip the " */
+    lex_unescape_string(lex, strbuffer_value(&lex->saved_text) + 1,
+                        lex_string_buffer(lex, lex->saved_text.length + 1), error);
+    return;
+
+out:
+    lex_free_string(lex);
+}
 
 static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
-    const char *saved_text;
-    char *end;
     double doubleval;
 
     lex->token = TOKEN_INVALID;
@@ -498,12 +640,9 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
 
         lex_unget_unsave(lex, c);
 
-        saved_text = strbuffer_value(&lex->saved_text);
-
-        errno = 0;
-        intval = json_strtoint(saved_text, &end, 10);
-        if (errno == ERANGE) {
-            if (intval < 0)
+        if (jsonp_strtoint(strbuffer_value(&lex->saved_text), lex->saved_text.length,
+                           &intval)) {
+            if (lex->saved_text.value[0] == '-')
                 error_set(error, lex, json_error_numeric_overflow,
                           "too big negative integer");
             else
@@ -511,8 +650,6 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error) {
             goto out;
         }
 
-        assert(end == saved_text + lex->saved_text.length);
-
         lex->token = TOKEN_INTEGER;
         lex->value.integer = intval;
         return 0;
@@ -561,231 +698,426 @@ out:
     return -1;
 }
 
-static int lex_scan(lex_t *lex, json_error_t *error) {
-    int c;
+/*** in-place scanning of buffered input ***/
 
-    strbuffer_clear(&lex->saved_text);
+/* Consume len bytes of the current chunk, containing no newlines and
+   columns UTF-8 characters, as the text of the current token */
+static void lex_consume_inplace(lex_t *lex, const char *start, size_t len,
+                                size_t columns) {
+    stream_t *stream = &lex->stream;
 
-    if (lex->token == TOKEN_STRING)
-        lex_free_string(lex);
+    stream->chunk_pos += len;
+    stream->position += len;
+    stream->column += (int)columns;
 
-    do
-        c = lex_get(lex, error);
-    while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    lex->token_text = start;
+    lex->token_len = len;
+}
 
-    if (c == STREAM_STATE_EOF) {
-        lex->token = TOKEN_EOF;
-        goto out;
-    }
+static int lex_scan_string_inplace(lex_t *lex, const char *start, const char *end,
+                                   json_error_t *error) {
+    const char *p = start + 1;
+    char *t;
+    size_t extra = 0;
+    int escapes = 0;
 
-    if (c == STREAM_STATE_ERROR) {
-        lex->token = TOKEN_INVALID;
-        goto out;
-    }
+    while (1) {
+        unsigned char c;
 
-    lex_save(lex, c);
+        p += scan_plain(p, end - p);
+        if (p == end) {
+            /* Continues in the next chunk, or premature end of input */
+            return 0;
+        }
 
-    if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
-        lex->token = c;
+        c = (unsigned char)*p;
+        if (c == '"')
+            break;
 
-    else if (c == '"')
-        lex_scan_string(lex, error);
+        if (c <= 0x1F) {
+            /* control character, reported by the regular scanner */
+            return 0;
+        }
 
-    else if (l_isdigit(c) || c == '-') {
-        if (lex_scan_number(lex, c, error))
-            goto out;
-    }
+        if (c == '\\') {
+            if (end - p < 2)
+                return 0;
 
-    else if (l_isalpha(c)) {
-        /* eat up the whole identifier for clearer error messages */
-        const char *saved_text;
+            c = (unsigned char)p[1];
+            if (c == 'u') {
+                int i;
+                if (end - p < 6)
+                    return 0;
+                for (i = 2; i < 6; i++) {
+                    if (!l_isxdigit(p[i]))
+                        return 0;
+                }
+                p += 6;
+            } else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
+                       c == 'n' || c == 'r' || c == 't')
+                p += 2;
+            else
+                return 0;
+
+            escapes = 1;
+        } else if (c >= 0x80) {
+            const char *lim = p + stream_utf8_run(&lex->stream, p - lex->stream.chunk);
+            if (p == lim)
+                return 0;
+
+            /* A run of non-ASCII bytes in a valid range ends on a
+               sequence boundary */
+            while (p < lim && (unsigned char)*p >= 0x80) {
+                if (((unsigned char)*p & 0xC0) == 0x80)
+                    extra++;
+                p++;
+            }
+        } else
+            p++;
+    }
 
-        do
-            c = lex_get_save(lex, error);
-        while (l_isalpha(c));
-        lex_unget_unsave(lex, c);
+    /* include the closing quote */
+    p++;
+    lex_consume_inplace(lex, start, p - start, (p - start) - extra);
 
-        saved_text = strbuffer_value(&lex->saved_text);
+    lex->token = TOKEN_INVALID;
+    lex->value.string.val = NULL;
 
-        if (strcmp(saved_text, "true") == 0)
-            lex->token = TOKEN_TRUE;
-        else if (strcmp(saved_text, "false") == 0)
-            lex->token = TOKEN_FALSE;
-        else if (strcmp(saved_text, "null") == 0)
-            lex->token = TOKEN_NULL;
-        else
-            lex->token = TOKEN_INVALID;
-    }
+    if (lex->insitu && (size_t)(p - start - 2) > JSON_STRING_INLINE_MAX) {
+        /* Decode over the source, the closing quote leaves room for
+           the terminator */
+        t = (char *)start + 1;
+    } else
+        t = lex_string_buffer(lex, p - start + 1);
 
-    else {
-        /* save the rest of the input UTF-8 sequence to get an error
-           message of valid UTF-8 */
-        lex_save_cached(lex);
-        lex->token = TOKEN_INVALID;
-    }
+    if (escapes) {
+        lex_unescape_string(lex, start + 1, t, error);
+    } else {
+        size_t len = p - start - 2;
+        if (!t)
+            return 1;
 
-out:
-    return lex->token;
-}
+        if (t != start + 1)
+            memcpy(t, start + 1, len);
+        t[len] = '\0';
 
-static char *lex_steal_string(lex_t *lex, size_t *out_len) {
-    char *result = NULL;
-    if (lex->token == TOKEN_STRING) {
-        result = lex->value.string.val;
-        *out_len = lex->value.string.len;
-        lex->value.string.val = NULL;
-        lex->value.string.len = 0;
+        lex->value.string.val = t;
+        lex->value.string.len = len;
+        lex->token = TOKEN_STRING;
     }
-    return result;
-}
-
-static int lex_init(lex_t *lex, get_func get, size_t flags, void *data) {
-    stream_init(&lex->stream, get, data);
-    if (strbuffer_init(&lex->saved_text))
-        return -1;
-
-    lex->flags = flags;
-    lex->token = TOKEN_INVALID;
-    return 0;
-}
 
-static void lex_close(lex_t *lex) {
-    if (lex->token == TOKEN_STRING)
-        lex_free_string(lex);
-    strbuffer_close(&lex->saved_text);
+    return 1;
 }
 
-/*** parser ***/
+static int lex_scan_number_inplace(lex_t *lex, const char *start, const char *end,
+                                   json_error_t *error) {
+    const char *p = start;
+    int is_real = (lex->flags & JSON_DECODE_INT_AS_REAL) ? 1 : 0;
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error);
+    if (*p == '-')
+        p++;
 
-static json_t *parse_object(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *object = json_object();
-    if (!object)
-        return NULL;
+    if (p == end || !l_isdigit(*p))
+        return 0;
 
-    lex_scan(lex, error);
-    if (lex->token == '}')
-        return object;
+    if (*p == '0')
+        p++;
+    else {
+        while (p < end && l_isdigit(*p))
+            p++;
+    }
 
-    while (1) {
-        char *key;
-        size_t len;
-        json_t *value;
+    if (p < end && *p == '.') {
+        p++;
+        if (p == end || !l_isdigit(*p))
+            return 0;
+        while (p < end && l_isdigit(*p))
+            p++;
+        is_real = 1;
+    }
 
-        if (lex->token != TOKEN_STRING) {
-            error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
-            goto error;
-        }
+    if (p < end && (*p == 'E' || *p == 'e')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == end || !l_isdigit(*p))
+            return 0;
+        while (p < end && l_isdigit(*p))
+            p++;
+        is_real = 1;
+    }
 
-        key = lex_steal_string(lex, &len);
-        if (!key)
-            return NULL;
-        if (memchr(key, '\0', len)) {
-            jsonp_free(key);
-            error_set(error, lex, json_error_null_byte_in_key,
-                      "NUL byte in object key not supported");
-            goto error;
-        }
+    if (p == end && !stream_chunk_is_last(&lex->stream)) {
+        /* The number may continue in the next chunk */
+        return 0;
+    }
 
-        if (flags & JSON_REJECT_DUPLICATES) {
-            if (json_object_getn(object, key, len)) {
-                jsonp_free(key);
-                error_set(error, lex, json_error_duplicate_key, "duplicate object key");
-                goto error;
-            }
-        }
+    if (p < end && (l_isdigit(*p) || (unsigned char)*p >= 0x80)) {
+        /* Digits after a leading zero, or an invalid UTF-8 byte that
+           the regular scanner reports before the number */
+        return 0;
+    }
 
-        lex_scan(lex, error);
-        if (lex->token != ':') {
-            jsonp_free(key);
-            error_set(error, lex, json_error_invalid_syntax, "':' expected");
-            goto error;
+    if (!is_real) {
+        lex_consume_inplace(lex, start, p - start, p - start);
+        if (jsonp_strtoint(start, p - start, &lex->value.integer)) {
+            lex->token = TOKEN_INVALID;
+            if (*start == '-')
+                error_set(error, lex, json_error_numeric_overflow,
+                          "too big negative integer");
+            else
+                error_set(error, lex, json_error_numeric_overflow, "too big integer");
+            return 1;
         }
+        lex->token = TOKEN_INTEGER;
+        return 1;
+    }
 
-        lex_scan(lex, error);
-        value = parse_value(lex, flags, error);
-        if (!value) {
-            jsonp_free(key);
-            goto error;
-        }
+    lex_consume_inplace(lex, start, p - start, p - start);
+    lex->token = TOKEN_INVALID;
 
-        if (json_object_setn_new_nocheck(object, key, len, value)) {
-            jsonp_free(key);
-            goto error;
-        }
+    /* jsonp_strtod() needs the number in a NUL terminated buffer */
+    lex->token_text = NULL;
+    if (strbuffer_append_bytes(&lex->saved_text, start, p - start))
+        return 1;
+
+    if (jsonp_strtod(&lex->saved_text, &lex->value.real)) {
+        error_set(error, lex, json_error_numeric_overflow, "real number overflow");
+        return 1;
+    }
 
-        jsonp_free(key);
+    lex->token = TOKEN_REAL;
+    return 1;
+}
 
-        lex_scan(lex, error);
-        if (lex->token != ',')
+/* Scan the next token directly from the current chunk without copying
+   it to saved_text. Return 1 if the token was scanned, or 0 if the
+   regular scanner has to be used, e.g. because the token continues past
+   the chunk or it's invalid and an error has to be reported. */
+static int lex_scan_inplace(lex_t *lex, json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    const char *p, *end;
+
+    if (stream->state != STREAM_STATE_OK || stream->buffer[stream->buffer_pos] != '\0')
+        return 0;
+
+    p = stream->chunk + stream->chunk_pos;
+    end = stream->chunk + stream->chunk_len;
+
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == '\r')
+            stream->column++;
+        else if (*p == '\n') {
+            stream->line++;
+            stream->last_column = stream->column;
+            stream->column = 0;
+        } else
             break;
 
-        lex_scan(lex, error);
+        stream->position++;
+        p++;
     }
+    stream->chunk_pos = p - stream->chunk;
 
-    if (lex->token != '}') {
-        error_set(error, lex, json_error_invalid_syntax, "'}' expected");
-        goto error;
-    }
+    if (p == end)
+        return 0;
 
-    return object;
+    switch (*p) {
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            lex_consume_inplace(lex, p, 1, 1);
+            lex->token = *p;
+            return 1;
+
+        case '"':
+            return lex_scan_string_inplace(lex, p, end, error);
+
+        case 't':
+        case 'f':
+        case 'n': {
+            const char *q = p;
+            size_t len;
 
-error:
-    json_decref(object);
-    return NULL;
+            while (q < end && l_isalpha(*q))
+                q++;
+            if (q == end ? !stream_chunk_is_last(stream) : (unsigned char)*q >= 0x80)
+                return 0;
+
+            len = q - p;
+            if (len == 4 && memcmp(p, "true", 4) == 0)
+                lex->token = TOKEN_TRUE;
+            else if (len == 5 && memcmp(p, "false", 5) == 0)
+                lex->token = TOKEN_FALSE;
+            else if (len == 4 && memcmp(p, "null", 4) == 0)
+                lex->token = TOKEN_NULL;
+            else
+                return 0;
+
+            lex_consume_inplace(lex, p, len, len);
+            return 1;
+        }
+
+        default:
+            if (l_isdigit(*p) || *p == '-')
+                return lex_scan_number_inplace(lex, p, end, error);
+            return 0;
+    }
 }
 
-static json_t *parse_array(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *array = json_array();
-    if (!array)
-        return NULL;
+static int lex_scan(lex_t *lex, json_error_t *error) {
+    int c;
 
-    lex_scan(lex, error);
-    if (lex->token == ']')
-        return array;
+    strbuffer_clear(&lex->saved_text);
+    lex->token_text = NULL;
 
-    while (lex->token) {
-        json_t *elem = parse_value(lex, flags, error);
-        if (!elem)
-            goto error;
+    if (lex->token == TOKEN_STRING)
+        lex_free_string(lex);
 
-        if (json_array_append_new(array, elem)) {
-            goto error;
-        }
+    if (lex_scan_inplace(lex, error))
+        return lex->token;
 
-        lex_scan(lex, error);
-        if (lex->token != ',')
-            break;
+    do
+        c = lex_get(lex, error);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
 
-        lex_scan(lex, error);
+    if (c == STREAM_STATE_EOF) {
+        lex->token = TOKEN_EOF;
+        goto out;
     }
 
-    if (lex->token != ']') {
-        error_set(error, lex, json_error_invalid_syntax, "']' expected");
-        goto error;
+    if (c == STREAM_STATE_ERROR) {
+        lex->token = TOKEN_INVALID;
+        goto out;
     }
 
-    return array;
+    lex_save(lex, c);
 
-error:
-    json_decref(array);
-    return NULL;
+    if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
+        lex->token = c;
+
+    else if (c == '"')
+        lex_scan_string(lex, error);
+
+    else if (l_isdigit(c) || c == '-') {
+        if (lex_scan_number(lex, c, error))
+            goto out;
+    }
+
+    else if (l_isalpha(c)) {
+        /* eat up the whole identifier for clearer error messages */
+        const char *saved_text;
+
+        do
+            c = lex_get_save(lex, error);
+        while (l_isalpha(c));
+        lex_unget_unsave(lex, c);
+
+        saved_text = strbuffer_value(&lex->saved_text);
+
+        if (strcmp(saved_text, "true") == 0)
+            lex->token = TOKEN_TRUE;
+        else if (strcmp(saved_text, "false") == 0)
+            lex->token = TOKEN_FALSE;
+        else if (strcmp(saved_text, "null") == 0)
+            lex->token = TOKEN_NULL;
+        else
+            lex->token = TOKEN_INVALID;
+    }
+
+    else {
+        /* save the rest of the input UTF-8 sequence to get an error
+           message of valid UTF-8 */
+        lex_save_cached(lex);
+        lex->token = TOKEN_INVALID;
+    }
+
+out:
+    return lex->token;
 }
 
-static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *json;
+static char *lex_steal_string(lex_t *lex, size_t *out_len) {
+    char *result = NULL;
+    if (lex->token == TOKEN_STRING) {
+        result = lex->value.string.val;
+        *out_len = lex->value.string.len;
+        lex->value.string.val = NULL;
+        lex->value.string.len = 0;
+    }
+    return result;
+}
 
-    lex->depth++;
-    if (lex->depth > JSON_PARSER_MAX_DEPTH) {
-        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
-        return NULL;
+static int lex_init(lex_t *lex, get_func get, fill_func fill, size_t flags, void *data) {
+    if (stream_init(&lex->stream, get, fill, data))
+        return -1;
+    if (strbuffer_init(&lex->saved_text)) {
+        stream_close(&lex->stream);
+        return -1;
     }
 
+    lex->token_text = NULL;
+    lex->token_len = 0;
+    lex->arena = NULL;
+    lex->insitu = 0;
+    lex->member = 0;
+    memset(lex->sizes, 0, sizeof(lex->sizes));
+    lex->flags = flags;
+    lex->token = TOKEN_INVALID;
+    return 0;
+}
+
+/* Prepare the lexer of a json_parser_t for the next input of
+   json_parser_loadb(), keeping its buffers and caches */
+static void lex_reset(lex_t *lex) {
+    stream_t *stream = &lex->stream;
+
+    stream->buffer[0] = '\0';
+    stream->buffer_pos = 0;
+    stream->state = STREAM_STATE_OK;
+    stream->line = 1;
+    stream->column = 0;
+    stream->last_column = 0;
+    stream->position = 0;
+
+    strbuffer_clear(&lex->saved_text);
+    lex->token_text = NULL;
+    lex->token_len = 0;
+    lex->member = 0;
+    lex->token = TOKEN_INVALID;
+}
+
+static void lex_close(lex_t *lex) {
+    if (lex->token == TOKEN_STRING)
+        lex_free_string(lex);
+    strbuffer_close(&lex->saved_text);
+    stream_close(&lex->stream);
+}
+
+/*** parser ***/
+
+/* Containers at the same depth and position, like the elements of an
+   array of records or the same member of each record, often have
+   similar sizes. Return where the size of the container that starts at
+   the current token is remembered. */
+static size_t *lex_size_hint(lex_t *lex) {
+    return &lex->sizes[(lex->depth * 31 + lex->member) & (SIZE_CACHE_SIZE - 1)];
+}
+
+static void lex_free_key(lex_t *lex, char *key, const char *key_buf) {
+    if (key != key_buf)
+        lex_free(lex, key);
+}
+
+/* Build the value of a scalar token, or report an invalid token */
+static json_t *parse_scalar(lex_t *lex, size_t flags, json_error_t *error) {
     switch (lex->token) {
         case TOKEN_STRING: {
             const char *value = lex->value.string.val;
             size_t len = lex->value.string.len;
+            json_t *json;
 
             if (!(flags & JSON_ALLOW_NUL)) {
                 if (memchr(value, '\0', len)) {
@@ -795,41 +1127,36 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
                 }
             }
 
-            json = jsonp_stringn_nocheck_own(value, len);
+            if (len == 0 && (flags & JSON_SHARE_VALUES)) {
+                lex_free_string(lex);
+                json = jsonp_shared_empty_string();
+            } else if (value == lex->small)
+                json = jsonp_stringn(lex->arena, value, len);
+            else if (lex_is_insitu(lex, value))
+                json = jsonp_stringn_borrow(lex->arena, value, len);
+            else
+                json = jsonp_stringn_own(lex->arena, value, len);
             lex->value.string.val = NULL;
             lex->value.string.len = 0;
-            break;
+            return json;
         }
 
-        case TOKEN_INTEGER: {
-            json = json_integer(lex->value.integer);
-            break;
-        }
+        case TOKEN_INTEGER:
+            if (flags & JSON_SHARE_VALUES)
+                return jsonp_shared_integer(lex->arena, lex->value.integer);
+            return jsonp_integer(lex->arena, lex->value.integer);
 
-        case TOKEN_REAL: {
-            json = json_real(lex->value.real);
-            break;
-        }
+        case TOKEN_REAL:
+            return jsonp_real(lex->arena, lex->value.real);
 
         case TOKEN_TRUE:
-            json = json_true();
-            break;
+            return json_true();
 
         case TOKEN_FALSE:
-            json = json_false();
-            break;
+            return json_false();
 
         case TOKEN_NULL:
-            json = json_null();
-            break;
-
-        case '{':
-            json = parse_object(lex, flags, error);
-            break;
-
-        case '[':
-            json = parse_array(lex, flags, error);
-            break;
+            return json_null();
 
         case TOKEN_INVALID:
             error_set(error, lex, json_error_invalid_syntax, "invalid token");
@@ -839,268 +1166,3196 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
             error_set(error, lex, json_error_invalid_syntax, "unexpected token");
             return NULL;
     }
+}
 
-    if (!json)
-        return NULL;
-
-    lex->depth--;
-    return json;
+/* The nesting limit set with JSON_MAX_DEPTH(), or the default one */
+static size_t parse_max_depth(size_t flags) {
+    size_t depth = (flags >> 16) & 0xFFFF;
+    return depth ? depth : JSON_PARSER_MAX_DEPTH;
 }
 
-static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
-    json_t *result;
+/* A container that parse_value() is decoding */
+struct parse_frame {
+    json_t *container;
+    /* Where the size of the container is remembered, see lex_size_hint() */
+    size_t *hint;
+    /* Number of members or elements so far */
+    size_t index;
+    /* Key of the member whose value is being decoded, or NULL */
+    char *key;
+    size_t key_len;
+    char key_buf[JSON_STRING_INLINE_MAX + 1];
+};
+
+/* Frames kept in parse_value()'s own stack frame before allocating */
+#define PARSE_INLINE_FRAMES 8
 
-    lex->depth = 0;
+typedef struct {
+    struct parse_frame *frames;
+    size_t depth;
+    size_t size;
+    struct parse_frame inline_frames[PARSE_INLINE_FRAMES];
+} parse_stack_t;
 
-    lex_scan(lex, error);
-    if (!(flags & JSON_DECODE_ANY)) {
-        if (lex->token != '[' && lex->token != '{') {
-            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
-            return NULL;
-        }
-    }
+static struct parse_frame *parse_push(parse_stack_t *stack, json_t *container,
+                                      size_t *hint) {
+    struct parse_frame *frame;
 
-    result = parse_value(lex, flags, error);
-    if (!result)
-        return NULL;
+    if (stack->depth == stack->size) {
+        struct parse_frame *new_frames;
+        size_t i;
 
-    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
-        lex_scan(lex, error);
-        if (lex->token != TOKEN_EOF) {
-            error_set(error, lex, json_error_end_of_input_expected,
-                      "end of file expected");
-            json_decref(result);
+        new_frames = jsonp_malloc_as(stack->size * 2 * sizeof(struct parse_frame),
+                                     json_memory_parser);
+        if (!new_frames)
             return NULL;
+        memcpy(new_frames, stack->frames, stack->depth * sizeof(struct parse_frame));
+
+        /* Short keys point into the frame */
+        for (i = 0; i < stack->depth; i++) {
+            if (stack->frames[i].key == stack->frames[i].key_buf)
+                new_frames[i].key = new_frames[i].key_buf;
         }
-    }
 
-    if (error) {
-        /* Save the position even though there was no error */
-        error->position = (int)lex->stream.position;
+        if (stack->frames != stack->inline_frames)
+            jsonp_free(stack->frames);
+        stack->frames = new_frames;
+        stack->size *= 2;
     }
 
-    return result;
+    frame = &stack->frames[stack->depth++];
+    frame->container = container;
+    frame->hint = hint;
+    frame->index = 0;
+    frame->key = NULL;
+    return frame;
 }
 
-typedef struct {
-    const char *data;
-    size_t pos;
-} string_data_t;
+/* Decode the value that starts at the current token. Nested containers
+   are kept on an explicit stack instead of recursing, so the depth of
+   the input doesn't affect the C stack. */
+static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error) {
+    parse_stack_t stack;
+    struct parse_frame *frame;
+    size_t max_depth = parse_max_depth(flags), *hint;
+    json_t *value;
+    char *key;
+    size_t len;
+    int res;
 
-static int string_get(void *data) {
-    char c;
-    string_data_t *stream = (string_data_t *)data;
-    c = stream->data[stream->pos];
-    if (c == '\0')
-        return EOF;
-    else {
-        stream->pos++;
-        return (unsigned char)c;
+    stack.frames = stack.inline_frames;
+    stack.depth = 0;
+    stack.size = PARSE_INLINE_FRAMES;
+
+value:
+    lex->depth++;
+    if (lex->depth > max_depth) {
+        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+        goto error;
     }
-}
 
-json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
-    lex_t lex;
-    json_t *result;
-    string_data_t stream_data;
+    if (lex->token == '{') {
+        hint = lex_size_hint(lex);
+        value = jsonp_object(lex->arena);
+        if (!value)
+            goto error;
 
-    jsonp_error_init(error, "<string>");
+        lex_scan(lex, error);
+        if (lex->token == '}') {
+            *hint = 0;
+            goto done;
+        }
+
+        if (!parse_push(&stack, value, hint)) {
+            json_decref(value);
+            error_set(error, lex, json_error_out_of_memory, "out of memory");
+            goto error;
+        }
+        if (*hint && json_object_reserve(value, min(*hint, SIZE_HINT_MAX)))
+            goto error;
+        goto key;
+    }
+
+    if (lex->token == '[') {
+        hint = lex_size_hint(lex);
+        value = jsonp_array_sized(lex->arena, *hint ? min(*hint, SIZE_HINT_MAX) : 8);
+        if (!value)
+            goto error;
+
+        lex_scan(lex, error);
+        if (lex->token == ']') {
+            *hint = 0;
+            goto done;
+        }
+
+        if (!parse_push(&stack, value, hint)) {
+            json_decref(value);
+            error_set(error, lex, json_error_out_of_memory, "out of memory");
+            goto error;
+        }
+        goto element;
+    }
+
+    value = parse_scalar(lex, flags, error);
+    if (!value)
+        goto error;
+
+done:
+    /* value is complete, add it to the innermost container */
+    lex->depth--;
+    if (stack.depth == 0) {
+        if (stack.frames != stack.inline_frames)
+            jsonp_free(stack.frames);
+        return value;
+    }
+    frame = &stack.frames[stack.depth - 1];
+
+    if (json_is_object(frame->container)) {
+        res = json_object_setn_new_nocheck(frame->container, frame->key, frame->key_len,
+                                           value);
+
+        lex_free_key(lex, frame->key, frame->key_buf);
+        frame->key = NULL;
+        if (res)
+            goto error;
+        frame->index++;
+
+        lex_scan(lex, error);
+        if (lex->token == ',') {
+            lex_scan(lex, error);
+            goto key;
+        }
+        if (lex->token != '}') {
+            error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+            goto error;
+        }
+    } else {
+        if (json_array_append_new(frame->container, value))
+            goto error;
+        frame->index++;
+
+        lex_scan(lex, error);
+        if (lex->token == ',') {
+            lex_scan(lex, error);
+            goto element;
+        }
+        if (lex->token != ']') {
+            error_set(error, lex, json_error_invalid_syntax, "']' expected");
+            goto error;
+        }
+    }
+
+    /* The container is complete */
+    *frame->hint = frame->index;
+    value = frame->container;
+    stack.depth--;
+    goto done;
+
+element:
+    if (lex->token == TOKEN_EOF) {
+        error_set(error, lex, json_error_invalid_syntax, "']' expected");
+        goto error;
+    }
+    lex->member = 0;
+    goto value;
+
+key:
+    frame = &stack.frames[stack.depth - 1];
+    if (lex->token != TOKEN_STRING) {
+        error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+        goto error;
+    }
+
+    key = lex_steal_string(lex, &len);
+    if (key == lex->small) {
+        /* the next string token reuses the buffer */
+        memcpy(frame->key_buf, key, len + 1);
+        key = frame->key_buf;
+    }
+    frame->key = key;
+    frame->key_len = len;
+
+    if (memchr(key, '\0', len)) {
+        error_set(error, lex, json_error_null_byte_in_key,
+                  "NUL byte in object key not supported");
+        goto error;
+    }
+
+    if (flags & JSON_REJECT_DUPLICATES) {
+        if (json_object_getn(frame->container, key, len)) {
+            error_set(error, lex, json_error_duplicate_key, "duplicate object key");
+            goto error;
+        }
+    }
+
+    lex_scan(lex, error);
+    if (lex->token != ':') {
+        error_set(error, lex, json_error_invalid_syntax, "':' expected");
+        goto error;
+    }
+
+    lex_scan(lex, error);
+    lex->member = frame->index;
+    goto value;
+
+error:
+    while (stack.depth) {
+        frame = &stack.frames[--stack.depth];
+        if (frame->key)
+            lex_free_key(lex, frame->key, frame->key_buf);
+        json_decref(frame->container);
+    }
+    if (stack.frames != stack.inline_frames)
+        jsonp_free(stack.frames);
+    return NULL;
+}
+
+static json_t *parse_json(lex_t *lex, size_t flags, json_error_t *error) {
+    json_t *result;
+
+    lex->depth = 0;
+
+    lex_scan(lex, error);
+    if (!(flags & JSON_DECODE_ANY)) {
+        if (lex->token != '[' && lex->token != '{') {
+            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+            return NULL;
+        }
+    }
+
+    result = parse_value(lex, flags, error);
+    if (!result)
+        return NULL;
+
+    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            json_decref(result);
+            return NULL;
+        }
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)lex->stream.position;
+    }
+
+    return result;
+}
+
+/*** event parser ***/
+
+/* These decode like parse_value(), but pass each value to the handler
+   instead of building a tree. The only state kept besides the lexer's
+   is the kind of each open container, so memory use doesn't depend on
+   the size of the input, and the C stack not on its depth. */
+
+/* Container kinds kept in sax_parse_value()'s own stack frame before
+   allocating */
+#define SAX_INLINE_DEPTH 64
+
+typedef struct {
+    char *kinds; /* '{' or '[' for each open container */
+    size_t depth;
+    size_t size;
+    char inline_kinds[SAX_INLINE_DEPTH];
+} sax_stack_t;
+
+static int sax_push(sax_stack_t *stack, char kind) {
+    char *new_kinds;
+
+    if (stack->depth == stack->size) {
+        new_kinds = jsonp_malloc_as(stack->size * 2, json_memory_parser);
+        if (!new_kinds)
+            return -1;
+        memcpy(new_kinds, stack->kinds, stack->depth);
+
+        if (stack->kinds != stack->inline_kinds)
+            jsonp_free(stack->kinds);
+        stack->kinds = new_kinds;
+        stack->size *= 2;
+    }
+
+    stack->kinds[stack->depth++] = kind;
+    return 0;
+}
+
+static int sax_abort(lex_t *lex, json_error_t *error) {
+    error_set(error, lex, json_error_aborted, "aborted by handler");
+    return -1;
+}
+
+static int sax_parse_value(lex_t *lex, const json_sax_handler_t *handler, void *data,
+                           size_t flags, json_error_t *error) {
+    sax_stack_t stack;
+    size_t max_depth = parse_max_depth(flags);
+    int aborted, result = -1;
+    char kind;
+
+    stack.kinds = stack.inline_kinds;
+    stack.depth = 0;
+    stack.size = SAX_INLINE_DEPTH;
+
+value:
+    aborted = 0;
+    lex->depth++;
+    if (lex->depth > max_depth) {
+        error_set(error, lex, json_error_stack_overflow, "maximum parsing depth reached");
+        goto out;
+    }
+
+    switch (lex->token) {
+        case TOKEN_STRING: {
+            const char *value = lex->value.string.val;
+            size_t len = lex->value.string.len;
+
+            if (!(flags & JSON_ALLOW_NUL)) {
+                if (memchr(value, '\0', len)) {
+                    error_set(error, lex, json_error_null_character,
+                              "\\u0000 is not allowed without JSON_ALLOW_NUL");
+                    goto out;
+                }
+            }
+
+            if (handler->string)
+                aborted = handler->string(value, len, data);
+            break;
+        }
+
+        case TOKEN_INTEGER:
+            if (handler->integer)
+                aborted = handler->integer(lex->value.integer, data);
+            break;
+
+        case TOKEN_REAL:
+            if (handler->real)
+                aborted = handler->real(lex->value.real, data);
+            break;
+
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+            if (handler->boolean)
+                aborted = handler->boolean(lex->token == TOKEN_TRUE, data);
+            break;
+
+        case TOKEN_NULL:
+            if (handler->null)
+                aborted = handler->null(data);
+            break;
+
+        case '{':
+        case '[':
+            kind = (char)lex->token;
+            if (kind == '{' ? handler->start_object && handler->start_object(data)
+                            : handler->start_array && handler->start_array(data))
+                goto abort;
+            if (sax_push(&stack, kind)) {
+                error_set(error, lex, json_error_out_of_memory, "out of memory");
+                goto out;
+            }
+
+            lex_scan(lex, error);
+            if (lex->token == (kind == '{' ? '}' : ']'))
+                goto end;
+            if (kind == '{')
+                goto key;
+            goto element;
+
+        case TOKEN_INVALID:
+            error_set(error, lex, json_error_invalid_syntax, "invalid token");
+            goto out;
+
+        default:
+            error_set(error, lex, json_error_invalid_syntax, "unexpected token");
+            goto out;
+    }
+
+    if (aborted)
+        goto abort;
+    lex->depth--;
+
+next:
+    /* The value is complete, continue with the innermost container */
+    if (stack.depth == 0) {
+        result = 0;
+        goto out;
+    }
+    kind = stack.kinds[stack.depth - 1];
+
+    lex_scan(lex, error);
+    if (lex->token == ',') {
+        lex_scan(lex, error);
+        if (kind == '{')
+            goto key;
+        goto element;
+    }
+    if (kind == '{' && lex->token != '}') {
+        error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+        goto out;
+    }
+    if (kind == '[' && lex->token != ']') {
+        error_set(error, lex, json_error_invalid_syntax, "']' expected");
+        goto out;
+    }
+
+end:
+    /* The container is complete */
+    kind = stack.kinds[--stack.depth];
+    if (kind == '{' ? handler->end_object && handler->end_object(data)
+                    : handler->end_array && handler->end_array(data))
+        goto abort;
+    lex->depth--;
+    goto next;
+
+element:
+    if (lex->token == TOKEN_EOF) {
+        error_set(error, lex, json_error_invalid_syntax, "']' expected");
+        goto out;
+    }
+    goto value;
+
+key:
+    if (lex->token != TOKEN_STRING) {
+        error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+        goto out;
+    }
+
+    if (memchr(lex->value.string.val, '\0', lex->value.string.len)) {
+        error_set(error, lex, json_error_null_byte_in_key,
+                  "NUL byte in object key not supported");
+        goto out;
+    }
+
+    if (handler->key && handler->key(lex->value.string.val, lex->value.string.len, data))
+        goto abort;
+
+    lex_scan(lex, error);
+    if (lex->token != ':') {
+        error_set(error, lex, json_error_invalid_syntax, "':' expected");
+        goto out;
+    }
+
+    lex_scan(lex, error);
+    goto value;
+
+abort:
+    sax_abort(lex, error);
+out:
+    if (stack.kinds != stack.inline_kinds)
+        jsonp_free(stack.kinds);
+    return result;
+}
+
+static int sax_parse_json(lex_t *lex, const json_sax_handler_t *handler, void *data,
+                          size_t flags, json_error_t *error) {
+    lex->depth = 0;
+
+    lex_scan(lex, error);
+    if (!(flags & JSON_DECODE_ANY)) {
+        if (lex->token != '[' && lex->token != '{') {
+            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+            return -1;
+        }
+    }
+
+    if (sax_parse_value(lex, handler, data, flags, error))
+        return -1;
+
+    if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            return -1;
+        }
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)lex->stream.position;
+    }
+
+    return 0;
+}
+
+/*** push parser ***/
+
+/* The push parser keeps the containers being built on an explicit
+   stack, so it can return between any two tokens. The lexer treats the
+   end of the input buffer as the end of the input, so a token that
+   reaches it may be incomplete. The bytes from its start are kept in
+   pending and scanned again when more input arrives. */
+
+#define FRAME_ARRAY_FIRST   0 /* after '[' */
+#define FRAME_ARRAY_VALUE   1 /* after ',' */
+#define FRAME_ARRAY_NEXT    2 /* after an element */
+#define FRAME_OBJECT_FIRST  3 /* after '{' */
+#define FRAME_OBJECT_KEY    4 /* after ',' */
+#define FRAME_OBJECT_COLON  5 /* after a key */
+#define FRAME_OBJECT_VALUE  6 /* after ':' */
+#define FRAME_OBJECT_NEXT   7 /* after a member */
+
+/* What the pending input starts with */
+#define PENDING_OTHER  0
+#define PENDING_STRING 1
+#define PENDING_WORD   2
+#define PENDING_READY  3 /* follows a complete value */
+
+struct parser_frame {
+    json_t *container;
+    /* Key of the member whose value comes next */
+    char *key;
+    size_t key_len;
+    int state;
+};
+
+struct json_parser_t {
+    lex_t lex;
+    size_t flags;
+    struct parser_frame *frames;
+    size_t depth;
+    size_t size;
+    /* The value decoded last, until it's taken */
+    json_t *value;
+    /* Nonzero if the top level value has been decoded and only the end
+       of input may follow */
+    int done;
+    /* json_parser_need_more while decoding, json_parser_complete after
+       json_parser_finish() and json_parser_error after an error */
+    int status;
+    /* Set by parser_get_end() if the lexer needs the next byte after
+       the buffer */
+    int hit_end;
+    strbuffer_t pending;
+    int pending_kind;
+    /* The last pending byte is an unescaped backslash */
+    int pending_escape;
+    /* json_parser_feed() has been called, so json_parser_loadb() can't
+       be */
+    int fed;
+    json_error_t error;
+};
+
+static int parser_get_end(void *data) {
+    ((json_parser_t *)data)->hit_end = 1;
+    return EOF;
+}
+
+static void parser_set_input(json_parser_t *parser, const char *input, size_t len) {
+    stream_t *stream = &parser->lex.stream;
+
+    stream_set_buffer(stream, input, len);
+    stream->buffer[0] = '\0';
+    stream->buffer_pos = 0;
+    stream->state = STREAM_STATE_OK;
+}
+
+static int parser_error(json_parser_t *parser, enum json_error_code code,
+                        const char *msg) {
+    error_set(&parser->error, &parser->lex, code, "%s", msg);
+    parser->status = json_parser_error;
+    return -1;
+}
+
+static int parser_oom(json_parser_t *parser) {
+    error_set(&parser->error, NULL, json_error_out_of_memory, "out of memory");
+    parser->status = json_parser_error;
+    return -1;
+}
+
+static void parser_scan_escapes(json_parser_t *parser, const char *p, size_t len) {
+    const char *end = p + len;
+
+    for (; p < end; p++) {
+        if (parser->pending_escape)
+            parser->pending_escape = 0;
+        else if (*p == '\\')
+            parser->pending_escape = 1;
+    }
+}
+
+/* Keep input from offset on for the next call */
+static int parser_stash(json_parser_t *parser, const char *input, size_t len,
+                        size_t offset) {
+    strbuffer_t *pending = &parser->pending;
+    const char *p, *end;
+
+    if (input == pending->value) {
+        memmove(pending->value, pending->value + offset, len - offset);
+        pending->length = len - offset;
+        pending->value[pending->length] = '\0';
+    } else {
+        strbuffer_clear(pending);
+        if (strbuffer_append_bytes(pending, input + offset, len - offset))
+            return parser_oom(parser);
+    }
+
+    p = pending->value;
+    end = p + pending->length;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+
+    parser->pending_kind = PENDING_OTHER;
+    parser->pending_escape = 0;
+    if (p < end && *p == '"') {
+        parser->pending_kind = PENDING_STRING;
+        parser_scan_escapes(parser, p + 1, end - p - 1);
+    } else if (p < end && (l_isalpha(*p) || l_isdigit(*p) || *p == '-'))
+        parser->pending_kind = PENDING_WORD;
+    return 0;
+}
+
+/* Return nonzero if buffer may complete the pending token, so that
+   it's worth scanning it again */
+static int parser_may_complete(json_parser_t *parser, const char *buffer,
+                               size_t buflen) {
+    size_t i;
+
+    if (parser->pending_kind == PENDING_STRING) {
+        for (i = 0; i < buflen; i++) {
+            if (parser->pending_escape)
+                parser->pending_escape = 0;
+            else if (buffer[i] == '\\')
+                parser->pending_escape = 1;
+            else if (buffer[i] == '"')
+                return 1;
+        }
+        return 0;
+    }
+
+    if (parser->pending_kind == PENDING_WORD) {
+        for (i = 0; i < buflen; i++) {
+            char c = buffer[i];
+            if (!l_isalpha(c) && !l_isdigit(c) && c != '.' && c != '+' && c != '-')
+                return 1;
+        }
+        return 0;
+    }
+
+    return parser->pending_kind == PENDING_READY || buflen > 0;
+}
+
+/* Add a complete value to the innermost container. Returns 1 if it's
+   the top level value and no more input is needed. */
+static int parser_add(json_parser_t *parser, json_t *value) {
+    struct parser_frame *frame;
+    int result;
+
+    if (parser->depth == 0) {
+        json_decref(parser->value);
+        parser->value = value;
+        if (parser->flags & JSON_DISABLE_EOF_CHECK)
+            return 1;
+        parser->done = 1;
+        return 0;
+    }
+
+    frame = &parser->frames[parser->depth - 1];
+    if (frame->state == FRAME_ARRAY_FIRST || frame->state == FRAME_ARRAY_VALUE) {
+        frame->state = FRAME_ARRAY_NEXT;
+        if (json_array_append_new(frame->container, value))
+            return parser_oom(parser);
+        return 0;
+    }
+
+    result = json_object_setn_new_nocheck(frame->container, frame->key, frame->key_len,
+                                          value);
+
+    jsonp_free(frame->key);
+    frame->key = NULL;
+    frame->state = FRAME_OBJECT_NEXT;
+    if (result)
+        return parser_oom(parser);
+    return 0;
+}
+
+static int parser_push(json_parser_t *parser, json_t *container, int state) {
+    struct parser_frame *frame;
+
+    if (!container)
+        return parser_oom(parser);
+
+    if (parser->depth == parser->size) {
+        size_t new_size = parser->size ? parser->size * 2 : 16;
+        struct parser_frame *new_frames;
+
+        new_frames = jsonp_malloc_as(new_size * sizeof(struct parser_frame),
+                                     json_memory_parser);
+        if (!new_frames) {
+            json_decref(container);
+            return parser_oom(parser);
+        }
+        if (parser->frames)
+            memcpy(new_frames, parser->frames,
+                   parser->depth * sizeof(struct parser_frame));
+        jsonp_free(parser->frames);
+        parser->frames = new_frames;
+        parser->size = new_size;
+    }
+
+    frame = &parser->frames[parser->depth++];
+    frame->container = container;
+    frame->key = NULL;
+    frame->key_len = 0;
+    frame->state = state;
+    return 0;
+}
+
+/* Handle the token just scanned, with the same checks and errors as
+   parse_json(). Returns 1 if a top level value is complete, 0 if more
+   tokens are needed and -1 on error. */
+static int parser_token(json_parser_t *parser) {
+    lex_t *lex = &parser->lex;
+    size_t flags = parser->flags;
+    struct parser_frame *frame;
+    json_t *value;
+
+    if (parser->depth == 0) {
+        if (parser->done) {
+            if (lex->token == TOKEN_EOF)
+                return 1;
+            return parser_error(parser, json_error_end_of_input_expected,
+                                "end of file expected");
+        }
+        if (!(flags & JSON_DECODE_ANY) && lex->token != '[' && lex->token != '{')
+            return parser_error(parser, json_error_invalid_syntax,
+                                "'[' or '{' expected");
+        goto value;
+    }
+
+    frame = &parser->frames[parser->depth - 1];
+    switch (frame->state) {
+        case FRAME_ARRAY_FIRST:
+            if (lex->token == ']')
+                goto close;
+            /* fall through */
+        case FRAME_ARRAY_VALUE:
+            if (lex->token == TOKEN_EOF)
+                return parser_error(parser, json_error_invalid_syntax, "']' expected");
+            goto value;
+
+        case FRAME_ARRAY_NEXT:
+            if (lex->token == ',') {
+                frame->state = FRAME_ARRAY_VALUE;
+                return 0;
+            }
+            if (lex->token == ']')
+                goto close;
+            return parser_error(parser, json_error_invalid_syntax, "']' expected");
+
+        case FRAME_OBJECT_FIRST:
+            if (lex->token == '}')
+                goto close;
+            /* fall through */
+        case FRAME_OBJECT_KEY: {
+            char *key;
+            size_t len;
+
+            if (lex->token != TOKEN_STRING)
+                return parser_error(parser, json_error_invalid_syntax,
+                                    "string or '}' expected");
+
+            if (memchr(lex->value.string.val, '\0', lex->value.string.len))
+                return parser_error(parser, json_error_null_byte_in_key,
+                                    "NUL byte in object key not supported");
+
+            if ((flags & JSON_REJECT_DUPLICATES) &&
+                json_object_getn(frame->container, lex->value.string.val,
+                                 lex->value.string.len))
+                return parser_error(parser, json_error_duplicate_key,
+                                    "duplicate object key");
+
+            key = lex_steal_string(lex, &len);
+            if (key == lex->small)
+                key = jsonp_strndup_as(key, len, json_memory_parser);
+            if (!key)
+                return parser_oom(parser);
+
+            frame->key = key;
+            frame->key_len = len;
+            frame->state = FRAME_OBJECT_COLON;
+            return 0;
+        }
+
+        case FRAME_OBJECT_COLON:
+            if (lex->token != ':')
+                return parser_error(parser, json_error_invalid_syntax, "':' expected");
+            frame->state = FRAME_OBJECT_VALUE;
+            return 0;
+
+        case FRAME_OBJECT_VALUE:
+            goto value;
+
+        default: /* FRAME_OBJECT_NEXT */
+            if (lex->token == ',') {
+                frame->state = FRAME_OBJECT_KEY;
+                return 0;
+            }
+            if (lex->token == '}')
+                goto close;
+            return parser_error(parser, json_error_invalid_syntax, "'}' expected");
+    }
+
+value:
+    if (parser->depth + 1 > parse_max_depth(flags))
+        return parser_error(parser, json_error_stack_overflow,
+                            "maximum parsing depth reached");
+
+    if (lex->token == '{')
+        return parser_push(parser, jsonp_object(NULL), FRAME_OBJECT_FIRST);
+    if (lex->token == '[')
+        return parser_push(parser, jsonp_array(NULL), FRAME_ARRAY_FIRST);
+
+    value = parse_scalar(lex, flags, &parser->error);
+    if (!value) {
+        if (!parser->error.text[0])
+            return parser_oom(parser);
+        parser->status = json_parser_error;
+        return -1;
+    }
+    return parser_add(parser, value);
+
+close:
+    value = frame->container;
+    parser->depth--;
+    return parser_add(parser, value);
+}
+
+/* Scan and handle the tokens of input, stashing the rest of it if it
+   ends within a token or after a top level value */
+static int parser_run(json_parser_t *parser, const char *input, size_t len) {
+    lex_t *lex = &parser->lex;
+    stream_t *stream = &lex->stream;
+    size_t start = stream->position;
+
+    parser_set_input(parser, input, len);
+
+    while (1) {
+        size_t offset = stream->position - start;
+        int line = stream->line;
+        int column = stream->column;
+        int last_column = stream->last_column;
+        int result;
+
+        parser->hit_end = 0;
+        lex_scan(lex, &parser->error);
+
+        if (parser->hit_end) {
+            /* Nothing but whitespace is consumed on a retry */
+            parser->error.text[0] = '\0';
+            if (lex->token == TOKEN_EOF) {
+                strbuffer_clear(&parser->pending);
+                return 0;
+            }
+
+            stream->line = line;
+            stream->column = column;
+            stream->last_column = last_column;
+            stream->position = start + offset;
+            return parser_stash(parser, input, len, offset);
+        }
+
+        result = parser_token(parser);
+        if (result < 0)
+            return -1;
+        if (result > 0) {
+            parser->error.position = (int)stream->position;
+            if (parser_stash(parser, input, len, stream->position - start))
+                return -1;
+            parser->pending_kind = PENDING_READY;
+            return 1;
+        }
+    }
+}
+
+json_parser_t *json_parser_create(size_t flags) {
+    json_parser_t *parser = jsonp_malloc_as(sizeof(json_parser_t), json_memory_parser);
+    if (!parser)
+        return NULL;
+
+    if (lex_init(&parser->lex, parser_get_end, NULL, flags, parser)) {
+        jsonp_free(parser);
+        return NULL;
+    }
+    if (strbuffer_init(&parser->pending)) {
+        lex_close(&parser->lex);
+        jsonp_free(parser);
+        return NULL;
+    }
+
+    parser->flags = flags;
+    parser->frames = NULL;
+    parser->depth = 0;
+    parser->size = 0;
+    parser->value = NULL;
+    parser->done = 0;
+    parser->status = json_parser_need_more;
+    parser->pending_kind = PENDING_OTHER;
+    parser->pending_escape = 0;
+    parser->fed = 0;
+    parser->lex.stream.last_column = 0;
+    jsonp_error_init(&parser->error, "<stream>");
+    return parser;
+}
+
+void json_parser_destroy(json_parser_t *parser) {
+    size_t i;
+
+    if (!parser)
+        return;
+
+    for (i = 0; i < parser->depth; i++) {
+        json_decref(parser->frames[i].container);
+        jsonp_free(parser->frames[i].key);
+    }
+    jsonp_free(parser->frames);
+    json_decref(parser->value);
+    strbuffer_close(&parser->pending);
+    lex_close(&parser->lex);
+    jsonp_free(parser);
+}
+
+static enum json_parser_status parser_result(json_parser_t *parser, int result,
+                                             json_error_t *error) {
+    if (error)
+        *error = parser->error;
+    if (result < 0)
+        return json_parser_error;
+    return result ? json_parser_complete : json_parser_need_more;
+}
+
+/* Check the arguments and state common to json_parser_feed() and
+   json_parser_finish() */
+static int parser_check(json_parser_t *parser, int valid, json_error_t *error) {
+    if (!parser || !valid || parser->status == json_parser_complete) {
+        jsonp_error_init(error, "<stream>");
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+    if (parser->status == json_parser_error) {
+        if (error)
+            *error = parser->error;
+        return -1;
+    }
+    return 0;
+}
+
+enum json_parser_status json_parser_feed(json_parser_t *parser, const char *buffer,
+                                         size_t buflen, json_error_t *error) {
+    strbuffer_t *pending;
+    int result;
+
+    if (parser_check(parser, buffer || !buflen, error))
+        return json_parser_error;
+    if (!buffer)
+        buffer = "";
+    parser->fed = 1;
+
+    pending = &parser->pending;
+    if (pending->length) {
+        int ready = parser_may_complete(parser, buffer, buflen);
+
+        if (strbuffer_append_bytes(pending, buffer, buflen))
+            return parser_result(parser, parser_oom(parser), error);
+        if (!ready)
+            return parser_result(parser, 0, error);
+
+        result = parser_run(parser, pending->value, pending->length);
+    } else
+        result = parser_run(parser, buffer, buflen);
+
+    return parser_result(parser, result, error);
+}
+
+enum json_parser_status json_parser_finish(json_parser_t *parser, json_error_t *error) {
+    int result;
+
+    if (parser_check(parser, 1, error))
+        return json_parser_error;
+
+    /* The end of the buffer is now the end of input */
+    parser->lex.stream.get = NULL;
+    result = parser_run(parser, parser->pending.value, parser->pending.length);
+    if (result > 0)
+        parser->status = json_parser_complete;
+
+    return parser_result(parser, result, error);
+}
+
+/* Decode a whole document with the lexer of the parser, whose buffers
+   and key cache stay allocated for the next one */
+json_t *json_parser_loadb(json_parser_t *parser, const char *buffer, size_t buflen,
+                          json_error_t *error) {
+    lex_t *lex;
+    get_func get;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (!parser || !buffer || parser->fed) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    lex = &parser->lex;
+    lex_reset(lex);
+    stream_set_buffer(&lex->stream, buffer, buflen);
+
+    /* The end of the buffer is the end of input */
+    get = lex->stream.get;
+    lex->stream.get = NULL;
+    result = parse_json(lex, parser->flags, error);
+    lex->stream.get = get;
+
+    if (lex->token == TOKEN_STRING)
+        lex_free_string(lex);
+    lex->token = TOKEN_INVALID;
+    return result;
+}
+
+json_t *json_parser_value(json_parser_t *parser) {
+    json_t *value;
+
+    if (!parser)
+        return NULL;
+
+    value = parser->value;
+    parser->value = NULL;
+    return value;
+}
+
+json_t *json_loads(const char *string, size_t flags, json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<string>");
 
     if (string == NULL) {
         error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
         return NULL;
     }
 
-    stream_data.data = string;
-    stream_data.pos = 0;
+    if (lex_init(&lex, NULL, NULL, flags, NULL))
+        return NULL;
+    stream_set_buffer(&lex.stream, string, strlen(string));
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, NULL, NULL, flags, NULL))
+        return NULL;
+    stream_set_buffer(&lex.stream, buffer, buflen);
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+json_t *json_loadb_arena(json_arena_t *arena, const char *buffer, size_t buflen,
+                         size_t flags, json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (arena == NULL || buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, NULL, NULL, flags, NULL))
+        return NULL;
+    stream_set_buffer(&lex.stream, buffer, buflen);
+    lex.arena = arena;
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+json_t *json_loadb_insitu(json_arena_t *arena, char *buffer, size_t buflen, size_t flags,
+                          json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, NULL, NULL, flags, NULL))
+        return NULL;
+    stream_set_buffer(&lex.stream, buffer, buflen);
+    lex.arena = arena;
+    lex.insitu = 1;
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+static size_t file_fill_func(void *buffer, size_t buflen, void *data) {
+    size_t len = fread(buffer, 1, buflen, (FILE *)data);
+    if (len == 0 && ferror((FILE *)data))
+        return (size_t)-1;
+    return len;
+}
+
+json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    json_t *result;
+
+    if (input == stdin)
+        source = "<stdin>";
+    else
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    /* Reading ahead would consume input that follows the JSON text,
+       so only read in chunks if the whole stream is parsed */
+    if (flags & JSON_DISABLE_EOF_CHECK) {
+        if (lex_init(&lex, (get_func)fgetc, NULL, flags, input))
+            return NULL;
+    } else {
+        if (lex_init(&lex, NULL, file_fill_func, flags, input))
+            return NULL;
+    }
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+static int fd_get_func(int *fd) {
+#ifdef HAVE_UNISTD_H
+    uint8_t c;
+    if (read(*fd, &c, 1) == 1)
+        return c;
+#endif
+    return EOF;
+}
+
+static size_t fd_fill_func(void *buffer, size_t buflen, void *data) {
+#ifdef HAVE_UNISTD_H
+    ssize_t len;
+
+    do
+        len = read(*(int *)data, buffer, buflen);
+    while (len < 0 && errno == EINTR);
+
+    if (len >= 0)
+        return (size_t)len;
+#else
+    (void)buffer;
+    (void)buflen;
+    (void)data;
+#endif
+    return (size_t)-1;
+}
+
+json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    json_t *result;
+
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+    else
+#endif
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input < 0) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    /* See json_loadf() */
+    if (flags & JSON_DISABLE_EOF_CHECK) {
+        if (lex_init(&lex, (get_func)fd_get_func, NULL, flags, &input))
+            return NULL;
+    } else {
+        if (lex_init(&lex, NULL, fd_fill_func, flags, &input))
+            return NULL;
+    }
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+#ifdef USE_MMAP
+/* Decode a regular file from a read-only mapping, as a single buffer.
+   Returns 0 without touching *result if the file can't be mapped, and
+   it has to be read as a stream instead. */
+static int load_mapped(FILE *fp, size_t flags, json_t **result, json_error_t *error) {
+    struct stat st;
+    size_t length;
+    void *map;
+    lex_t lex;
+
+    if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (unsigned long long)st.st_size > (size_t)-1)
+        return 0;
+    length = (size_t)st.st_size;
+
+    map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map == MAP_FAILED)
+        return 0;
+#ifdef HAVE_POSIX_MADVISE
+    /* Let the kernel read ahead more aggressively, and drop the pages
+       behind the lexer sooner */
+    posix_madvise(map, length, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    *result = NULL;
+    if (!lex_init(&lex, NULL, NULL, flags, NULL)) {
+        stream_set_buffer(&lex.stream, map, length);
+        *result = parse_json(&lex, flags, error);
+        lex_close(&lex);
+    }
+
+    munmap(map, length);
+    return 1;
+}
+#endif
+
+json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
+    json_t *result;
+    FILE *fp;
+
+    jsonp_error_init(error, path);
+
+    if (path == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
+                  strerror(errno));
+        return NULL;
+    }
+
+#ifdef USE_MMAP
+    if (load_mapped(fp, flags, &result, error)) {
+        fclose(fp);
+        return result;
+    }
+#endif
+
+    result = json_loadf(fp, flags, error);
+    if (error)
+        jsonp_error_set_source(error, path);
+
+    fclose(fp);
+    return result;
+}
+
+json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags,
+                           json_error_t *error) {
+    lex_t lex;
+    json_t *result;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (lex_init(&lex, NULL, callback, flags, arg))
+        return NULL;
+
+    result = parse_json(&lex, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+/* The values and the temporary memory of these come from allocator */
+json_t *json_loads_ex(const json_allocator_t *allocator, const char *string, size_t flags,
+                      json_error_t *error) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_loads(string, flags, error);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+json_t *json_loadb_ex(const json_allocator_t *allocator, const char *buffer,
+                      size_t buflen, size_t flags, json_error_t *error) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_loadb(buffer, buflen, flags, error);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+json_t *json_loadf_ex(const json_allocator_t *allocator, FILE *input, size_t flags,
+                      json_error_t *error) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_loadf(input, flags, error);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+json_t *json_load_file_ex(const json_allocator_t *allocator, const char *path,
+                          size_t flags, json_error_t *error) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_load_file(path, flags, error);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+json_t *json_load_callback_ex(const json_allocator_t *allocator,
+                              json_load_callback_t callback, void *arg, size_t flags,
+                              json_error_t *error) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_load_callback(callback, arg, flags, error);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+int json_sax_loadb(const char *buffer, size_t buflen, const json_sax_handler_t *handler,
+                   void *data, size_t flags, json_error_t *error) {
+    lex_t lex;
+    int result;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL || handler == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (lex_init(&lex, NULL, NULL, flags, NULL))
+        return -1;
+    stream_set_buffer(&lex.stream, buffer, buflen);
+
+    result = sax_parse_json(&lex, handler, data, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+int json_sax_loadf(FILE *input, const json_sax_handler_t *handler, void *data,
+                   size_t flags, json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    int result;
+
+    if (input == stdin)
+        source = "<stdin>";
+    else
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input == NULL || handler == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    /* See json_loadf() */
+    if (flags & JSON_DISABLE_EOF_CHECK) {
+        if (lex_init(&lex, (get_func)fgetc, NULL, flags, input))
+            return -1;
+    } else {
+        if (lex_init(&lex, NULL, file_fill_func, flags, input))
+            return -1;
+    }
+
+    result = sax_parse_json(&lex, handler, data, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+int json_sax_loadfd(int input, const json_sax_handler_t *handler, void *data,
+                    size_t flags, json_error_t *error) {
+    lex_t lex;
+    const char *source;
+    int result;
+
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+    else
+#endif
+        source = "<stream>";
+
+    jsonp_error_init(error, source);
+
+    if (input < 0 || handler == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    /* See json_loadf() */
+    if (flags & JSON_DISABLE_EOF_CHECK) {
+        if (lex_init(&lex, (get_func)fd_get_func, NULL, flags, &input))
+            return -1;
+    } else {
+        if (lex_init(&lex, NULL, fd_fill_func, flags, &input))
+            return -1;
+    }
+
+    result = sax_parse_json(&lex, handler, data, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+int json_sax_load_callback(json_load_callback_t callback, void *arg,
+                           const json_sax_handler_t *handler, void *data, size_t flags,
+                           json_error_t *error) {
+    lex_t lex;
+    int result;
+
+    jsonp_error_init(error, "<callback>");
+
+    if (callback == NULL || handler == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    if (lex_init(&lex, NULL, callback, flags, arg))
+        return -1;
+
+    result = sax_parse_json(&lex, handler, data, flags, error);
+
+    lex_close(&lex);
+    return result;
+}
+
+/*** record reader ***/
+
+/* The input is split into lines, and each line is decoded on its own
+   with the same lexer, so that an invalid record can't affect the
+   next one. Lines within the read buffer are decoded in place, and
+   only lines that continue past it are copied. */
+
+struct json_reader_t {
+    lex_t lex;
+    size_t flags;
+    const char *source;
+    fill_func fill;
+    void *data;
+    int fd;
+    /* The whole input, or the read buffer for a fill function */
+    const char *input;
+    size_t input_len;
+    size_t input_pos;
+    char *read_buffer;
+    /* Start of a line that didn't fit in the read buffer */
+    strbuffer_t pending;
+    /* Values are being decoded from the current line */
+    int in_line;
+    int line;
+    /* Input offset of the next line */
+    size_t position;
+};
+
+static json_reader_t *reader_create(fill_func fill, void *data, size_t flags,
+                                    const char *source) {
+    json_reader_t *reader = jsonp_malloc_as(sizeof(json_reader_t), json_memory_parser);
+    if (!reader)
+        return NULL;
+
+    if (lex_init(&reader->lex, NULL, NULL, flags, NULL)) {
+        jsonp_free(reader);
+        return NULL;
+    }
+    if (strbuffer_init(&reader->pending)) {
+        lex_close(&reader->lex);
+        jsonp_free(reader);
+        return NULL;
+    }
+
+    reader->read_buffer = NULL;
+    if (fill) {
+        reader->read_buffer = jsonp_malloc_as(STREAM_CHUNK_SIZE, json_memory_parser);
+        if (!reader->read_buffer) {
+            json_reader_destroy(reader);
+            return NULL;
+        }
+    }
+
+    reader->flags = flags;
+    reader->source = source;
+    reader->fill = fill;
+    reader->data = data;
+    reader->input = NULL;
+    reader->input_len = 0;
+    reader->input_pos = 0;
+    reader->in_line = 0;
+    reader->line = 0;
+    reader->position = 0;
+    return reader;
+}
+
+/* Point the lexer to the next line. Returns 0 at the end of input and
+   -1 on error. */
+static int reader_next_line(json_reader_t *reader) {
+    strbuffer_t *pending = &reader->pending;
+    stream_t *stream = &reader->lex.stream;
+    const char *start, *newline;
+    size_t len;
+
+    strbuffer_clear(pending);
+
+    while (1) {
+        if (reader->input_pos == reader->input_len) {
+            size_t n = 0;
+
+            if (reader->fill)
+                n = reader->fill(reader->read_buffer, STREAM_CHUNK_SIZE, reader->data);
+            if (n == 0 || n == (size_t)-1) {
+                reader->fill = NULL;
+                if (!pending->length)
+                    return 0;
+                start = pending->value;
+                len = pending->length;
+                break;
+            }
+
+            reader->input = reader->read_buffer;
+            reader->input_len = n;
+            reader->input_pos = 0;
+        }
+
+        start = reader->input + reader->input_pos;
+        len = reader->input_len - reader->input_pos;
+        newline = memchr(start, '\n', len);
+
+        if (!newline && reader->fill) {
+            if (strbuffer_append_bytes(pending, start, len))
+                return -1;
+            reader->input_pos = reader->input_len;
+            continue;
+        }
+
+        if (newline) {
+            len = newline - start;
+            reader->input_pos++;
+        }
+        reader->input_pos += len;
+
+        if (pending->length) {
+            if (strbuffer_append_bytes(pending, start, len))
+                return -1;
+            start = pending->value;
+            len = pending->length;
+        }
+        break;
+    }
+
+    stream_set_buffer(stream, start, len);
+    stream->buffer[0] = '\0';
+    stream->buffer_pos = 0;
+    stream->state = STREAM_STATE_OK;
+    stream->line = ++reader->line;
+    stream->column = 0;
+    stream->position = reader->position;
+    reader->position += len + 1;
+    return 1;
+}
+
+json_reader_t *json_reader_create_buffer(const char *buffer, size_t buflen,
+                                         size_t flags) {
+    json_reader_t *reader;
+
+    if (!buffer)
+        return NULL;
+
+    reader = reader_create(NULL, NULL, flags, "<buffer>");
+    if (!reader)
+        return NULL;
+
+    reader->input = buffer;
+    reader->input_len = buflen;
+    return reader;
+}
+
+json_reader_t *json_reader_create_file(FILE *input, size_t flags) {
+    if (!input)
+        return NULL;
+    return reader_create(file_fill_func, input, flags,
+                         input == stdin ? "<stdin>" : "<stream>");
+}
+
+json_reader_t *json_reader_create_fd(int input, size_t flags) {
+    json_reader_t *reader;
+    const char *source = "<stream>";
+
+    if (input < 0)
+        return NULL;
+#ifdef HAVE_UNISTD_H
+    if (input == STDIN_FILENO)
+        source = "<stdin>";
+#endif
+
+    reader = reader_create(fd_fill_func, NULL, flags, source);
+    if (!reader)
+        return NULL;
+
+    reader->fd = input;
+    reader->data = &reader->fd;
+    return reader;
+}
+
+json_reader_t *json_reader_create_callback(json_load_callback_t callback, void *data,
+                                           size_t flags) {
+    if (!callback)
+        return NULL;
+    return reader_create(callback, data, flags, "<callback>");
+}
+
+void json_reader_destroy(json_reader_t *reader) {
+    if (!reader)
+        return;
+
+    jsonp_free(reader->read_buffer);
+    strbuffer_close(&reader->pending);
+    lex_close(&reader->lex);
+    jsonp_free(reader);
+}
+
+int json_reader_next(json_reader_t *reader, json_t **value, json_error_t *error) {
+    lex_t *lex;
+    json_t *result;
+    int res;
+
+    jsonp_error_init(error, reader ? reader->source : "<stream>");
+
+    if (!reader || !value) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
+
+    *value = NULL;
+    lex = &reader->lex;
+
+    while (1) {
+        if (!reader->in_line) {
+            res = reader_next_line(reader);
+            if (res < 0) {
+                error_set(error, NULL, json_error_out_of_memory, "out of memory");
+                return -1;
+            }
+            if (res == 0)
+                return 0;
+            reader->in_line = 1;
+        }
+
+        lex->depth = 0;
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF)
+            break;
+        reader->in_line = 0;
+    }
+
+    if (!(reader->flags & JSON_DECODE_ANY)) {
+        if (lex->token != '[' && lex->token != '{') {
+            error_set(error, lex, json_error_invalid_syntax, "'[' or '{' expected");
+            goto error;
+        }
+    }
+
+    result = parse_value(lex, reader->flags, error);
+    if (!result)
+        goto error;
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)lex->stream.position;
+    }
+
+    *value = result;
+    return 1;
+
+error:
+    /* Skip the rest of the line */
+    reader->in_line = 0;
+    return -1;
+}
+
+/*** parallel loading ***/
+
+/* The input is split into chunks that are decoded by separate tasks.
+   The elements of a top level array are split after a comma found by a
+   structural scan, which only tracks strings and nesting, and records
+   are split after a newline. The decoded chunks are then joined in
+   order. */
+
+/* Inputs are never split into chunks smaller than this */
+#define PARALLEL_MIN_CHUNK 65536
+
+struct parallel_chunk {
+    const char *start;
+    size_t length;
+    json_t *values;
+    json_error_t error;
+};
+
+struct parallel_load {
+    struct parallel_chunk *chunks;
+    size_t count;
+    size_t flags;
+    int lines;
+};
+
+/* Find where to split the top level array in buffer into at most count
+   chunks, and store their end offsets in ends. The first chunk starts
+   after the opening bracket, which is returned, and each of the others
+   after the comma that ends the previous one. Returns 0 if buffer
+   doesn't hold an array. */
+static size_t parallel_split_array(const char *buffer, size_t buflen, size_t count,
+                                   size_t *ends, size_t *num_chunks) {
+    const char *p = buffer, *end = buffer + buflen;
+    size_t start, target, step, depth = 1, n = 0;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    if (p == end || *p != '[')
+        return 0;
+
+    start = ++p - buffer;
+    step = (buflen - start) / count;
+    target = start + step;
+
+    while (p < end) {
+        switch (*p++) {
+            case '"':
+                while (p < end) {
+                    p += scan_plain(p, end - p);
+                    if (p == end)
+                        break;
+                    if (*p == '"') {
+                        p++;
+                        break;
+                    }
+                    if (*p == '\\' && p + 1 < end)
+                        p++;
+                    p++;
+                }
+                break;
+
+            case '[':
+            case '{':
+                depth++;
+                break;
+
+            case ']':
+            case '}':
+                if (--depth == 0)
+                    p = end;
+                break;
+
+            case ',':
+                if (depth == 1 && (size_t)(p - buffer) >= target && n + 1 < count) {
+                    ends[n++] = p - buffer;
+                    target += step;
+                }
+                break;
+        }
+    }
+
+    ends[n++] = buflen;
+    *num_chunks = n;
+    return start;
+}
+
+/* Like parallel_split_array(), but split after newlines. Every chunk
+   holds whole lines. */
+static size_t parallel_split_lines(const char *buffer, size_t buflen, size_t count,
+                                   size_t *ends, size_t *num_chunks) {
+    size_t offset = 0, step = buflen / count, n = 0;
+    const char *newline;
+
+    while (n + 1 < count && offset + step < buflen) {
+        newline = memchr(buffer + offset + step, '\n', buflen - offset - step);
+        if (!newline)
+            break;
+        offset = newline + 1 - buffer;
+        ends[n++] = offset;
+    }
+
+    ends[n++] = buflen;
+    *num_chunks = n;
+    return 0;
+}
+
+/* Decode the elements of a chunk of a top level array. first and last
+   tell whether the chunk begins or ends the array. */
+static json_t *parallel_parse_elements(lex_t *lex, int first, int last, size_t flags,
+                                       json_error_t *error) {
+    stream_t *stream = &lex->stream;
+    json_t *array = jsonp_array(NULL);
+    if (!array)
+        return NULL;
+
+    /* The elements are inside the array */
+    lex->depth = 1;
+
+    lex_scan(lex, error);
+    if (!first || lex->token != ']') {
+        while (lex->token) {
+            json_t *elem = parse_value(lex, flags, error);
+            if (!elem)
+                goto error;
+
+            if (json_array_append_new(array, elem))
+                goto error;
+
+            lex_scan(lex, error);
+            if (lex->token != ',')
+                break;
+
+            /* The rest of the array is in the following chunks */
+            if (!last && stream->chunk_pos == stream->chunk_len)
+                return array;
+
+            lex_scan(lex, error);
+        }
+
+        if (lex->token != ']') {
+            error_set(error, lex, json_error_invalid_syntax, "']' expected");
+            goto error;
+        }
+    }
+
+    if (!last || !(flags & JSON_DISABLE_EOF_CHECK)) {
+        lex_scan(lex, error);
+        if (lex->token != TOKEN_EOF) {
+            error_set(error, lex, json_error_end_of_input_expected,
+                      "end of file expected");
+            goto error;
+        }
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)stream->position;
+    }
+
+    return array;
+
+error:
+    json_decref(array);
+    return NULL;
+}
+
+/* Decode the records of a chunk of lines */
+static json_t *parallel_parse_lines(const char *start, size_t length, size_t flags,
+                                    json_error_t *error) {
+    json_reader_t *reader;
+    json_t *array, *value;
+    int res;
+
+    array = jsonp_array(NULL);
+    reader = json_reader_create_buffer(start, length, flags);
+    if (!array || !reader) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        goto error;
+    }
+
+    while ((res = json_reader_next(reader, &value, error)) > 0) {
+        if (json_array_append_new(array, value)) {
+            error_set(error, NULL, json_error_out_of_memory, "out of memory");
+            goto error;
+        }
+    }
+    if (res < 0)
+        goto error;
+
+    json_reader_destroy(reader);
+    error->position = (int)length;
+    return array;
+
+error:
+    json_reader_destroy(reader);
+    json_decref(array);
+    return NULL;
+}
+
+static void parallel_task(void *arg, size_t index) {
+    struct parallel_load *load = arg;
+    struct parallel_chunk *chunk = &load->chunks[index];
+    lex_t lex;
+
+    jsonp_error_init(&chunk->error, "<buffer>");
+
+    if (load->lines) {
+        chunk->values =
+            parallel_parse_lines(chunk->start, chunk->length, load->flags, &chunk->error);
+        return;
+    }
+
+    chunk->values = NULL;
+    if (lex_init(&lex, NULL, NULL, load->flags, NULL)) {
+        error_set(&chunk->error, NULL, json_error_out_of_memory, "out of memory");
+        return;
+    }
+    stream_set_buffer(&lex.stream, chunk->start, chunk->length);
+
+    chunk->values = parallel_parse_elements(&lex, index == 0, index == load->count - 1,
+                                            load->flags, &chunk->error);
+    lex_close(&lex);
+}
+
+/* Make the location of an error in a part of buffer starting at offset
+   relative to the whole buffer */
+static void locate_error(json_error_t *error, const char *buffer, size_t offset) {
+    const char *p = buffer, *end = buffer + offset, *newline;
+    int lines = 0, column = 0;
+
+    while ((newline = memchr(p, '\n', end - p)) != NULL) {
+        lines++;
+        p = newline + 1;
+    }
+    for (; p < end; p++) {
+        if (((unsigned char)*p & 0xC0) != 0x80)
+            column++;
+    }
+
+    if (error->line == 1)
+        error->column += column;
+    if (error->line > 0)
+        error->line += lines;
+    error->position += (int)offset;
+}
+
+static json_t *load_parallel(const char *buffer, size_t buflen, size_t flags,
+                             size_t jobs, json_task_runner_t runner, void *data,
+                             int lines, json_error_t *error) {
+    struct parallel_load load;
+    struct parallel_chunk *chunks;
+    size_t *ends, start, i;
+    json_t *result = NULL;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (jobs > buflen / PARALLEL_MIN_CHUNK)
+        jobs = buflen / PARALLEL_MIN_CHUNK;
+    if (jobs == 0)
+        jobs = 1;
+    if (jobs == 1 && !lines)
+        return json_loadb(buffer, buflen, flags, error);
+
+    ends = jsonp_malloc_as(jobs * sizeof(size_t), json_memory_parser);
+    chunks = jsonp_malloc_as(jobs * sizeof(struct parallel_chunk), json_memory_parser);
+    if (!ends || !chunks) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        goto out;
+    }
+
+    load.chunks = chunks;
+    load.flags = flags;
+    load.lines = lines;
+
+    if (lines)
+        start = parallel_split_lines(buffer, buflen, jobs, ends, &load.count);
+    else {
+        start = parallel_split_array(buffer, buflen, jobs, ends, &load.count);
+        if (start == 0 || load.count == 1) {
+            /* Not an array, or nothing to split */
+            result = json_loadb(buffer, buflen, flags, error);
+            goto out;
+        }
+    }
+
+    for (i = 0; i < load.count; i++) {
+        chunks[i].start = buffer + start;
+        chunks[i].length = ends[i] - start;
+        start = ends[i];
+    }
+
+    if (runner && load.count > 1)
+        runner(parallel_task, &load, load.count, data);
+    else {
+        for (i = 0; i < load.count; i++)
+            parallel_task(&load, i);
+    }
+
+    /* Report the first error in the input, and join the chunks if
+       there is none */
+    for (i = 0; i < load.count; i++) {
+        if (!chunks[i].values) {
+            if (error) {
+                *error = chunks[i].error;
+                locate_error(error, buffer, chunks[i].start - buffer);
+            }
+            break;
+        }
+    }
+
+    if (i == load.count) {
+        size_t total;
+        int failed;
+
+        result = chunks[0].values;
+        chunks[0].values = NULL;
+
+        total = json_array_size(result);
+        for (i = 1; i < load.count; i++)
+            total += json_array_size(chunks[i].values);
+
+        failed = json_array_reserve(result, total);
+        for (i = 1; i < load.count && !failed; i++)
+            failed = jsonp_array_move(result, chunks[i].values);
+
+        if (failed) {
+            error_set(error, NULL, json_error_out_of_memory, "out of memory");
+            json_decref(result);
+            result = NULL;
+        }
+
+        if (result && error) {
+            i = load.count - 1;
+            error->position = chunks[i].error.position + (int)(chunks[i].start - buffer);
+        }
+    }
+
+    for (i = 0; i < load.count; i++)
+        json_decref(chunks[i].values);
+
+out:
+    jsonp_free(chunks);
+    jsonp_free(ends);
+    return result;
+}
+
+json_t *json_loadb_parallel(const char *buffer, size_t buflen, size_t flags, size_t jobs,
+                            json_task_runner_t runner, void *data, json_error_t *error) {
+    return load_parallel(buffer, buflen, flags, jobs, runner, data, 0, error);
+}
+
+json_t *json_loadb_lines_parallel(const char *buffer, size_t buflen, size_t flags,
+                                  size_t jobs, json_task_runner_t runner, void *data,
+                                  json_error_t *error) {
+    return load_parallel(buffer, buflen, flags, jobs, runner, data, 1, error);
+}
+
+/*** lazy documents ***/
+
+/* A document is an index of the structural characters of its buffer,
+   string and scalar starts included, built in a single pass that also
+   checks the nesting and separators. Accessors walk the index and
+   skip nested values in constant time, and only the values that are
+   asked for are decoded, with the lexer as usual. */
+
+#define EXPECT_VALUE        0
+#define EXPECT_VALUE_OR_END 1 /* after '[' */
+#define EXPECT_KEY          2
+#define EXPECT_KEY_OR_END   3 /* after '{' */
+#define EXPECT_COLON        4
+#define EXPECT_NEXT         5 /* ',' or the end of the container */
+#define EXPECT_EOF          6
+
+struct json_doc_t {
+    const char *buffer;
+    size_t length;
+    size_t flags;
+    /* Buffer offsets of the index entries */
+    size_t *offsets;
+    /* For '{' and '[', the entry of the matching bracket, and for
+       strings and scalars the offset where they end */
+    size_t *extents;
+    size_t count;
+    size_t size;
+    /* Decoded values by entry, allocated on first use */
+    json_t **values;
+};
+
+static const json_lazy_t lazy_none = {NULL, 0};
+
+static void doc_error(json_doc_t *doc, json_error_t *error, size_t offset,
+                      enum json_error_code code, const char *msg) {
+    if (!error)
+        return;
+    jsonp_error_set(error, 1, 0, 0, code, "%s", msg);
+    locate_error(error, doc->buffer, offset);
+}
+
+static int doc_add(json_doc_t *doc, size_t offset, size_t extent) {
+    if (doc->count == doc->size) {
+        size_t new_size = doc->size * 2;
+        size_t *offsets = jsonp_malloc_as(new_size * sizeof(size_t), json_memory_parser);
+        size_t *extents = jsonp_malloc_as(new_size * sizeof(size_t), json_memory_parser);
+
+        if (!offsets || !extents) {
+            jsonp_free(offsets);
+            jsonp_free(extents);
+            return -1;
+        }
+        memcpy(offsets, doc->offsets, doc->count * sizeof(size_t));
+        memcpy(extents, doc->extents, doc->count * sizeof(size_t));
+        jsonp_free(doc->offsets);
+        jsonp_free(doc->extents);
+        doc->offsets = offsets;
+        doc->extents = extents;
+        doc->size = new_size;
+    }
+
+    doc->offsets[doc->count] = offset;
+    doc->extents[doc->count] = extent;
+    doc->count++;
+    return 0;
+}
+
+/* Return the offset after the string starting at offset, or 0 if it
+   doesn't end */
+static size_t doc_skip_string(const json_doc_t *doc, size_t offset) {
+    const char *p = doc->buffer + offset + 1, *end = doc->buffer + doc->length;
+
+    while (p < end) {
+        p += scan_plain(p, end - p);
+        if (p == end)
+            break;
+        if (*p == '"')
+            return p + 1 - doc->buffer;
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        p++;
+    }
+    return 0;
+}
+
+/* Return the offset after the number or literal starting at offset */
+static size_t doc_skip_scalar(const json_doc_t *doc, size_t offset) {
+    const char *p = doc->buffer + offset, *end = doc->buffer + doc->length;
+
+    while (p < end && *p != ',' && *p != ':' && *p != ']' && *p != '}' && *p != '[' &&
+           *p != '{' && *p != '"' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+        p++;
+    return p - doc->buffer;
+}
+
+static int doc_index(json_doc_t *doc, json_error_t *error) {
+    const char *buffer = doc->buffer;
+    size_t stack[JSON_PARSER_MAX_DEPTH];
+    size_t depth = 0, offset = 0, extent;
+    int expect = EXPECT_VALUE;
+    char c;
+
+    while (1) {
+        while (offset < doc->length &&
+               (buffer[offset] == ' ' || buffer[offset] == '\t' ||
+                buffer[offset] == '\n' || buffer[offset] == '\r'))
+            offset++;
+        if (offset == doc->length)
+            break;
+
+        c = buffer[offset];
+        switch (expect) {
+            case EXPECT_EOF:
+                if (doc->flags & JSON_DISABLE_EOF_CHECK)
+                    return 0;
+                doc_error(doc, error, offset, json_error_end_of_input_expected,
+                          "end of file expected");
+                return -1;
+
+            case EXPECT_KEY_OR_END:
+            case EXPECT_KEY:
+                if (c == '}' && expect == EXPECT_KEY_OR_END)
+                    goto close;
+                if (c != '"') {
+                    doc_error(doc, error, offset, json_error_invalid_syntax,
+                              "string or '}' expected");
+                    return -1;
+                }
+                extent = doc_skip_string(doc, offset);
+                if (!extent)
+                    goto premature;
+                if (doc_add(doc, offset, extent))
+                    goto oom;
+                offset = extent;
+                expect = EXPECT_COLON;
+                continue;
+
+            case EXPECT_COLON:
+                if (c != ':') {
+                    doc_error(doc, error, offset, json_error_invalid_syntax,
+                              "':' expected");
+                    return -1;
+                }
+                if (doc_add(doc, offset, 0))
+                    goto oom;
+                offset++;
+                expect = EXPECT_VALUE;
+                continue;
+
+            case EXPECT_NEXT:
+                if (c == ',') {
+                    if (doc_add(doc, offset, 0))
+                        goto oom;
+                    offset++;
+                    if (buffer[doc->offsets[stack[depth - 1]]] == '{')
+                        expect = EXPECT_KEY;
+                    else
+                        expect = EXPECT_VALUE;
+                    continue;
+                }
+                if (c == ']' || c == '}')
+                    goto close;
+                if (buffer[doc->offsets[stack[depth - 1]]] == '{')
+                    doc_error(doc, error, offset, json_error_invalid_syntax,
+                              "'}' expected");
+                else
+                    doc_error(doc, error, offset, json_error_invalid_syntax,
+                              "']' expected");
+                return -1;
+
+            case EXPECT_VALUE_OR_END:
+                if (c == ']')
+                    goto close;
+                break;
+        }
+
+        /* A value */
+        if (depth == 0 && !(doc->flags & JSON_DECODE_ANY) && c != '[' && c != '{') {
+            doc_error(doc, error, offset, json_error_invalid_syntax,
+                      "'[' or '{' expected");
+            return -1;
+        }
+
+        /* Scalars count as a level, as with the other decoders. The
+           stack has room for JSON_PARSER_MAX_DEPTH at most. */
+        if (depth == min(parse_max_depth(doc->flags), JSON_PARSER_MAX_DEPTH)) {
+            doc_error(doc, error, offset, json_error_stack_overflow,
+                      "maximum parsing depth reached");
+            return -1;
+        }
+
+        if (c == '[' || c == '{') {
+            stack[depth++] = doc->count;
+            if (doc_add(doc, offset, 0))
+                goto oom;
+            offset++;
+            expect = c == '[' ? EXPECT_VALUE_OR_END : EXPECT_KEY_OR_END;
+            continue;
+        }
+
+        if (c == ']' || c == '}' || c == ',' || c == ':') {
+            doc_error(doc, error, offset, json_error_invalid_syntax, "unexpected token");
+            return -1;
+        }
+
+        if (c == '"') {
+            extent = doc_skip_string(doc, offset);
+            if (!extent)
+                goto premature;
+        } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' ||
+                   c == 'n')
+            extent = doc_skip_scalar(doc, offset);
+        else {
+            doc_error(doc, error, offset, json_error_invalid_syntax, "invalid token");
+            return -1;
+        }
+
+        if (doc_add(doc, offset, extent))
+            goto oom;
+        offset = extent;
+        expect = depth ? EXPECT_NEXT : EXPECT_EOF;
+        continue;
+
+    close:
+        if ((c == ']') != (buffer[doc->offsets[stack[depth - 1]]] == '[')) {
+            doc_error(doc, error, offset, json_error_invalid_syntax,
+                      c == ']' ? "'}' expected" : "']' expected");
+            return -1;
+        }
+        doc->extents[stack[--depth]] = doc->count;
+        if (doc_add(doc, offset, 0))
+            goto oom;
+        offset++;
+        expect = depth ? EXPECT_NEXT : EXPECT_EOF;
+    }
+
+    if (expect == EXPECT_EOF)
+        return 0;
+
+premature:
+    doc_error(doc, error, doc->length, json_error_premature_end_of_input,
+              "premature end of input");
+    return -1;
+
+oom:
+    doc_error(doc, error, offset, json_error_out_of_memory, "out of memory");
+    return -1;
+}
+
+json_doc_t *json_doc_loadb(const char *buffer, size_t buflen, size_t flags,
+                           json_error_t *error) {
+    json_doc_t *doc;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (buffer == NULL) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    doc = jsonp_malloc_as(sizeof(json_doc_t), json_memory_parser);
+    if (!doc) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+
+    doc->buffer = buffer;
+    doc->length = buflen;
+    doc->flags = flags;
+    doc->count = 0;
+    doc->size = 64;
+    doc->values = NULL;
+    doc->offsets = jsonp_malloc_as(doc->size * sizeof(size_t), json_memory_parser);
+    doc->extents = jsonp_malloc_as(doc->size * sizeof(size_t), json_memory_parser);
+    if (!doc->offsets || !doc->extents) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        json_doc_destroy(doc);
+        return NULL;
+    }
+
+    if (doc_index(doc, error)) {
+        json_error_t load_error;
+        json_t *json;
+
+        /* The input is invalid, so this is cheap compared to indexing
+           it. Report the error as json_loadb() does, as the index only
+           tells where the structure broke. */
+        if (error && json_error_code(error) != json_error_out_of_memory) {
+            json = json_loadb(buffer, buflen, flags, &load_error);
+            if (!json)
+                *error = load_error;
+            json_decref(json);
+        }
+
+        json_doc_destroy(doc);
+        return NULL;
+    }
+
+    if (error) {
+        /* Save the position even though there was no error */
+        error->position = (int)buflen;
+    }
+
+    return doc;
+}
+
+void json_doc_destroy(json_doc_t *doc) {
+    size_t i;
+
+    if (!doc)
+        return;
+
+    if (doc->values) {
+        for (i = 0; i < doc->count; i++)
+            json_decref(doc->values[i]);
+        jsonp_free(doc->values);
+    }
+    jsonp_free(doc->offsets);
+    jsonp_free(doc->extents);
+    jsonp_free(doc);
+}
+
+json_lazy_t json_doc_root(json_doc_t *doc) {
+    json_lazy_t root = lazy_none;
+
+    if (doc && doc->count) {
+        root.doc = doc;
+        root.node = 0;
+    }
+    return root;
+}
+
+static char lazy_char(const json_doc_t *doc, size_t node) {
+    return doc->buffer[doc->offsets[node]];
+}
+
+/* Return the entry after the value at node */
+static size_t lazy_skip(const json_doc_t *doc, size_t node) {
+    char c = lazy_char(doc, node);
+    if (c == '[' || c == '{')
+        return doc->extents[node] + 1;
+    return node + 1;
+}
+
+json_type json_lazy_typeof(json_lazy_t value) {
+    const json_doc_t *doc = value.doc;
+    const char *p, *end;
+
+    if (!doc)
+        return JSON_NULL;
+
+    switch (lazy_char(doc, value.node)) {
+        case '{':
+            return JSON_OBJECT;
+        case '[':
+            return JSON_ARRAY;
+        case '"':
+            return JSON_STRING;
+        case 't':
+            return JSON_TRUE;
+        case 'f':
+            return JSON_FALSE;
+        case 'n':
+            return JSON_NULL;
+    }
+
+    if (doc->flags & JSON_DECODE_INT_AS_REAL)
+        return JSON_REAL;
+
+    p = doc->buffer + doc->offsets[value.node];
+    end = doc->buffer + doc->extents[value.node];
+    for (; p < end; p++) {
+        if (*p == '.' || *p == 'e' || *p == 'E')
+            return JSON_REAL;
+    }
+    return JSON_INTEGER;
+}
+
+/* Compare the key at node to key */
+static int lazy_key_equal(const json_doc_t *doc, size_t node, const char *key,
+                          size_t key_len) {
+    const char *start = doc->buffer + doc->offsets[node];
+    size_t length = doc->extents[node] - doc->offsets[node];
+    lex_t lex;
+    int equal;
+
+    if (!memchr(start + 1, '\\', length - 2))
+        return length - 2 == key_len && !memcmp(start + 1, key, key_len);
+
+    /* Decode escapes */
+    if (lex_init(&lex, NULL, NULL, doc->flags, NULL))
+        return 0;
+    stream_set_buffer(&lex.stream, start, length);
+    lex_scan(&lex, NULL);
+    equal = lex.token == TOKEN_STRING && lex.value.string.len == key_len &&
+            !memcmp(lex.value.string.val, key, key_len);
+    lex_close(&lex);
+    return equal;
+}
+
+json_lazy_t json_lazy_object_get(json_lazy_t object, const char *key) {
+    const json_doc_t *doc = object.doc;
+    json_lazy_t result = lazy_none;
+    size_t node, key_len;
+
+    if (!doc || !key || lazy_char(doc, object.node) != '{')
+        return lazy_none;
+
+    key_len = strlen(key);
+    node = object.node + 1;
+    if (lazy_char(doc, node) == '}')
+        return lazy_none;
+
+    /* The last one wins, as when decoding the object */
+    while (1) {
+        if (lazy_key_equal(doc, node, key, key_len)) {
+            result.doc = object.doc;
+            result.node = node + 2;
+        }
+        node = lazy_skip(doc, node + 2);
+        if (lazy_char(doc, node) != ',')
+            break;
+        node++;
+    }
+    return result;
+}
+
+json_lazy_t json_lazy_array_get(json_lazy_t array, size_t index) {
+    const json_doc_t *doc = array.doc;
+    json_lazy_t result = lazy_none;
+    size_t node;
+
+    if (!doc || lazy_char(doc, array.node) != '[')
+        return lazy_none;
+
+    node = array.node + 1;
+    if (lazy_char(doc, node) == ']')
+        return lazy_none;
+
+    while (index-- > 0) {
+        node = lazy_skip(doc, node);
+        if (lazy_char(doc, node) != ',')
+            return lazy_none;
+        node++;
+    }
+
+    result.doc = array.doc;
+    result.node = node;
+    return result;
+}
+
+size_t json_lazy_size(json_lazy_t value) {
+    const json_doc_t *doc = value.doc;
+    size_t node, size = 0;
+    char c;
+
+    if (!doc)
+        return 0;
+
+    c = lazy_char(doc, value.node);
+    if (c != '[' && c != '{')
+        return 0;
+
+    node = value.node + 1;
+    if (node == doc->extents[value.node])
+        return 0;
+
+    while (1) {
+        size++;
+        node = lazy_skip(doc, c == '{' ? node + 2 : node);
+        if (lazy_char(doc, node) != ',')
+            break;
+        node++;
+    }
+    return size;
+}
+
+json_t *json_lazy_value(json_lazy_t value, json_error_t *error) {
+    json_doc_t *doc = value.doc;
+    size_t start, end;
+    json_t *result;
+    lex_t lex;
+    char c;
+
+    jsonp_error_init(error, "<buffer>");
+
+    if (!doc) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return NULL;
+    }
+
+    if (!doc->values) {
+        doc->values = jsonp_malloc_as(doc->count * sizeof(json_t *), json_memory_parser);
+        if (!doc->values) {
+            error_set(error, NULL, json_error_out_of_memory, "out of memory");
+            return NULL;
+        }
+        memset(doc->values, 0, doc->count * sizeof(json_t *));
+    }
+    if (doc->values[value.node])
+        return doc->values[value.node];
 
-    if (lex_init(&lex, string_get, flags, (void *)&stream_data))
-        return NULL;
+    start = doc->offsets[value.node];
+    c = lazy_char(doc, value.node);
+    if (c == '[' || c == '{')
+        end = doc->offsets[doc->extents[value.node]] + 1;
+    else
+        end = doc->extents[value.node];
 
-    result = parse_json(&lex, flags, error);
+    if (lex_init(&lex, NULL, NULL, doc->flags, NULL)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        return NULL;
+    }
+    stream_set_buffer(&lex.stream, doc->buffer + start, end - start);
 
+    result = parse_json(&lex, (doc->flags | JSON_DECODE_ANY) & ~JSON_DISABLE_EOF_CHECK,
+                        error);
     lex_close(&lex);
+
+    if (error) {
+        if (result)
+            error->position = (int)end;
+        else
+            locate_error(error, doc->buffer, start);
+    }
+
+    doc->values[value.node] = result;
     return result;
 }
 
-typedef struct {
-    const char *data;
+/*** selective loading ***/
+
+/* The pointers are merged into a tree of their reference tokens. The
+   input is walked along the tree with the lexer, and values off it are
+   stepped over in the buffer without decoding them. Values that are
+   pointed to are decoded with parse_value(), and pointers below them
+   are then resolved in the decoded value. */
+
+/* Bytes of numbers and literals */
+#define l_isscalar(c)                                                                    \
+    (l_isalpha(c) || l_isdigit(c) || (c) == '-' || (c) == '+' || (c) == '.')
+
+struct select_node {
+    struct select_node *child;
+    struct select_node *next;
+    /* The value pointed to, if found */
+    json_t *value;
+    /* The token as an array index, or (size_t)-1 */
+    size_t index;
+    int selected;
     size_t len;
-    size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void *data) {
-    char c;
-    buffer_data_t *stream = data;
-    if (stream->pos >= stream->len)
-        return EOF;
-
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
-}
+    char *token;
+};
 
-json_t *json_loadb(const char *buffer, size_t buflen, size_t flags, json_error_t *error) {
+struct select_state {
     lex_t lex;
-    json_t *result;
-    buffer_data_t stream_data;
+    size_t flags;
+    /* Values were stepped over, so the lexer's line and column are
+       off */
+    int skipped;
+};
 
-    jsonp_error_init(error, "<buffer>");
+static struct select_node *select_node_new(const char *token, size_t len) {
+    struct select_node *node =
+        jsonp_malloc_as(sizeof(struct select_node) + len + 1, json_memory_parser);
+    size_t i;
 
-    if (buffer == NULL) {
-        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+    if (!node)
         return NULL;
+
+    node->child = node->next = NULL;
+    node->value = NULL;
+    node->selected = 0;
+    node->len = len;
+    node->token = (char *)(node + 1);
+    memcpy(node->token, token, len);
+    node->token[len] = '\0';
+
+    /* Array indices have no leading zeros */
+    node->index = (size_t)-1;
+    if (len > 0 && (len == 1 || token[0] != '0')) {
+        node->index = 0;
+        for (i = 0; i < len; i++) {
+            if (!l_isdigit(token[i]) || node->index > ((size_t)-1 - 9) / 10) {
+                node->index = (size_t)-1;
+                break;
+            }
+            node->index = node->index * 10 + (token[i] - '0');
+        }
     }
 
-    stream_data.data = buffer;
-    stream_data.pos = 0;
-    stream_data.len = buflen;
+    return node;
+}
 
-    if (lex_init(&lex, buffer_get, flags, (void *)&stream_data))
-        return NULL;
+static void select_node_free(struct select_node *node) {
+    while (node) {
+        struct select_node *next = node->next;
+        select_node_free(node->child);
+        json_decref(node->value);
+        jsonp_free(node);
+        node = next;
+    }
+}
 
-    result = parse_json(&lex, flags, error);
+/* Add the node of pointer below root and return it in out. Returns -1
+   if the pointer is invalid, and -2 on allocation failure. */
+static int select_node_add(struct select_node *root, const char *pointer,
+                           struct select_node **out) {
+    struct select_node *node = root, *child;
+    strbuffer_t token;
+    const char *p = pointer;
+    int res = 0;
 
-    lex_close(&lex);
-    return result;
+    if (*p && *p != '/')
+        return -1;
+
+    if (strbuffer_init(&token))
+        return -2;
+
+    while (*p) {
+        /* Unescape the next reference token */
+        strbuffer_clear(&token);
+        for (p++; *p && *p != '/'; p++) {
+            char c = *p;
+            if (c == '~') {
+                if (p[1] != '0' && p[1] != '1') {
+                    res = -1;
+                    goto out;
+                }
+                c = *++p == '0' ? '~' : '/';
+            }
+            if (strbuffer_append_byte(&token, c)) {
+                res = -2;
+                goto out;
+            }
+        }
+
+        for (child = node->child; child; child = child->next) {
+            if (child->len == token.length &&
+                !memcmp(child->token, token.value, token.length))
+                break;
+        }
+        if (!child) {
+            child = select_node_new(token.value, token.length);
+            if (!child) {
+                res = -2;
+                goto out;
+            }
+            child->next = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    node->selected = 1;
+    *out = node;
+
+out:
+    strbuffer_close(&token);
+    return res;
 }
 
-json_t *json_loadf(FILE *input, size_t flags, json_error_t *error) {
-    lex_t lex;
-    const char *source;
-    json_t *result;
+/* Drop the values found below node, for a duplicate key */
+static void select_node_reset(struct select_node *node) {
+    for (; node; node = node->next) {
+        json_decref(node->value);
+        node->value = NULL;
+        select_node_reset(node->child);
+    }
+}
 
-    if (input == stdin)
-        source = "<stdin>";
-    else
-        source = "<stream>";
+/* Resolve the pointers below node in its decoded value */
+static void select_resolve(struct select_node *node) {
+    struct select_node *child;
 
-    jsonp_error_init(error, source);
+    for (child = node->child; child; child = child->next) {
+        json_t *value = NULL;
 
-    if (input == NULL) {
-        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
-        return NULL;
+        if (json_is_object(node->value))
+            value = json_object_getn(node->value, child->token, child->len);
+        else if (json_is_array(node->value) && child->index != (size_t)-1)
+            value = json_array_get(node->value, child->index);
+
+        json_decref(child->value);
+        child->value = json_incref(value);
+        select_resolve(child);
     }
+}
 
-    if (lex_init(&lex, (get_func)fgetc, flags, input))
-        return NULL;
+static void select_error(struct select_state *s, const char *p, enum json_error_code code,
+                         const char *msg, json_error_t *error) {
+    if (!error)
+        return;
+    jsonp_error_set(error, 1, 0, 0, code, "%s", msg);
+    locate_error(error, s->lex.stream.chunk, p - s->lex.stream.chunk);
+}
 
-    result = parse_json(&lex, flags, error);
+/* Return the next non-whitespace byte of the input without consuming
+   it, or EOF */
+static int select_peek(struct select_state *s) {
+    const stream_t *stream = &s->lex.stream;
+    const char *p = stream->chunk + stream->chunk_pos;
+    const char *end = stream->chunk + stream->chunk_len;
 
-    lex_close(&lex);
-    return result;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p < end ? (unsigned char)*p : EOF;
 }
 
-static int fd_get_func(int *fd) {
-#ifdef HAVE_UNISTD_H
-    uint8_t c;
-    if (read(*fd, &c, 1) == 1)
-        return c;
-#endif
-    return EOF;
+/* Whether the innermost of depth open containers is an object */
+static int select_in_object(const unsigned char *objects, size_t depth) {
+    return depth && ((objects[(depth - 1) / 8] >> ((depth - 1) % 8)) & 1);
 }
 
-json_t *json_loadfd(int input, size_t flags, json_error_t *error) {
-    lex_t lex;
-    const char *source;
-    json_t *result;
+/* Step over the next value, or with open set to '[' or '{', over the
+   rest of the current array or object. Nothing is decoded or
+   allocated, and only the nesting and the ends of strings are
+   checked. */
+static int select_skip(struct select_state *s, int open, json_error_t *error) {
+    stream_t *stream = &s->lex.stream;
+    const char *start = stream->chunk + stream->chunk_pos, *p = start;
+    const char *end = stream->chunk + stream->chunk_len;
+    unsigned char objects[JSON_PARSER_MAX_DEPTH / 8 + 1];
+    size_t depth = 0, max_depth;
+    char prev = (char)open, c;
+
+    /* Values at depth max_depth would be too deep. The open container
+       is already counted in the depth of the lexer. */
+    max_depth = min(parse_max_depth(s->flags), JSON_PARSER_MAX_DEPTH) - s->lex.depth;
+
+    if (open) {
+        objects[0] = open == '{';
+        depth = 1;
+        max_depth++;
+    }
 
-#ifdef HAVE_UNISTD_H
-    if (input == STDIN_FILENO)
-        source = "<stdin>";
-    else
-#endif
-        source = "<stream>";
+    while (1) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+        if (p == end) {
+            select_error(s, p, json_error_premature_end_of_input,
+                         "premature end of input", error);
+            return -1;
+        }
 
-    jsonp_error_init(error, source);
+        c = *p;
+        switch (c) {
+            case '"':
+                /* Keys are not values */
+                if (depth == max_depth &&
+                    !(select_in_object(objects, depth) && (prev == '{' || prev == ','))) {
+                    select_error(s, p, json_error_stack_overflow,
+                                 "maximum parsing depth reached", error);
+                    return -1;
+                }
+                for (p++;; p++) {
+                    p += scan_plain(p, end - p);
+                    if (p == end) {
+                        select_error(s, p, json_error_premature_end_of_input,
+                                     "premature end of input", error);
+                        return -1;
+                    }
+                    if (*p == '"')
+                        break;
+                    if (*p == '\\' && p + 1 < end)
+                        p++;
+                }
+                p++;
+                break;
+
+            case '[':
+            case '{':
+                if (depth == max_depth) {
+                    select_error(s, p, json_error_stack_overflow,
+                                 "maximum parsing depth reached", error);
+                    return -1;
+                }
+                if (*p == '{')
+                    objects[depth / 8] |= 1 << (depth % 8);
+                else
+                    objects[depth / 8] &= ~(1 << (depth % 8));
+                depth++;
+                p++;
+                break;
+
+            case ']':
+            case '}':
+                if (depth == 0) {
+                    select_error(s, p, json_error_invalid_syntax, "unexpected token",
+                                 error);
+                    return -1;
+                }
+                depth--;
+                if ((*p == '}') != ((objects[depth / 8] >> (depth % 8)) & 1)) {
+                    select_error(s, p, json_error_invalid_syntax,
+                                 *p == '}' ? "']' expected" : "'}' expected", error);
+                    return -1;
+                }
+                p++;
+                break;
+
+            case ',':
+            case ':':
+                if (depth == 0) {
+                    select_error(s, p, json_error_invalid_syntax, "unexpected token",
+                                 error);
+                    return -1;
+                }
+                p++;
+                break;
 
-    if (input < 0) {
-        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
-        return NULL;
+            default:
+                if (!l_isdigit(*p) && *p != '-' && *p != 't' && *p != 'f' && *p != 'n') {
+                    select_error(s, p, json_error_invalid_syntax, "invalid token", error);
+                    return -1;
+                }
+                if (depth == max_depth) {
+                    select_error(s, p, json_error_stack_overflow,
+                                 "maximum parsing depth reached", error);
+                    return -1;
+                }
+                while (p < end && l_isscalar(*p))
+                    p++;
+                break;
+        }
+        prev = c;
+
+        if (depth == 0)
+            break;
     }
 
-    if (lex_init(&lex, (get_func)fd_get_func, flags, &input))
-        return NULL;
+    stream->chunk_pos = p - stream->chunk;
+    stream->position += p - start;
+    s->skipped = 1;
+    return 0;
+}
 
-    result = parse_json(&lex, flags, error);
+static int select_value(struct select_state *s, struct select_node *node,
+                        json_error_t *error);
 
-    lex_close(&lex);
-    return result;
+static int select_object(struct select_state *s, struct select_node *node,
+                         json_error_t *error) {
+    lex_t *lex = &s->lex;
+
+    lex_scan(lex, error);
+    if (lex->token == '}')
+        return 0;
+
+    while (1) {
+        struct select_node *child;
+        const char *key;
+        size_t len;
+
+        if (lex->token != TOKEN_STRING) {
+            error_set(error, lex, json_error_invalid_syntax, "string or '}' expected");
+            return -1;
+        }
+
+        key = lex->value.string.val;
+        len = lex->value.string.len;
+        if (memchr(key, '\0', len)) {
+            error_set(error, lex, json_error_null_byte_in_key,
+                      "NUL byte in object key not supported");
+            return -1;
+        }
+
+        for (child = node->child; child; child = child->next) {
+            if (child->len == len && !memcmp(child->token, key, len))
+                break;
+        }
+
+        lex_scan(lex, error);
+        if (lex->token != ':') {
+            error_set(error, lex, json_error_invalid_syntax, "':' expected");
+            return -1;
+        }
+
+        if (child) {
+            /* The last duplicate wins */
+            json_decref(child->value);
+            child->value = NULL;
+            select_node_reset(child->child);
+
+            lex_scan(lex, error);
+            if (select_value(s, child, error))
+                return -1;
+        } else if (select_skip(s, 0, error))
+            return -1;
+
+        lex_scan(lex, error);
+        if (lex->token != ',')
+            break;
+
+        lex_scan(lex, error);
+    }
+
+    if (lex->token != '}') {
+        error_set(error, lex, json_error_invalid_syntax, "'}' expected");
+        return -1;
+    }
+
+    return 0;
 }
 
-json_t *json_load_file(const char *path, size_t flags, json_error_t *error) {
-    json_t *result;
-    FILE *fp;
+static int select_array(struct select_state *s, struct select_node *node,
+                        json_error_t *error) {
+    lex_t *lex = &s->lex;
+    size_t index = 0, last = 0;
+    struct select_node *child;
 
-    jsonp_error_init(error, path);
+    for (child = node->child; child; child = child->next) {
+        if (child->index != (size_t)-1 && child->index >= last)
+            last = child->index + 1;
+    }
 
-    if (path == NULL) {
-        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
-        return NULL;
+    if (select_peek(s) == ']') {
+        lex_scan(lex, error);
+        return 0;
     }
 
-    fp = fopen(path, "rb");
-    if (!fp) {
-        error_set(error, NULL, json_error_cannot_open_file, "unable to open %s: %s", path,
-                  strerror(errno));
-        return NULL;
+    while (1) {
+        /* Nothing is pointed to in the rest of the array */
+        if (index == last)
+            return select_skip(s, '[', error);
+
+        for (child = node->child; child; child = child->next) {
+            if (child->index == index)
+                break;
+        }
+
+        if (child) {
+            lex_scan(lex, error);
+            if (select_value(s, child, error))
+                return -1;
+        } else if (select_skip(s, 0, error))
+            return -1;
+        index++;
+
+        lex_scan(lex, error);
+        if (lex->token != ',')
+            break;
     }
 
-    result = json_loadf(fp, flags, error);
+    if (lex->token != ']') {
+        error_set(error, lex, json_error_invalid_syntax, "']' expected");
+        return -1;
+    }
 
-    fclose(fp);
-    return result;
+    return 0;
 }
 
-#define MAX_BUF_LEN 1024
+/* Walk the value starting with the current token, whose node is node */
+static int select_value(struct select_state *s, struct select_node *node,
+                        json_error_t *error) {
+    lex_t *lex = &s->lex;
+    int res;
 
-typedef struct {
-    char data[MAX_BUF_LEN];
-    size_t len;
-    size_t pos;
-    json_load_callback_t callback;
-    void *arg;
-} callback_data_t;
+    if (node->selected) {
+        node->value = parse_value(lex, s->flags, error);
+        if (!node->value)
+            return -1;
+        select_resolve(node);
+        return 0;
+    }
 
-static int callback_get(void *data) {
-    char c;
-    callback_data_t *stream = data;
+    if (lex->token == '{' || lex->token == '[') {
+        lex->depth++;
+        if (lex->depth > min(parse_max_depth(s->flags), JSON_PARSER_MAX_DEPTH)) {
+            error_set(error, lex, json_error_stack_overflow,
+                      "maximum parsing depth reached");
+            return -1;
+        }
 
-    if (stream->pos >= stream->len) {
-        stream->pos = 0;
-        stream->len = stream->callback(stream->data, MAX_BUF_LEN, stream->arg);
-        if (stream->len == 0 || stream->len == (size_t)-1)
-            return EOF;
+        if (!node->child)
+            res = select_skip(s, lex->token, error);
+        else if (lex->token == '{')
+            res = select_object(s, node, error);
+        else
+            res = select_array(s, node, error);
+
+        lex->depth--;
+        return res;
     }
 
-    c = stream->data[stream->pos];
-    stream->pos++;
-    return (unsigned char)c;
+    /* A scalar that can't hold what is pointed to */
+    {
+        json_t *value = parse_value(lex, s->flags, error);
+        if (!value)
+            return -1;
+        json_decref(value);
+        return 0;
+    }
 }
 
-json_t *json_load_callback(json_load_callback_t callback, void *arg, size_t flags,
-                           json_error_t *error) {
-    lex_t lex;
-    json_t *result;
+int json_loadb_select(const char *buffer, size_t buflen, size_t flags,
+                      const char *const *pointers, json_t **values, size_t count,
+                      json_error_t *error) {
+    struct select_state s;
+    struct select_node *root, **nodes = NULL;
+    size_t i;
+    int res = -1;
 
-    callback_data_t stream_data;
+    jsonp_error_init(error, "<buffer>");
 
-    memset(&stream_data, 0, sizeof(stream_data));
-    stream_data.callback = callback;
-    stream_data.arg = arg;
+    if (buffer == NULL || (count && (!pointers || !values))) {
+        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
+        return -1;
+    }
 
-    jsonp_error_init(error, "<callback>");
+    for (i = 0; i < count; i++)
+        values[i] = NULL;
 
-    if (callback == NULL) {
-        error_set(error, NULL, json_error_invalid_argument, "wrong arguments");
-        return NULL;
+    root = select_node_new("", 0);
+    if (count)
+        nodes = jsonp_malloc_as(count * sizeof(struct select_node *), json_memory_parser);
+    if (!root || (count && !nodes)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        goto out;
     }
 
-    if (lex_init(&lex, (get_func)callback_get, flags, &stream_data))
-        return NULL;
+    for (i = 0; i < count; i++) {
+        int added = pointers[i] ? select_node_add(root, pointers[i], &nodes[i]) : -1;
+        if (added == -1) {
+            error_set(error, NULL, json_error_invalid_argument,
+                      "invalid JSON Pointer '%s'", pointers[i] ? pointers[i] : "(null)");
+            goto out;
+        }
+        if (added == -2) {
+            error_set(error, NULL, json_error_out_of_memory, "out of memory");
+            goto out;
+        }
+    }
 
-    result = parse_json(&lex, flags, error);
+    if (lex_init(&s.lex, NULL, NULL, flags, NULL)) {
+        error_set(error, NULL, json_error_out_of_memory, "out of memory");
+        goto out;
+    }
+    stream_set_buffer(&s.lex.stream, buffer, buflen);
+    s.flags = flags;
+    s.skipped = 0;
+    s.lex.depth = 0;
+
+    lex_scan(&s.lex, error);
+    if (!(flags & JSON_DECODE_ANY) && s.lex.token != '[' && s.lex.token != '{')
+        error_set(error, &s.lex, json_error_invalid_syntax, "'[' or '{' expected");
+    else if (!select_value(&s, root, error)) {
+        res = 0;
+        if (!(flags & JSON_DISABLE_EOF_CHECK)) {
+            lex_scan(&s.lex, error);
+            if (s.lex.token != TOKEN_EOF) {
+                error_set(error, &s.lex, json_error_end_of_input_expected,
+                          "end of file expected");
+                res = -1;
+            }
+        }
+    }
 
-    lex_close(&lex);
-    return result;
+    if (error && s.skipped && res && error->line > 0) {
+        /* Count the lines and columns that were stepped over */
+        size_t position = error->position;
+        error->line = 1;
+        error->column = 0;
+        error->position = 0;
+        locate_error(error, buffer, position);
+    }
+    if (error && !res)
+        error->position = (int)s.lex.stream.position;
+
+    lex_close(&s.lex);
+
+    if (!res) {
+        for (i = 0; i < count; i++)
+            values[i] = json_incref(nodes[i]->value);
+    }
+
+out:
+    select_node_free(root);
+    jsonp_free(nodes);
+    return res;
 }
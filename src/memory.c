@@ -6,6 +6,10 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -20,26 +24,239 @@
 static json_malloc_t do_malloc = malloc;
 static json_free_t do_free = free;
 
-void *jsonp_malloc(size_t size) {
+/* The functions of json_set_alloc_funcs() behind the allocator
+   interface */
+static void *funcs_malloc(size_t size, void *ctx) {
+    (void)ctx;
+    return (*do_malloc)(size);
+}
+
+static void funcs_free(void *ptr, size_t size, void *ctx) {
+    (void)size;
+    (void)ctx;
+    (*do_free)(ptr);
+}
+
+static json_allocator_t global_allocator = {funcs_malloc, funcs_free, NULL};
+
+/* The allocator of a call like json_loadb_ex() in progress, NULL for
+   the global one. Without thread local storage, such calls must not
+   run in several threads at once. */
+#ifdef HAVE___THREAD
+static __thread const json_allocator_t *current_allocator = NULL;
+#else
+static const json_allocator_t *current_allocator = NULL;
+#endif
+
+const json_allocator_t *jsonp_current_allocator(void) { return current_allocator; }
+
+const json_allocator_t *jsonp_use_allocator(const json_allocator_t *allocator) {
+    const json_allocator_t *previous = current_allocator;
+    current_allocator = allocator;
+    return previous;
+}
+
+static void *raw_malloc(const json_allocator_t *allocator, size_t size) {
+    if (!allocator)
+        allocator = &global_allocator;
+    return allocator->malloc(size, allocator->ctx);
+}
+
+static void raw_free(const json_allocator_t *allocator, void *ptr, size_t size) {
+    if (!allocator)
+        allocator = &global_allocator;
+    allocator->free(ptr, size, allocator->ctx);
+}
+
+#ifdef USE_MEMORY_STATS
+
+/* Each block starts with its size and category, so that frees can be
+   counted too. The header keeps the alignment of malloc(). */
+typedef union {
+    struct {
+        size_t size;
+        enum json_memory_category category;
+    } info;
+    char align[16];
+} stats_header_t;
+
+static size_t stats_allocs[JSON_MEMORY_CATEGORIES];
+static size_t stats_frees[JSON_MEMORY_CATEGORIES];
+static size_t stats_bytes[JSON_MEMORY_CATEGORIES];
+static size_t stats_live = 0;
+static size_t stats_peak = 0;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define stats_add(var_, n_) __atomic_add_fetch(&(var_), (n_), __ATOMIC_RELAXED)
+#define stats_sub(var_, n_) __atomic_sub_fetch(&(var_), (n_), __ATOMIC_RELAXED)
+#define stats_raise(var_, old_, new_)                                                    \
+    __atomic_compare_exchange_n(&(var_), &(old_), (new_), 1, __ATOMIC_RELAXED,           \
+                                __ATOMIC_RELAXED)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define stats_add(var_, n_) __sync_add_and_fetch(&(var_), (n_))
+#define stats_sub(var_, n_) __sync_sub_and_fetch(&(var_), (n_))
+#define stats_raise(var_, old_, new_)                                                    \
+    (__sync_bool_compare_and_swap(&(var_), (old_), (new_)) || ((old_) = (var_), 0))
+#else
+#define stats_add(var_, n_)           ((var_) += (n_))
+#define stats_sub(var_, n_)           ((var_) -= (n_))
+#define stats_raise(var_, old_, new_) ((var_) = (new_), 1)
+#endif
+
+void jsonp_memory_count(enum json_memory_category category, size_t size, int freed) {
+    size_t live, peak;
+
+    if (freed) {
+        stats_add(stats_frees[category], 1);
+        stats_sub(stats_bytes[category], size);
+        stats_sub(stats_live, size);
+        return;
+    }
+
+    stats_add(stats_allocs[category], 1);
+    stats_add(stats_bytes[category], size);
+    live = stats_add(stats_live, size);
+
+    peak = stats_peak;
+    while (live > peak && !stats_raise(stats_peak, peak, live))
+        ;
+}
+
+void *jsonp_alloc(const json_allocator_t *allocator, size_t size,
+                  enum json_memory_category category) {
+    stats_header_t *header;
+
+    if (!size || size > (size_t)-1 - sizeof(stats_header_t))
+        return NULL;
+
+    header = raw_malloc(allocator, sizeof(stats_header_t) + size);
+    if (!header)
+        return NULL;
+
+    header->info.size = size;
+    header->info.category = category;
+    jsonp_memory_count(category, size, 0);
+    return header + 1;
+}
+
+/* The header knows the size even if the caller doesn't */
+void jsonp_dealloc(const json_allocator_t *allocator, void *ptr, size_t size) {
+    stats_header_t *header;
+
+    if (!ptr)
+        return;
+
+    header = (stats_header_t *)ptr - 1;
+    size = header->info.size;
+    jsonp_memory_count(header->info.category, size, 1);
+    raw_free(allocator, header, sizeof(stats_header_t) + size);
+}
+
+/* The caller frees the result without knowing about the header */
+char *jsonp_disown(void *ptr) {
+    stats_header_t *header;
+    size_t size;
+
+    if (!ptr)
+        return NULL;
+
+    header = (stats_header_t *)ptr - 1;
+    size = header->info.size;
+    jsonp_memory_count(header->info.category, size, 1);
+    memmove(header, ptr, size);
+    return (char *)header;
+}
+
+int json_memory_stats(json_memory_stats_t *stats) {
+    size_t i;
+
+    if (!stats)
+        return -1;
+
+    for (i = 0; i < JSON_MEMORY_CATEGORIES; i++) {
+        stats->allocs[i] = stats_allocs[i];
+        stats->frees[i] = stats_frees[i];
+        stats->bytes[i] = stats_bytes[i];
+    }
+    stats->live_bytes = stats_live;
+    stats->peak_bytes = stats_peak;
+    return 0;
+}
+
+void json_memory_stats_reset(void) {
+    size_t i;
+
+    for (i = 0; i < JSON_MEMORY_CATEGORIES; i++) {
+        stats_allocs[i] = 0;
+        stats_frees[i] = 0;
+    }
+    stats_peak = stats_live;
+}
+
+#else
+
+void *jsonp_alloc(const json_allocator_t *allocator, size_t size,
+                  enum json_memory_category category) {
+    (void)category;
     if (!size)
         return NULL;
 
-    return (*do_malloc)(size);
+    return raw_malloc(allocator, size);
 }
 
-void jsonp_free(void *ptr) {
+void jsonp_dealloc(const json_allocator_t *allocator, void *ptr, size_t size) {
     if (!ptr)
         return;
 
-    (*do_free)(ptr);
+    raw_free(allocator, ptr, size);
+}
+
+char *jsonp_disown(void *ptr) { return ptr; }
+
+int json_memory_stats(json_memory_stats_t *stats) {
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+    return -1;
+}
+
+void json_memory_stats_reset(void) {}
+
+#endif
+
+void *jsonp_malloc(size_t size) { return jsonp_malloc_as(size, json_memory_other); }
+
+void *jsonp_malloc_as(size_t size, enum json_memory_category category) {
+    return jsonp_alloc(current_allocator, size, category);
+}
+
+void jsonp_free(void *ptr) { jsonp_dealloc(current_allocator, ptr, 0); }
+
+/* Memory without a header, which is never released or comes from
+   the caller. It's always from the global allocator. */
+void *jsonp_malloc_untracked(size_t size) {
+    if (!size)
+        return NULL;
+
+    return raw_malloc(NULL, size);
+}
+
+void jsonp_free_untracked(void *ptr) {
+    if (!ptr)
+        return;
+
+    raw_free(NULL, ptr, 0);
 }
 
 char *jsonp_strdup(const char *str) { return jsonp_strndup(str, strlen(str)); }
 
 char *jsonp_strndup(const char *str, size_t len) {
+    return jsonp_strndup_as(str, len, json_memory_other);
+}
+
+char *jsonp_strndup_as(const char *str, size_t len, enum json_memory_category category) {
     char *new_str;
 
-    new_str = jsonp_malloc(len + 1);
+    new_str = jsonp_malloc_as(len + 1, category);
     if (!new_str)
         return NULL;
 
@@ -51,11 +268,29 @@ char *jsonp_strndup(const char *str, size_t len) {
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn) {
     do_malloc = malloc_fn;
     do_free = free_fn;
+    global_allocator.malloc = funcs_malloc;
+    global_allocator.free = funcs_free;
+    global_allocator.ctx = NULL;
 }
 
 void json_get_alloc_funcs(json_malloc_t *malloc_fn, json_free_t *free_fn) {
+    int funcs = global_allocator.malloc == funcs_malloc;
+
     if (malloc_fn)
-        *malloc_fn = do_malloc;
+        *malloc_fn = funcs ? do_malloc : NULL;
     if (free_fn)
-        *free_fn = do_free;
+        *free_fn = funcs ? do_free : NULL;
+}
+
+void json_set_allocator(const json_allocator_t *allocator) {
+    if (!allocator || !allocator->malloc || !allocator->free) {
+        json_set_alloc_funcs(malloc, free);
+        return;
+    }
+    global_allocator = *allocator;
+}
+
+void json_get_allocator(json_allocator_t *allocator) {
+    if (allocator)
+        *allocator = global_allocator;
 }
@@ -9,6 +9,7 @@
 #include "jansson.h"
 #include "jansson_private.h"
 #include "utf.h"
+#include <stddef.h>
 #include <string.h>
 
 typedef struct {
@@ -16,11 +17,16 @@ typedef struct {
     int column;
     size_t pos;
     char token;
+    /* Set on the '{' of a compiled unpack format if the object isn't
+       checked for unpacked keys */
+    char unchecked;
 } token_t;
 
 typedef struct {
     const char *start;
     const char *fmt;
+    /* Next token of a compiled format, or NULL */
+    const token_t *plan;
     token_t prev_token;
     token_t token;
     token_t next_token;
@@ -30,12 +36,31 @@ typedef struct {
     int column;
     size_t pos;
     int has_error;
+    /* A format is being compiled, and there are no arguments */
+    int dry_run;
+    /* Values are written here instead of being built, see write_done() */
+    json_writer_t *writer;
+    /* The key of the object member being packed, written before its
+       value */
+    const char *key;
+    size_t key_len;
 } scanner_t;
 
+struct json_plan_t {
+    size_t flags;
+    int pack;
+    token_t tokens[1];
+};
+
 #define token(scanner) ((scanner)->token.token)
 
-static const char *const type_names[] = {"object", "array", "string", "integer",
-                                         "real",   "true",  "false",  "null"};
+/* Read the next argument, or use a stand-in in a dry run. Unpack
+   targets are never written to without a value to unpack. */
+#define next_arg(scanner, ap, type_, dry_value)                                          \
+    ((scanner)->dry_run ? (dry_value) : va_arg(*(ap), type_))
+
+static const char *const type_names[] = {"object", "array", "string", "integer", "real",
+                                         "true",   "false", "null",   "raw"};
 
 #define type_name(x) type_names[json_typeof(x)]
 
@@ -46,6 +71,7 @@ static void scanner_init(scanner_t *s, json_error_t *error, size_t flags,
     s->error = error;
     s->flags = flags;
     s->fmt = s->start = fmt;
+    s->plan = NULL;
     memset(&s->prev_token, 0, sizeof(token_t));
     memset(&s->token, 0, sizeof(token_t));
     memset(&s->next_token, 0, sizeof(token_t));
@@ -53,6 +79,10 @@ static void scanner_init(scanner_t *s, json_error_t *error, size_t flags,
     s->column = 0;
     s->pos = 0;
     s->has_error = 0;
+    s->dry_run = 0;
+    s->writer = NULL;
+    s->key = NULL;
+    s->key_len = 0;
 }
 
 static void next_token(scanner_t *s) {
@@ -65,6 +95,14 @@ static void next_token(scanner_t *s) {
         return;
     }
 
+    if (s->plan) {
+        /* The last token is the end of the format */
+        s->token = *s->plan;
+        if (s->plan->token)
+            s->plan++;
+        return;
+    }
+
     if (!token(s) && !*s->fmt)
         return;
 
@@ -112,6 +150,31 @@ static void set_error(scanner_t *s, const char *source, enum json_error_code cod
     va_end(ap);
 }
 
+/* Finish writing a value, res being the result of the writer call.
+   Nothing is built in writer mode, so json_null() stands in for each
+   value written. */
+static json_t *write_done(scanner_t *s, int res) {
+    if (res) {
+        set_error(s, "<internal>", json_error_aborted, "Unable to write value");
+        s->has_error = 1;
+        return NULL;
+    }
+    return json_null();
+}
+
+/* Write the key of the object member being packed, if any. After an
+   error nothing is written, but the format and the arguments are still
+   consumed as usual. */
+static int write_key(scanner_t *s) {
+    const char *key = s->key;
+
+    if (s->has_error)
+        return -1;
+
+    s->key = NULL;
+    return key ? json_writer_keyn(s->writer, key, s->key_len) : 0;
+}
+
 static json_t *pack(scanner_t *s, va_list *ap);
 
 /* ours will be set to 1 if jsonp_free() must be called for the result
@@ -130,7 +193,7 @@ static char *read_string(scanner_t *s, va_list *ap, const char *purpose, size_t
     *ours = 0;
     if (t != '#' && t != '%' && t != '+') {
         /* Optimize the simple case */
-        str = va_arg(*ap, const char *);
+        str = next_arg(s, ap, const char *, "");
 
         if (!str) {
             if (!optional) {
@@ -164,7 +227,7 @@ static char *read_string(scanner_t *s, va_list *ap, const char *purpose, size_t
     }
 
     while (1) {
-        str = va_arg(*ap, const char *);
+        str = next_arg(s, ap, const char *, "");
         if (!str) {
             set_error(s, "<args>", json_error_null_value, "NULL %s", purpose);
             s->has_error = 1;
@@ -173,9 +236,9 @@ static char *read_string(scanner_t *s, va_list *ap, const char *purpose, size_t
         next_token(s);
 
         if (token(s) == '#') {
-            length = va_arg(*ap, int);
+            length = next_arg(s, ap, int, 0);
         } else if (token(s) == '%') {
-            length = va_arg(*ap, size_t);
+            length = next_arg(s, ap, size_t, 0);
         } else {
             prev_token(s);
             length = s->has_error ? 0 : strlen(str);
@@ -211,7 +274,12 @@ static char *read_string(scanner_t *s, va_list *ap, const char *purpose, size_t
 }
 
 static json_t *pack_object(scanner_t *s, va_list *ap) {
-    json_t *object = json_object();
+    json_t *object = NULL;
+
+    if (!s->writer)
+        object = json_object();
+    else if (write_key(s) || json_writer_begin_object(s->writer))
+        write_done(s, -1);
     next_token(s);
 
     while (token(s) != '}') {
@@ -241,7 +309,12 @@ static json_t *pack_object(scanner_t *s, va_list *ap) {
         valueOptional = token(s);
         prev_token(s);
 
+        /* The key is written with the value, so that it's left out
+           with an omitted value */
+        s->key = key;
+        s->key_len = len;
         value = pack(s, ap);
+        s->key = NULL;
         if (!value) {
             if (ours)
                 jsonp_free(key);
@@ -258,7 +331,8 @@ static json_t *pack_object(scanner_t *s, va_list *ap) {
         if (s->has_error)
             json_decref(value);
 
-        if (!s->has_error && json_object_set_new_nocheck(object, key, value)) {
+        if (!s->has_error && !s->writer &&
+            json_object_set_new_nocheck(object, key, value)) {
             set_error(s, "<internal>", json_error_out_of_memory,
                       "Unable to add key \"%s\"", key);
             s->has_error = 1;
@@ -270,6 +344,9 @@ static json_t *pack_object(scanner_t *s, va_list *ap) {
         next_token(s);
     }
 
+    if (s->writer && !s->has_error)
+        return write_done(s, json_writer_end_object(s->writer));
+
     if (!s->has_error)
         return object;
 
@@ -279,7 +356,12 @@ error:
 }
 
 static json_t *pack_array(scanner_t *s, va_list *ap) {
-    json_t *array = json_array();
+    json_t *array = NULL;
+
+    if (!s->writer)
+        array = json_array();
+    else if (write_key(s) || json_writer_begin_array(s->writer))
+        write_done(s, -1);
     next_token(s);
 
     while (token(s) != ']') {
@@ -310,7 +392,7 @@ static json_t *pack_array(scanner_t *s, va_list *ap) {
         if (s->has_error)
             json_decref(value);
 
-        if (!s->has_error && json_array_append_new(array, value)) {
+        if (!s->has_error && !s->writer && json_array_append_new(array, value)) {
             set_error(s, "<internal>", json_error_out_of_memory,
                       "Unable to append to array");
             s->has_error = 1;
@@ -319,6 +401,9 @@ static json_t *pack_array(scanner_t *s, va_list *ap) {
         next_token(s);
     }
 
+    if (s->writer && !s->has_error)
+        return write_done(s, json_writer_end_array(s->writer));
+
     if (!s->has_error)
         return array;
 
@@ -327,6 +412,18 @@ error:
     return NULL;
 }
 
+static json_t *pack_null(scanner_t *s) {
+    if (s->writer)
+        return write_done(s, write_key(s) || json_writer_null(s->writer));
+    return json_null();
+}
+
+static json_t *pack_boolean(scanner_t *s, int value) {
+    if (s->writer)
+        return write_done(s, write_key(s) || json_writer_boolean(s->writer, value));
+    return value ? json_true() : json_false();
+}
+
 static json_t *pack_string(scanner_t *s, va_list *ap) {
     char *str;
     char t;
@@ -343,13 +440,27 @@ static json_t *pack_string(scanner_t *s, va_list *ap) {
     str = read_string(s, ap, "string", &len, &ours, optional);
 
     if (!str)
-        return t == '?' && !s->has_error ? json_null() : NULL;
+        return t == '?' && !s->has_error ? pack_null(s) : NULL;
 
     if (s->has_error) {
         /* It's impossible to reach this point if ours != 0, do not free str. */
         return NULL;
     }
 
+    if (s->writer) {
+        json_t *result = write_done(
+            s, write_key(s) || json_writer_stringn(s->writer, str, len));
+        if (ours)
+            jsonp_free(str);
+        return result;
+    }
+
+    if (len == 0 && (s->flags & JSON_SHARE_VALUES)) {
+        if (ours)
+            jsonp_free(str);
+        return jsonp_shared_empty_string();
+    }
+
     if (ours)
         return jsonp_stringn_nocheck_own(str, len);
 
@@ -366,14 +477,23 @@ static json_t *pack_object_inter(scanner_t *s, va_list *ap, int need_incref) {
     if (ntoken != '?' && ntoken != '*')
         prev_token(s);
 
-    json = va_arg(*ap, json_t *);
+    json = next_arg(s, ap, json_t *, json_null());
+
+    if (json && s->writer) {
+        json_t *result = NULL;
+        if (!s->has_error)
+            result = write_done(s, write_key(s) || json_writer_value(s->writer, json));
+        if (!need_incref)
+            json_decref(json);
+        return result;
+    }
 
     if (json)
         return need_incref ? json_incref(json) : json;
 
     switch (ntoken) {
         case '?':
-            return json_null();
+            return pack_null(s);
         case '*':
             return NULL;
         default:
@@ -386,7 +506,15 @@ static json_t *pack_object_inter(scanner_t *s, va_list *ap, int need_incref) {
 }
 
 static json_t *pack_integer(scanner_t *s, json_int_t value) {
-    json_t *json = json_integer(value);
+    json_t *json;
+
+    if (s->writer)
+        return write_done(s, write_key(s) || json_writer_integer(s->writer, value));
+
+    if (s->flags & JSON_SHARE_VALUES)
+        json = jsonp_shared_integer(NULL, value);
+    else
+        json = json_integer(value);
 
     if (!json) {
         set_error(s, "<internal>", json_error_out_of_memory, "Out of memory");
@@ -397,9 +525,21 @@ static json_t *pack_integer(scanner_t *s, json_int_t value) {
 }
 
 static json_t *pack_real(scanner_t *s, double value) {
-    /* Allocate without setting value so we can identify OOM error. */
-    json_t *json = json_real(0.0);
+    json_t *json;
+
+    if (s->writer) {
+        /* value - value is NaN for infinities and NaN */
+        if (value - value != 0.0) {
+            set_error(s, "<args>", json_error_numeric_overflow,
+                      "Invalid floating point value");
+            s->has_error = 1;
+            return NULL;
+        }
+        return write_done(s, write_key(s) || json_writer_real(s->writer, value));
+    }
 
+    /* Allocate without setting value so we can identify OOM error. */
+    json = json_real(0.0);
     if (!json) {
         set_error(s, "<internal>", json_error_out_of_memory, "Out of memory");
         s->has_error = 1;
@@ -432,19 +572,19 @@ static json_t *pack(scanner_t *s, va_list *ap) {
             return pack_string(s, ap);
 
         case 'n': /* null */
-            return json_null();
+            return pack_null(s);
 
         case 'b': /* boolean */
-            return va_arg(*ap, int) ? json_true() : json_false();
+            return pack_boolean(s, next_arg(s, ap, int, 0));
 
         case 'i': /* integer from int */
-            return pack_integer(s, va_arg(*ap, int));
+            return pack_integer(s, next_arg(s, ap, int, 0));
 
         case 'I': /* integer from json_int_t */
-            return pack_integer(s, va_arg(*ap, json_int_t));
+            return pack_integer(s, next_arg(s, ap, json_int_t, 0));
 
         case 'f': /* real */
-            return pack_real(s, va_arg(*ap, double));
+            return pack_real(s, next_arg(s, ap, double, 0.0));
 
         case 'O': /* a json_t object; increments refcount */
             return pack_object_inter(s, ap, 1);
@@ -466,6 +606,7 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
     int ret = -1;
     int strict = 0;
     int gotopt = 0;
+    int unchecked = s->token.unchecked;
 
     /* Use a set (emulated by a hashtable) to check that all object
        keys are accessed. Checking that the correct number of keys
@@ -516,7 +657,7 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
             goto out;
         }
 
-        key = va_arg(*ap, const char *);
+        key = next_arg(s, ap, const char *, "");
         if (!key) {
             set_error(s, "<args>", json_error_null_value, "NULL object key");
             goto out;
@@ -544,7 +685,8 @@ static int unpack_object(scanner_t *s, json_t *root, va_list *ap) {
         if (unpack(s, value, ap))
             goto out;
 
-        hashtable_set(&key_set, key, strlen(key), json_null());
+        if (!unchecked)
+            hashtable_set(&key_set, key, strlen(key), json_null());
         next_token(s);
     }
 
@@ -685,8 +827,8 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
                 const char **str_target;
                 size_t *len_target = NULL;
 
-                str_target = va_arg(*ap, const char **);
-                if (!str_target) {
+                str_target = next_arg(s, ap, const char **, NULL);
+                if (!str_target && !s->dry_run) {
                     set_error(s, "<args>", json_error_null_value, "NULL string argument");
                     return -1;
                 }
@@ -694,8 +836,8 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
                 next_token(s);
 
                 if (token(s) == '%') {
-                    len_target = va_arg(*ap, size_t *);
-                    if (!len_target) {
+                    len_target = next_arg(s, ap, size_t *, NULL);
+                    if (!len_target && !s->dry_run) {
                         set_error(s, "<args>", json_error_null_value,
                                   "NULL string length argument");
                         return -1;
@@ -719,7 +861,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
             }
 
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                int *target = va_arg(*ap, int *);
+                int *target = next_arg(s, ap, int *, NULL);
                 if (root)
                     *target = (int)json_integer_value(root);
             }
@@ -734,7 +876,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
             }
 
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                json_int_t *target = va_arg(*ap, json_int_t *);
+                json_int_t *target = next_arg(s, ap, json_int_t *, NULL);
                 if (root)
                     *target = json_integer_value(root);
             }
@@ -749,7 +891,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
             }
 
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                int *target = va_arg(*ap, int *);
+                int *target = next_arg(s, ap, int *, NULL);
                 if (root)
                     *target = json_is_true(root);
             }
@@ -764,7 +906,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
             }
 
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                double *target = va_arg(*ap, double *);
+                double *target = next_arg(s, ap, double *, NULL);
                 if (root)
                     *target = json_real_value(root);
             }
@@ -779,7 +921,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
             }
 
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                double *target = va_arg(*ap, double *);
+                double *target = next_arg(s, ap, double *, NULL);
                 if (root)
                     *target = json_number_value(root);
             }
@@ -793,7 +935,7 @@ static int unpack(scanner_t *s, json_t *root, va_list *ap) {
 
         case 'o':
             if (!(s->flags & JSON_VALIDATE_ONLY)) {
-                json_t **target = va_arg(*ap, json_t **);
+                json_t **target = next_arg(s, ap, json_t **, NULL);
                 if (root)
                     *target = root;
             }
@@ -873,6 +1015,124 @@ json_t *json_pack(const char *fmt, ...) {
     return value;
 }
 
+/* json_pack_ex() already names the variant with flags */
+json_t *json_vpack_alloc(const json_allocator_t *allocator, json_error_t *error,
+                         size_t flags, const char *fmt, va_list ap) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *value = json_vpack_ex(error, flags, fmt, ap);
+
+    jsonp_use_allocator(previous);
+    return value;
+}
+
+json_t *json_pack_alloc(const json_allocator_t *allocator, json_error_t *error,
+                        size_t flags, const char *fmt, ...) {
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, fmt);
+    value = json_vpack_alloc(allocator, error, flags, fmt, ap);
+    va_end(ap);
+
+    return value;
+}
+
+int json_writer_vpack(json_writer_t *writer, json_error_t *error, const char *fmt,
+                      va_list ap) {
+    scanner_t s;
+    va_list ap_copy;
+    json_t *value;
+
+    if (!writer) {
+        jsonp_error_init(error, "<writer>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL writer");
+        return -1;
+    }
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return -1;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, 0, fmt);
+    s.writer = writer;
+    next_token(&s);
+
+    va_copy(ap_copy, ap);
+    value = pack(&s, &ap_copy);
+    va_end(ap_copy);
+
+    if (!value)
+        return -1;
+
+    next_token(&s);
+    if (token(&s)) {
+        set_error(&s, "<format>", json_error_invalid_format,
+                  "Garbage after format string");
+        return -1;
+    }
+
+    return 0;
+}
+
+int json_writer_pack(json_writer_t *writer, json_error_t *error, const char *fmt, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = json_writer_vpack(writer, error, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static int dump_to_strbuffer(const char *buffer, size_t size, void *data) {
+    return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+}
+
+char *json_vpack_dumps(json_error_t *error, size_t flags, const char *fmt, va_list ap) {
+    strbuffer_t strbuff;
+    json_writer_t *writer;
+    int ret;
+
+    if (strbuffer_init(&strbuff)) {
+        jsonp_error_init(error, "<internal>");
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+
+    writer = json_writer_create(dump_to_strbuffer, &strbuff, flags);
+    if (!writer) {
+        strbuffer_close(&strbuff);
+        jsonp_error_init(error, "<internal>");
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        return NULL;
+    }
+
+    /* The writer passes the output on when the value is complete */
+    ret = json_writer_vpack(writer, error, fmt, ap);
+    json_writer_destroy(writer);
+
+    if (ret) {
+        strbuffer_close(&strbuff);
+        return NULL;
+    }
+    return jsonp_disown(strbuffer_steal_value(&strbuff));
+}
+
+char *json_pack_dumps(json_error_t *error, size_t flags, const char *fmt, ...) {
+    char *result;
+    va_list ap;
+
+    va_start(ap, fmt);
+    result = json_vpack_dumps(error, flags, fmt, ap);
+    va_end(ap);
+
+    return result;
+}
+
 int json_vunpack_ex(json_t *root, json_error_t *error, size_t flags, const char *fmt,
                     va_list ap) {
     scanner_t s;
@@ -934,3 +1194,188 @@ int json_unpack(json_t *root, const char *fmt, ...) {
 
     return ret;
 }
+
+/* Mark the objects of an unpack format whose keys don't need to be
+   remembered, because they aren't checked for unpacked keys */
+static void plan_mark_unchecked(json_plan_t *plan) {
+    token_t *t, *end;
+
+    for (t = plan->tokens; t->token; t++) {
+        int depth = 0, strict;
+
+        if (t->token != '{')
+            continue;
+
+        for (end = t; end->token; end++) {
+            if (end->token == '{')
+                depth++;
+            else if (end->token == '}' && --depth == 0)
+                break;
+        }
+
+        /* The format is valid, so a strictness marker can only be just
+           before the end of the object */
+        if (end[-1].token == '!')
+            strict = 1;
+        else if (end[-1].token == '*')
+            strict = -1;
+        else
+            strict = (plan->flags & JSON_STRICT) ? 1 : 0;
+        t->unchecked = strict != 1;
+    }
+}
+
+static json_plan_t *plan_compile(json_error_t *error, size_t flags, const char *fmt,
+                                 int pack_plan) {
+    scanner_t s;
+    json_plan_t *plan;
+    size_t count = 1, i;
+    int failed;
+
+    if (!fmt || !*fmt) {
+        jsonp_error_init(error, "<format>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or empty format string");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    /* Tokenize the format once, including its end */
+    scanner_init(&s, error, flags, fmt);
+    for (next_token(&s); token(&s); next_token(&s))
+        count++;
+
+    plan = jsonp_malloc(offsetof(json_plan_t, tokens) + count * sizeof(token_t));
+    if (!plan) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "Out of memory");
+        jsonp_error_set_source(error, "<internal>");
+        return NULL;
+    }
+    plan->flags = flags;
+    plan->pack = pack_plan;
+
+    scanner_init(&s, error, flags, fmt);
+    for (i = 0; i < count; i++) {
+        next_token(&s);
+        plan->tokens[i] = s.token;
+    }
+
+    /* Check the format by packing or unpacking without arguments, so
+       that format errors are reported as they would be later */
+    scanner_init(&s, error, flags, "");
+    s.plan = plan->tokens;
+    s.dry_run = 1;
+    next_token(&s);
+
+    if (pack_plan) {
+        json_t *value = pack(&s, NULL);
+        failed = !value;
+        json_decref(value);
+    } else
+        failed = unpack(&s, NULL, NULL);
+
+    if (!failed) {
+        next_token(&s);
+        if (token(&s)) {
+            set_error(&s, "<format>", json_error_invalid_format,
+                      "Garbage after format string");
+            failed = 1;
+        }
+    }
+
+    if (failed) {
+        jsonp_free(plan);
+        return NULL;
+    }
+
+    if (!pack_plan)
+        plan_mark_unchecked(plan);
+    return plan;
+}
+
+json_plan_t *json_pack_compile(json_error_t *error, size_t flags, const char *fmt) {
+    return plan_compile(error, flags, fmt, 1);
+}
+
+json_plan_t *json_unpack_compile(json_error_t *error, size_t flags, const char *fmt) {
+    return plan_compile(error, flags, fmt, 0);
+}
+
+void json_plan_destroy(json_plan_t *plan) { jsonp_free(plan); }
+
+json_t *json_vpack_plan(json_error_t *error, const json_plan_t *plan, va_list ap) {
+    scanner_t s;
+    va_list ap_copy;
+    json_t *value;
+
+    if (!plan || !plan->pack) {
+        jsonp_error_init(error, "<plan>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or unpack plan");
+        return NULL;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, plan->flags, "");
+    s.plan = plan->tokens;
+    next_token(&s);
+
+    va_copy(ap_copy, ap);
+    value = pack(&s, &ap_copy);
+    va_end(ap_copy);
+
+    return value;
+}
+
+json_t *json_pack_plan(json_error_t *error, const json_plan_t *plan, ...) {
+    json_t *value;
+    va_list ap;
+
+    va_start(ap, plan);
+    value = json_vpack_plan(error, plan, ap);
+    va_end(ap);
+
+    return value;
+}
+
+int json_vunpack_plan(json_t *root, json_error_t *error, const json_plan_t *plan,
+                      va_list ap) {
+    scanner_t s;
+    va_list ap_copy;
+    int ret;
+
+    if (!root) {
+        jsonp_error_init(error, "<root>");
+        jsonp_error_set(error, -1, -1, 0, json_error_null_value, "NULL root value");
+        return -1;
+    }
+
+    if (!plan || plan->pack) {
+        jsonp_error_init(error, "<plan>");
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        "NULL or pack plan");
+        return -1;
+    }
+    jsonp_error_init(error, NULL);
+
+    scanner_init(&s, error, plan->flags, "");
+    s.plan = plan->tokens;
+    next_token(&s);
+
+    va_copy(ap_copy, ap);
+    ret = unpack(&s, root, &ap_copy);
+    va_end(ap_copy);
+
+    return ret;
+}
+
+int json_unpack_plan(json_t *root, json_error_t *error, const json_plan_t *plan, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, plan);
+    ret = json_vunpack_plan(root, error, plan, ap);
+    va_end(ap);
+
+    return ret;
+}
@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "jansson_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+
+/* JSON Pointer (RFC 6901). A pointer is a list of reference tokens,
+   each of them preceded by a '/'. In the tokens, "~1" stands for '/'
+   and "~0" for '~'. */
+
+/* A reference token, with the escapes replaced */
+typedef struct {
+    const char *key;
+    size_t key_len;
+    size_t index;       /* NO_INDEX if not an array index */
+    json_key_t *handle; /* the key with its hash, in compiled pointers */
+} token_t;
+
+#define NO_INDEX  ((size_t)-1)
+#define END_INDEX ((size_t)-2) /* "-", the position after the last element */
+
+struct json_pointer_t {
+    size_t count;
+    token_t tokens[1];
+};
+
+/* Compiled pointers sorted by their tokens, so that each pointer shares
+   a prefix with the previous one, which is resolved only once */
+struct json_pointer_batch_t {
+    size_t count;
+    size_t depth; /* the most tokens of a pointer */
+    json_pointer_t **pointers;
+    size_t *order;  /* positions of the pointers in the input */
+    size_t *shared; /* tokens in common with the previous pointer */
+};
+
+/*** parsing ***/
+
+#define SCANNER_INLINE 64
+
+typedef struct {
+    const char *start;
+    const char *pos; /* at the '/' of the next token, or end */
+    const char *end;
+    char *buffer; /* for keys with escapes */
+    size_t buffer_size;
+    char inline_buffer[SCANNER_INLINE];
+} scanner_t;
+
+/* Returns 0 if pointer is not a pointer */
+static int scanner_init(scanner_t *s, const char *pointer) {
+    if (!pointer || (*pointer && *pointer != '/'))
+        return 0;
+
+    s->start = pointer;
+    s->pos = pointer;
+    s->end = pointer + strlen(pointer);
+    s->buffer = s->inline_buffer;
+    s->buffer_size = SCANNER_INLINE;
+    return 1;
+}
+
+static void scanner_close(scanner_t *s) {
+    if (s->buffer != s->inline_buffer)
+        jsonp_free(s->buffer);
+}
+
+#define scanner_at_end(s_) ((s_)->pos == (s_)->end)
+
+/* Array indexes are "0" or have no leading zeros */
+static size_t parse_index(const char *token, size_t len) {
+    size_t index = 0, i;
+
+    if (len == 1 && token[0] == '-')
+        return END_INDEX;
+    if (len == 0 || (token[0] == '0' && len > 1))
+        return NO_INDEX;
+
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9')
+            return NO_INDEX;
+        if (index > (END_INDEX - 1 - (size_t)(token[i] - '0')) / 10)
+            return NO_INDEX;
+        index = index * 10 + (size_t)(token[i] - '0');
+    }
+    return index;
+}
+
+/* The key stays valid until the next token is read. Returns 1 if a
+   token was read, 0 at the end and -1 on error. */
+static int scanner_next(scanner_t *s, token_t *token, json_error_t *error) {
+    const char *begin, *p;
+    char *key;
+    size_t len;
+
+    if (scanner_at_end(s))
+        return 0;
+
+    begin = s->pos + 1;
+    p = begin;
+    while (p < s->end && *p != '/')
+        p++;
+    len = (size_t)(p - begin);
+    s->pos = p;
+
+    token->handle = NULL;
+    if (!memchr(begin, '~', len)) {
+        token->key = begin;
+        token->key_len = len;
+        token->index = parse_index(begin, len);
+        return 1;
+    }
+
+    if (len > s->buffer_size) {
+        key = jsonp_malloc(len);
+        if (!key) {
+            jsonp_error_set(error, -1, -1, (size_t)(begin - s->start),
+                            json_error_out_of_memory, "out of memory");
+            return -1;
+        }
+        scanner_close(s);
+        s->buffer = key;
+        s->buffer_size = len;
+    }
+
+    key = s->buffer;
+    for (p = begin; p < s->pos; p++) {
+        if (*p != '~') {
+            *key++ = *p;
+            continue;
+        }
+        if (p + 1 == s->pos || (p[1] != '0' && p[1] != '1')) {
+            jsonp_error_set(error, -1, -1, (size_t)(p - s->start),
+                            json_error_invalid_syntax,
+                            "'~' must be followed by '0' or '1'");
+            return -1;
+        }
+        *key++ = p[1] == '0' ? '~' : '/';
+        p++;
+    }
+
+    /* An escape is never part of an array index */
+    token->key = s->buffer;
+    token->key_len = (size_t)(key - s->buffer);
+    token->index = NO_INDEX;
+    return 1;
+}
+
+/*** evaluation ***/
+
+static json_t *token_get(const json_t *json, const token_t *token) {
+    if (json_is_object(json)) {
+        if (token->handle)
+            return json_object_get_key(json, token->handle);
+        return json_object_getn(json, token->key, token->key_len);
+    }
+    if (json_is_array(json) && token->index < json_array_size(json))
+        return json_array_get(json, token->index);
+    return NULL;
+}
+
+/* Steals the reference to value */
+static int token_set(json_t *json, const token_t *token, json_t *value) {
+    size_t size;
+
+    if (json_is_object(json)) {
+        if (token->handle)
+            return json_object_set_key_new(json, token->handle, value);
+        return json_object_setn_new(json, token->key, token->key_len, value);
+    }
+
+    if (json_is_array(json)) {
+        size = json_array_size(json);
+        if (token->index == END_INDEX || token->index == size)
+            return json_array_append_new(json, value);
+        if (token->index < size)
+            return json_array_set_new(json, token->index, value);
+    }
+
+    json_decref(value);
+    return -1;
+}
+
+static int token_del(json_t *json, const token_t *token) {
+    if (json_is_object(json))
+        return json_object_deln(json, token->key, token->key_len);
+    if (json_is_array(json) && token->index < json_array_size(json))
+        return json_array_remove(json, token->index);
+    return -1;
+}
+
+/* Return the value that the last token refers to a member of, and
+   the last token in token */
+static json_t *scan_parent(json_t *root, scanner_t *s, token_t *token) {
+    json_t *json = root;
+
+    if (scanner_next(s, token, NULL) != 1)
+        return NULL;
+
+    while (!scanner_at_end(s)) {
+        json = token_get(json, token);
+        if (!json || scanner_next(s, token, NULL) != 1)
+            return NULL;
+    }
+    return json;
+}
+
+static json_t *compiled_parent(json_t *root, const json_pointer_t *pointer) {
+    json_t *json = root;
+    size_t i;
+
+    if (!pointer || !pointer->count)
+        return NULL;
+
+    for (i = 0; json && i < pointer->count - 1; i++)
+        json = token_get(json, &pointer->tokens[i]);
+    return json;
+}
+
+json_t *json_pointer_get(const json_t *root, const char *pointer) {
+    json_t *json = (json_t *)root;
+    scanner_t s;
+    token_t token;
+    int result = 0;
+
+    if (!root || !scanner_init(&s, pointer))
+        return NULL;
+
+    while (json && (result = scanner_next(&s, &token, NULL)) == 1)
+        json = token_get(json, &token);
+
+    scanner_close(&s);
+    return result < 0 ? NULL : json;
+}
+
+int json_pointer_set_new(json_t *root, const char *pointer, json_t *value) {
+    json_t *parent;
+    scanner_t s;
+    token_t token;
+    int result;
+
+    if (!value)
+        return -1;
+
+    if (!root || !scanner_init(&s, pointer)) {
+        json_decref(value);
+        return -1;
+    }
+
+    parent = scan_parent(root, &s, &token);
+    if (parent) {
+        result = token_set(parent, &token, value);
+    } else {
+        json_decref(value);
+        result = -1;
+    }
+
+    scanner_close(&s);
+    return result;
+}
+
+int json_pointer_del(json_t *root, const char *pointer) {
+    json_t *parent;
+    scanner_t s;
+    token_t token;
+    int result = -1;
+
+    if (!root || !scanner_init(&s, pointer))
+        return -1;
+
+    parent = scan_parent(root, &s, &token);
+    if (parent)
+        result = token_del(parent, &token);
+
+    scanner_close(&s);
+    return result;
+}
+
+/*** compiled pointers ***/
+
+json_pointer_t *json_pointer_compile(const char *pointer, json_error_t *error) {
+    json_pointer_t *compiled;
+    const char *p;
+    size_t count = 0;
+    scanner_t s;
+    token_t *token;
+    int result;
+
+    jsonp_error_init(error, "<pointer>");
+    if (!scanner_init(&s, pointer)) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument,
+                        pointer ? "a pointer must start with '/'" : "NULL pointer");
+        return NULL;
+    }
+
+    for (p = pointer; *p; p++) {
+        if (*p == '/')
+            count++;
+    }
+
+    compiled = jsonp_malloc(offsetof(json_pointer_t, tokens) +
+                            (count ? count : 1) * sizeof(token_t));
+    if (!compiled) {
+        jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "out of memory");
+        scanner_close(&s);
+        return NULL;
+    }
+    compiled->count = 0;
+
+    /* The keys are kept in their handles */
+    while ((result = scanner_next(&s, &compiled->tokens[compiled->count], error)) == 1) {
+        token = &compiled->tokens[compiled->count];
+        token->handle = json_key_createn(token->key, token->key_len);
+        if (!token->handle) {
+            jsonp_error_set(error, -1, -1, (size_t)(s.pos - pointer),
+                            json_error_invalid_utf8,
+                            "invalid UTF-8 in a reference token");
+            result = -1;
+            break;
+        }
+        token->key = jsonp_key_string(token->handle);
+        compiled->count++;
+    }
+
+    scanner_close(&s);
+    if (result < 0) {
+        json_pointer_destroy(compiled);
+        return NULL;
+    }
+    return compiled;
+}
+
+void json_pointer_destroy(json_pointer_t *pointer) {
+    size_t i;
+
+    if (!pointer)
+        return;
+
+    for (i = 0; i < pointer->count; i++)
+        json_key_destroy(pointer->tokens[i].handle);
+    jsonp_free(pointer);
+}
+
+json_t *json_pointer_get_compiled(const json_t *root, const json_pointer_t *pointer) {
+    json_t *json = (json_t *)root;
+    size_t i;
+
+    if (!pointer)
+        return NULL;
+
+    for (i = 0; json && i < pointer->count; i++)
+        json = token_get(json, &pointer->tokens[i]);
+    return json;
+}
+
+int json_pointer_set_compiled_new(json_t *root, const json_pointer_t *pointer,
+                                  json_t *value) {
+    json_t *parent;
+
+    if (!value)
+        return -1;
+
+    parent = compiled_parent(root, pointer);
+    if (!parent) {
+        json_decref(value);
+        return -1;
+    }
+    return token_set(parent, &pointer->tokens[pointer->count - 1], value);
+}
+
+int json_pointer_del_compiled(json_t *root, const json_pointer_t *pointer) {
+    json_t *parent = compiled_parent(root, pointer);
+
+    if (!parent)
+        return -1;
+    return token_del(parent, &pointer->tokens[pointer->count - 1]);
+}
+
+/*** batches ***/
+
+typedef struct {
+    json_pointer_t *pointer;
+    size_t index;
+} batch_entry_t;
+
+static int compare_tokens(const token_t *token1, const token_t *token2) {
+    size_t len = token1->key_len < token2->key_len ? token1->key_len : token2->key_len;
+    int result = memcmp(token1->key, token2->key, len);
+
+    if (result)
+        return result;
+    if (token1->key_len != token2->key_len)
+        return token1->key_len < token2->key_len ? -1 : 1;
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const batch_entry_t *entry1 = a, *entry2 = b;
+    const json_pointer_t *pointer1 = entry1->pointer, *pointer2 = entry2->pointer;
+    size_t i;
+    int result;
+
+    for (i = 0; i < pointer1->count && i < pointer2->count; i++) {
+        result = compare_tokens(&pointer1->tokens[i], &pointer2->tokens[i]);
+        if (result)
+            return result;
+    }
+    if (pointer1->count != pointer2->count)
+        return pointer1->count < pointer2->count ? -1 : 1;
+
+    /* Keep the order of equal pointers */
+    return entry1->index < entry2->index ? -1 : entry1->index > entry2->index;
+}
+
+static size_t shared_tokens(const json_pointer_t *pointer1,
+                            const json_pointer_t *pointer2) {
+    size_t i;
+
+    for (i = 0; i < pointer1->count && i < pointer2->count; i++) {
+        if (compare_tokens(&pointer1->tokens[i], &pointer2->tokens[i]))
+            break;
+    }
+    return i;
+}
+
+json_pointer_batch_t *json_pointer_batch_compile(const char *const *pointers,
+                                                 size_t count, json_error_t *error) {
+    json_pointer_batch_t *batch;
+    batch_entry_t *entries;
+    size_t i;
+
+    jsonp_error_init(error, "<pointer>");
+    if (!pointers && count) {
+        jsonp_error_set(error, -1, -1, 0, json_error_invalid_argument, "NULL pointers");
+        return NULL;
+    }
+    if (count > (size_t)-1 / sizeof(batch_entry_t))
+        goto oom;
+
+    batch = jsonp_malloc(sizeof(json_pointer_batch_t));
+    if (!batch)
+        goto oom;
+    batch->count = 0;
+    batch->depth = 0;
+    batch->pointers = jsonp_malloc((count ? count : 1) * sizeof(json_pointer_t *));
+    batch->order = jsonp_malloc((count ? count : 1) * sizeof(size_t));
+    batch->shared = jsonp_malloc((count ? count : 1) * sizeof(size_t));
+    entries = jsonp_malloc((count ? count : 1) * sizeof(batch_entry_t));
+    if (!batch->pointers || !batch->order || !batch->shared || !entries) {
+        jsonp_free(entries);
+        json_pointer_batch_destroy(batch);
+        goto oom;
+    }
+
+    for (i = 0; i < count; i++) {
+        entries[i].pointer = json_pointer_compile(pointers[i], error);
+        entries[i].index = i;
+        if (!entries[i].pointer) {
+            while (i--)
+                json_pointer_destroy(entries[i].pointer);
+            jsonp_free(entries);
+            json_pointer_batch_destroy(batch);
+            return NULL;
+        }
+    }
+
+    qsort(entries, count, sizeof(batch_entry_t), compare_entries);
+    for (i = 0; i < count; i++) {
+        batch->pointers[i] = entries[i].pointer;
+        batch->order[i] = entries[i].index;
+        batch->shared[i] =
+            i ? shared_tokens(entries[i - 1].pointer, entries[i].pointer) : 0;
+        if (entries[i].pointer->count > batch->depth)
+            batch->depth = entries[i].pointer->count;
+    }
+    batch->count = count;
+
+    jsonp_free(entries);
+    return batch;
+
+oom:
+    jsonp_error_set(error, -1, -1, 0, json_error_out_of_memory, "out of memory");
+    return NULL;
+}
+
+void json_pointer_batch_destroy(json_pointer_batch_t *batch) {
+    size_t i;
+
+    if (!batch)
+        return;
+
+    for (i = 0; i < batch->count; i++)
+        json_pointer_destroy(batch->pointers[i]);
+    jsonp_free(batch->pointers);
+    jsonp_free(batch->order);
+    jsonp_free(batch->shared);
+    jsonp_free(batch);
+}
+
+#define BATCH_INLINE_DEPTH 16
+
+size_t json_pointer_batch_get(const json_t *root, const json_pointer_batch_t *batch,
+                              json_t **values) {
+    json_t *inline_path[BATCH_INLINE_DEPTH + 1], **path = inline_path, *json;
+    const json_pointer_t *pointer;
+    size_t i, depth, resolved = 0, found = 0;
+
+    if (!batch || !values)
+        return 0;
+
+    /* path[i] is the value after the first i tokens of the previous
+       pointer, for i up to resolved */
+    if (batch->depth > BATCH_INLINE_DEPTH) {
+        path = jsonp_malloc((batch->depth + 1) * sizeof(json_t *));
+        if (!path) {
+            /* Resolve each pointer from the root instead */
+            for (i = 0; i < batch->count; i++) {
+                json = json_pointer_get_compiled(root, batch->pointers[i]);
+                values[batch->order[i]] = json;
+                found += json != NULL;
+            }
+            return found;
+        }
+    }
+    path[0] = (json_t *)root;
+
+    for (i = 0; i < batch->count; i++) {
+        pointer = batch->pointers[i];
+        depth = batch->shared[i] < resolved ? batch->shared[i] : resolved;
+        json = path[depth];
+
+        while (json && depth < pointer->count) {
+            json = token_get(json, &pointer->tokens[depth]);
+            if (json)
+                path[++depth] = json;
+        }
+        resolved = depth;
+
+        values[batch->order[i]] = json;
+        found += json != NULL;
+    }
+
+    if (path != inline_path)
+        jsonp_free(path);
+    return found;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include "scan.h"
+
+#if defined(SCAN_X86)
+#include <immintrin.h>
+#elif defined(SCAN_SSE2_ONLY)
+#include <emmintrin.h>
+#elif defined(SCAN_NEON)
+#include <arm_neon.h>
+#endif
+
+static size_t scan_plain_scalar(const char *buffer, size_t size) {
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        unsigned char c = (unsigned char)buffer[i];
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+            break;
+    }
+    return i;
+}
+
+#if defined(SCAN_X86) || defined(SCAN_SSE2_ONLY)
+
+/* As signed bytes, both control characters and non-ASCII bytes compare
+   less than 0x20 */
+SCAN_TARGET("sse2")
+static size_t scan_plain_sse2(const char *buffer, size_t size) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmplt_epi8(v, space));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(special);
+        if (mask)
+            return i + scan_ctz(mask);
+    }
+    return i + scan_plain_scalar(buffer + i, size - i);
+}
+
+#endif
+
+#ifdef SCAN_X86
+
+SCAN_TARGET("avx2")
+static size_t scan_plain_avx2(const char *buffer, size_t size) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_cmpgt_epi8(space, v));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(special);
+        if (mask)
+            return i + scan_ctz(mask);
+    }
+    return i + scan_plain_sse2(buffer + i, size - i);
+}
+
+#endif
+
+#ifdef SCAN_NEON
+
+static size_t scan_plain_neon(const char *buffer, size_t size) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(buffer + i));
+        uint8x16_t special =
+            vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                     vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, high)));
+        if (vmaxvq_u8(special))
+            break;
+    }
+    return i + scan_plain_scalar(buffer + i, size - i);
+}
+
+#endif
+
+int scan_cpu_features(void) {
+    /* Concurrent first calls store the same value, so no locking is
+       needed */
+    static int features = -1;
+
+    if (features == -1) {
+        int found = 0;
+#if defined(SCAN_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            found |= SCAN_CPU_SSE2;
+        if (__builtin_cpu_supports("ssse3"))
+            found |= SCAN_CPU_SSSE3;
+        if (__builtin_cpu_supports("avx2"))
+            found |= SCAN_CPU_AVX2;
+#elif defined(SCAN_SSE2_ONLY)
+        found = SCAN_CPU_SSE2;
+#elif defined(SCAN_NEON)
+        found = SCAN_CPU_NEON;
+#endif
+        features = found;
+    }
+    return features;
+}
+
+typedef size_t (*scan_func)(const char *buffer, size_t size);
+
+/* Pick the widest kernel the CPU supports on the first call */
+static size_t scan_plain_detect(const char *buffer, size_t size);
+static scan_func scan_plain_impl = scan_plain_detect;
+
+static size_t scan_plain_detect(const char *buffer, size_t size) {
+    int features = scan_cpu_features();
+    scan_func impl = scan_plain_scalar;
+
+#if defined(SCAN_X86)
+    if (features & SCAN_CPU_AVX2)
+        impl = scan_plain_avx2;
+    else if (features & SCAN_CPU_SSE2)
+        impl = scan_plain_sse2;
+#elif defined(SCAN_SSE2_ONLY)
+    if (features & SCAN_CPU_SSE2)
+        impl = scan_plain_sse2;
+#elif defined(SCAN_NEON)
+    if (features & SCAN_CPU_NEON)
+        impl = scan_plain_neon;
+#endif
+
+    scan_plain_impl = impl;
+    return impl(buffer, size);
+}
+
+size_t scan_plain(const char *buffer, size_t size) {
+    /* Not worth the indirect call for short runs */
+    if (size < 16)
+        return scan_plain_scalar(buffer, size);
+    return scan_plain_impl(buffer, size);
+}
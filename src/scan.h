@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86       1
+#define SCAN_TARGET(t) __attribute__((target(t)))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define SCAN_SSE2_ONLY 1
+#define SCAN_TARGET(t)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SCAN_NEON 1
+#endif
+
+#if defined(__GNUC__)
+#define scan_ctz(x) __builtin_ctz(x)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static __inline unsigned int scan_ctz(unsigned int x) {
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (unsigned int)index;
+}
+#endif
+
+#define SCAN_CPU_SSE2  0x1
+#define SCAN_CPU_SSSE3 0x2
+#define SCAN_CPU_AVX2  0x4
+#define SCAN_CPU_NEON  0x8
+
+/*
+ * scan_cpu_features - Get the SIMD instruction sets usable at runtime
+ *
+ * Returns a combination of the SCAN_CPU_* flags. Only instruction sets
+ * that this build has kernels for are reported.
+ */
+int scan_cpu_features(void);
+
+/*
+ * scan_plain - Find the first byte that needs attention in a string
+ *
+ * @buffer: Bytes to scan
+ * @size: Number of bytes in @buffer
+ *
+ * Returns the length of the longest prefix of @buffer that consists
+ * only of printable ASCII characters other than '"' and '\\'. Those
+ * bytes can be copied verbatim both when decoding and encoding a JSON
+ * string. Uses SIMD instructions if the CPU supports them.
+ */
+size_t scan_plain(const char *buffer, size_t size);
+
+#endif
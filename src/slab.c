@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <jansson_private_config.h>
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+
+#include "jansson.h"
+#include "jansson_private.h"
+
+/* The caches of exiting threads are flushed by a thread exit
+   callback. Without one, the nodes of each thread would be lost when
+   it exits, so the pools aren't used. */
+#if defined(USE_SLAB_ALLOCATOR) && defined(HAVE___THREAD) &&                               \
+    (defined(HAVE_ATOMIC_BUILTINS) || defined(HAVE_SYNC_BUILTINS)) &&                      \
+    (defined(_WIN32) || defined(HAVE_PTHREAD_H))
+
+/*
+ * Nodes up to SLAB_MAX_SIZE bytes are carved from chunks in size
+ * classes of SLAB_GRANULE bytes. Freed nodes go to a free list of the
+ * freeing thread, which is refilled from and flushed to a shared depot
+ * in batches, and when the thread exits. Chunks are never returned to
+ * the system. Memory statistics count the nodes, not the chunks.
+ */
+#define SLAB_GRANULE    16
+#define SLAB_CLASSES    8
+#define SLAB_MAX_SIZE   (SLAB_GRANULE * SLAB_CLASSES)
+#define SLAB_CHUNK_SIZE 8192
+#define SLAB_BATCH      32
+
+typedef struct slab_node {
+    struct slab_node *next;
+} slab_node_t;
+
+typedef struct {
+    slab_node_t *free;
+    size_t count;
+} slab_cache_t;
+
+typedef struct {
+    slab_node_t *free;
+    char *pos;
+    char *end;
+} slab_depot_t;
+
+/* Each chunk starts with a pointer to the previous one */
+typedef union slab_chunk {
+    union slab_chunk *prev;
+    double align;
+} slab_chunk_t;
+
+static __thread slab_cache_t slab_caches[SLAB_CLASSES];
+static __thread int slab_registered = 0;
+
+static slab_depot_t slab_depots[SLAB_CLASSES];
+static slab_chunk_t *slab_chunks = NULL;
+static volatile char slab_locked = 0;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define slab_trylock() (__atomic_test_and_set(&slab_locked, __ATOMIC_ACQUIRE) == 0)
+#define slab_unlock()  __atomic_clear(&slab_locked, __ATOMIC_RELEASE)
+#else
+#define slab_trylock() (__sync_lock_test_and_set(&slab_locked, 1) == 0)
+#define slab_unlock()  __sync_lock_release(&slab_locked)
+#endif
+
+static void slab_lock(void) {
+    while (!slab_trylock()) {
+#ifdef HAVE_SCHED_YIELD
+        sched_yield();
+#endif
+    }
+}
+
+static void slab_flush(size_t index, slab_cache_t *cache);
+
+/* Return all the cached nodes of this thread to the depots */
+static void slab_flush_all(void) {
+    size_t i;
+
+    slab_lock();
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        while (slab_caches[i].free)
+            slab_flush(i, &slab_caches[i]);
+    }
+    slab_unlock();
+}
+
+/* A thread that frees nodes after its exit callback ran registers
+   again. The callback is then run again, or with pthreads, up to
+   PTHREAD_DESTRUCTOR_ITERATIONS times in total. */
+#ifdef _WIN32
+
+static DWORD slab_fls = FLS_OUT_OF_INDEXES;
+static int slab_fls_ready = 0;
+
+static void WINAPI slab_thread_exit(void *data) {
+    (void)data;
+    slab_registered = 0;
+    slab_flush_all();
+}
+
+static void slab_register(void) {
+    slab_lock();
+    if (!slab_fls_ready) {
+        slab_fls = FlsAlloc(slab_thread_exit);
+        slab_fls_ready = 1;
+    }
+    slab_unlock();
+
+    if (slab_fls != FLS_OUT_OF_INDEXES && FlsSetValue(slab_fls, &slab_registered))
+        slab_registered = 1;
+}
+
+#else
+
+static pthread_key_t slab_key;
+static int slab_key_ready = 0;
+
+static void slab_thread_exit(void *data) {
+    (void)data;
+    slab_registered = 0;
+    slab_flush_all();
+}
+
+static void slab_register(void) {
+    slab_lock();
+    if (!slab_key_ready)
+        slab_key_ready = pthread_key_create(&slab_key, slab_thread_exit) == 0 ? 1 : -1;
+    slab_unlock();
+
+    if (slab_key_ready == 1 && pthread_setspecific(slab_key, &slab_registered) == 0)
+        slab_registered = 1;
+}
+
+#endif
+
+/* Move up to SLAB_BATCH nodes from the depot to the cache of this
+   thread, carving new ones if the depot is empty. Called with the
+   lock held. */
+static void slab_refill(size_t index, slab_cache_t *cache) {
+    slab_depot_t *depot = &slab_depots[index];
+    size_t size = (index + 1) * SLAB_GRANULE;
+
+    while (cache->count < SLAB_BATCH) {
+        slab_node_t *node;
+
+        if (depot->free) {
+            node = depot->free;
+            depot->free = node->next;
+        } else {
+            if ((size_t)(depot->end - depot->pos) < size) {
+                slab_chunk_t *chunk = jsonp_malloc_untracked(SLAB_CHUNK_SIZE);
+                if (!chunk)
+                    return;
+
+                chunk->prev = slab_chunks;
+                slab_chunks = chunk;
+
+                depot->pos = (char *)(chunk + 1);
+                depot->end = (char *)chunk + SLAB_CHUNK_SIZE;
+            }
+
+            node = (slab_node_t *)depot->pos;
+            depot->pos += size;
+        }
+
+        node->next = cache->free;
+        cache->free = node;
+        cache->count++;
+    }
+}
+
+/* Return SLAB_BATCH nodes from the cache of this thread to the
+   depot. Called with the lock held. */
+static void slab_flush(size_t index, slab_cache_t *cache) {
+    slab_depot_t *depot = &slab_depots[index];
+    size_t i;
+
+    for (i = 0; i < SLAB_BATCH && cache->free; i++) {
+        slab_node_t *node = cache->free;
+        cache->free = node->next;
+        cache->count--;
+
+        node->next = depot->free;
+        depot->free = node;
+    }
+}
+
+void *jsonp_node_malloc(const json_allocator_t *allocator, size_t size,
+                        enum json_memory_category category) {
+    slab_cache_t *cache;
+    slab_node_t *node;
+    size_t index;
+
+    if (allocator || size == 0 || size > SLAB_MAX_SIZE)
+        return jsonp_alloc(allocator, size, category);
+
+    if (!slab_registered)
+        slab_register();
+
+    index = (size - 1) / SLAB_GRANULE;
+    cache = &slab_caches[index];
+
+    if (!cache->free) {
+        slab_lock();
+        slab_refill(index, cache);
+        slab_unlock();
+
+        if (!cache->free)
+            return NULL;
+    }
+
+    node = cache->free;
+    cache->free = node->next;
+    cache->count--;
+#ifdef USE_MEMORY_STATS
+    jsonp_memory_count(category, size, 0);
+#endif
+    return node;
+}
+
+void jsonp_node_free(const json_allocator_t *allocator, void *ptr, size_t size,
+                     enum json_memory_category category) {
+    slab_cache_t *cache;
+    slab_node_t *node = ptr;
+    size_t index;
+
+    if (!ptr)
+        return;
+
+    if (allocator || size > SLAB_MAX_SIZE) {
+        jsonp_dealloc(allocator, ptr, size);
+        return;
+    }
+
+#ifdef USE_MEMORY_STATS
+    jsonp_memory_count(category, size, 1);
+#else
+    (void)category;
+#endif
+    if (!slab_registered)
+        slab_register();
+
+    index = (size - 1) / SLAB_GRANULE;
+    cache = &slab_caches[index];
+
+    node->next = cache->free;
+    cache->free = node;
+    cache->count++;
+
+    if (cache->count > 2 * SLAB_BATCH) {
+        slab_lock();
+        slab_flush(index, cache);
+        slab_unlock();
+    }
+}
+
+#else
+
+void *jsonp_node_malloc(const json_allocator_t *allocator, size_t size,
+                        enum json_memory_category category) {
+    return jsonp_alloc(allocator, size, category);
+}
+
+void jsonp_node_free(const json_allocator_t *allocator, void *ptr, size_t size,
+                     enum json_memory_category category) {
+    (void)category;
+    jsonp_dealloc(allocator, ptr, size);
+}
+
+#endif
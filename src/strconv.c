@@ -1,7 +1,9 @@
 #include "jansson_private.h"
 #include "strbuffer.h"
+#include "pow10.h"
 #include <assert.h>
 #include <errno.h>
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
@@ -55,10 +57,190 @@ static void from_locale(char *buffer) {
 }
 #endif
 
+#define l_isdigit(c) ('0' <= (c) && (c) <= '9')
+
+/* Bits of the 128-bit product of a and b */
+static void mul_64x64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+
+    *hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl);
+    *lo = t + (rm1 << 32);
+    *hi += *lo < t;
+#endif
+}
+
+/* floor(log2(10^e)) for the exponents of pow10_table, without relying
+   on the right shift of negative numbers */
+#define floor_log2_pow10(e) ((int)(((long)(e)*217706 + 65536L * 1200) >> 16) - 1200)
+
+#define DOUBLE_SIGNIFICAND_BITS 52
+#define DOUBLE_EXPONENT_BIAS    1023
+
+static double double_from_bits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint64_t double_to_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/* Powers of ten that are exactly representable as a double */
+static const double exact_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                     1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                     1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Convert mantissa * 10^exp10 to the nearest double with the
+   Eisel-Lemire algorithm. Return 0 if the result can't be decided
+   with 128 bits of precision, or is subnormal or out of range. */
+static int eisel_lemire(uint64_t mantissa, int exp10, int negative, double *out) {
+    uint64_t hi, lo, y_hi, y_lo, bits;
+    const uint64_t *power;
+    int shift = 0, msb;
+    long exp2;
+
+    if (exp10 < POW10_MIN_EXP || exp10 > POW10_MAX_EXP)
+        return 0;
+
+    power = pow10_table[exp10 - POW10_MIN_EXP];
+
+    while (!(mantissa >> 63)) {
+        mantissa <<= 1;
+        shift++;
+    }
+    exp2 = (long)floor_log2_pow10(exp10) + 64 + DOUBLE_EXPONENT_BIAS - shift;
+
+    mul_64x64(mantissa, power[0], &hi, &lo);
+    if ((hi & 0x1FF) == 0x1FF && lo + mantissa < mantissa) {
+        /* The truncated power may be too small; use the lower bits */
+        mul_64x64(mantissa, power[1], &y_hi, &y_lo);
+        lo += y_hi;
+        if (lo < y_hi)
+            hi++;
+        if ((hi & 0x1FF) == 0x1FF && lo + 1 == 0 && y_lo + mantissa < mantissa)
+            return 0;
+    }
+
+    msb = (int)(hi >> 63);
+    bits = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
+
+    if (lo == 0 && (hi & 0x1FF) == 0 && (bits & 3) == 1) {
+        /* Exactly halfway between two doubles */
+        return 0;
+    }
+
+    bits = (bits + (bits & 1)) >> 1;
+    if (bits >> (DOUBLE_SIGNIFICAND_BITS + 1)) {
+        bits >>= 1;
+        exp2++;
+    }
+
+    if (exp2 <= 0 || exp2 >= 0x7FF)
+        return 0;
+
+    bits = ((uint64_t)exp2 << DOUBLE_SIGNIFICAND_BITS) |
+           (bits & (((uint64_t)1 << DOUBLE_SIGNIFICAND_BITS) - 1));
+    if (negative)
+        bits |= (uint64_t)1 << 63;
+
+    *out = double_from_bits(bits);
+    return 1;
+}
+
+/* Convert a number that the lexer has validated without going through
+   strtod(). Return 0 if the slow path has to be used. */
+static int strtod_fast(const char *str, size_t length, double *out) {
+    const char *p = str, *end = str + length;
+    uint64_t mantissa = 0;
+    int negative = 0, digits = 0, exp10 = 0;
+
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+
+    for (; p < end && l_isdigit(*p); p++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += mantissa != 0;
+        } else if (*p == '0')
+            exp10++;
+        else
+            return 0;
+    }
+
+    if (p < end && *p == '.') {
+        for (p++; p < end && l_isdigit(*p); p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += mantissa != 0;
+                exp10--;
+            } else if (*p != '0')
+                return 0;
+        }
+    }
+
+    if (p < end) {
+        int exp_negative = 0, exp = 0;
+
+        /* 'e' or 'E' */
+        p++;
+        if (*p == '+')
+            p++;
+        else if (*p == '-') {
+            exp_negative = 1;
+            p++;
+        }
+
+        for (; p < end; p++) {
+            if (exp < 100000)
+                exp = exp * 10 + (*p - '0');
+        }
+        exp10 += exp_negative ? -exp : exp;
+    }
+
+    if (mantissa == 0) {
+        *out = negative ? -0.0 : 0.0;
+        return 1;
+    }
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    /* Both operands and the result of a single IEEE operation are
+       correctly rounded */
+    if (mantissa <= (uint64_t)1 << 53 && exp10 >= -22 && exp10 <= 22) {
+        double value = (double)mantissa;
+
+        if (exp10 < 0)
+            value /= exact_pow10[-exp10];
+        else
+            value *= exact_pow10[exp10];
+
+        *out = negative ? -value : value;
+        return 1;
+    }
+#endif
+
+    return eisel_lemire(mantissa, exp10, negative, out);
+}
+
 int jsonp_strtod(strbuffer_t *strbuffer, double *out) {
     double value;
     char *end;
 
+    if (strtod_fast(strbuffer->value, strbuffer->length, out))
+        return 0;
+
 #if JSON_HAVE_LOCALECONV
     to_locale(strbuffer);
 #endif
@@ -76,13 +258,231 @@ int jsonp_strtod(strbuffer_t *strbuffer, double *out) {
     return 0;
 }
 
+/* Shortest round-trip digits with Grisu2 (Florian Loitsch, "Printing
+   Floating-Point Numbers Quickly and Accurately with Integers"). The
+   digits always convert back to the same double, and are the shortest
+   possible in all but a small fraction of cases. */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+/* The binary exponent range that the digit generation works with */
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+static diy_fp_t diy_fp_mul(diy_fp_t x, diy_fp_t y) {
+    diy_fp_t r;
+    uint64_t lo;
+
+    mul_64x64(x.f, y.f, &r.f, &lo);
+    /* round to nearest */
+    r.f += lo >> 63;
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static diy_fp_t diy_fp_normalize(diy_fp_t x) {
+    while (!(x.f >> 63)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Nudge the last digit towards w, which is dist below the upper
+   boundary, as long as the digits stay within delta */
+static void grisu2_round(char *digits, int length, uint64_t dist, uint64_t delta,
+                         uint64_t rest, uint64_t ten_k) {
+    while (rest < dist && delta - rest >= ten_k &&
+           (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        digits[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Generate the digits of w, whose boundaries are low and high. Return
+   the number of digits and add the decimal exponent to *exp10. */
+static int grisu2_digits(diy_fp_t low, diy_fp_t w, diy_fp_t high, char *digits,
+                         int *exp10) {
+    static const uint32_t pow10_32[] = {1,      10,      100,      1000,      10000,
+                                        100000, 1000000, 10000000, 100000000,
+                                        1000000000};
+    uint64_t delta = high.f - low.f, dist = high.f - w.f;
+    uint64_t one = (uint64_t)1 << -high.e, rest;
+    uint32_t p1 = (uint32_t)(high.f >> -high.e);
+    uint64_t p2 = high.f & (one - 1);
+    int length = 0, n = 10;
+
+    while (n > 1 && p1 < pow10_32[n - 1])
+        n--;
+
+    /* Integral part */
+    while (n > 0) {
+        uint32_t pow10 = pow10_32[--n];
+
+        digits[length++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        rest = ((uint64_t)p1 << -high.e) + p2;
+        if (rest <= delta) {
+            *exp10 += n;
+            grisu2_round(digits, length, dist, delta, rest, (uint64_t)pow10 << -high.e);
+            return length;
+        }
+    }
+
+    /* Fractional part */
+    for (;;) {
+        p2 *= 10;
+        digits[length++] = (char)('0' + (p2 >> -high.e));
+        p2 &= one - 1;
+        delta *= 10;
+        dist *= 10;
+        n--;
+        if (p2 <= delta)
+            break;
+    }
+
+    *exp10 += n;
+    grisu2_round(digits, length, dist, delta, p2, one);
+    return length;
+}
+
+/* Write the shortest digits of a positive finite value. Return the
+   number of digits, value being digits * 10^*exp10. */
+static int grisu2(double value, char *digits, int *exp10) {
+    uint64_t bits = double_to_bits(value);
+    uint64_t hidden = (uint64_t)1 << DOUBLE_SIGNIFICAND_BITS;
+    uint64_t fraction = bits & (hidden - 1);
+    int exponent = (int)(bits >> DOUBLE_SIGNIFICAND_BITS);
+    diy_fp_t v, low, high, c;
+    int f, k;
+
+    if (exponent == 0) {
+        /* subnormal */
+        v.f = fraction;
+        v.e = 1 - DOUBLE_EXPONENT_BIAS - DOUBLE_SIGNIFICAND_BITS;
+    } else {
+        v.f = fraction + hidden;
+        v.e = exponent - DOUBLE_EXPONENT_BIAS - DOUBLE_SIGNIFICAND_BITS;
+    }
+
+    /* The boundaries are halfway to the neighbouring doubles. The lower
+       one is closer when the significand is a power of two. */
+    high.f = 2 * v.f + 1;
+    high.e = v.e - 1;
+    high = diy_fp_normalize(high);
+    if (fraction == 0 && exponent > 1) {
+        low.f = 4 * v.f - 1;
+        low.e = v.e - 2;
+    } else {
+        low.f = 2 * v.f - 1;
+        low.e = v.e - 1;
+    }
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+    v = diy_fp_normalize(v);
+
+    /* Scale by a power of ten c = 10^k that brings the exponent of the
+       upper boundary into [GRISU_ALPHA, GRISU_GAMMA] */
+    f = GRISU_ALPHA - high.e - 1;
+    k = (f * 78913) / (1 << 18) + (f > 0);
+    c.f = pow10_table[k - POW10_MIN_EXP][0];
+    c.f += pow10_table[k - POW10_MIN_EXP][1] >> 63;
+    c.e = floor_log2_pow10(k) - 63;
+
+    v = diy_fp_mul(v, c);
+    low = diy_fp_mul(low, c);
+    high = diy_fp_mul(high, c);
+
+    /* Shrink the interval by the possible error of the products */
+    low.f++;
+    high.f--;
+
+    *exp10 = -k;
+    return grisu2_digits(low, v, high, digits, exp10);
+}
+
+/* Format a finite value with the shortest digits, in the same style as
+   "%.17g" */
+static int dtostr_shortest(char *buffer, size_t size, double value) {
+    char digits[20], *p = buffer;
+    int length, exp10, point, i;
+
+    if (size < 32)
+        return -1;
+
+    if (double_to_bits(value) >> 63) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    if (value == 0) {
+        memcpy(p, "0.0", 4);
+        return (int)(p - buffer) + 3;
+    }
+
+    length = grisu2(value, digits, &exp10);
+    while (length > 1 && digits[length - 1] == '0') {
+        length--;
+        exp10++;
+    }
+
+    /* The position of the decimal point relative to the first digit */
+    point = length + exp10;
+
+    if (point < -3 || point > 17) {
+        *p++ = digits[0];
+        if (length > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, length - 1);
+            p += length - 1;
+        }
+        *p++ = 'e';
+        exp10 = point - 1;
+        if (exp10 < 0) {
+            *p++ = '-';
+            exp10 = -exp10;
+        }
+        p += jsonp_inttostr(p, exp10);
+    } else if (point <= 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = point; i < 0; i++)
+            *p++ = '0';
+        memcpy(p, digits, length);
+        p += length;
+    } else if (point < length) {
+        memcpy(p, digits, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, digits + point, length - point);
+        p += length - point;
+    } else {
+        memcpy(p, digits, length);
+        p += length;
+        for (i = length; i < point; i++)
+            *p++ = '0';
+        *p++ = '.';
+        *p++ = '0';
+    }
+
+    *p = '\0';
+    return (int)(p - buffer);
+}
+
 int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
     int ret;
     char *start, *end;
     size_t length;
 
-    if (precision == 0)
+    if (precision == 0) {
+        /* NaN and infinities take the snprintf() path */
+        if (value - value == 0)
+            return dtostr_shortest(buffer, size, value);
         precision = 17;
+    }
 
     ret = snprintf(buffer, size, "%.*g", precision, value);
     if (ret < 0)
@@ -130,3 +530,77 @@ int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
 
     return (int)length;
 }
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+/* json_int_t is signed; compute with an unsigned type that covers it */
+typedef unsigned long long json_uint_t;
+
+#define JSONP_INT_MAX (((json_uint_t)1 << (sizeof(json_int_t) * 8 - 1)) - 1)
+
+int jsonp_inttostr(char *buffer, json_int_t value) {
+    char tmp[JSONP_INT_STR_LENGTH];
+    char *p = tmp + sizeof(tmp);
+    json_uint_t u;
+    size_t length;
+
+    /* negate in unsigned arithmetic so that the minimum value works */
+    u = value < 0 ? (json_uint_t)0 - (json_uint_t)value : (json_uint_t)value;
+
+    while (u >= 100) {
+        unsigned int pair = (unsigned int)(u % 100);
+        u /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * pair, 2);
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * u, 2);
+    } else
+        *--p = (char)('0' + u);
+
+    if (value < 0)
+        *--p = '-';
+
+    length = tmp + sizeof(tmp) - p;
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    return (int)length;
+}
+
+int jsonp_strtoint(const char *str, size_t length, json_int_t *out) {
+    const char *end = str + length;
+    json_uint_t value = 0, limit = JSONP_INT_MAX;
+    int negative = 0;
+
+    if (str < end && *str == '-') {
+        negative = 1;
+        limit++;
+        str++;
+    }
+
+    /* the lexer has checked that there are only digits */
+    for (; str < end; str++) {
+        unsigned int digit = (unsigned int)(*str - '0');
+        if (value > (limit - digit) / 10)
+            return -1;
+        value = value * 10 + digit;
+    }
+
+    if (!negative)
+        *out = (json_int_t)value;
+    else if (value == limit)
+        *out = -(json_int_t)(value - 1) - 1;
+    else
+        *out = -(json_int_t)value;
+    return 0;
+}
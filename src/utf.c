@@ -6,8 +6,15 @@
  */
 
 #include "utf.h"
+#include "scan.h"
 #include <string.h>
 
+#if defined(SCAN_X86)
+#include <immintrin.h>
+#elif defined(SCAN_NEON)
+#include <arm_neon.h>
+#endif
+
 int utf8_encode(int32_t codepoint, char *buffer, size_t *size) {
     if (codepoint < 0)
         return -1;
@@ -137,23 +144,207 @@ const char *utf8_iterate(const char *buffer, size_t bufsize, int32_t *codepoint)
     return buffer + count;
 }
 
-int utf8_check_string(const char *string, size_t length) {
+static size_t utf8_check_prefix_scalar(const char *buffer, size_t size) {
     size_t i;
 
-    for (i = 0; i < length; i++) {
-        size_t count = utf8_check_first(string[i]);
+    for (i = 0; i < size; i++) {
+        size_t count = utf8_check_first(buffer[i]);
         if (count == 0)
-            return 0;
+            break;
         else if (count > 1) {
-            if (count > length - i)
-                return 0;
+            if (count > size - i)
+                break;
 
-            if (!utf8_check_full(&string[i], count, NULL))
-                return 0;
+            if (!utf8_check_full(&buffer[i], count, NULL))
+                break;
 
             i += count - 1;
         }
     }
 
-    return 1;
+    return i;
+}
+
+/*
+ * Block validation after Keiser & Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte". Each byte is classified together
+ * with the byte before it by three 16-entry lookup tables, indexed by
+ * the high and low nibble of the previous byte and the high nibble of
+ * the current byte. The AND of the three lookups is non-zero for every
+ * invalid pair, except that a missing third or fourth byte is found
+ * by comparing with the bytes two and three positions back.
+ */
+#define UTF8_TOO_SHORT      0x01
+#define UTF8_TOO_LONG       0x02
+#define UTF8_OVERLONG_3     0x04
+#define UTF8_TOO_LARGE      0x08
+#define UTF8_SURROGATE      0x10
+#define UTF8_OVERLONG_2     0x20
+#define UTF8_TOO_LARGE_1000 0x40
+#define UTF8_OVERLONG_4     0x40
+#define UTF8_TWO_CONTS      0x80
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* Indexed by the high nibble of the previous byte */
+#define UTF8_BYTE_1_HIGH                                                                 \
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,          \
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TWO_CONTS, UTF8_TWO_CONTS,    \
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TOO_SHORT | UTF8_OVERLONG_2,               \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,              \
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+
+/* Indexed by the low nibble of the previous byte */
+#define UTF8_BYTE_1_LOW                                                                  \
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,                   \
+        UTF8_CARRY | UTF8_OVERLONG_2, UTF8_CARRY, UTF8_CARRY, UTF8_CARRY | UTF8_TOO_LARGE, \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,             \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                              \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+
+/* Indexed by the high nibble of the current byte */
+#define UTF8_BYTE_2_HIGH                                                                 \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,     \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,                                 \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |            \
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,                                      \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |            \
+            UTF8_TOO_LARGE,                                                             \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |             \
+            UTF8_TOO_LARGE,                                                             \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |             \
+            UTF8_TOO_LARGE,                                                             \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+
+#if defined(SCAN_X86)
+
+/* Return the offset of the first 16-byte block that contains or ends
+   an invalid sequence, or the end of the last whole block */
+SCAN_TARGET("ssse3")
+static size_t utf8_check_blocks_ssse3(const char *buffer, size_t size) {
+    static const unsigned char byte_1_high[16] = {UTF8_BYTE_1_HIGH};
+    static const unsigned char byte_1_low[16] = {UTF8_BYTE_1_LOW};
+    static const unsigned char byte_2_high[16] = {UTF8_BYTE_2_HIGH};
+    const __m128i table1 = _mm_loadu_si128((const __m128i *)byte_1_high);
+    const __m128i table2 = _mm_loadu_si128((const __m128i *)byte_1_low);
+    const __m128i table3 = _mm_loadu_si128((const __m128i *)byte_2_high);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i third = _mm_set1_epi8(0xE0 - 0x80);
+    const __m128i fourth = _mm_set1_epi8(0xF0 - 0x80);
+    const __m128i high = _mm_set1_epi8((char)0x80);
+    __m128i prev = _mm_setzero_si128();
+    int prev_ascii = 1;
+    size_t i;
+
+    for (i = 0; i + 16 <= size; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *)(buffer + i));
+        __m128i prev1, special, must23, error;
+        int ascii = _mm_movemask_epi8(input) == 0;
+
+        if (ascii && prev_ascii) {
+            prev = input;
+            continue;
+        }
+
+        prev1 = _mm_alignr_epi8(input, prev, 15);
+        special = _mm_and_si128(
+            _mm_and_si128(
+                _mm_shuffle_epi8(table1, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(table2, _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(table3, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+        must23 = _mm_or_si128(_mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), third),
+                              _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), fourth));
+        error = _mm_xor_si128(_mm_and_si128(must23, high), special);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF)
+            return i;
+
+        prev = input;
+        prev_ascii = ascii;
+    }
+
+    return i;
+}
+
+#elif defined(SCAN_NEON)
+
+static size_t utf8_check_blocks_neon(const char *buffer, size_t size) {
+    static const uint8_t byte_1_high[16] = {UTF8_BYTE_1_HIGH};
+    static const uint8_t byte_1_low[16] = {UTF8_BYTE_1_LOW};
+    static const uint8_t byte_2_high[16] = {UTF8_BYTE_2_HIGH};
+    const uint8x16_t table1 = vld1q_u8(byte_1_high);
+    const uint8x16_t table2 = vld1q_u8(byte_1_low);
+    const uint8x16_t table3 = vld1q_u8(byte_2_high);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+    const uint8x16_t third = vdupq_n_u8(0xE0 - 0x80);
+    const uint8x16_t fourth = vdupq_n_u8(0xF0 - 0x80);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    uint8x16_t prev = vdupq_n_u8(0);
+    int prev_ascii = 1;
+    size_t i;
+
+    for (i = 0; i + 16 <= size; i += 16) {
+        uint8x16_t input = vld1q_u8((const uint8_t *)(buffer + i));
+        uint8x16_t prev1, special, must23, error;
+        int ascii = vmaxvq_u8(input) < 0x80;
+
+        if (ascii && prev_ascii) {
+            prev = input;
+            continue;
+        }
+
+        prev1 = vextq_u8(prev, input, 15);
+        special = vandq_u8(vandq_u8(vqtbl1q_u8(table1, vshrq_n_u8(prev1, 4)),
+                                    vqtbl1q_u8(table2, vandq_u8(prev1, nibble))),
+                           vqtbl1q_u8(table3, vshrq_n_u8(input, 4)));
+
+        must23 = vorrq_u8(vqsubq_u8(vextq_u8(prev, input, 14), third),
+                          vqsubq_u8(vextq_u8(prev, input, 13), fourth));
+        error = veorq_u8(vandq_u8(must23, high), special);
+
+        if (vmaxvq_u8(error))
+            return i;
+
+        prev = input;
+        prev_ascii = ascii;
+    }
+
+    return i;
+}
+
+#endif
+
+size_t utf8_check_prefix(const char *buffer, size_t size) {
+    size_t done = 0;
+
+    /* Short inputs are faster to check one sequence at a time */
+    if (size >= 32) {
+#if defined(SCAN_X86)
+        if (scan_cpu_features() & SCAN_CPU_SSSE3)
+            done = utf8_check_blocks_ssse3(buffer, size);
+#elif defined(SCAN_NEON)
+        done = utf8_check_blocks_neon(buffer, size);
+#endif
+
+        /* The blocks before done are valid, but the last sequence in
+           them may continue after done. Back up to its first byte. */
+        while (done > 0 && ((unsigned char)buffer[done - 1] & 0xC0) == 0x80)
+            done--;
+        if (done > 0 && (unsigned char)buffer[done - 1] >= 0xC0)
+            done--;
+    }
+
+    return done + utf8_check_prefix_scalar(buffer + done, size - done);
+}
+
+int utf8_check_string(const char *string, size_t length) {
+    return utf8_check_prefix(string, length) == length;
 }
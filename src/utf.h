@@ -23,6 +23,7 @@ size_t utf8_check_first(char byte);
 size_t utf8_check_full(const char *buffer, size_t size, int32_t *codepoint);
 const char *utf8_iterate(const char *buffer, size_t size, int32_t *codepoint);
 
+size_t utf8_check_prefix(const char *buffer, size_t size);
 int utf8_check_string(const char *string, size_t length);
 
 #endif
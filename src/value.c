@@ -21,6 +21,9 @@
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
 
 #include "hashtable.h"
 #include "jansson.h"
@@ -37,32 +40,181 @@ static JSON_INLINE int isnan(double x) { return x != x; }
 static JSON_INLINE int isinf(double x) { return !isnan(x) && isnan(x - x); }
 #endif
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents);
+static json_t *do_deep_copy(const json_t *json, jsonp_parents_t *parents);
 
-static JSON_INLINE void json_init(json_t *json, json_type type) {
+/* Called right after node_malloc(), which reserved room for the
+   allocator of the current call if there is one */
+static JSON_INLINE void json_init(json_t *json, json_type type, json_arena_t *arena) {
     json->type = type;
-    json->refcount = 1;
+    if (arena)
+        json->refcount = JSONP_ARENA_REFCOUNT | 1;
+    else if (jsonp_current_allocator())
+        json->refcount = JSON_INTERNAL_ALLOCATED | 1;
+    else
+        json->refcount = 1;
+}
+
+/* Fixed-size nodes and array tables are freed with their size, so
+   that they can come from the slab allocator */
+static void *node_malloc(json_arena_t *arena, size_t size) {
+    const json_allocator_t *allocator;
+    jsonp_owner_t *owner;
+
+    if (arena)
+        return jsonp_arena_malloc(arena, size);
+
+    allocator = jsonp_current_allocator();
+    if (!allocator)
+        return jsonp_node_malloc(NULL, size, json_memory_node);
+
+    owner = jsonp_node_malloc(allocator, sizeof(jsonp_owner_t) + size, json_memory_node);
+    if (!owner)
+        return NULL;
+    owner->allocator = allocator;
+    return owner + 1;
+}
+
+/* The node must have been initialized with json_init() */
+static void node_free(json_arena_t *arena, void *ptr, size_t size) {
+    const json_allocator_t *allocator;
+
+    if (arena)
+        return;
+
+    allocator = jsonp_allocator_of((json_t *)ptr);
+    if (allocator)
+        jsonp_node_free(allocator, (jsonp_owner_t *)ptr - 1, sizeof(jsonp_owner_t) + size,
+                        json_memory_node);
+    else
+        jsonp_node_free(NULL, ptr, size, json_memory_node);
+}
+
+static void *table_malloc(json_array_t *array, size_t size) {
+    if (array->arena)
+        return jsonp_arena_malloc(array->arena, size);
+    return jsonp_node_malloc(jsonp_allocator_of(&array->json), size, json_memory_array);
+}
+
+static void table_free(json_array_t *array, void *ptr, size_t size) {
+    if (!array->arena)
+        jsonp_node_free(jsonp_allocator_of(&array->json), ptr, size, json_memory_array);
+}
+
+/* The references held by arena containers are released with the arena.
+   Values from outside the arena are recorded so that they can be. */
+static int container_adopt(json_arena_t *arena, json_t *value) {
+    if (arena && jsonp_arena_adopt(arena, value)) {
+        json_decref(value);
+        return -1;
+    }
+    return 0;
+}
+
+static void container_release(json_arena_t *arena, json_t *value) {
+    if (!arena)
+        json_decref(value);
+}
+
+/*** circular reference check ***/
+
+static size_t parents_home(const jsonp_parents_t *parents, const json_t *json) {
+    size_t hash = (size_t)json;
+
+    /* Values are at least 16 bytes apart; mix the higher bits in */
+    hash = (hash >> 4) ^ (hash >> 12) ^ (hash >> 20);
+    return hash & (parents->size - 1);
+}
+
+void jsonp_parents_init(jsonp_parents_t *parents) {
+    parents->slots = parents->inline_slots;
+    parents->size = JSONP_PARENTS_INLINE;
+    parents->count = 0;
+    memset(parents->inline_slots, 0, sizeof(parents->inline_slots));
+}
+
+void jsonp_parents_close(jsonp_parents_t *parents) {
+    if (parents->slots != parents->inline_slots)
+        jsonp_free((void *)parents->slots);
 }
 
-int jsonp_loop_check(hashtable_t *parents, const json_t *json, char *key, size_t key_size,
-                     size_t *key_len_out) {
-    size_t key_len = snprintf(key, key_size, "%p", json);
+static int parents_grow(jsonp_parents_t *parents) {
+    const json_t **old_slots = parents->slots;
+    size_t old_size = parents->size, i, j;
+
+    parents->slots = jsonp_malloc(old_size * 2 * sizeof(json_t *));
+    if (!parents->slots) {
+        parents->slots = old_slots;
+        return -1;
+    }
+    memset((void *)parents->slots, 0, old_size * 2 * sizeof(json_t *));
+    parents->size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+        if (!old_slots[i])
+            continue;
+        j = parents_home(parents, old_slots[i]);
+        while (parents->slots[j])
+            j = (j + 1) & (parents->size - 1);
+        parents->slots[j] = old_slots[i];
+    }
+
+    if (old_slots != parents->inline_slots)
+        jsonp_free((void *)old_slots);
+    return 0;
+}
 
-    if (key_len_out)
-        *key_len_out = key_len;
+int jsonp_parents_enter(jsonp_parents_t *parents, const json_t *json) {
+    size_t i;
 
-    if (hashtable_get(parents, key, key_len))
+    /* Keep the load factor at most 1/2 */
+    if (2 * (parents->count + 1) > parents->size && parents_grow(parents))
         return -1;
 
-    return hashtable_set(parents, key, key_len, json_null());
+    i = parents_home(parents, json);
+    while (parents->slots[i]) {
+        if (parents->slots[i] == json)
+            return -1;
+        i = (i + 1) & (parents->size - 1);
+    }
+
+    parents->slots[i] = json;
+    parents->count++;
+    return 0;
+}
+
+void jsonp_parents_leave(jsonp_parents_t *parents, const json_t *json) {
+    size_t mask = parents->size - 1, i, j, home;
+
+    i = parents_home(parents, json);
+    while (parents->slots[i] != json)
+        i = (i + 1) & mask;
+
+    /* Shift the following entries of the cluster back to fill the hole,
+       unless they would move before their home slot */
+    j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!parents->slots[j])
+            break;
+        home = parents_home(parents, parents->slots[j]);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            parents->slots[i] = parents->slots[j];
+            i = j;
+        }
+    }
+
+    parents->slots[i] = NULL;
+    parents->count--;
 }
 
 /*** object ***/
 
 extern volatile uint32_t hashtable_seed;
 
-json_t *json_object(void) {
-    json_object_t *object = jsonp_malloc(sizeof(json_object_t));
+json_t *json_object(void) { return jsonp_object(NULL); }
+
+json_t *jsonp_object(json_arena_t *arena) {
+    json_object_t *object = node_malloc(arena, sizeof(json_object_t));
     if (!object)
         return NULL;
 
@@ -71,10 +223,10 @@ json_t *json_object(void) {
         json_object_seed(0);
     }
 
-    json_init(&object->json, JSON_OBJECT);
+    json_init(&object->json, JSON_OBJECT, arena);
 
-    if (hashtable_init(&object->hashtable)) {
-        jsonp_free(object);
+    if (hashtable_init_arena(&object->hashtable, arena)) {
+        node_free(arena, object, sizeof(json_object_t));
         return NULL;
     }
 
@@ -83,7 +235,7 @@ json_t *json_object(void) {
 
 static void json_delete_object(json_object_t *object) {
     hashtable_close(&object->hashtable);
-    jsonp_free(object);
+    node_free(object->hashtable.arena, object, sizeof(json_object_t));
 }
 
 size_t json_object_size(const json_t *json) {
@@ -92,6 +244,9 @@ size_t json_object_size(const json_t *json) {
     if (!json_is_object(json))
         return 0;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_size(json);
+
     object = json_to_object(json);
     return object->hashtable.size;
 }
@@ -109,6 +264,9 @@ json_t *json_object_getn(const json_t *json, const char *key, size_t key_len) {
     if (!key || !json_is_object(json))
         return NULL;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_object_getn(json, key, key_len);
+
     object = json_to_object(json);
     return hashtable_get(&object->hashtable, key, key_len);
 }
@@ -121,27 +279,37 @@ int json_object_set_new_nocheck(json_t *json, const char *key, json_t *value) {
     return json_object_setn_new_nocheck(json, key, strlen(key), value);
 }
 
-int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
-                                 json_t *value) {
+/* hash is NULL if it's not known */
+static int object_setn_new(json_t *json, const char *key, size_t key_len,
+                           const size_t *hash, json_t *value) {
     json_object_t *object;
 
     if (!value)
         return -1;
 
-    if (!key || !json_is_object(json) || json == value) {
+    if (!key || !json_is_object(json) || json == value || jsonp_is_immortal(json)) {
         json_decref(value);
         return -1;
     }
     object = json_to_object(json);
 
-    if (hashtable_set(&object->hashtable, key, key_len, value)) {
-        json_decref(value);
+    if (container_adopt(object->hashtable.arena, value))
+        return -1;
+
+    if (hash ? hashtable_set_hashed(&object->hashtable, key, key_len, *hash, value)
+             : hashtable_set(&object->hashtable, key, key_len, value)) {
+        container_release(object->hashtable.arena, value);
         return -1;
     }
 
     return 0;
 }
 
+int json_object_setn_new_nocheck(json_t *json, const char *key, size_t key_len,
+                                 json_t *value) {
+    return object_setn_new(json, key, key_len, NULL, value);
+}
+
 int json_object_set_new(json_t *json, const char *key, json_t *value) {
     if (!key) {
         json_decref(value);
@@ -160,6 +328,79 @@ int json_object_setn_new(json_t *json, const char *key, size_t key_len, json_t *
     return json_object_setn_new_nocheck(json, key, key_len, value);
 }
 
+/* A key with its hash, for the seed it was created with */
+struct json_key_t {
+    size_t hash;
+    size_t seed;
+    size_t len;
+    char key[1];
+};
+
+json_key_t *json_key_create(const char *key) {
+    if (!key)
+        return NULL;
+
+    return json_key_createn(key, strlen(key));
+}
+
+json_key_t *json_key_createn(const char *key, size_t key_len) {
+    json_key_t *handle;
+
+    if (!key || !utf8_check_string(key, key_len))
+        return NULL;
+
+    if (key_len >= (size_t)-1 - offsetof(json_key_t, key))
+        return NULL;
+
+    handle = jsonp_malloc(offsetof(json_key_t, key) + key_len + 1);
+    if (!handle)
+        return NULL;
+
+    memcpy(handle->key, key, key_len);
+    handle->key[key_len] = '\0';
+    handle->len = key_len;
+    handle->seed = hashtable_current_seed();
+    handle->hash = hashtable_hash(key, key_len);
+    return handle;
+}
+
+void json_key_destroy(json_key_t *key) { jsonp_free(key); }
+
+const char *jsonp_key_string(const json_key_t *key) { return key->key; }
+
+/* The hash of a key created before the seed was set is out of date */
+static size_t key_hash(const json_key_t *key) {
+    if (key->seed == hashtable_current_seed())
+        return key->hash;
+    return hashtable_hash(key->key, key->len);
+}
+
+json_t *json_object_get_key(const json_t *json, const json_key_t *key) {
+    json_object_t *object;
+
+    if (!key || !json_is_object(json))
+        return NULL;
+
+    if (jsonp_is_image(json))
+        return jsonp_image_object_getn(json, key->key, key->len);
+
+    object = json_to_object(json);
+    return hashtable_get_hashed(&object->hashtable, key->key, key->len, key_hash(key));
+}
+
+int json_object_set_key_new(json_t *json, const json_key_t *key, json_t *value) {
+    size_t hash;
+
+    if (!key) {
+        json_decref(value);
+        return -1;
+    }
+
+    /* The key was checked when the handle was created */
+    hash = key_hash(key);
+    return object_setn_new(json, key->key, key->len, &hash, value);
+}
+
 int json_object_del(json_t *json, const char *key) {
     if (!key)
         return -1;
@@ -170,7 +411,7 @@ int json_object_del(json_t *json, const char *key) {
 int json_object_deln(json_t *json, const char *key, size_t key_len) {
     json_object_t *object;
 
-    if (!key || !json_is_object(json))
+    if (!key || !json_is_object(json) || jsonp_is_immortal(json))
         return -1;
 
     object = json_to_object(json);
@@ -180,7 +421,7 @@ int json_object_deln(json_t *json, const char *key, size_t key_len) {
 int json_object_clear(json_t *json) {
     json_object_t *object;
 
-    if (!json_is_object(json))
+    if (!json_is_object(json) || jsonp_is_immortal(json))
         return -1;
 
     object = json_to_object(json);
@@ -189,6 +430,13 @@ int json_object_clear(json_t *json) {
     return 0;
 }
 
+int json_object_reserve(json_t *json, size_t size) {
+    if (!json_is_object(json) || jsonp_is_immortal(json))
+        return -1;
+
+    return hashtable_reserve(&json_to_object(json)->hashtable, size);
+}
+
 int json_object_update(json_t *object, json_t *other) {
     const char *key;
     size_t key_len;
@@ -237,18 +485,16 @@ int json_object_update_missing(json_t *object, json_t *other) {
     return 0;
 }
 
-int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *parents) {
+int do_object_update_recursive(json_t *object, json_t *other, jsonp_parents_t *parents) {
     const char *key;
     size_t key_len;
     json_t *value;
-    char loop_key[LOOP_KEY_LEN];
     int res = 0;
-    size_t loop_key_len;
 
     if (!json_is_object(object) || !json_is_object(other))
         return -1;
 
-    if (jsonp_loop_check(parents, other, loop_key, sizeof(loop_key), &loop_key_len))
+    if (jsonp_parents_enter(parents, other))
         return -1;
 
     json_object_keylen_foreach(other, key, key_len, value) {
@@ -267,29 +513,80 @@ int do_object_update_recursive(json_t *object, json_t *other, hashtable_t *paren
         }
     }
 
-    hashtable_del(parents, loop_key, loop_key_len);
+    jsonp_parents_leave(parents, other);
 
     return res;
 }
 
 int json_object_update_recursive(json_t *object, json_t *other) {
     int res;
-    hashtable_t parents_set;
+    jsonp_parents_t parents_set;
 
-    if (hashtable_init(&parents_set))
-        return -1;
+    jsonp_parents_init(&parents_set);
     res = do_object_update_recursive(object, other, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_parents_close(&parents_set);
 
     return res;
 }
 
+/* Objects on the updated paths are copied, all other values are
+   shared with object */
+static json_t *do_object_update_recursive_copy(json_t *object, json_t *other,
+                                               jsonp_parents_t *parents) {
+    const char *key;
+    size_t key_len;
+    json_t *result, *value, *v;
+
+    if (jsonp_parents_enter(parents, other))
+        return NULL;
+
+    result = json_copy(object);
+    if (!result)
+        goto out;
+
+    json_object_keylen_foreach(other, key, key_len, value) {
+        v = json_object_getn(object, key, key_len);
+
+        if (json_is_object(v) && json_is_object(value))
+            v = do_object_update_recursive_copy(v, value, parents);
+        else
+            v = json_incref(value);
+
+        if (json_object_setn_new_nocheck(result, key, key_len, v)) {
+            json_decref(result);
+            result = NULL;
+            break;
+        }
+    }
+
+out:
+    jsonp_parents_leave(parents, other);
+    return result;
+}
+
+json_t *json_object_update_recursive_copy(json_t *object, json_t *other) {
+    json_t *result;
+    jsonp_parents_t parents_set;
+
+    if (!json_is_object(object) || !json_is_object(other))
+        return NULL;
+
+    jsonp_parents_init(&parents_set);
+    result = do_object_update_recursive_copy(object, other, &parents_set);
+    jsonp_parents_close(&parents_set);
+
+    return result;
+}
+
 void *json_object_iter(json_t *json) {
     json_object_t *object;
 
     if (!json_is_object(json))
         return NULL;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_object_iter(json);
+
     object = json_to_object(json);
     return hashtable_iter(&object->hashtable);
 }
@@ -300,6 +597,9 @@ void *json_object_iter_at(json_t *json, const char *key) {
     if (!key || !json_is_object(json))
         return NULL;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_object_iter_at(json, key, strlen(key));
+
     object = json_to_object(json);
     return hashtable_iter_at(&object->hashtable, key, strlen(key));
 }
@@ -310,6 +610,9 @@ void *json_object_iter_next(json_t *json, void *iter) {
     if (!json_is_object(json) || iter == NULL)
         return NULL;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_object_iter_next(json, iter);
+
     object = json_to_object(json);
     return hashtable_iter_next(&object->hashtable, iter);
 }
@@ -332,16 +635,22 @@ json_t *json_object_iter_value(void *iter) {
     if (!iter)
         return NULL;
 
+    if (jsonp_is_image_pair(iter))
+        return jsonp_image_iter_value(iter);
+
     return (json_t *)hashtable_iter_value(iter);
 }
 
 int json_object_iter_set_new(json_t *json, void *iter, json_t *value) {
-    if (!json_is_object(json) || !iter || !value) {
+    if (!json_is_object(json) || !iter || !value || jsonp_is_immortal(json)) {
         json_decref(value);
         return -1;
     }
 
-    hashtable_iter_set(iter, value);
+    if (container_adopt(json_to_object(json)->hashtable.arena, value))
+        return -1;
+
+    hashtable_iter_set(&json_to_object(json)->hashtable, iter, value);
     return 0;
 }
 
@@ -356,15 +665,25 @@ static int json_object_equal(const json_t *object1, const json_t *object2) {
     const char *key;
     size_t key_len;
     const json_t *value1, *value2;
+    void *iter2;
 
     if (json_object_size(object1) != json_object_size(object2))
         return 0;
 
+    /* Objects from the same source usually have their keys in the same
+       order, and then no lookups are needed */
+    iter2 = json_object_iter((json_t *)object2);
     json_object_keylen_foreach((json_t *)object1, key, key_len, value1) {
-        value2 = json_object_getn(object2, key, key_len);
+        if (iter2 && json_object_iter_key_len(iter2) == key_len &&
+            memcmp(json_object_iter_key(iter2), key, key_len) == 0)
+            value2 = json_object_iter_value(iter2);
+        else
+            value2 = json_object_getn(object2, key, key_len);
 
         if (!json_equal(value1, value2))
             return 0;
+        if (iter2)
+            iter2 = json_object_iter_next((json_t *)object2, iter2);
     }
 
     return 1;
@@ -387,59 +706,30 @@ static json_t *json_object_copy(json_t *object) {
     return result;
 }
 
-static json_t *json_object_deep_copy(const json_t *object, hashtable_t *parents) {
-    json_t *result;
-    void *iter;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
-
-    if (jsonp_loop_check(parents, object, loop_key, sizeof(loop_key), &loop_key_len))
-        return NULL;
-
-    result = json_object();
-    if (!result)
-        goto out;
+/*** array ***/
 
-    /* Cannot use json_object_foreach because object has to be cast
-       non-const */
-    iter = json_object_iter((json_t *)object);
-    while (iter) {
-        const char *key;
-        size_t key_len;
-        const json_t *value;
-        key = json_object_iter_key(iter);
-        key_len = json_object_iter_key_len(iter);
-        value = json_object_iter_value(iter);
-
-        if (json_object_setn_new_nocheck(result, key, key_len,
-                                         do_deep_copy(value, parents))) {
-            json_decref(result);
-            result = NULL;
-            break;
-        }
-        iter = json_object_iter_next((json_t *)object, iter);
-    }
+json_t *json_array(void) { return jsonp_array(NULL); }
 
-out:
-    hashtable_del(parents, loop_key, loop_key_len);
+json_t *jsonp_array(json_arena_t *arena) { return jsonp_array_sized(arena, 8); }
 
-    return result;
-}
+json_t *jsonp_array_sized(json_arena_t *arena, size_t size) {
+    json_array_t *array;
 
-/*** array ***/
+    if (size == 0 || size > (size_t)-1 / sizeof(json_t *))
+        return NULL;
 
-json_t *json_array(void) {
-    json_array_t *array = jsonp_malloc(sizeof(json_array_t));
+    array = node_malloc(arena, sizeof(json_array_t));
     if (!array)
         return NULL;
-    json_init(&array->json, JSON_ARRAY);
+    json_init(&array->json, JSON_ARRAY, arena);
 
     array->entries = 0;
-    array->size = 8;
+    array->size = size;
+    array->arena = arena;
 
-    array->table = jsonp_malloc(array->size * sizeof(json_t *));
+    array->table = table_malloc(array, array->size * sizeof(json_t *));
     if (!array->table) {
-        jsonp_free(array);
+        node_free(arena, array, sizeof(json_array_t));
         return NULL;
     }
 
@@ -452,14 +742,17 @@ static void json_delete_array(json_array_t *array) {
     for (i = 0; i < array->entries; i++)
         json_decref(array->table[i]);
 
-    jsonp_free(array->table);
-    jsonp_free(array);
+    table_free(array, array->table, array->size * sizeof(json_t *));
+    node_free(array->arena, array, sizeof(json_array_t));
 }
 
 size_t json_array_size(const json_t *json) {
     if (!json_is_array(json))
         return 0;
 
+    if (jsonp_is_image(json))
+        return jsonp_image_size(json);
+
     return json_to_array(json)->entries;
 }
 
@@ -467,6 +760,8 @@ json_t *json_array_get(const json_t *json, size_t index) {
     json_array_t *array;
     if (!json_is_array(json))
         return NULL;
+    if (jsonp_is_image(json))
+        return jsonp_image_array_get(json, index);
     array = json_to_array(json);
 
     if (index >= array->entries)
@@ -481,7 +776,7 @@ int json_array_set_new(json_t *json, size_t index, json_t *value) {
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || jsonp_is_immortal(json)) {
         json_decref(value);
         return -1;
     }
@@ -492,7 +787,10 @@ int json_array_set_new(json_t *json, size_t index, json_t *value) {
         return -1;
     }
 
-    json_decref(array->table[index]);
+    if (container_adopt(array->arena, value))
+        return -1;
+
+    container_release(array->arena, array->table[index]);
     array->table[index] = value;
 
     return 0;
@@ -508,7 +806,7 @@ static void array_copy(json_t **dest, size_t dpos, json_t **src, size_t spos,
 }
 
 static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
-    size_t new_size;
+    size_t new_size, old_size = array->size;
     json_t **old_table, **new_table;
 
     if (array->entries + amount <= array->size)
@@ -517,7 +815,7 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
     old_table = array->table;
 
     new_size = max(array->size + amount, array->size * 2);
-    new_table = jsonp_malloc(new_size * sizeof(json_t *));
+    new_table = table_malloc(array, new_size * sizeof(json_t *));
     if (!new_table)
         return NULL;
 
@@ -526,27 +824,54 @@ static json_t **json_array_grow(json_array_t *array, size_t amount, int copy) {
 
     if (copy) {
         array_copy(array->table, 0, old_table, 0, array->entries);
-        jsonp_free(old_table);
+        table_free(array, old_table, old_size * sizeof(json_t *));
         return array->table;
     }
 
     return old_table;
 }
 
+int json_array_reserve(json_t *json, size_t size) {
+    json_array_t *array;
+    json_t **new_table;
+
+    if (!json_is_array(json) || jsonp_is_immortal(json))
+        return -1;
+    array = json_to_array(json);
+
+    if (size <= array->size)
+        return 0;
+    if (size > (size_t)-1 / sizeof(json_t *))
+        return -1;
+
+    new_table = table_malloc(array, size * sizeof(json_t *));
+    if (!new_table)
+        return -1;
+
+    array_copy(new_table, 0, array->table, 0, array->entries);
+    table_free(array, array->table, array->size * sizeof(json_t *));
+    array->table = new_table;
+    array->size = size;
+    return 0;
+}
+
 int json_array_append_new(json_t *json, json_t *value) {
     json_array_t *array;
 
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || jsonp_is_immortal(json)) {
         json_decref(value);
         return -1;
     }
     array = json_to_array(json);
 
+    if (container_adopt(array->arena, value))
+        return -1;
+
     if (!json_array_grow(array, 1, 1)) {
-        json_decref(value);
+        container_release(array->arena, value);
         return -1;
     }
 
@@ -556,14 +881,58 @@ int json_array_append_new(json_t *json, json_t *value) {
     return 0;
 }
 
+static void decref_values(json_t **values, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        json_decref(values[i]);
+}
+
+int json_array_append_many_new(json_t *json, json_t **values, size_t count) {
+    json_array_t *array;
+    size_t i;
+
+    if (!values)
+        return count ? -1 : 0;
+
+    for (i = 0; i < count; i++) {
+        if (!values[i] || values[i] == json)
+            break;
+    }
+    if (i < count || !json_is_array(json) || jsonp_is_immortal(json) ||
+        count > (size_t)-1 / sizeof(json_t *) - json_to_array(json)->size) {
+        decref_values(values, count);
+        return -1;
+    }
+    array = json_to_array(json);
+
+    if (!json_array_grow(array, count, 1)) {
+        decref_values(values, count);
+        return -1;
+    }
+
+    /* Values adopted before a failure are released with the arena, so
+       the array is only changed once all of them are adopted */
+    for (i = 0; i < count; i++)
+        if (container_adopt(array->arena, values[i])) {
+            decref_values(values + i + 1, count - i - 1);
+            return -1;
+        }
+
+    memcpy(array->table + array->entries, values, count * sizeof(json_t *));
+    array->entries += count;
+    return 0;
+}
+
 int json_array_insert_new(json_t *json, size_t index, json_t *value) {
     json_array_t *array;
     json_t **old_table;
+    size_t old_size;
 
     if (!value)
         return -1;
 
-    if (!json_is_array(json) || json == value) {
+    if (!json_is_array(json) || json == value || jsonp_is_immortal(json)) {
         json_decref(value);
         return -1;
     }
@@ -574,16 +943,20 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
         return -1;
     }
 
+    if (container_adopt(array->arena, value))
+        return -1;
+
+    old_size = array->size;
     old_table = json_array_grow(array, 1, 0);
     if (!old_table) {
-        json_decref(value);
+        container_release(array->arena, value);
         return -1;
     }
 
     if (old_table != array->table) {
         array_copy(array->table, 0, old_table, 0, index);
         array_copy(array->table, index + 1, old_table, index, array->entries - index);
-        jsonp_free(old_table);
+        table_free(array, old_table, old_size * sizeof(json_t *));
     } else
         array_move(array, index + 1, index, array->entries - index);
 
@@ -596,14 +969,14 @@ int json_array_insert_new(json_t *json, size_t index, json_t *value) {
 int json_array_remove(json_t *json, size_t index) {
     json_array_t *array;
 
-    if (!json_is_array(json))
+    if (!json_is_array(json) || jsonp_is_immortal(json))
         return -1;
     array = json_to_array(json);
 
     if (index >= array->entries)
         return -1;
 
-    json_decref(array->table[index]);
+    container_release(array->arena, array->table[index]);
 
     /* If we're removing the last element, nothing has to be moved */
     if (index < array->entries - 1)
@@ -618,12 +991,12 @@ int json_array_clear(json_t *json) {
     json_array_t *array;
     size_t i;
 
-    if (!json_is_array(json))
+    if (!json_is_array(json) || jsonp_is_immortal(json))
         return -1;
     array = json_to_array(json);
 
     for (i = 0; i < array->entries; i++)
-        json_decref(array->table[i]);
+        container_release(array->arena, array->table[i]);
 
     array->entries = 0;
     return 0;
@@ -633,20 +1006,48 @@ int json_array_extend(json_t *json, json_t *other_json) {
     json_array_t *array, *other;
     size_t i;
 
-    if (!json_is_array(json) || !json_is_array(other_json))
+    if (!json_is_array(json) || !json_is_array(other_json) || jsonp_is_immortal(json))
         return -1;
     array = json_to_array(json);
+
+    if (jsonp_is_image(other_json)) {
+        for (i = 0; i < json_array_size(other_json); i++) {
+            if (json_array_append(json, json_array_get(other_json, i)))
+                return -1;
+        }
+        return 0;
+    }
     other = json_to_array(other_json);
 
     if (!json_array_grow(array, other->entries, 1))
         return -1;
 
-    for (i = 0; i < other->entries; i++)
+    for (i = 0; i < other->entries; i++) {
         json_incref(other->table[i]);
+        if (container_adopt(array->arena, other->table[i]))
+            return -1;
+    }
+
+    array_copy(array->table, array->entries, other->table, 0, other->entries);
+
+    array->entries += other->entries;
+    return 0;
+}
+
+int jsonp_array_move(json_t *json, json_t *other_json) {
+    json_array_t *array = json_to_array(json);
+    json_array_t *other = json_to_array(other_json);
+
+    if (array->arena != other->arena)
+        return -1;
+
+    if (!json_array_grow(array, other->entries, 1))
+        return -1;
 
     array_copy(array->table, array->entries, other->table, 0, other->entries);
 
     array->entries += other->entries;
+    other->entries = 0;
     return 0;
 }
 
@@ -684,80 +1085,104 @@ static json_t *json_array_copy(json_t *array) {
     return result;
 }
 
-static json_t *json_array_deep_copy(const json_t *array, hashtable_t *parents) {
-    json_t *result;
-    size_t i;
-    char loop_key[LOOP_KEY_LEN];
-    size_t loop_key_len;
-
-    if (jsonp_loop_check(parents, array, loop_key, sizeof(loop_key), &loop_key_len))
-        return NULL;
-
-    result = json_array();
-    if (!result)
-        goto out;
-
-    for (i = 0; i < json_array_size(array); i++) {
-        if (json_array_append_new(result,
-                                  do_deep_copy(json_array_get(array, i), parents))) {
-            json_decref(result);
-            result = NULL;
-            break;
-        }
-    }
+/*** string ***/
 
-out:
-    hashtable_del(parents, loop_key, loop_key_len);
+#define string_node_size(capacity_) (offsetof(json_string_t, data) + (capacity_))
 
-    return result;
-}
+/* Strings of an image have no pointer to their value */
+#define string_value(s_) ((s_)->value ? (s_)->value : (s_)->data)
 
-/*** string ***/
+/* How string_create() treats the value */
+#define STRING_COPY   0
+#define STRING_OWN    1
+#define STRING_BORROW 2
 
-static json_t *string_create(const char *value, size_t len, int own) {
-    char *v;
+/* Short strings are copied next to the node, and an owned buffer is
+   released in that case. A borrowed value is used as is, and never
+   released. */
+static json_t *string_create(json_arena_t *arena, const char *value, size_t len,
+                             int mode) {
+    char *v = NULL;
     json_string_t *string;
+    size_t capacity = 0;
 
     if (!value)
         return NULL;
 
-    if (own)
+    if (len <= JSON_STRING_INLINE_MAX)
+        capacity = len + 1;
+    else if (mode != STRING_COPY)
         v = (char *)value;
     else {
-        v = jsonp_strndup(value, len);
+        v = arena ? jsonp_arena_strndup(arena, value, len)
+                  : jsonp_strndup_as(value, len, json_memory_string);
         if (!v)
             return NULL;
     }
 
-    string = jsonp_malloc(sizeof(json_string_t));
+    string = node_malloc(arena, string_node_size(capacity));
     if (!string) {
-        jsonp_free(v);
+        if (!arena && mode == STRING_OWN)
+            jsonp_free((char *)value);
+        else if (!arena && mode == STRING_COPY)
+            jsonp_free(v);
         return NULL;
     }
-    json_init(&string->json, JSON_STRING);
+    json_init(&string->json, JSON_STRING, arena);
+    string->borrowed = 0;
+    if (!v) {
+        memcpy(string->data, value, len);
+        string->data[len] = '\0';
+        v = string->data;
+        if (mode == STRING_OWN && !arena)
+            jsonp_free((char *)value);
+    } else if (mode == STRING_BORROW)
+        string->borrowed = 1;
     string->value = v;
     string->length = len;
+    string->arena = arena;
+    string->capacity = (unsigned char)capacity;
 
     return &string->json;
 }
 
+static json_string_t shared_empty_string = {{JSON_STRING, (size_t)-1}, "", 0, NULL, 0, 0,
+                                            ""};
+
+/* Immortal empty string for JSON_SHARE_VALUES */
+json_t *jsonp_shared_empty_string(void) { return &shared_empty_string.json; }
+
 json_t *json_string_nocheck(const char *value) {
     if (!value)
         return NULL;
 
-    return string_create(value, strlen(value), 0);
+    return string_create(NULL, value, strlen(value), STRING_COPY);
 }
 
 json_t *json_stringn_nocheck(const char *value, size_t len) {
-    return string_create(value, len, 0);
+    return string_create(NULL, value, len, STRING_COPY);
 }
 
 /* this is private; "steal" is not a public API concept */
 json_t *jsonp_stringn_nocheck_own(const char *value, size_t len) {
-    return string_create(value, len, 1);
+    return string_create(NULL, value, len, STRING_OWN);
 }
 
-json_t *json_string(const char *value) {
+json_t *jsonp_stringn(json_arena_t *arena, const char *value, size_t len) {
+    return string_create(arena, value, len, STRING_COPY);
+}
+
+/* value must have been allocated from arena, if not NULL */
+json_t *jsonp_stringn_own(json_arena_t *arena, const char *value, size_t len) {
+    return string_create(arena, value, len, STRING_OWN);
+}
+
+/* value must outlive the string, and isn't released with it */
+json_t *jsonp_stringn_borrow(json_arena_t *arena, const char *value, size_t len) {
+    return string_create(arena, value, len, STRING_BORROW);
+}
+
+json_t *json_string(const char *value) {
     if (!value)
         return NULL;
 
@@ -775,7 +1200,7 @@ const char *json_string_value(const json_t *json) {
     if (!json_is_string(json))
         return NULL;
 
-    return json_to_string(json)->value;
+    return string_value(json_to_string(json));
 }
 
 size_t json_string_length(const json_t *json) {
@@ -793,20 +1218,37 @@ int json_string_set_nocheck(json_t *json, const char *value) {
 }
 
 int json_string_setn_nocheck(json_t *json, const char *value, size_t len) {
+    const json_allocator_t *allocator;
     char *dup;
     json_string_t *string;
 
-    if (!json_is_string(json) || !value)
+    if (!json_is_string(json) || !value || jsonp_is_immortal(json))
         return -1;
 
-    dup = jsonp_strndup(value, len);
+    string = json_to_string(json);
+    allocator = jsonp_allocator_of(json);
+    if (len < string->capacity) {
+        /* value may point into the current value */
+        memmove(string->data, value, len);
+        dup = string->data;
+        dup[len] = '\0';
+    } else if (string->arena)
+        dup = jsonp_arena_strndup(string->arena, value, len);
+    else {
+        dup = jsonp_alloc(allocator, len + 1, json_memory_string);
+        if (dup) {
+            memcpy(dup, value, len);
+            dup[len] = '\0';
+        }
+    }
     if (!dup)
         return -1;
 
-    string = json_to_string(json);
-    jsonp_free(string->value);
+    if (!string->arena && !string->borrowed && string->value != string->data)
+        jsonp_dealloc(allocator, string->value, 0);
     string->value = dup;
     string->length = len;
+    string->borrowed = 0;
 
     return 0;
 }
@@ -826,8 +1268,9 @@ int json_string_setn(json_t *json, const char *value, size_t len) {
 }
 
 static void json_delete_string(json_string_t *string) {
-    jsonp_free(string->value);
-    jsonp_free(string);
+    if (!string->borrowed && string->value != string->data)
+        jsonp_dealloc(jsonp_allocator_of(&string->json), string->value, 0);
+    node_free(string->arena, string, string_node_size(string->capacity));
 }
 
 static int json_string_equal(const json_t *string1, const json_t *string2) {
@@ -835,20 +1278,21 @@ static int json_string_equal(const json_t *string1, const json_t *string2) {
 
     s1 = json_to_string(string1);
     s2 = json_to_string(string2);
-    return s1->length == s2->length && !memcmp(s1->value, s2->value, s1->length);
+    return s1->length == s2->length &&
+           !memcmp(string_value(s1), string_value(s2), s1->length);
 }
 
 static json_t *json_string_copy(const json_t *string) {
     json_string_t *s;
 
     s = json_to_string(string);
-    return json_stringn_nocheck(s->value, s->length);
+    return json_stringn_nocheck(string_value(s), s->length);
 }
 
 json_t *json_vsprintf(const char *fmt, va_list ap) {
     json_t *json = NULL;
     int length;
-    char *buf;
+    char *buf, small[JSON_STRING_INLINE_MAX + 1];
     va_list aq;
     va_copy(aq, ap);
 
@@ -860,7 +1304,15 @@ json_t *json_vsprintf(const char *fmt, va_list ap) {
         goto out;
     }
 
-    buf = jsonp_malloc((size_t)length + 1);
+    if (length <= JSON_STRING_INLINE_MAX) {
+        /* stored inline, no need for a temporary buffer */
+        vsnprintf(small, sizeof(small), fmt, aq);
+        if (utf8_check_string(small, length))
+            json = json_stringn_nocheck(small, length);
+        goto out;
+    }
+
+    buf = jsonp_malloc_as((size_t)length + 1, json_memory_string);
     if (!buf)
         goto out;
 
@@ -890,16 +1342,77 @@ json_t *json_sprintf(const char *fmt, ...) {
 
 /*** integer ***/
 
-json_t *json_integer(json_int_t value) {
-    json_integer_t *integer = jsonp_malloc(sizeof(json_integer_t));
+json_t *json_integer(json_int_t value) { return jsonp_integer(NULL, value); }
+
+json_t *jsonp_integer(json_arena_t *arena, json_int_t value) {
+    json_integer_t *integer = node_malloc(arena, sizeof(json_integer_t));
     if (!integer)
         return NULL;
-    json_init(&integer->json, JSON_INTEGER);
+    json_init(&integer->json, JSON_INTEGER, arena);
 
     integer->value = value;
     return &integer->json;
 }
 
+/* Immortal integers for JSON_SHARE_VALUES */
+#ifndef SHARED_INT_MIN
+#define SHARED_INT_MIN -128
+#endif
+#ifndef SHARED_INT_MAX
+#define SHARED_INT_MAX 1023
+#endif
+
+static json_integer_t shared_integers[SHARED_INT_MAX - SHARED_INT_MIN + 1];
+
+/* The table is filled in on first use by the thread that claims it,
+   and the others wait until it's published */
+static volatile char shared_claimed = 0;
+static volatile int shared_ready = 0;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define shared_claim()    (__atomic_test_and_set(&shared_claimed, __ATOMIC_RELAXED) == 0)
+#define shared_is_ready() __atomic_load_n(&shared_ready, __ATOMIC_ACQUIRE)
+#define shared_publish()  __atomic_store_n(&shared_ready, 1, __ATOMIC_RELEASE)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define shared_claim()    (__sync_lock_test_and_set(&shared_claimed, 1) == 0)
+#define shared_is_ready() __sync_fetch_and_add(&shared_ready, 0)
+#define shared_publish()  (__sync_synchronize(), shared_ready = 1)
+#else
+/* Not thread safe */
+#define shared_claim()    1
+#define shared_is_ready() shared_ready
+#define shared_publish()  (shared_ready = 1)
+#endif
+
+static void shared_integers_init(void) {
+    size_t i;
+
+    if (!shared_claim()) {
+        while (!shared_is_ready()) {
+#ifdef HAVE_SCHED_YIELD
+            sched_yield();
+#endif
+        }
+        return;
+    }
+
+    for (i = 0; i < SHARED_INT_MAX - SHARED_INT_MIN + 1; i++) {
+        shared_integers[i].json.type = JSON_INTEGER;
+        shared_integers[i].json.refcount = (size_t)-1;
+        shared_integers[i].value = SHARED_INT_MIN + (json_int_t)i;
+    }
+    shared_publish();
+}
+
+json_t *jsonp_shared_integer(json_arena_t *arena, json_int_t value) {
+    if (value < SHARED_INT_MIN || value > SHARED_INT_MAX)
+        return jsonp_integer(arena, value);
+
+    if (!shared_is_ready())
+        shared_integers_init();
+    return &shared_integers[value - SHARED_INT_MIN].json;
+}
+
 json_int_t json_integer_value(const json_t *json) {
     if (!json_is_integer(json))
         return 0;
@@ -908,7 +1421,7 @@ json_int_t json_integer_value(const json_t *json) {
 }
 
 int json_integer_set(json_t *json, json_int_t value) {
-    if (!json_is_integer(json))
+    if (!json_is_integer(json) || jsonp_is_immortal(json))
         return -1;
 
     json_to_integer(json)->value = value;
@@ -916,7 +1429,9 @@ int json_integer_set(json_t *json, json_int_t value) {
     return 0;
 }
 
-static void json_delete_integer(json_integer_t *integer) { jsonp_free(integer); }
+static void json_delete_integer(json_integer_t *integer) {
+    node_free(NULL, integer, sizeof(json_integer_t));
+}
 
 static int json_integer_equal(const json_t *integer1, const json_t *integer2) {
     return json_integer_value(integer1) == json_integer_value(integer2);
@@ -928,16 +1443,18 @@ static json_t *json_integer_copy(const json_t *integer) {
 
 /*** real ***/
 
-json_t *json_real(double value) {
+json_t *json_real(double value) { return jsonp_real(NULL, value); }
+
+json_t *jsonp_real(json_arena_t *arena, double value) {
     json_real_t *real;
 
     if (isnan(value) || isinf(value))
         return NULL;
 
-    real = jsonp_malloc(sizeof(json_real_t));
+    real = node_malloc(arena, sizeof(json_real_t));
     if (!real)
         return NULL;
-    json_init(&real->json, JSON_REAL);
+    json_init(&real->json, JSON_REAL, arena);
 
     real->value = value;
     return &real->json;
@@ -951,7 +1468,7 @@ double json_real_value(const json_t *json) {
 }
 
 int json_real_set(json_t *json, double value) {
-    if (!json_is_real(json) || isnan(value) || isinf(value))
+    if (!json_is_real(json) || isnan(value) || isinf(value) || jsonp_is_immortal(json))
         return -1;
 
     json_to_real(json)->value = value;
@@ -959,7 +1476,9 @@ int json_real_set(json_t *json, double value) {
     return 0;
 }
 
-static void json_delete_real(json_real_t *real) { jsonp_free(real); }
+static void json_delete_real(json_real_t *real) {
+    node_free(NULL, real, sizeof(json_real_t));
+}
 
 static int json_real_equal(const json_t *real1, const json_t *real2) {
     return json_real_value(real1) == json_real_value(real2);
@@ -997,12 +1516,86 @@ json_t *json_null(void) {
     return &the_null;
 }
 
-/*** deletion ***/
+/*** raw ***/
 
-void json_delete(json_t *json) {
-    if (!json)
-        return;
+#define raw_node_size(len_) (offsetof(json_raw_t, value) + (len_) + 1)
+
+#define is_json_space(c_) ((c_) == ' ' || (c_) == '\t' || (c_) == '\n' || (c_) == '\r')
+
+json_t *json_rawn_nocheck(const char *text, size_t len) {
+    json_raw_t *raw;
+
+    if (!text || len > (size_t)-1 - raw_node_size(0))
+        return NULL;
+
+    /* The white space around the value would end up in the output */
+    while (len > 0 && is_json_space(*text)) {
+        text++;
+        len--;
+    }
+    while (len > 0 && is_json_space(text[len - 1]))
+        len--;
+
+    raw = node_malloc(NULL, raw_node_size(len));
+    if (!raw)
+        return NULL;
+    json_init(&raw->json, JSON_RAW, NULL);
 
+    memcpy(raw->value, text, len);
+    raw->value[len] = '\0';
+    raw->length = len;
+    return &raw->json;
+}
+
+json_t *json_rawn(const char *text, size_t len) {
+    /* The text is decoded once to check it, without building values */
+    static const json_sax_handler_t no_events = {NULL};
+
+    if (!text || json_sax_loadb(text, len, &no_events, NULL, JSON_DECODE_ANY, NULL))
+        return NULL;
+
+    return json_rawn_nocheck(text, len);
+}
+
+json_t *json_raw(const char *text) {
+    if (!text)
+        return NULL;
+
+    return json_rawn(text, strlen(text));
+}
+
+const char *json_raw_value(const json_t *json) {
+    if (!json_is_raw(json))
+        return NULL;
+
+    return json_to_raw(json)->value;
+}
+
+size_t json_raw_length(const json_t *json) {
+    if (!json_is_raw(json))
+        return 0;
+
+    return json_to_raw(json)->length;
+}
+
+static void json_delete_raw(json_raw_t *raw) {
+    node_free(NULL, raw, raw_node_size(raw->length));
+}
+
+static int json_raw_equal(const json_t *raw1, const json_t *raw2) {
+    size_t length = json_raw_length(raw1);
+
+    return length == json_raw_length(raw2) &&
+           memcmp(json_raw_value(raw1), json_raw_value(raw2), length) == 0;
+}
+
+static json_t *json_raw_copy(const json_t *raw) {
+    return json_rawn_nocheck(json_raw_value(raw), json_raw_length(raw));
+}
+
+/*** deletion ***/
+
+static void delete_node(json_t *json) {
     switch (json_typeof(json)) {
         case JSON_OBJECT:
             json_delete_object(json_to_object(json));
@@ -1019,6 +1612,9 @@ void json_delete(json_t *json) {
         case JSON_REAL:
             json_delete_real(json_to_real(json));
             break;
+        case JSON_RAW:
+            json_delete_raw(json_to_raw(json));
+            break;
         default:
             return;
     }
@@ -1026,6 +1622,248 @@ void json_delete(json_t *json) {
     /* json_delete is not called for true, false or null */
 }
 
+static int is_nonempty_container(json_t *json) {
+    if (json_is_array(json))
+        return json_to_array(json)->entries != 0;
+    if (json_is_object(json))
+        return json_to_object(json)->hashtable.size != 0;
+    return 0;
+}
+
+/* Containers kept in json_delete()'s own stack frame before allocating */
+#define DELETE_INLINE_DEPTH 16
+
+/* Containers that json_delete() is emptying, innermost last */
+typedef struct {
+    json_t **values;
+    size_t len;
+    size_t size;
+    json_t *inline_values[DELETE_INLINE_DEPTH];
+} delete_stack_t;
+
+static int delete_push(delete_stack_t *stack, json_t *json) {
+    json_t **new_values;
+
+    if (stack->len == stack->size) {
+        if (stack->size > (size_t)-1 / 2 / sizeof(json_t *))
+            return -1;
+
+        new_values = jsonp_malloc(stack->size * 2 * sizeof(json_t *));
+        if (!new_values)
+            return -1;
+        memcpy(new_values, stack->values, stack->len * sizeof(json_t *));
+
+        if (stack->values != stack->inline_values)
+            jsonp_free(stack->values);
+        stack->values = new_values;
+        stack->size *= 2;
+    }
+
+    stack->values[stack->len++] = json;
+    return 0;
+}
+
+/* The members of a container are released one at a time, and a member
+   that loses its last reference and has members of its own is emptied
+   next instead of recursing, so deep trees don't use up the C stack */
+void json_delete(json_t *json) {
+    delete_stack_t stack;
+    json_t *member;
+
+    if (!json)
+        return;
+    if (!is_nonempty_container(json)) {
+        delete_node(json);
+        return;
+    }
+
+    stack.values = stack.inline_values;
+    stack.len = 0;
+    stack.size = DELETE_INLINE_DEPTH;
+    stack.values[stack.len++] = json;
+
+    while (stack.len) {
+        json = stack.values[stack.len - 1];
+        if (!is_nonempty_container(json)) {
+            stack.len--;
+            delete_node(json);
+            continue;
+        }
+
+        if (json_is_array(json))
+            member = json_to_array(json)->table[--json_to_array(json)->entries];
+        else
+            member = hashtable_take_last(&json_to_object(json)->hashtable);
+
+        /* A partly copied object may have NULL values */
+        if (!member || member->refcount == (size_t)-1 ||
+            (JSON_INTERNAL_DECREF(member) & ~JSON_INTERNAL_ALLOCATED) != 0)
+            continue;
+
+        if (!is_nonempty_container(member))
+            delete_node(member);
+        else if (delete_push(&stack, member))
+            json_delete(member); /* recurse without memory for the stack */
+    }
+
+    if (stack.values != stack.inline_values)
+        jsonp_free(stack.values);
+}
+
+/*** deferred destruction ***/
+
+/* Containers released by json_decref_deferred() wait in the pending
+   stack. json_reclaim() takes them over to the work stack and tears
+   them down one member at a time, so that each step frees at most one
+   node. A member that loses its last reference is pushed on top, so
+   the work stack is only as deep as the trees. */
+typedef struct {
+    json_t **values;
+    size_t len;
+    size_t size;
+} reclaim_stack_t;
+
+static reclaim_stack_t reclaim_pending = {NULL, 0, 0};
+static reclaim_stack_t reclaim_work = {NULL, 0, 0};
+static volatile char pending_locked = 0;
+static volatile char work_locked = 0;
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+#define reclaim_trylock(lock_) (__atomic_test_and_set(&(lock_), __ATOMIC_ACQUIRE) == 0)
+#define reclaim_unlock(lock_)  __atomic_clear(&(lock_), __ATOMIC_RELEASE)
+#elif defined(HAVE_SYNC_BUILTINS)
+#define reclaim_trylock(lock_) (__sync_lock_test_and_set(&(lock_), 1) == 0)
+#define reclaim_unlock(lock_)  __sync_lock_release(&(lock_))
+#else
+/* Not thread safe */
+#define reclaim_trylock(lock_) 1
+#define reclaim_unlock(lock_)  ((void)0)
+#endif
+
+static void reclaim_lock(volatile char *lock) {
+    (void)lock;
+    while (!reclaim_trylock(*lock)) {
+#ifdef HAVE_SCHED_YIELD
+        sched_yield();
+#endif
+    }
+}
+
+/* The stacks always come from the global allocator, as they outlive
+   the calls that push to them */
+static int reclaim_push(reclaim_stack_t *stack, json_t *json) {
+    json_t **values;
+    size_t size;
+
+    if (stack->len == stack->size) {
+        size = stack->size ? stack->size * 2 : 16;
+        if (size > (size_t)-1 / sizeof(json_t *))
+            return -1;
+
+        values = jsonp_alloc(NULL, size * sizeof(json_t *), json_memory_other);
+        if (!values)
+            return -1;
+        if (stack->len)
+            memcpy(values, stack->values, stack->len * sizeof(json_t *));
+        jsonp_dealloc(NULL, stack->values, stack->size * sizeof(json_t *));
+        stack->values = values;
+        stack->size = size;
+    }
+
+    stack->values[stack->len++] = json;
+    return 0;
+}
+
+static void reclaim_release(reclaim_stack_t *stack) {
+    jsonp_dealloc(NULL, stack->values, stack->size * sizeof(json_t *));
+    stack->values = NULL;
+    stack->len = 0;
+    stack->size = 0;
+}
+
+/* Drop a reference held by a container that's being torn down */
+static void reclaim_member(json_t *member) {
+    if (!member || member->refcount == (size_t)-1 ||
+        (JSON_INTERNAL_DECREF(member) & ~JSON_INTERNAL_ALLOCATED) != 0)
+        return;
+
+    if (!is_nonempty_container(member) || reclaim_push(&reclaim_work, member))
+        json_delete(member);
+}
+
+/* One step on the container at the top of the work stack */
+static void reclaim_step(void) {
+    json_t *json = reclaim_work.values[reclaim_work.len - 1];
+    json_array_t *array;
+    json_t *member = NULL;
+
+    if (json_is_array(json)) {
+        array = json_to_array(json);
+        if (array->entries)
+            member = array->table[--array->entries];
+    } else
+        member = hashtable_take_last(&json_to_object(json)->hashtable);
+
+    if (member) {
+        reclaim_member(member);
+        return;
+    }
+
+    reclaim_work.len--;
+    json_delete(json);
+}
+
+void json_decref_deferred(json_t *json) {
+    int failed;
+
+    if (!json || json->refcount == (size_t)-1 ||
+        (JSON_INTERNAL_DECREF(json) & ~JSON_INTERNAL_ALLOCATED) != 0)
+        return;
+
+    /* Nothing to spread out for scalars and empty containers */
+    if (!is_nonempty_container(json)) {
+        json_delete(json);
+        return;
+    }
+
+    reclaim_lock(&pending_locked);
+    failed = reclaim_push(&reclaim_pending, json);
+    reclaim_unlock(pending_locked);
+
+    if (failed)
+        json_delete(json);
+}
+
+size_t json_reclaim(size_t budget) {
+    reclaim_stack_t pending;
+    size_t steps = 0;
+
+    reclaim_lock(&work_locked);
+    while (!budget || steps < budget) {
+        if (!reclaim_work.len) {
+            /* Take over the pending containers, leaving an empty
+               stack in their place */
+            reclaim_release(&reclaim_work);
+            reclaim_lock(&pending_locked);
+            pending = reclaim_pending;
+            reclaim_pending = reclaim_work;
+            reclaim_unlock(pending_locked);
+
+            reclaim_work = pending;
+            if (!reclaim_work.len)
+                break;
+        }
+
+        reclaim_step();
+        steps++;
+    }
+    if (!reclaim_work.len)
+        reclaim_release(&reclaim_work);
+    reclaim_unlock(work_locked);
+
+    return steps;
+}
+
 /*** equality ***/
 
 int json_equal(const json_t *json1, const json_t *json2) {
@@ -1035,10 +1873,14 @@ int json_equal(const json_t *json1, const json_t *json2) {
     if (json_typeof(json1) != json_typeof(json2))
         return 0;
 
-    /* this covers true, false and null as they are singletons */
     if (json1 == json2)
         return 1;
 
+    /* Image arrays and objects have their hashes cached */
+    if ((json_is_object(json1) || json_is_array(json1)) && jsonp_is_image(json1) &&
+        jsonp_is_image(json2) && jsonp_image_hash(json1) != jsonp_image_hash(json2))
+        return 0;
+
     switch (json_typeof(json1)) {
         case JSON_OBJECT:
             return json_object_equal(json1, json2);
@@ -1050,11 +1892,149 @@ int json_equal(const json_t *json1, const json_t *json2) {
             return json_integer_equal(json1, json2);
         case JSON_REAL:
             return json_real_equal(json1, json2);
+        case JSON_RAW:
+            return json_raw_equal(json1, json2);
+        case JSON_TRUE:
+        case JSON_FALSE:
+        case JSON_NULL:
+            /* Singletons, except in images */
+            return 1;
         default:
             return 0;
     }
 }
 
+/*** hashing ***/
+
+/* The hashes don't depend on the seed of the object keys, so they're
+   the same in every process */
+#define HASH_PRIME 0x100000001b3ULL
+
+static size_t hash_finish(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return (size_t)hash;
+}
+
+/* Words are read in little-endian order, so that the hash doesn't
+   depend on the byte order */
+static uint64_t hash_bytes(const char *data, size_t length) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t hash = 0xcbf29ce484222325ULL ^ length, word;
+    size_t i;
+
+    while (length) {
+        word = 0;
+        for (i = 0; i < 8 && i < length; i++)
+            word |= (uint64_t)p[i] << (8 * i);
+        hash = (hash ^ word) * HASH_PRIME;
+        hash ^= hash >> 32;
+        p += i;
+        length -= i;
+    }
+    return hash;
+}
+
+static int hash_value(const json_t *json, jsonp_parents_t *parents, size_t *hash);
+
+/* Objects are hashed in a way that doesn't depend on the order of
+   their keys, as json_equal() doesn't. parents is NULL if there are no
+   circular references. */
+static int hash_contents(const json_t *json, jsonp_parents_t *parents, size_t *hash) {
+    uint64_t result = (uint64_t)json_typeof(json) * 0x9e3779b97f4a7c15ULL, bits;
+    const char *key;
+    size_t key_len, i, child;
+    json_t *value;
+    double real;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            json_object_keylen_foreach((json_t *)json, key, key_len, value) {
+                if (hash_value(value, parents, &child))
+                    return -1;
+                result += hash_finish(hash_bytes(key, key_len) ^ (child * HASH_PRIME));
+            }
+            result ^= json_object_size(json);
+            break;
+        case JSON_ARRAY:
+            for (i = 0; i < json_array_size(json); i++) {
+                if (hash_value(json_array_get(json, i), parents, &child))
+                    return -1;
+                result = hash_finish(result ^ child);
+            }
+            break;
+        case JSON_STRING:
+            result ^= hash_bytes(json_string_value(json), json_string_length(json));
+            break;
+        case JSON_INTEGER:
+            result ^= (uint64_t)json_integer_value(json);
+            break;
+        case JSON_REAL:
+            /* -0.0 is equal to 0.0 */
+            real = json_real_value(json);
+            if (real == 0.0)
+                real = 0.0;
+            bits = 0;
+            memcpy(&bits, &real, sizeof(real) < sizeof(bits) ? sizeof(real) : 8);
+            result ^= bits;
+            break;
+        case JSON_RAW:
+            result ^= hash_bytes(json_raw_value(json), json_raw_length(json));
+            break;
+        default:
+            break;
+    }
+
+    *hash = hash_finish(result);
+    return 0;
+}
+
+static int hash_value(const json_t *json, jsonp_parents_t *parents, size_t *hash) {
+    int result;
+
+    if (!json_is_object(json) && !json_is_array(json))
+        return hash_contents(json, parents, hash);
+
+    /* Image arrays and objects have it cached */
+    if (jsonp_is_image(json)) {
+        *hash = jsonp_image_hash(json);
+        return 0;
+    }
+
+    if (parents && jsonp_parents_enter(parents, json))
+        return -1;
+    result = hash_contents(json, parents, hash);
+    if (parents)
+        jsonp_parents_leave(parents, json);
+    return result;
+}
+
+size_t jsonp_hash_contents(const json_t *json) {
+    size_t hash;
+
+    if (hash_contents(json, NULL, &hash))
+        return 0;
+    return hash;
+}
+
+size_t json_hash(const json_t *json) {
+    jsonp_parents_t parents;
+    size_t hash;
+    int result;
+
+    if (!json)
+        return 0;
+
+    jsonp_parents_init(&parents);
+    result = hash_value(json, &parents, &hash);
+    jsonp_parents_close(&parents);
+
+    return result ? 0 : hash;
+}
+
 /*** copying ***/
 
 json_t *json_copy(json_t *json) {
@@ -1072,6 +2052,8 @@ json_t *json_copy(json_t *json) {
             return json_integer_copy(json);
         case JSON_REAL:
             return json_real_copy(json);
+        case JSON_RAW:
+            return json_raw_copy(json);
         case JSON_TRUE:
         case JSON_FALSE:
         case JSON_NULL:
@@ -1083,38 +2065,348 @@ json_t *json_copy(json_t *json) {
 
 json_t *json_deep_copy(const json_t *json) {
     json_t *res;
-    hashtable_t parents_set;
+    jsonp_parents_t parents_set;
 
-    if (hashtable_init(&parents_set))
-        return NULL;
+    jsonp_parents_init(&parents_set);
     res = do_deep_copy(json, &parents_set);
-    hashtable_close(&parents_set);
+    jsonp_parents_close(&parents_set);
 
     return res;
 }
 
-json_t *do_deep_copy(const json_t *json, hashtable_t *parents) {
-    if (!json)
-        return NULL;
+json_t *json_copy_ex(const json_allocator_t *allocator, json_t *json) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_copy(json);
 
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+json_t *json_deep_copy_ex(const json_allocator_t *allocator, const json_t *json) {
+    const json_allocator_t *previous = jsonp_use_allocator(allocator);
+    json_t *result = json_deep_copy(json);
+
+    jsonp_use_allocator(previous);
+    return result;
+}
+
+/* For the types other than arrays and objects, deep copying doesn't
+   differ from shallow copying */
+static json_t *copy_scalar(const json_t *json) {
     switch (json_typeof(json)) {
-        case JSON_OBJECT:
-            return json_object_deep_copy(json, parents);
-        case JSON_ARRAY:
-            return json_array_deep_copy(json, parents);
-            /* for the rest of the types, deep copying doesn't differ from
-               shallow copying */
         case JSON_STRING:
             return json_string_copy(json);
         case JSON_INTEGER:
             return json_integer_copy(json);
         case JSON_REAL:
             return json_real_copy(json);
+        case JSON_RAW:
+            return json_raw_copy(json);
+        /* The copy of an image value doesn't refer to the image */
         case JSON_TRUE:
+            return json_true();
         case JSON_FALSE:
+            return json_false();
         case JSON_NULL:
-            return (json_t *)json;
+            return json_null();
         default:
             return NULL;
     }
 }
+
+/* A container that do_deep_copy() is copying */
+struct copy_frame {
+    const json_t *source;
+    json_t *copy;
+    /* Next element of an array, or next member of an object */
+    size_t index;
+    void *iter;
+    /* Pair of the copy for iter. Its keys are copied up front without
+       hashing them again, unless the source is an image, which has no
+       hashtable. */
+    void *copy_iter;
+};
+
+/* Frames kept in do_deep_copy()'s own stack frame before allocating */
+#define COPY_INLINE_FRAMES 8
+
+typedef struct {
+    struct copy_frame *frames;
+    size_t depth;
+    size_t size;
+    struct copy_frame inline_frames[COPY_INLINE_FRAMES];
+} copy_stack_t;
+
+static struct copy_frame *copy_push(copy_stack_t *stack, const json_t *source,
+                                    json_t *copy) {
+    struct copy_frame *frame;
+
+    if (stack->depth == stack->size) {
+        struct copy_frame *new_frames;
+
+        new_frames = jsonp_malloc(stack->size * 2 * sizeof(struct copy_frame));
+        if (!new_frames)
+            return NULL;
+        memcpy(new_frames, stack->frames, stack->depth * sizeof(struct copy_frame));
+
+        if (stack->frames != stack->inline_frames)
+            jsonp_free(stack->frames);
+        stack->frames = new_frames;
+        stack->size *= 2;
+    }
+
+    frame = &stack->frames[stack->depth++];
+    frame->source = source;
+    frame->copy = copy;
+    frame->index = 0;
+    frame->iter = NULL;
+    frame->copy_iter = NULL;
+    return frame;
+}
+
+/* Nested containers are kept on an explicit stack instead of
+   recursing, so the depth of json doesn't affect the C stack */
+static json_t *do_deep_copy(const json_t *json, jsonp_parents_t *parents) {
+    copy_stack_t stack;
+    struct copy_frame *frame;
+    hashtable_t *hashtable;
+    json_t *copy;
+
+    stack.frames = stack.inline_frames;
+    stack.depth = 0;
+    stack.size = COPY_INLINE_FRAMES;
+
+value:
+    if (!json)
+        goto error;
+    if (!json_is_array(json) && !json_is_object(json)) {
+        copy = copy_scalar(json);
+        if (!copy)
+            goto error;
+        goto done;
+    }
+
+    if (jsonp_parents_enter(parents, json))
+        goto error;
+    copy = json_is_array(json) ? json_array() : json_object();
+    frame = copy ? copy_push(&stack, json, copy) : NULL;
+    if (!frame) {
+        jsonp_parents_leave(parents, json);
+        json_decref(copy);
+        goto error;
+    }
+
+    if (json_is_object(json)) {
+        frame->iter = json_object_iter((json_t *)json);
+        if (!jsonp_is_image(json)) {
+            hashtable = &json_to_object(copy)->hashtable;
+            if (hashtable_copy_keys(hashtable, &json_to_object(json)->hashtable))
+                goto error;
+            frame->copy_iter = hashtable_iter(hashtable);
+        }
+    }
+    goto next;
+
+done:
+    /* copy is complete, add it to the innermost container */
+    if (stack.depth == 0) {
+        if (stack.frames != stack.inline_frames)
+            jsonp_free(stack.frames);
+        return copy;
+    }
+    frame = &stack.frames[stack.depth - 1];
+
+    if (json_is_array(frame->copy)) {
+        if (json_array_append_new(frame->copy, copy))
+            goto error;
+        frame->index++;
+    } else if (frame->copy_iter) {
+        hashtable = &json_to_object(frame->copy)->hashtable;
+        hashtable_iter_set(hashtable, frame->copy_iter, copy);
+        frame->copy_iter = hashtable_iter_next(hashtable, frame->copy_iter);
+        frame->iter = json_object_iter_next((json_t *)frame->source, frame->iter);
+    } else {
+        if (json_object_setn_new_nocheck(frame->copy, json_object_iter_key(frame->iter),
+                                         json_object_iter_key_len(frame->iter), copy))
+            goto error;
+        frame->iter = json_object_iter_next((json_t *)frame->source, frame->iter);
+    }
+
+next:
+    /* Continue with the next value of the innermost container */
+    frame = &stack.frames[stack.depth - 1];
+    if (json_is_array(frame->source) && frame->index < json_array_size(frame->source)) {
+        json = json_array_get(frame->source, frame->index);
+        goto value;
+    }
+    if (json_is_object(frame->source) && frame->iter) {
+        json = json_object_iter_value(frame->iter);
+        goto value;
+    }
+
+    /* The container is complete */
+    jsonp_parents_leave(parents, frame->source);
+    copy = frame->copy;
+    stack.depth--;
+    goto done;
+
+error:
+    while (stack.depth) {
+        frame = &stack.frames[--stack.depth];
+        jsonp_parents_leave(parents, frame->source);
+        json_decref(frame->copy);
+    }
+    if (stack.frames != stack.inline_frames)
+        jsonp_free(stack.frames);
+    return NULL;
+}
+
+/*** freezing ***/
+
+/* Values that are already immortal are left as they are. Others can
+   only be frozen if their parent holds the only reference, so that no
+   one else's value becomes immutable or is kept alive. */
+static int can_freeze_child(const json_t *json, const json_t *root);
+
+static int can_freeze(const json_t *json, const json_t *root) {
+    void *iter;
+    size_t i;
+
+    if (jsonp_is_immortal(json))
+        return 1;
+    if (jsonp_is_arena(json))
+        return 0;
+
+    if (json_is_object(json)) {
+        iter = json_object_iter((json_t *)json);
+        while (iter) {
+            if (!can_freeze_child(json_object_iter_value(iter), root))
+                return 0;
+            iter = json_object_iter_next((json_t *)json, iter);
+        }
+    } else if (json_is_array(json)) {
+        for (i = 0; i < json_array_size(json); i++) {
+            if (!can_freeze_child(json_array_get(json, i), root))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int can_freeze_child(const json_t *json, const json_t *root) {
+    if (jsonp_is_immortal(json))
+        return 1;
+    if (json == root || (json->refcount & ~JSON_INTERNAL_ALLOCATED) != 1)
+        return 0;
+    return can_freeze(json, root);
+}
+
+static void freeze(json_t *json) {
+    void *iter;
+    size_t i;
+
+    if (jsonp_is_immortal(json))
+        return;
+    json->refcount = (size_t)-1;
+
+    if (json_is_object(json)) {
+        iter = json_object_iter(json);
+        while (iter) {
+            freeze(json_object_iter_value(iter));
+            iter = json_object_iter_next(json, iter);
+        }
+    } else if (json_is_array(json)) {
+        for (i = 0; i < json_array_size(json); i++)
+            freeze(json_array_get(json, i));
+    }
+}
+
+int json_freeze(json_t *json) {
+    if (!json || !can_freeze(json, json))
+        return -1;
+
+    freeze(json);
+    return 0;
+}
+
+/*** memory usage ***/
+
+/* Immortal values that aren't allocated */
+static int is_static(const json_t *json) {
+    return json_is_true(json) || json_is_false(json) || json_is_null(json) ||
+           jsonp_is_image(json) || json == &shared_empty_string.json ||
+           (json_is_integer(json) && json_to_integer(json) >= shared_integers &&
+            json_to_integer(json) <= &shared_integers[SHARED_INT_MAX - SHARED_INT_MIN]);
+}
+
+/* Values with more than one reference are counted once. Remembering
+   them also stops at circular references. */
+static size_t memory_usage(const json_t *json, jsonp_parents_t *seen) {
+    const json_string_t *string;
+    const json_array_t *array;
+    size_t size = 0, i;
+    json_t *value;
+    void *iter;
+
+    if (!json || is_static(json))
+        return 0;
+    if ((json->refcount & ~JSON_INTERNAL_ALLOCATED) != 1 &&
+        jsonp_parents_enter(seen, json))
+        return 0;
+
+    /* The nodes of arena values belong to the arena */
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            if (!jsonp_is_arena(json))
+                size = sizeof(json_object_t) +
+                       hashtable_memory_usage(&json_to_object(json)->hashtable);
+            iter = json_object_iter((json_t *)json);
+            while (iter) {
+                value = json_object_iter_value(iter);
+                size += memory_usage(value, seen);
+                iter = json_object_iter_next((json_t *)json, iter);
+            }
+            break;
+        case JSON_ARRAY:
+            array = json_to_array(json);
+            if (!array->arena)
+                size = sizeof(json_array_t) + array->size * sizeof(json_t *);
+            for (i = 0; i < array->entries; i++)
+                size += memory_usage(array->table[i], seen);
+            break;
+        case JSON_STRING:
+            string = json_to_string(json);
+            if (!string->arena) {
+                size = string_node_size(string->capacity);
+                if (!string->borrowed && string->value != string->data)
+                    size += string->length + 1;
+            }
+            break;
+        case JSON_INTEGER:
+            if (!jsonp_is_arena(json))
+                size = sizeof(json_integer_t);
+            break;
+        case JSON_REAL:
+            if (!jsonp_is_arena(json))
+                size = sizeof(json_real_t);
+            break;
+        case JSON_RAW:
+            size = raw_node_size(json_raw_length(json));
+            break;
+        default:
+            break;
+    }
+    if (jsonp_allocator_of(json))
+        size += sizeof(jsonp_owner_t);
+    return size;
+}
+
+size_t json_memory_usage(const json_t *json) {
+    jsonp_parents_t seen;
+    size_t size;
+
+    jsonp_parents_init(&seen);
+    size = memory_usage(json, &seen);
+    jsonp_parents_close(&seen);
+    return size;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/*
+ * The hash below is derived from wyhash by Wang Yi
+ * <godspeed_china@yeah.net>, https://github.com/wangyi-fudan/wyhash,
+ * which carries the following notice:
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ */
+
+/* A seeded 64-bit hash for short keys, after wyhash. It mixes 16 bytes with one 64x64 -> 128 bit
+   multiplication, which makes it several times faster than lookup3
+   for small object keys. Values are only used in-process, so the
+   input is read in native byte order. */
+
+#ifndef WYHASH_H
+#define WYHASH_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#define WYHASH_P0 0xa0761d6478bd642fULL
+#define WYHASH_P1 0xe7037ed1a0b428dbULL
+#define WYHASH_P2 0x8ebc6af09c88c6e3ULL
+#define WYHASH_P3 0x589965cc75374cc3ULL
+
+static void wyhash_mul(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), lo, hi;
+
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl);
+    lo = t + (rm1 << 32);
+    hi += lo < t;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    wyhash_mul(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wyhash_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wyhash_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t a, b, s1, s2;
+    size_t i;
+
+    seed ^= wyhash_mix(seed ^ WYHASH_P0, WYHASH_P1);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyhash_read32(p) << 32) | wyhash_read32(p + ((len >> 3) << 2));
+            b = (wyhash_read32(p + len - 4) << 32) |
+                wyhash_read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else
+            a = b = 0;
+    } else {
+        i = len;
+        if (i > 48) {
+            s1 = s2 = seed;
+            do {
+                seed = wyhash_mix(wyhash_read64(p) ^ WYHASH_P1,
+                                  wyhash_read64(p + 8) ^ seed);
+                s1 = wyhash_mix(wyhash_read64(p + 16) ^ WYHASH_P2,
+                                wyhash_read64(p + 24) ^ s1);
+                s2 = wyhash_mix(wyhash_read64(p + 32) ^ WYHASH_P3,
+                                wyhash_read64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = wyhash_mix(wyhash_read64(p) ^ WYHASH_P1, wyhash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wyhash_read64(p + i - 16);
+        b = wyhash_read64(p + i - 8);
+    }
+
+    a ^= WYHASH_P1;
+    b ^= seed;
+    wyhash_mul(&a, &b);
+    return wyhash_mix(a ^ WYHASH_P0 ^ len, b ^ WYHASH_P1);
+}
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+/* Measure the decoding and encoding speed, the allocations and the
+   peak heap use for a set of documents. Without file arguments, the
+   built-in corpus is generated: documents shaped like the well-known
+   twitter.json, canada.json and citm_catalog.json, NDJSON logs, deeply
+   nested arrays and large strings. Files ending in .ndjson or .jsonl
+   are read one record per line.
+
+   Each document gives one line of JSON on standard output, so results
+   of different builds can be compared with any JSON tool. */
+
+#include <jansson.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/*** allocation counting ***/
+
+/* Each block starts with its size so that frees can be counted too */
+#define HEADER_SIZE 16
+
+static size_t allocs, live_bytes, peak_bytes;
+
+static void *counting_malloc(size_t size) {
+    char *block = malloc(size + HEADER_SIZE);
+    if (!block)
+        return NULL;
+
+    *(size_t *)block = size;
+    allocs++;
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    return block + HEADER_SIZE;
+}
+
+static void counting_free(void *ptr) {
+    char *block;
+
+    if (!ptr)
+        return;
+    block = (char *)ptr - HEADER_SIZE;
+    live_bytes -= *(size_t *)block;
+    free(block);
+}
+
+static void reset_counters(void) {
+    allocs = 0;
+    peak_bytes = live_bytes;
+}
+
+/*** timing ***/
+
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/*** documents ***/
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} buffer_t;
+
+static void buffer_append(buffer_t *buf, const char *data, size_t len) {
+    if (buf->len + len + 1 > buf->size) {
+        while (buf->len + len + 1 > buf->size)
+            buf->size = buf->size ? buf->size * 2 : 4096;
+        buf->data = realloc(buf->data, buf->size);
+        if (!buf->data) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buffer_printf(buffer_t *buf, const char *fmt, ...) {
+    char text[1024];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (len < 0 || (size_t)len >= sizeof(text)) {
+        fprintf(stderr, "generated text too long\n");
+        exit(1);
+    }
+    buffer_append(buf, text, len);
+}
+
+/* The corpus is the same on every run */
+static unsigned int random_state;
+
+static unsigned int random_next(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static const char *const words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "\xe5\x90\x8d\xe5\x89\x8d", "\xe3\x81\x82\xe3\x82\x86\xe3\x81\xbf",
+    "caf\xc3\xa9", "na\\u00efve", "\\\"quoted\\\"", "line\\nbreak"};
+
+static const char *word(void) {
+    return words[random_next() % (sizeof(words) / sizeof(words[0]))];
+}
+
+static void append_words(buffer_t *buf, int count) {
+    int i;
+
+    for (i = 0; i < count; i++)
+        buffer_printf(buf, i ? " %s" : "%s", word());
+}
+
+/* Statuses with nested users and entities, mostly strings */
+static void generate_twitter(buffer_t *buf) {
+    int i, j;
+
+    buffer_printf(buf, "{\"statuses\": [");
+    for (i = 0; i < 400; i++) {
+        unsigned int id = random_next();
+
+        buffer_printf(buf, "%s{\"created_at\": \"Sun Aug 31 00:29:%02d +0000 2014\", ",
+                      i ? ", " : "", i % 60);
+        buffer_printf(buf, "\"id\": 5058749%u, \"id_str\": \"5058749%u\", \"text\": \"",
+                      id, id);
+        append_words(buf, 12 + random_next() % 20);
+        buffer_printf(buf, "\", \"source\": \"<a href=\\\"http://twitter.com/download/"
+                           "iphone\\\" rel=\\\"nofollow\\\">Twitter for iPhone</a>\", ");
+        buffer_printf(buf, "\"truncated\": false, \"in_reply_to_status_id\": null, "
+                           "\"user\": {\"id\": %u, \"name\": \"",
+                      random_next());
+        append_words(buf, 2);
+        buffer_printf(buf, "\", \"screen_name\": \"user%d\", \"location\": \"", i);
+        append_words(buf, 1);
+        buffer_printf(buf, "\", \"description\": \"");
+        append_words(buf, 20);
+        buffer_printf(buf, "\", \"url\": null, \"entities\": {\"description\": "
+                           "{\"urls\": []}}, \"protected\": false, ");
+        buffer_printf(buf, "\"followers_count\": %u, \"friends_count\": %u, "
+                           "\"listed_count\": %u, \"favourites_count\": %u, ",
+                      random_next() % 10000, random_next() % 10000,
+                      random_next() % 100, random_next() % 10000);
+        buffer_printf(buf, "\"utc_offset\": null, \"time_zone\": null, "
+                           "\"geo_enabled\": false, \"verified\": false, "
+                           "\"statuses_count\": %u, \"lang\": \"ja\", ",
+                      random_next() % 100000);
+        buffer_printf(buf, "\"profile_background_color\": \"C0DEED\", "
+                           "\"profile_image_url\": \"http://pbs.twimg.com/profile_images/"
+                           "%u/normal.jpeg\", \"default_profile\": true}, ",
+                      random_next());
+        buffer_printf(buf, "\"geo\": null, \"coordinates\": null, \"place\": null, "
+                           "\"retweet_count\": %u, \"favorite_count\": %u, ",
+                      random_next() % 100, random_next() % 100);
+        buffer_printf(buf, "\"entities\": {\"hashtags\": [], \"symbols\": [], "
+                           "\"urls\": [], \"user_mentions\": [");
+        for (j = 0; j < (int)(random_next() % 3); j++) {
+            buffer_printf(buf, "%s{\"screen_name\": \"user%u\", \"id\": %u, "
+                               "\"indices\": [%d, %d]}",
+                          j ? ", " : "", random_next() % 1000, random_next(), j * 10,
+                          j * 10 + 9);
+        }
+        buffer_printf(buf, "]}, \"favorited\": false, \"retweeted\": false, "
+                           "\"lang\": \"ja\"}");
+    }
+    buffer_printf(buf, "], \"search_metadata\": {\"completed_in\": 0.087, "
+                       "\"max_id\": 505874924095815681, \"query\": \"%%E4%%B8%%80\", "
+                       "\"count\": 100, \"since_id\": 0}}");
+}
+
+/* A polygon with many points, mostly numbers with full precision */
+static void generate_canada(buffer_t *buf) {
+    int i, j;
+
+    buffer_printf(buf, "{\"type\": \"FeatureCollection\", \"features\": [{\"type\": "
+                       "\"Feature\", \"properties\": {\"name\": \"Canada\"}, "
+                       "\"geometry\": {\"type\": \"Polygon\", \"coordinates\": [");
+    for (i = 0; i < 480; i++) {
+        buffer_printf(buf, i ? ", [" : "[");
+        for (j = 0; j < 120; j++) {
+            double x = -141.0 + (random_next() % 100000000) / 1e6;
+            double y = 41.0 + (random_next() % 40000000) / 1e6;
+            buffer_printf(buf, j ? ",[%.15g,%.15g]" : "[%.15g,%.15g]", x, y);
+        }
+        buffer_printf(buf, "]");
+    }
+    buffer_printf(buf, "]}}]}");
+}
+
+/* Objects keyed by numeric ids, with many small integers and nulls */
+static void generate_citm(buffer_t *buf) {
+    int i, j;
+
+    buffer_printf(buf, "{\"areaNames\": {");
+    for (i = 0; i < 200; i++) {
+        buffer_printf(buf, "%s\"%d\": \"", i ? ", " : "", 205705993 + i);
+        append_words(buf, 3);
+        buffer_printf(buf, "\"");
+    }
+    buffer_printf(buf, "}, \"events\": {");
+    for (i = 0; i < 1000; i++) {
+        buffer_printf(buf, "%s\"%d\": {\"description\": null, \"id\": %d, "
+                           "\"logo\": null, \"name\": \"",
+                      i ? ", " : "", 138586341 + i, 138586341 + i);
+        append_words(buf, 4);
+        buffer_printf(buf, "\", \"subTopicIds\": [337184269, 337184283], "
+                           "\"subjectCode\": null, \"subtitle\": null, "
+                           "\"topicIds\": [324846099, 107888604]}");
+    }
+    buffer_printf(buf, "}, \"performances\": [");
+    for (i = 0; i < 1000; i++) {
+        buffer_printf(buf, "%s{\"eventId\": %d, \"id\": %d, \"logo\": "
+                           "\"/images/UE0AAAAACEKo6QAAAAZDSVRN\", \"name\": null, "
+                           "\"prices\": [",
+                      i ? ", " : "", 138586341 + i, 339887544 + i);
+        for (j = 0; j < 4; j++)
+            buffer_printf(buf, "%s{\"amount\": %u, \"audienceSubCategoryId\": 337100890, "
+                               "\"seatCategoryId\": %d}",
+                          j ? ", " : "", random_next() % 100000, 338937295 + j);
+        buffer_printf(buf, "], \"seatCategories\": [");
+        for (j = 0; j < 4; j++)
+            buffer_printf(buf, "%s{\"areas\": [{\"areaId\": %d, \"blockIds\": []}, "
+                               "{\"areaId\": %d, \"blockIds\": []}], "
+                               "\"seatCategoryId\": %d}",
+                          j ? ", " : "", 205705999 + j, 205706007 + j, 338937295 + j);
+        buffer_printf(buf, "], \"seatMapImage\": null, \"start\": %u000, "
+                           "\"venueCode\": \"PLEYEL_PLEYEL\"}",
+                      1372701600u + i * 3600u);
+    }
+    buffer_printf(buf, "], \"venueNames\": {\"PLEYEL_PLEYEL\": \"Salle Pleyel\"}}");
+}
+
+/* Log records, one per line */
+static void generate_ndjson(buffer_t *buf) {
+    static const char *const levels[] = {"debug", "info", "info", "warn", "error"};
+    int i;
+
+    for (i = 0; i < 20000; i++) {
+        buffer_printf(buf, "{\"ts\": \"2024-05-01T12:%02d:%02d.%03dZ\", "
+                           "\"level\": \"%s\", \"service\": \"api\", \"msg\": \"",
+                      i / 60 % 60, i % 60, i % 1000, levels[random_next() % 5]);
+        append_words(buf, 6);
+        buffer_printf(buf, "\", \"status\": %u, \"latency_ms\": %.3f, "
+                           "\"path\": \"/v1/items/%u\", \"user\": {\"id\": %u, "
+                           "\"ip\": \"10.0.%u.%u\"}, \"tags\": [\"web\", \"eu\"]}\n",
+                      200 + random_next() % 4 * 100, (random_next() % 100000) / 1e3,
+                      random_next() % 10000, random_next(), random_next() % 256,
+                      random_next() % 256);
+    }
+}
+
+/* Arrays and objects nested close to the default depth limit */
+static void generate_deep(buffer_t *buf) {
+    int i, j;
+
+    buffer_printf(buf, "[");
+    for (i = 0; i < 100; i++) {
+        buffer_printf(buf, i ? ", " : "");
+        for (j = 0; j < 1000; j++)
+            buffer_printf(buf, j % 2 ? "{\"a\": " : "[");
+        buffer_printf(buf, "%d", i);
+        for (j = 1000; j-- > 0;)
+            buffer_printf(buf, j % 2 ? "}" : "]");
+    }
+    buffer_printf(buf, "]");
+}
+
+/* A few long strings with escapes and non-ASCII text */
+static void generate_strings(buffer_t *buf) {
+    int i, j;
+
+    buffer_printf(buf, "[");
+    for (i = 0; i < 8; i++) {
+        buffer_printf(buf, i ? ", \"" : "\"");
+        for (j = 0; j < 40000; j++) {
+            append_words(buf, 1);
+            buffer_printf(buf, j % 10 ? " " : "\\n");
+        }
+        buffer_printf(buf, "\"");
+    }
+    buffer_printf(buf, "]");
+}
+
+static const struct {
+    const char *name;
+    void (*generate)(buffer_t *buf);
+    int lines;
+} corpus[] = {{"twitter", generate_twitter, 0},   {"canada", generate_canada, 0},
+              {"citm_catalog", generate_citm, 0}, {"ndjson_logs", generate_ndjson, 1},
+              {"deep_nesting", generate_deep, 0}, {"large_strings", generate_strings, 0}};
+
+static int read_file(const char *path, buffer_t *buf) {
+    char chunk[65536];
+    size_t len;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return -1;
+    while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        buffer_append(buf, chunk, len);
+    fclose(fp);
+    return 0;
+}
+
+/*** measuring ***/
+
+/* Decode a document into an array of its records if lines is
+   nonzero, or the value itself otherwise */
+static json_t *load(const buffer_t *buf, int lines, json_error_t *error) {
+    json_reader_t *reader;
+    json_t *array, *value;
+    int res;
+
+    if (!lines)
+        return json_loadb(buf->data, buf->len, 0, error);
+
+    array = json_array();
+    reader = json_reader_create_buffer(buf->data, buf->len, 0);
+    while ((res = json_reader_next(reader, &value, error)) > 0)
+        json_array_append_new(array, value);
+    json_reader_destroy(reader);
+    if (res < 0) {
+        json_decref(array);
+        return NULL;
+    }
+    return array;
+}
+
+/* Encode a document like load() decodes it, returning the length */
+static size_t dump(const json_t *json, int lines) {
+    size_t i, total = 0;
+    char *text;
+
+    if (!lines) {
+        text = json_dumps(json, 0);
+        total = text ? strlen(text) : 0;
+        counting_free(text);
+        return total;
+    }
+
+    for (i = 0; i < json_array_size(json); i++) {
+        text = json_dumps(json_array_get(json, i), 0);
+        if (text)
+            total += strlen(text) + 1;
+        counting_free(text);
+    }
+    return total;
+}
+
+struct result {
+    size_t runs;
+    double best;
+};
+
+/* Run load or dump for at least min_time seconds and three times, and
+   keep the fastest run */
+static void measure(const buffer_t *buf, const json_t *json, int lines, double min_time,
+                    struct result *result) {
+    double start = now(), t;
+
+    result->runs = 0;
+    result->best = 0;
+    while (result->runs < 3 || now() - start < min_time) {
+        t = now();
+        if (json)
+            dump(json, lines);
+        else
+            json_decref(load(buf, lines, NULL));
+        t = now() - t;
+
+        if (result->runs == 0 || t < result->best)
+            result->best = t;
+        result->runs++;
+    }
+}
+
+static int run(const char *name, const buffer_t *buf, int lines, double min_time,
+               const char *label) {
+    struct result load_time, dump_time;
+    size_t load_allocs, load_peak, dump_allocs, dump_len;
+    json_error_t error;
+    json_t *json, *report;
+
+    reset_counters();
+    json = load(buf, lines, &error);
+    load_allocs = allocs;
+    load_peak = peak_bytes;
+    if (!json) {
+        fprintf(stderr, "%s: %d:%d: %s\n", name, error.line, error.column, error.text);
+        return -1;
+    }
+
+    reset_counters();
+    dump_len = dump(json, lines);
+    dump_allocs = allocs;
+
+    measure(buf, NULL, lines, min_time, &load_time);
+    measure(buf, json, lines, min_time, &dump_time);
+    json_decref(json);
+
+    report = json_pack("{s:s, s:s*, s:s, s:I, s:I, s:f, s:f, s:I, s:I, s:I, s:I, s:I}",
+                       "corpus", name, "label", label, "version", jansson_version_str(),
+                       "bytes", (json_int_t)buf->len, "dump_bytes", (json_int_t)dump_len,
+                       "load_mb_s", buf->len / load_time.best / 1e6, "dump_mb_s",
+                       dump_len / dump_time.best / 1e6, "load_allocs",
+                       (json_int_t)load_allocs, "dump_allocs", (json_int_t)dump_allocs,
+                       "load_peak_bytes", (json_int_t)load_peak, "load_runs",
+                       (json_int_t)load_time.runs, "dump_runs",
+                       (json_int_t)dump_time.runs);
+    json_dumpf(report, stdout, JSON_COMPACT | JSON_PRESERVE_ORDER);
+    printf("\n");
+    fflush(stdout);
+    json_decref(report);
+    return 0;
+}
+
+static int has_suffix(const char *str, const char *suffix) {
+    size_t len = strlen(str), suffix_len = strlen(suffix);
+    return len >= suffix_len && !strcmp(str + len - suffix_len, suffix);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-t SECONDS] [-l LABEL] [-c NAME] [FILE...]\n\n"
+            "  -t SECONDS  time to run each measurement for (default 0.5)\n"
+            "  -l LABEL    add a label to the results, e.g. the commit\n"
+            "  -c NAME     run only the built-in document NAME\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    double min_time = 0.5;
+    const char *label = NULL, *only = NULL;
+    buffer_t buf;
+    size_t i;
+    int arg, status = 0;
+
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (arg + 1 == argc)
+            usage(argv[0]);
+        if (!strcmp(argv[arg], "-t"))
+            min_time = atof(argv[++arg]);
+        else if (!strcmp(argv[arg], "-l"))
+            label = argv[++arg];
+        else if (!strcmp(argv[arg], "-c"))
+            only = argv[++arg];
+        else
+            usage(argv[0]);
+    }
+
+    json_set_alloc_funcs(counting_malloc, counting_free);
+
+    if (arg < argc) {
+        for (; arg < argc; arg++) {
+            const char *name = strrchr(argv[arg], '/');
+
+            memset(&buf, 0, sizeof(buf));
+            if (read_file(argv[arg], &buf)) {
+                fprintf(stderr, "%s: unable to read\n", argv[arg]);
+                status = 1;
+                continue;
+            }
+            if (run(name ? name + 1 : argv[arg], &buf,
+                    has_suffix(argv[arg], ".ndjson") || has_suffix(argv[arg], ".jsonl"),
+                    min_time, label))
+                status = 1;
+            free(buf.data);
+        }
+        return status;
+    }
+
+    for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+        if (only && strcmp(only, corpus[i].name))
+            continue;
+
+        memset(&buf, 0, sizeof(buf));
+        random_state = 2463534242u;
+        corpus[i].generate(&buf);
+        if (run(corpus[i].name, &buf, corpus[i].lines, min_time, label))
+            status = 1;
+        free(buf.data);
+    }
+    return status;
+}
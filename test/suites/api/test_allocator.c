@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *document = "{\"name\": \"a string that is too long to be inline\","
+                              " \"values\": [1, 2.5, true, null, \"x\", [], {}],"
+                              " \"nested\": {\"a\": {\"b\": {\"c\": [1, 2, 3]}}}}";
+
+static void check_balanced(const counter_t *counter, const char *what) {
+    if (counter->allocs == 0)
+        fail(what);
+    if (counter->allocs != counter->frees || counter->live != 0)
+        fail(what);
+    if (counter->wrong_sizes != 0)
+        fail(what);
+}
+
+static void test_global_allocator(void) {
+    json_allocator_t allocator, current;
+    json_malloc_t mfunc;
+    json_free_t ffunc;
+    counter_t counter;
+    json_t *json;
+    char *dump;
+
+    json_get_allocator(&current);
+    if (!current.malloc || !current.free)
+        fail("json_get_allocator() returned no functions");
+
+    counter_init(&counter, &allocator);
+    json_set_allocator(&allocator);
+
+    json_get_allocator(&current);
+    if (current.malloc != counter_malloc || current.free != counter_free ||
+        current.ctx != &counter)
+        fail("json_get_allocator() didn't return the allocator");
+
+    json_get_alloc_funcs(&mfunc, &ffunc);
+    if (mfunc || ffunc)
+        fail("json_get_alloc_funcs() returned functions with an allocator set");
+
+    json = json_loads(document, 0, NULL);
+    if (!json)
+        fail("unable to decode with an allocator");
+    dump = json_dumps(json, JSON_SORT_KEYS);
+    if (!dump)
+        fail("unable to encode with an allocator");
+    counter_free(dump, 0, &counter);
+    json_decref(json);
+
+    /* Nodes may stay in the slab allocator */
+    if (counter.allocs == 0 || counter.frees == 0 || counter.wrong_sizes != 0)
+        fail("the global allocator wasn't used");
+
+    json_set_alloc_funcs(malloc, free);
+    json_get_alloc_funcs(&mfunc, &ffunc);
+    if (mfunc != malloc || ffunc != free)
+        fail("json_set_alloc_funcs() didn't replace the allocator");
+}
+
+static void test_load_ex(void) {
+    json_allocator_t allocator, global_allocator;
+    counter_t counter, global;
+    json_error_t error;
+    json_t *json, *copy;
+    char key[16];
+    size_t i;
+
+    counter_init(&counter, &allocator);
+    counter_init(&global, &global_allocator);
+    json_set_allocator(&global_allocator);
+
+    json = json_loads_ex(&allocator, document, 0, &error);
+    if (!json)
+        fail("json_loads_ex() failed");
+    if (counter.allocs == 0 || global.allocs != 0)
+        fail("json_loads_ex() didn't use its allocator");
+
+    /* Extra references don't hide the flag from json_decref() */
+    json_incref(json);
+    json_decref(json);
+
+    /* Growing the values later uses the allocator of each value */
+    for (i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%d", (int)i);
+        json_object_set_new(json, key, json_true());
+        json_array_append(json_object_get(json, "values"), json_null());
+    }
+    json_string_set(json_object_get(json, "name"),
+                    "another string that is too long to be stored inline");
+    counter_free(json_dumps(json, JSON_SORT_KEYS | JSON_CACHE_SORTED_KEYS), 0, &global);
+    json_object_del(json, "key0");
+    if (global.allocs != global.frees)
+        fail("a value used the global allocator");
+
+    /* Copies made outside the call come from the global allocator */
+    copy = json_deep_copy(json);
+    if (!copy || !json_equal(copy, json))
+        fail("unable to copy a value of another allocator");
+    json_decref(json);
+    check_balanced(&counter, "json_loads_ex() values weren't freed by their allocator");
+    if (counter.sized_frees == 0)
+        fail("no sized frees");
+
+    memset(&counter, 0, sizeof(counter));
+    json = json_loadb_ex(&allocator, "[1, 2", 5, 0, &error);
+    if (json)
+        fail("json_loadb_ex() decoded invalid input");
+    if (counter.allocs != counter.frees || counter.live != 0)
+        fail("json_loadb_ex() leaked on error");
+
+    json_decref(copy);
+    json_set_alloc_funcs(malloc, free);
+}
+
+static void test_copy_ex(void) {
+    json_allocator_t allocator;
+    counter_t counter;
+    json_t *json, *copy;
+
+    json = json_loads(document, 0, NULL);
+    if (!json)
+        fail("unable to decode");
+
+    counter_init(&counter, &allocator);
+    copy = json_deep_copy_ex(&allocator, json);
+    if (!copy || !json_equal(copy, json))
+        fail("json_deep_copy_ex() failed");
+    json_decref(copy);
+    check_balanced(&counter, "json_deep_copy_ex() copy wasn't freed by its allocator");
+
+    memset(&counter, 0, sizeof(counter));
+    copy = json_copy_ex(&allocator, json);
+    if (!copy || !json_equal(copy, json))
+        fail("json_copy_ex() failed");
+    /* The members are shared with the original */
+    json_decref(json);
+    json_decref(copy);
+    check_balanced(&counter, "json_copy_ex() copy wasn't freed by its allocator");
+}
+
+static void test_pack_alloc(void) {
+    json_allocator_t allocator;
+    counter_t counter;
+    json_error_t error;
+    json_t *json;
+
+    counter_init(&counter, &allocator);
+    json = json_pack_alloc(&allocator, &error, 0, "{s:i, s:[f, s, b], s:{s:s#}}", "a", 1,
+                           "b", 2.5, "a string that is too long to be stored inline", 1,
+                           "c", "d", "efgh", 2);
+    if (!json)
+        fail("json_pack_alloc() failed");
+    if (json_integer_value(json_object_get(json, "a")) != 1)
+        fail("json_pack_alloc() packed the wrong value");
+    json_decref(json);
+    check_balanced(&counter, "json_pack_alloc() value wasn't freed by its allocator");
+
+    memset(&counter, 0, sizeof(counter));
+    json = json_pack_alloc(&allocator, &error, 0, "{s:[i, ?]}", "a", 1);
+    if (json)
+        fail("json_pack_alloc() packed an invalid format");
+    if (counter.allocs != counter.frees || counter.live != 0)
+        fail("json_pack_alloc() leaked on error");
+}
+
+static void run_tests() {
+    test_global_allocator();
+    test_load_ex();
+    test_copy_ex();
+    test_pack_alloc();
+}
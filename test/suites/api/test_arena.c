@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static int mallocs = 0;
+static int frees = 0;
+
+static void *counting_malloc(size_t size) {
+    mallocs++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr) {
+    frees++;
+    free(ptr);
+}
+
+static void *failing_malloc(size_t size) {
+    (void)size;
+    return NULL;
+}
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"arena\", \"ratio\": 0.5, \"ok\": true,"
+    " \"tags\": [\"a\", \"b\\n\", \"\\u00e4\"], \"nested\": {\"x\": [1, 2, {\"y\": null}]}}";
+
+static void load_into_arena() {
+    json_arena_t *arena;
+    json_t *json, *expected;
+    json_error_t error;
+
+    arena = json_arena_create(0);
+    if (!arena)
+        fail("json_arena_create failed");
+
+    json = json_loadb_arena(arena, document, strlen(document), 0, &error);
+    if (!json)
+        fail("json_loadb_arena failed on a valid document");
+
+    expected = json_loads(document, 0, &error);
+    if (!json_equal(json, expected))
+        fail("json_loadb_arena produced a different value");
+
+    /* Reference counting works as usual, but never frees */
+    json_incref(json);
+    json_decref(json);
+    json_decref(json);
+    if (json_integer_value(json_object_get(json, "id")) != 42)
+        fail("arena value was released by json_decref");
+    if (json_memory_usage(json) != 0)
+        fail("arena value was taken for a heap value after json_decref");
+
+    json_decref(expected);
+    json_arena_destroy(arena);
+}
+
+static void mutate_arena_values() {
+    json_arena_t *arena;
+    json_t *json, *tags, *foreign;
+    json_error_t error;
+    int i;
+
+    arena = json_arena_create(128);
+    json = json_loadb_arena(arena, document, strlen(document), 0, &error);
+    if (!json)
+        fail("json_loadb_arena failed on a valid document");
+
+    /* Grow containers and strings past the small block size */
+    tags = json_object_get(json, "tags");
+    for (i = 0; i < 100; i++) {
+        if (json_array_append_new(tags, json_integer(i)))
+            fail("unable to append to an arena array");
+        if (json_array_insert_new(tags, 0, json_real(i)))
+            fail("unable to insert to an arena array");
+    }
+    if (json_array_size(tags) != 203)
+        fail("arena array has the wrong size");
+    if (json_array_remove(tags, 0) || json_array_size(tags) != 202)
+        fail("unable to remove from an arena array");
+
+    if (json_string_set(json_object_get(json, "name"),
+                        "a string that is longer than the original one"))
+        fail("unable to set an arena string");
+    if (strcmp(json_string_value(json_object_get(json, "name")),
+               "a string that is longer than the original one"))
+        fail("arena string has the wrong value");
+
+    for (i = 0; i < 50; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "key%d", i);
+        if (json_object_set_new(json, key, json_integer(i)))
+            fail("unable to add to an arena object");
+    }
+    if (json_object_size(json) != 56)
+        fail("arena object has the wrong size");
+    if (json_object_del(json, "key10") || json_object_get(json, "key10"))
+        fail("unable to delete from an arena object");
+
+    /* A value from outside the arena is kept alive until the arena is
+       reset, even after being removed */
+    foreign = json_string("foreign");
+    json_object_set(json, "foreign", foreign);
+    json_array_append(tags, foreign);
+    if (foreign->refcount != 3)
+        fail("storing a value in an arena container didn't take a reference");
+
+    json_object_del(json, "foreign");
+    json_array_clear(tags);
+    if (foreign->refcount != 3)
+        fail("arena container released a foreign value early");
+
+    json_arena_reset(arena);
+    if (foreign->refcount != 1)
+        fail("json_arena_reset didn't release foreign values");
+
+    /* The arena can be reused after a reset */
+    json = json_loadb_arena(arena, document, strlen(document), 0, &error);
+    if (!json || json_object_size(json) != 6)
+        fail("json_loadb_arena failed after json_arena_reset");
+
+    json_decref(foreign);
+    json_arena_destroy(arena);
+}
+
+static void few_allocations() {
+    json_arena_t *arena;
+    json_t *json;
+    json_error_t error;
+
+    json_set_alloc_funcs(counting_malloc, counting_free);
+
+    arena = json_arena_create(0);
+    json = json_loadb_arena(arena, document, strlen(document), 0, &error);
+    if (!json)
+        fail("json_loadb_arena failed on a valid document");
+
+    /* The arena, its first block, and the lexer's scratch buffer */
+    if (mallocs > 3)
+        fail("json_loadb_arena allocated nodes from the heap");
+
+    json_arena_destroy(arena);
+    if (mallocs != frees)
+        fail("json_arena_destroy didn't free everything");
+
+    json_set_alloc_funcs(malloc, free);
+}
+
+static void append_many_failure() {
+    json_arena_t *arena;
+    json_t *json, *values[400];
+    json_error_t error;
+    int i;
+
+    arena = json_arena_create(16384);
+    json = json_loadb_arena(arena, "[]", 2, 0, &error);
+    if (!json)
+        fail("json_loadb_arena failed on a valid document");
+
+    /* Make room in the table, so that only adopting the values fails,
+       after the first ones are adopted */
+    for (i = 0; i < 400; i++)
+        json_array_append_new(json, json_null());
+    json_array_clear(json);
+
+    for (i = 0; i < 400; i++)
+        values[i] = json_integer(i);
+
+    json_set_alloc_funcs(failing_malloc, free);
+    if (!json_array_append_many_new(json, values, 400))
+        fail("json_array_append_many_new succeeded without memory");
+    json_set_alloc_funcs(malloc, free);
+
+    if (json_array_size(json) != 0)
+        fail("json_array_append_many_new changed the array on error");
+
+    json_arena_destroy(arena);
+}
+
+static void invalid_input() {
+    json_arena_t *arena;
+    json_error_t error;
+    const char truncated[] = "{\"a\": [1, 2, \"three\"";
+
+    arena = json_arena_create(0);
+
+    if (json_loadb_arena(NULL, "[]", 2, 0, &error))
+        fail("json_loadb_arena accepted a NULL arena");
+    if (json_error_code(&error) != json_error_invalid_argument)
+        fail("json_loadb_arena returned a wrong error code for a NULL arena");
+
+    if (json_loadb_arena(arena, truncated, strlen(truncated), 0, &error))
+        fail("json_loadb_arena accepted a truncated document");
+    if (strcmp(error.text, "']' expected near end of file"))
+        fail("json_loadb_arena returned a wrong error message");
+
+    json_arena_destroy(arena);
+
+    /* Passing NULL is allowed */
+    json_arena_reset(NULL);
+    json_arena_destroy(NULL);
+}
+
+static void run_tests() {
+    load_into_arena();
+    mutate_arena_values();
+    few_allocations();
+    append_many_failure();
+    invalid_input();
+}
@@ -7,6 +7,8 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void test_misc(void) {
     json_t *array, *five, *seven, *value;
@@ -337,6 +339,98 @@ static void test_extend(void) {
     json_decref(array2);
 }
 
+static void test_reserve(void) {
+    /* frozen values are never freed, keep them reachable */
+    static json_t *frozen;
+    json_t *array, *values[100];
+    size_t i;
+
+    array = json_array();
+    if (json_array_reserve(array, 1000) || json_array_size(array) != 0)
+        fail("json_array_reserve failed");
+    for (i = 0; i < 1000; i++) {
+        if (json_array_append_new(array, json_integer(i)))
+            fail("unable to append to a reserved array");
+    }
+    if (json_array_reserve(array, 10) || json_array_size(array) != 1000 ||
+        json_integer_value(json_array_get(array, 999)) != 999)
+        fail("json_array_reserve changed the array");
+    json_decref(array);
+
+    array = json_object();
+    if (!json_array_reserve(NULL, 1) || !json_array_reserve(array, 1))
+        fail("json_array_reserve succeeded with invalid arguments");
+    json_decref(array);
+    array = json_array();
+    if (!json_array_reserve(array, (size_t)-1))
+        fail("json_array_reserve succeeded with an impossible size");
+    json_decref(array);
+
+    /* bulk appends */
+    array = json_array();
+    for (i = 0; i < 100; i++)
+        values[i] = json_integer(i);
+    if (json_array_append_many_new(array, values, 10) ||
+        json_array_append_many_new(array, values + 10, 90) ||
+        json_array_append_many_new(array, NULL, 0) || json_array_size(array) != 100)
+        fail("json_array_append_many_new failed");
+    for (i = 0; i < 100; i++) {
+        if (json_integer_value(json_array_get(array, i)) != (json_int_t)i)
+            fail("json_array_append_many_new appended wrong values");
+    }
+
+    values[0] = json_string("a");
+    values[1] = NULL;
+    values[2] = json_string("c");
+    if (!json_array_append_many_new(array, values, 3) || json_array_size(array) != 100)
+        fail("json_array_append_many_new appended a NULL value");
+    values[0] = json_string("a");
+    values[1] = array;
+    json_incref(array);
+    if (!json_array_append_many_new(array, values, 2) || json_array_size(array) != 100)
+        fail("json_array_append_many_new appended the array to itself");
+
+    frozen = json_array();
+    json_freeze(frozen);
+    values[0] = json_string("a");
+    if (!json_array_append_many_new(frozen, values, 1) ||
+        !json_array_reserve(frozen, 10) || !json_array_append_many_new(NULL, NULL, 1))
+        fail("json_array_append_many_new succeeded with invalid arguments");
+    json_decref(array);
+}
+
+/* Arrays are sized from the arrays decoded before them */
+static void test_decode_sizes(void) {
+    const char *text = "[[1,2,3],[4,5,6],[7],[],[8,9,10,11,12,13,14,15,16,17],"
+                       "{\"a\":[1,2],\"b\":[]},{\"a\":[],\"b\":[3]}]";
+    json_t *array, *big;
+    char *dumped;
+    size_t i;
+
+    array = json_loads(text, 0, NULL);
+    dumped = json_dumps(array, JSON_COMPACT);
+    if (!dumped || strcmp(dumped, text))
+        fail("decoding arrays of different sizes failed");
+    free(dumped);
+    json_decref(array);
+
+    /* Larger arrays than the size hints go */
+    big = json_array();
+    for (i = 0; i < 3000; i++)
+        json_array_append_new(big, json_integer(i));
+    array = json_pack("[O, O, [i]]", big, big, 1);
+    dumped = json_dumps(array, 0);
+    json_decref(array);
+    array = json_loads(dumped, 0, NULL);
+    if (!json_equal(json_array_get(array, 0), big) ||
+        !json_equal(json_array_get(array, 1), big) ||
+        json_array_size(json_array_get(array, 2)) != 1)
+        fail("decoding large arrays failed");
+    free(dumped);
+    json_decref(array);
+    json_decref(big);
+}
+
 static void test_circular() {
     json_t *array1, *array2;
 
@@ -478,6 +572,8 @@ static void run_tests() {
     test_remove();
     test_clear();
     test_extend();
+    test_reserve();
+    test_decode_sizes();
     test_circular();
     test_array_foreach();
     test_bad_args();
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"small\": [0, 1, 23, 24, 255, 256, 65535, 65536, 4294967295, 4294967296],"
+    " \"negative\": [-1, -24, -25, -256, -257, -65537, -9223372036854775808],"
+    " \"big\": 9223372036854775807,"
+    " \"reals\": [0.0, -0.0, 0.5, 0.1, 1.5e300, -3.4e38, 1e-310, 100.0],"
+    " \"strings\": [\"\", \"a\", \"caf\xc3\xa9 \xe2\x82\xac \xf0\x9d\x84\x9e\","
+    " \"a string that is longer than the inline limit and the key buffer of the"
+    " map decoder\"],"
+    " \"a key that is longer than the key buffer of the map decoder, by a few bytes\":"
+    " {\"nested\": [[], {}, [[[null]]]]},"
+    " \"true\": true, \"false\": false, \"null\": null}";
+
+struct input {
+    const char *data;
+    size_t length;
+    size_t pos;
+    size_t step;
+};
+
+/* Return at most step bytes at a time */
+static size_t read_input(void *buffer, size_t buflen, void *data) {
+    struct input *input = data;
+    size_t len = input->length - input->pos;
+
+    if (len > buflen)
+        len = buflen;
+    if (len > input->step)
+        len = input->step;
+    memcpy(buffer, input->data + input->pos, len);
+    input->pos += len;
+    return len;
+}
+
+static char *encode(const json_t *json, size_t flags, size_t *size) {
+    char *buffer;
+
+    *size = json_cbor_dumpb(json, NULL, 0, flags);
+    if (*size == 0)
+        return NULL;
+
+    buffer = malloc(*size);
+    if (!buffer)
+        fail("malloc failed");
+    if (json_cbor_dumpb(json, buffer, *size, flags) != *size)
+        fail("json_cbor_dumpb returned a different size");
+    return buffer;
+}
+
+static void round_trip() {
+    json_t *json, *decoded, *long_string;
+    json_error_t error;
+    struct input input;
+    char *buffer, *text;
+    size_t size, length = 200000;
+
+    json = json_loads(document, 0, &error);
+    if (!json)
+        fail("json_loads failed");
+
+    /* A string that is split between the chunks of a stream */
+    text = malloc(length + 1);
+    if (!text)
+        fail("malloc failed");
+    memset(text, 'x', length);
+    text[length] = '\0';
+    long_string = json_string(text);
+    json_object_set_new(json, text, long_string);
+    free(text);
+
+    buffer = encode(json, 0, &size);
+    if (!buffer)
+        fail("json_cbor_dumpb failed");
+
+    decoded = json_cbor_loadb(buffer, size, 0, &error);
+    if (!decoded || !json_equal(decoded, json))
+        fail("json_cbor_loadb returned a different value");
+    if (error.position != (int)size)
+        fail("json_cbor_loadb didn't save the position");
+    if (!json_is_real(json_array_get(json_object_get(decoded, "reals"), 7)))
+        fail("json_cbor_loadb decoded a real as an integer");
+    json_decref(decoded);
+
+    /* The same in small and large pieces */
+    input.data = buffer;
+    input.length = size;
+    input.pos = 0;
+    input.step = 1;
+    decoded = json_cbor_load_callback(read_input, &input, 0, &error);
+    if (!decoded || !json_equal(decoded, json))
+        fail("json_cbor_load_callback returned a different value");
+    json_decref(decoded);
+
+    input.pos = 0;
+    input.step = 100000;
+    decoded = json_cbor_load_callback(read_input, &input, 0, &error);
+    if (!decoded || !json_equal(decoded, json))
+        fail("json_cbor_load_callback returned a different value in large pieces");
+    json_decref(decoded);
+
+    /* Integers as reals */
+    decoded = json_cbor_loadb(buffer, size, JSON_DECODE_INT_AS_REAL, &error);
+    if (json_real_value(json_object_get(decoded, "big")) != 9223372036854775807.0 ||
+        json_real_value(json_array_get(json_object_get(decoded, "negative"), 2)) != -25.0)
+        fail("json_cbor_loadb failed with JSON_DECODE_INT_AS_REAL");
+    json_decref(decoded);
+
+    free(buffer);
+    json_decref(json);
+}
+
+static void check_encoding(const json_t *json, size_t flags, const char *expected,
+                           size_t expected_size) {
+    char *buffer;
+    size_t size;
+
+    buffer = encode(json, flags, &size);
+    if (!buffer || size != expected_size || memcmp(buffer, expected, size))
+        fail("json_cbor_dumpb returned a wrong encoding");
+    free(buffer);
+}
+
+static void check_decoding(const char *input, size_t size, const char *expected,
+                           size_t flags) {
+    json_error_t error;
+    json_t *json, *value;
+
+    json = json_cbor_loadb(input, size, flags, &error);
+    value = json_loads(expected, JSON_DECODE_ANY | JSON_ALLOW_NUL, NULL);
+    if (!json || !json_equal(json, value))
+        fail("json_cbor_loadb returned a wrong value");
+    json_decref(json);
+    json_decref(value);
+}
+
+static void known_encodings() {
+    json_t *json;
+
+    /* Examples of RFC 8949, appendix A */
+    json = json_loads("[1, [2, 3], [4, 5]]", 0, NULL);
+    check_encoding(json, 0, "\x83\x01\x82\x02\x03\x82\x04\x05", 8);
+    json_decref(json);
+
+    json = json_loads("{\"a\": 1, \"b\": [2, 3]}", 0, NULL);
+    check_encoding(json, 0, "\xa2\x61\x61\x01\x61\x62\x82\x02\x03", 9);
+    json_decref(json);
+
+    json = json_integer(1000000);
+    check_encoding(json, JSON_ENCODE_ANY, "\x1a\x00\x0f\x42\x40", 5);
+    json_decref(json);
+
+    json = json_integer(-1000);
+    check_encoding(json, JSON_ENCODE_ANY, "\x39\x03\xe7", 3);
+    json_decref(json);
+
+    json = json_string("IETF");
+    check_encoding(json, JSON_ENCODE_ANY, "\x64\x49\x45\x54\x46", 5);
+    json_decref(json);
+
+    /* Reals are single precision if that's exact */
+    json = json_real(1.5);
+    check_encoding(json, JSON_ENCODE_ANY, "\xfa\x3f\xc0\x00\x00", 5);
+    json_decref(json);
+
+    json = json_real(0.1);
+    check_encoding(json, JSON_ENCODE_ANY, "\xfb\x3f\xb9\x99\x99\x99\x99\x99\x9a", 9);
+    json_decref(json);
+
+    /* Keys are sorted bytewise */
+    json = json_pack("{s:i, s:i, s:i}", "b", 1, "ab", 2, "a", 3);
+    check_encoding(json, JSON_SORT_KEYS, "\xa3\x61\x61\x03\x62\x61\x62\x02\x61\x62\x01",
+                   11);
+    check_encoding(json, 0, "\xa3\x61\x62\x01\x62\x61\x62\x02\x61\x61\x03", 11);
+    json_decref(json);
+
+    /* Half precision, indefinite lengths and tags */
+    check_decoding("\xf9\x3c\x00", 3, "1.0", JSON_DECODE_ANY);
+    check_decoding("\xf9\x7b\xff", 3, "65504.0", JSON_DECODE_ANY);
+    check_decoding("\xf9\x00\x01", 3, "5.960464477539063e-8", JSON_DECODE_ANY);
+    check_decoding("\xf9\xc4\x00", 3, "-4.0", JSON_DECODE_ANY);
+    check_decoding("\x9f\x01\x82\x02\x03\x9f\x04\x05\xff\xff", 10, "[1, [2, 3], [4, 5]]",
+                   0);
+    check_decoding("\xbf\x61\x61\x01\x61\x62\x9f\x02\x03\xff\xff", 11,
+                   "{\"a\": 1, \"b\": [2, 3]}", 0);
+    check_decoding("\x7f\x65strea\x64ming\xff", 13, "\"streaming\"", JSON_DECODE_ANY);
+    check_decoding("\xc1\x1a\x51\x4b\x67\xb0", 6, "1363896240", JSON_DECODE_ANY);
+    check_decoding("\x1b\x7f\xff\xff\xff\xff\xff\xff\xff", 9, "9223372036854775807",
+                   JSON_DECODE_ANY);
+}
+
+static void check_invalid(const char *input, size_t size, size_t flags,
+                          enum json_error_code code, int position) {
+    json_error_t error;
+
+    if (json_cbor_loadb(input, size, flags, &error))
+        fail("json_cbor_loadb accepted invalid input");
+    if (json_error_code(&error) != code || error.position != position)
+        fail("json_cbor_loadb returned a wrong error");
+    if (strcmp(error.source, "<buffer>") || error.line != -1)
+        fail("json_cbor_loadb returned a wrong error source");
+}
+
+static void invalid_input() {
+    char deep[3000];
+
+    check_invalid("\x82\x01", 2, 0, json_error_premature_end_of_input, 2);
+    check_invalid("\x83\x01\x19\x01", 4, 0, json_error_premature_end_of_input, 4);
+    check_invalid("\x81\x65\x61\x62", 4, 0, json_error_premature_end_of_input, 2);
+    check_invalid("\x80\x00", 2, 0, json_error_end_of_input_expected, 1);
+    check_invalid("\x01", 1, 0, json_error_invalid_syntax, 0);
+    check_invalid("\x81\x42\x61\x62", 4, 0, json_error_invalid_syntax, 1);
+    check_invalid("\xa1\x01\x01", 3, 0, json_error_invalid_syntax, 1);
+    check_invalid("\xa2\x61\x61\x01\x61\x61\x02", 7, JSON_REJECT_DUPLICATES,
+                json_error_duplicate_key, 4);
+    check_invalid("\x81\x63\x61\x00\x62", 5, 0, json_error_null_character, 1);
+    check_invalid("\xa1\x63\x61\x00\x62\x01", 6, JSON_ALLOW_NUL,
+                json_error_null_byte_in_key, 1);
+    check_invalid("\x81\x62\xc3\x28", 4, 0, json_error_invalid_utf8, 1);
+    check_invalid("\x81\x1b\x80\x00\x00\x00\x00\x00\x00\x00", 10, 0,
+                json_error_numeric_overflow, 1);
+    check_invalid("\x81\x3b\x80\x00\x00\x00\x00\x00\x00\x00", 10, 0,
+                json_error_numeric_overflow, 1);
+    check_invalid("\x81\xf9\x7e\x00", 4, 0, json_error_numeric_overflow, 1);
+    check_invalid("\x81\xf7", 2, 0, json_error_invalid_syntax, 1);
+    check_invalid("\x81\xff", 2, 0, json_error_invalid_syntax, 1);
+    check_invalid("\x81\x1c", 2, 0, json_error_invalid_syntax, 1);
+    check_invalid("\x9f\x01", 2, 0, json_error_premature_end_of_input, 2);
+    check_invalid("\x7f\x61\x61\x01\xff", 5, JSON_DECODE_ANY, json_error_invalid_syntax,
+                  3);
+
+    memset(deep, 0x81, sizeof(deep));
+    check_invalid(deep, sizeof(deep), 0, json_error_stack_overflow, 2048);
+
+    /* Trailing input without the check */
+    check_decoding("\x80\x00", 2, "[]", JSON_DISABLE_EOF_CHECK);
+    check_decoding("\x81\x63\x61\x00\x62", 5, "[\"a\\u0000b\"]", JSON_ALLOW_NUL);
+
+    if (json_cbor_loadb(NULL, 0, 0, NULL) || json_cbor_load_callback(NULL, NULL, 0, NULL))
+        fail("json_cbor_loadb accepted NULL input");
+}
+
+static void invalid_values() {
+    json_t *json, *array;
+    char buffer[16];
+
+    json = json_integer(1);
+    if (json_cbor_dumpb(json, buffer, sizeof(buffer), 0) ||
+        json_cbor_dumpb(NULL, buffer, sizeof(buffer), JSON_ENCODE_ANY))
+        fail("json_cbor_dumpb encoded an invalid value");
+    json_decref(json);
+
+    json = json_array();
+    array = json_array();
+    json_array_append_new(json, array);
+    json_array_append(array, json);
+    if (json_cbor_dumpb(json, buffer, sizeof(buffer), 0))
+        fail("json_cbor_dumpb encoded a circular reference");
+    json_array_clear(array);
+    json_decref(json);
+
+    if (json_cbor_dump_callback(json, NULL, NULL, 0) != -1)
+        fail("json_cbor_dump_callback accepted a NULL callback");
+}
+
+static void files() {
+    const char *path = "test_cbor.cbor";
+    json_t *json, *empty, *first, *second;
+    json_error_t error;
+    FILE *fp;
+
+    json = json_loads(document, 0, &error);
+    empty = json_array();
+    if (json_cbor_dump_file(json, path, JSON_SORT_KEYS))
+        fail("json_cbor_dump_file failed");
+    first = json_cbor_load_file(path, 0, &error);
+    if (!first || !json_equal(first, json))
+        fail("json_cbor_load_file returned a different value");
+    json_decref(first);
+    remove(path);
+
+    if (json_cbor_load_file(path, 0, &error) ||
+        json_error_code(&error) != json_error_cannot_open_file ||
+        strcmp(error.source, path))
+        fail("json_cbor_load_file opened a missing file");
+
+    /* Consecutive values are read one by one without the EOF check */
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    if (json_cbor_dumpf(json, fp, 0) || json_cbor_dumpf(empty, fp, 0))
+        fail("json_cbor_dumpf failed");
+    rewind(fp);
+
+    first = json_cbor_loadf(fp, JSON_DISABLE_EOF_CHECK, &error);
+    second = json_cbor_loadf(fp, 0, &error);
+    if (!json_equal(first, json) || !json_is_array(second) || json_array_size(second))
+        fail("json_cbor_loadf failed to read consecutive values");
+    if (strcmp(error.source, "<stream>"))
+        fail("json_cbor_loadf returned a wrong error source");
+    json_decref(first);
+    json_decref(second);
+    fclose(fp);
+
+    json_decref(empty);
+    json_decref(json);
+}
+
+static void run_tests() {
+    round_trip();
+    known_encodings();
+    invalid_input();
+    invalid_values();
+    files();
+}
@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdio.h>
 #include <string.h>
 
 static void test_copy_simple(void) {
@@ -313,6 +314,44 @@ static void test_deep_copy_object(void) {
     json_decref(copy);
 }
 
+static void test_deep_copy_large_object(void) {
+    json_t *object, *copy;
+    char key[16];
+    int i;
+
+    object = json_object();
+    for (i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        json_object_set_new(object, key, json_integer(i));
+    }
+    /* Deleted keys leave holes in the insertion order */
+    for (i = 0; i < 100; i += 3) {
+        snprintf(key, sizeof(key), "key%d", i);
+        json_object_del(object, key);
+    }
+
+    copy = json_deep_copy(object);
+    if (!copy || !json_equal(copy, object) || json_object_size(copy) != 66)
+        fail("deep copying a large object produces an inequal copy");
+    if (json_integer_value(json_object_get(copy, "key98")) != 98 ||
+        json_object_get(copy, "key99"))
+        fail("deep copying a large object produces a wrong copy");
+
+    /* The copy can be changed */
+    for (i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        json_object_set_new(copy, key, json_integer(-i));
+    }
+    if (json_object_size(copy) != 200 || json_object_del(copy, "key1") ||
+        json_integer_value(json_object_get(copy, "key50")) != -50 ||
+        json_integer_value(json_object_get(object, "key50")) != 50 ||
+        strcmp(json_object_iter_key(json_object_iter(copy)), "key2"))
+        fail("changing a deep copy of a large object failed");
+
+    json_decref(object);
+    json_decref(copy);
+}
+
 static void test_deep_copy_circular_references(void) {
     /* Construct a JSON object/array with a circular reference:
 
@@ -322,8 +361,9 @@ static void test_deep_copy_circular_references(void) {
       Deep copy it, remove the circular reference and deep copy again.
    */
 
-    json_t *json;
+    json_t *json, *inner;
     json_t *copy;
+    int i;
 
     json = json_object();
     json_object_set_new(json, "a", json_object());
@@ -362,6 +402,61 @@ static void test_deep_copy_circular_references(void) {
 
     json_decref(copy);
     json_decref(json);
+
+    /* Deeper than the inline slots of the cycle check */
+    json = inner = json_array();
+    for (i = 0; i < 100; i++) {
+        json_array_append_new(inner, json_array());
+        inner = json_array_get(inner, 0);
+    }
+    json_array_append(inner, json_array_get(json, 0));
+
+    copy = json_deep_copy(json);
+    if (copy)
+        fail("json_deep_copy copied a deep circular reference!");
+
+    json_array_clear(inner);
+    copy = json_deep_copy(json);
+    if (!copy || !json_equal(copy, json))
+        fail("json_deep_copy failed on a deep value!");
+
+    json_decref(copy);
+    json_decref(json);
+}
+
+/* Copying and freeing keep the nested values on the heap, so they
+   don't recurse once per level */
+static void test_deep_copy_deep_nesting(void) {
+    json_t *json, *inner, *copy;
+    size_t i;
+
+    json = inner = json_array();
+    for (i = 0; i < 100000; i++) {
+        json_t *child = (i % 2) ? json_array() : json_object();
+
+        if (json_is_array(inner))
+            json_array_append_new(inner, child);
+        else
+            json_object_set_new(inner, "a", child);
+        inner = child;
+    }
+
+    copy = json_deep_copy(json);
+    if (!copy || copy == json)
+        fail("json_deep_copy failed on a deep value!");
+
+    inner = copy;
+    for (i = 0; i < 100000; i++) {
+        inner = json_is_array(inner) ? json_array_get(inner, 0)
+                                     : json_object_get(inner, "a");
+        if (!inner || (json_is_array(inner) != (i % 2 == 1)))
+            fail("json_deep_copy made a wrong copy of a deep value!");
+    }
+    if (json_is_array(inner) ? json_array_size(inner) : json_object_size(inner))
+        fail("json_deep_copy made a wrong copy of a deep value!");
+
+    json_decref(copy);
+    json_decref(json);
 }
 
 static void run_tests() {
@@ -371,5 +466,7 @@ static void run_tests() {
     test_deep_copy_array();
     test_copy_object();
     test_deep_copy_object();
+    test_deep_copy_large_object();
     test_deep_copy_circular_references();
+    test_deep_copy_deep_nesting();
 }
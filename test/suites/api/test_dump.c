@@ -8,6 +8,7 @@
 #include "jansson_private_config.h"
 
 #include <jansson.h>
+#include <limits.h>
 #include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -18,6 +19,12 @@
 #define pipe(fds) _pipe(fds, 1024, _O_BINARY)
 #endif
 
+#if JSON_INTEGER_IS_LONG_LONG
+#define INTEGER_MAX LLONG_MAX
+#else
+#define INTEGER_MAX LONG_MAX
+#endif
+
 static int encode_null_callback(const char *buffer, size_t size, void *data) {
     (void)buffer;
     (void)size;
@@ -130,6 +137,46 @@ static void circular_references() {
     json_decref(json);
 }
 
+static void deep_circular_references() {
+    json_t *json, *inner, *shared;
+    char *result, *unchecked;
+    int i;
+
+    /* Nest deeper than the inline slots of the cycle check, sharing one
+       array in many places, which is not a circular reference */
+    json = inner = json_array();
+    shared = json_array();
+    for (i = 0; i < 200; i++) {
+        json_t *next = json_object();
+        json_array_append(inner, shared);
+        json_array_append_new(inner, next);
+        inner = json_object();
+        json_object_set_new(next, "next", inner);
+        inner = json_array();
+        json_object_set_new(json_object_get(next, "next"), "a", inner);
+    }
+
+    result = json_dumps(json, JSON_COMPACT);
+    if (!result)
+        fail("json_dumps failed on a deep value without circular references");
+
+    unchecked = json_dumps(json, JSON_COMPACT | JSON_NO_CYCLE_CHECK);
+    if (!unchecked || strcmp(result, unchecked))
+        fail("json_dumps returned different output with JSON_NO_CYCLE_CHECK");
+    free(result);
+    free(unchecked);
+
+    json_array_append(inner, json);
+    if (json_dumps(json, JSON_COMPACT))
+        fail("json_dumps encoded a deep circular reference!");
+    if (json_dump_size(json, JSON_COMPACT))
+        fail("json_dump_size accepted a deep circular reference!");
+
+    json_array_clear(inner);
+    json_decref(shared);
+    json_decref(json);
+}
+
 static void encode_other_than_array_or_object() {
     /* Encoding anything other than array or object should only
      * succeed if the JSON_ENCODE_ANY flag is used */
@@ -205,6 +252,50 @@ static void encode_nul_byte() {
     json_decref(json);
 }
 
+static void escape_long_strings() {
+    /* Put a character that needs escaping at every offset of a string
+       long enough to be scanned in vector-sized blocks */
+    static const struct {
+        const char *raw;
+        const char *escaped;
+    } specials[] = {{"\"", "\\\""}, {"\\", "\\\\"}, {"\n", "\\n"},
+                    {"\x1f", "\\u001F"}, {"\xc3\xa4", "\\u00E4"}};
+    char raw[80], expected[100];
+    size_t i, j, len = 70;
+
+    for (i = 0; i < sizeof(specials) / sizeof(specials[0]); i++) {
+        for (j = 0; j < len; j++) {
+            json_t *json, *loaded;
+            char *result;
+            size_t raw_len = strlen(specials[i].raw);
+
+            memset(raw, 'a', len);
+            memcpy(raw + j, specials[i].raw, raw_len);
+            raw[len + raw_len] = '\0';
+            memset(raw + j + raw_len, 'a', len - j);
+
+            expected[0] = '"';
+            memset(expected + 1, 'a', j);
+            strcpy(expected + 1 + j, specials[i].escaped);
+            memset(expected + 1 + j + strlen(specials[i].escaped), 'a', len - j);
+            strcpy(expected + 1 + j + strlen(specials[i].escaped) + len - j, "\"");
+
+            json = json_string(raw);
+            result = json_dumps(json, JSON_ENCODE_ANY | JSON_ENSURE_ASCII);
+            if (!result || strcmp(result, expected))
+                fail("json_dumps failed to escape a long string");
+
+            loaded = json_loads(result, JSON_DECODE_ANY, NULL);
+            if (!loaded || !json_equal(json, loaded))
+                fail("json_loads failed to decode a long escaped string");
+
+            free(result);
+            json_decref(loaded);
+            json_decref(json);
+        }
+    }
+}
+
 static void dump_file() {
     json_t *json;
     int result;
@@ -243,6 +334,236 @@ static void dumpb() {
     json_decref(obj);
 }
 
+struct chunks {
+    char output[65536];
+    size_t length;
+    int calls;
+    size_t max_size;
+    int split_utf8;
+};
+
+static int collect_chunks(const char *buffer, size_t size, void *data) {
+    struct chunks *chunks = (struct chunks *)data;
+
+    if (chunks->length + size > sizeof(chunks->output))
+        return -1;
+
+    /* A chunk must not start with a UTF-8 continuation byte */
+    if (((unsigned char)buffer[0] & 0xC0) == 0x80)
+        chunks->split_utf8 = 1;
+
+    memcpy(chunks->output + chunks->length, buffer, size);
+    chunks->length += size;
+    chunks->calls++;
+    if (size > chunks->max_size)
+        chunks->max_size = size;
+    return 0;
+}
+
+static int fail_chunks(const char *buffer, size_t size, void *data) {
+    (void)buffer;
+    (void)size;
+    (*(int *)data)++;
+    return -1;
+}
+
+static void dump_callback_chunks() {
+    static struct chunks chunks;
+    json_t *json;
+    char *expected;
+    int i, calls = 0;
+
+    json = json_array();
+    for (i = 0; i < 2000; i++) {
+        json_array_append_new(json, json_integer(i));
+        json_array_append_new(json, json_string("\xe2\x82\xac\xe2\x82\xac"));
+    }
+    expected = json_dumps(json, JSON_INDENT(2));
+
+    memset(&chunks, 0, sizeof(chunks));
+    if (json_dump_callback(json, collect_chunks, &chunks, JSON_INDENT(2)))
+        fail("json_dump_callback failed");
+    if (chunks.length != strlen(expected) || memcmp(chunks.output, expected, chunks.length))
+        fail("json_dump_callback returned different output");
+    if (chunks.calls > (int)(chunks.length / 4096) + 1)
+        fail("json_dump_callback called the callback for small chunks");
+
+    memset(&chunks, 0, sizeof(chunks));
+    if (json_dump_callback_ex(json, collect_chunks, &chunks, JSON_INDENT(2), 7))
+        fail("json_dump_callback_ex failed with a small buffer");
+    if (chunks.length != strlen(expected) || memcmp(chunks.output, expected, chunks.length))
+        fail("json_dump_callback_ex returned different output with a small buffer");
+    if (chunks.max_size > 8 || chunks.split_utf8)
+        fail("json_dump_callback_ex returned invalid chunks");
+
+    memset(&chunks, 0, sizeof(chunks));
+    if (json_dump_callback_ex(json, collect_chunks, &chunks, JSON_INDENT(2), 100000))
+        fail("json_dump_callback_ex failed with a large buffer");
+    if (chunks.calls != 1 || chunks.length != strlen(expected) ||
+        memcmp(chunks.output, expected, chunks.length))
+        fail("json_dump_callback_ex returned different output with a large buffer");
+
+    if (json_dump_callback(json, fail_chunks, &calls, 0) != -1 || calls != 1)
+        fail("json_dump_callback didn't stop when the callback failed");
+
+    free(expected);
+    json_decref(json);
+}
+
+static void dump_size() {
+    json_t *json;
+    char *result, buf[256];
+    size_t size;
+    int i;
+
+    json = json_pack("{s:[i,f,s,n]}", "foo", 42, 0.5, "bar\n\xe2\x82\xac");
+    result = json_dumps(json, JSON_INDENT(4) | JSON_ENSURE_ASCII);
+    size = json_dump_size(json, JSON_INDENT(4) | JSON_ENSURE_ASCII);
+    if (!result || size != strlen(result))
+        fail("json_dump_size returned a wrong size");
+    if (json_dumpb(json, buf, size, JSON_INDENT(4) | JSON_ENSURE_ASCII) != size ||
+        memcmp(buf, result, size))
+        fail("json_dumpb failed with a buffer of json_dump_size bytes");
+    free(result);
+
+    /* Larger than the internal buffer of json_dumps() */
+    for (i = 0; i < 1000; i++)
+        json_array_append_new(json_object_get(json, "foo"), json_integer(i));
+    result = json_dumps(json, JSON_SORT_KEYS);
+    if (!result || json_dump_size(json, JSON_SORT_KEYS) != strlen(result))
+        fail("json_dump_size returned a wrong size for a large value");
+    free(result);
+    json_decref(json);
+
+    json = json_string("");
+    if (json_dump_size(json, 0) != 0)
+        fail("json_dump_size accepted a string without JSON_ENCODE_ANY");
+    if (json_dump_size(json, JSON_ENCODE_ANY) != 2)
+        fail("json_dump_size returned a wrong size for an empty string");
+    json_decref(json);
+
+    if (json_dump_size(NULL, JSON_ENCODE_ANY) != 0)
+        fail("json_dump_size accepted NULL");
+}
+
+static int key_order(const char *key1, size_t len1, const char *key2, size_t len2) {
+    int res = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+
+    if (res)
+        return res;
+    return len1 < len2 ? -1 : len1 > len2;
+}
+
+static void check_sorted(const char *text) {
+    json_t *json;
+    const char *prev = NULL;
+    size_t prev_len = 0;
+    void *iter;
+
+    /* The decoder keeps the order of the keys */
+    json = json_loads(text, 0, NULL);
+    if (!json)
+        fail("unable to decode the output of JSON_SORT_KEYS");
+
+    for (iter = json_object_iter(json); iter; iter = json_object_iter_next(json, iter)) {
+        const char *key = json_object_iter_key(iter);
+        size_t key_len = json_object_iter_key_len(iter);
+
+        if (prev && key_order(prev, prev_len, key, key_len) >= 0)
+            fail("JSON_SORT_KEYS returned keys in a wrong order");
+        prev = key;
+        prev_len = key_len;
+    }
+    json_decref(json);
+}
+
+static void sort_keys() {
+    static const char *const prefixes[] = {"", "a", "ab", "b", "\xc3\xa4", "common prefix "};
+    json_t *json;
+    char key[64], *first, *result;
+    int i;
+
+    json = json_object();
+    for (i = 0; i < 300; i++) {
+        snprintf(key, sizeof(key), "%s%d", prefixes[i % 6], (i * 7919) % 1000);
+        json_object_set_new(json, key, json_integer(i));
+        json_object_set_new(json, prefixes[i % 6], json_integer(i));
+    }
+
+    result = json_dumps(json, JSON_SORT_KEYS);
+    check_sorted(result);
+
+    /* The cached order gives the same output, and follows changes */
+    first = json_dumps(json, JSON_SORT_KEYS | JSON_CACHE_SORTED_KEYS);
+    if (!first || strcmp(first, result))
+        fail("JSON_CACHE_SORTED_KEYS changed the output");
+    free(first);
+    free(result);
+
+    first = json_dumps(json, JSON_SORT_KEYS | JSON_CACHE_SORTED_KEYS);
+    result = json_dumps(json, JSON_SORT_KEYS);
+    if (!first || !result || strcmp(first, result))
+        fail("the cached key order returned different output");
+    free(first);
+    free(result);
+
+    json_object_set_new(json, "a", json_string("replaced"));
+    json_object_set_new(json, "0", json_true());
+    json_object_del(json, "b");
+    first = json_dumps(json, JSON_SORT_KEYS | JSON_CACHE_SORTED_KEYS);
+    result = json_dumps(json, JSON_SORT_KEYS);
+    if (!first || !result || strcmp(first, result) ||
+        strncmp(first, "{\"\": 294, \"0\": true,", 20))
+        fail("the cached key order wasn't updated");
+    check_sorted(first);
+    free(first);
+    free(result);
+
+    json_decref(json);
+}
+
+/* More levels than the encoder keeps without allocating */
+static void deep_nesting() {
+    json_t *json, *inner;
+    char *sorted, *unsorted, *expected, *p;
+    int i;
+
+    json = json_integer(0);
+    for (i = 0; i < 30; i++) {
+        inner = json;
+        json = i % 3 ? json_pack("{s:o, s:[i], s:{}}", "a", inner, "b", i, "c")
+                     : json_pack("[o, {s:i, s:i}]", inner, "x", i, "y", i);
+    }
+
+    /* The keys are in sorted order already */
+    sorted = json_dumps(json, JSON_INDENT(2) | JSON_SORT_KEYS);
+    unsorted = json_dumps(json, JSON_INDENT(2));
+    if (!sorted || !unsorted || strcmp(sorted, unsorted))
+        fail("JSON_SORT_KEYS changed the output of deep objects");
+    free(sorted);
+    free(unsorted);
+
+    unsorted = json_dumps(json, JSON_COMPACT);
+    json_decref(json);
+    json = json_loads(unsorted, 0, NULL);
+    sorted = json_dumps(json, JSON_COMPACT | JSON_SORT_KEYS);
+    if (!sorted || strcmp(sorted, unsorted))
+        fail("deep values changed in a round trip");
+    free(sorted);
+    free(unsorted);
+
+    /* Embedding only leaves out the outermost brackets */
+    unsorted = json_dumps(json, JSON_COMPACT | JSON_EMBED);
+    expected = json_dumps(json, JSON_COMPACT);
+    p = expected + strlen(expected) - 1;
+    *p = '\0';
+    if (!unsorted || strcmp(unsorted, expected + 1))
+        fail("JSON_EMBED failed on deep values");
+    free(unsorted);
+    free(expected);
+    json_decref(json);
+}
+
 static void dumpfd() {
 #ifdef HAVE_UNISTD_H
     int fds[2] = {-1, -1};
@@ -297,15 +618,89 @@ static void embed() {
     }
 }
 
+static void encode_integers() {
+    static const json_int_t values[] = {0, 7, -7, 10, 99, -100, 12345, -123456789,
+                                        INTEGER_MAX, -INTEGER_MAX, -INTEGER_MAX - 1};
+    char expected[64], *result;
+    size_t i;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        json_t *json = json_integer(values[i]);
+
+        snprintf(expected, sizeof(expected), "%" JSON_INTEGER_FORMAT, values[i]);
+        result = json_dumps(json, JSON_ENCODE_ANY);
+        if (!result || strcmp(result, expected))
+            fail("json_dumps returned an invalid integer");
+        json_decref(json);
+
+        json = json_loads(result, JSON_DECODE_ANY, NULL);
+        if (!json || json_integer_value(json) != values[i])
+            fail("integer didn't survive a dump and load round trip");
+        json_decref(json);
+        free(result);
+    }
+}
+
+static void encode_reals() {
+    static const struct {
+        double value;
+        size_t flags;
+        const char *expected;
+    } cases[] = {
+        {0.1, 0, "0.1"},
+        {-0.0, 0, "-0.0"},
+        {100.0, 0, "100.0"},
+        {1.5, 0, "1.5"},
+        {-65.613616999999977, 0, "-65.61361699999998"},
+        {0.0001, 0, "0.0001"},
+        {0.00001, 0, "1e-5"},
+        {1e16, 0, "10000000000000000.0"},
+        {1.5e17, 0, "1.5e17"},
+        {1.7976931348623157e308, 0, "1.7976931348623157e308"},
+        {2.2250738585072014e-308, 0, "2.2250738585072014e-308"},
+        {4.9406564584124654e-324, 0, "5e-324"},
+        {0.1, JSON_REAL_PRECISION(17), "0.10000000000000001"},
+        {3.14159, JSON_REAL_PRECISION(3), "3.14"},
+        {1234.5, JSON_REAL_PRECISION(2), "1.2e3"},
+    };
+    char *result;
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        json_t *json = json_real(cases[i].value);
+
+        result = json_dumps(json, JSON_ENCODE_ANY | cases[i].flags);
+        if (!result || strcmp(result, cases[i].expected))
+            fail("json_dumps returned an invalid real");
+        json_decref(json);
+
+        if (!cases[i].flags) {
+            json = json_loads(result, JSON_DECODE_ANY, NULL);
+            if (!json || json_real_value(json) != cases[i].value)
+                fail("real didn't survive a dump and load round trip");
+            json_decref(json);
+        }
+        free(result);
+    }
+}
+
 static void run_tests() {
     encode_null();
     encode_twice();
     circular_references();
+    deep_circular_references();
     encode_other_than_array_or_object();
     escape_slashes();
     encode_nul_byte();
+    escape_long_strings();
     dump_file();
     dumpb();
+    dump_callback_chunks();
+    dump_size();
+    sort_keys();
+    deep_nesting();
     dumpfd();
     embed();
+    encode_integers();
+    encode_reals();
 }
@@ -194,9 +194,64 @@ static void test_equal_complex() {
     json_decref(value3);
 }
 
+static void test_hash() {
+    json_t *value1, *value2, *array;
+    size_t hash;
+
+    if (json_hash(NULL))
+        fail("json_hash returned a hash for NULL");
+
+    /* Equal values have equal hashes */
+    value1 = json_loads("{\"a\": [1, 2.5, \"x\", true, null], \"b\": {\"c\": -0.0}}",
+                        0, NULL);
+    value2 = json_loads("{\"b\": {\"c\": 0.0}, \"a\": [1, 2.5, \"x\", true, null]}",
+                        0, NULL);
+    if (!json_equal(value1, value2) || json_hash(value1) != json_hash(value2))
+        fail("json_hash differs for equal values");
+
+    hash = json_hash(value1);
+    if (!hash || hash != json_hash(value1))
+        fail("json_hash is not stable");
+
+    /* Unequal values have different hashes, in all likelihood */
+    json_array_set_new(json_object_get(value2, "a"), 0, json_integer(2));
+    if (json_hash(value1) == json_hash(value2))
+        fail("json_hash is the same for different values");
+    json_array_set_new(json_object_get(value2, "a"), 0, json_real(1.0));
+    if (json_hash(value1) == json_hash(value2))
+        fail("json_hash is the same for an integer and a real");
+
+    array = json_loads("[1, 2]", 0, NULL);
+    json_decref(value2);
+    value2 = json_loads("[2, 1]", 0, NULL);
+    if (json_hash(array) == json_hash(value2))
+        fail("json_hash doesn't depend on the order of an array");
+    json_decref(value2);
+
+    value2 = json_pack("{ss}", "a", "b");
+    if (json_hash(array) == json_hash(value2))
+        fail("json_hash is the same for different values");
+    json_object_del(value2, "a");
+    json_object_set_new(value2, "b", json_string("a"));
+    if (json_hash(value2) == hash || json_hash(value2) == json_hash(array))
+        fail("json_hash is the same for different values");
+
+    /* A circular reference */
+    json_object_set(value2, "array", array);
+    json_array_append(array, value2);
+    if (json_hash(array))
+        fail("json_hash hashed a circular reference");
+    json_array_clear(array);
+
+    json_decref(array);
+    json_decref(value1);
+    json_decref(value2);
+}
+
 static void run_tests() {
     test_equal_simple();
     test_equal_array();
     test_equal_object();
     test_equal_complex();
+    test_hash();
 }
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"name\": \"config\", \"port\": 8080, \"ratio\": 0.5, \"debug\": false,"
+    " \"servers\": [{\"host\": \"a\", \"weight\": 1}, {\"host\": \"b\", \"weight\": 2}],"
+    " \"limits\": {\"cpu\": 4, \"memory\": 1024}, \"tags\": []}";
+
+/* Frozen values are never freed. Keep them reachable so that leak
+   checkers don't report them. */
+static json_t *frozen[4];
+
+static void frozen_values() {
+    json_t *json, *servers, *limits, *copy;
+    char *before, *after;
+    size_t refcount;
+
+    json = json_loads(document, 0, NULL);
+    before = json_dumps(json, JSON_SORT_KEYS);
+    if (json_freeze(json))
+        fail("json_freeze failed");
+    frozen[0] = json;
+
+    /* References are no-ops */
+    servers = json_object_get(json, "servers");
+    refcount = servers->refcount;
+    json_incref(servers);
+    json_decref(servers);
+    json_decref(servers);
+    json_decref(json);
+    if (servers->refcount != refcount || json->refcount != refcount)
+        fail("frozen values are reference counted");
+
+    /* Changes are rejected */
+    limits = json_object_get(json, "limits");
+    if (!json_object_set_new(json, "new", json_true()) ||
+        !json_object_del(json, "name") || !json_object_clear(limits) ||
+        !json_object_iter_set(limits, json_object_iter(limits), json_null()) ||
+        !json_array_append_new(servers, json_true()) ||
+        !json_array_set_new(servers, 0, json_true()) ||
+        !json_array_insert_new(servers, 0, json_true()) ||
+        !json_array_remove(servers, 0) || !json_array_clear(servers) ||
+        !json_array_extend(servers, json_object_get(json, "tags")) ||
+        !json_string_set(json_object_get(json, "name"), "other") ||
+        !json_integer_set(json_object_get(json, "port"), 1) ||
+        !json_real_set(json_object_get(json, "ratio"), 1.0))
+        fail("a frozen value was changed");
+
+    /* Reading and encoding work as before */
+    if (json_integer_value(json_object_get(json_array_get(servers, 1), "weight")) != 2)
+        fail("reading a frozen value failed");
+    after = json_dumps(json, JSON_SORT_KEYS | JSON_CACHE_SORTED_KEYS);
+    if (!after || strcmp(before, after))
+        fail("a frozen value is encoded differently");
+    free(before);
+    free(after);
+
+    /* Freezing again does nothing */
+    if (json_freeze(json) || json_freeze(servers))
+        fail("json_freeze failed on a frozen value");
+
+    /* Copies can be changed */
+    copy = json_deep_copy(json);
+    if (!copy || !json_equal(copy, json) ||
+        json_object_set_new(copy, "new", json_true()) ||
+        json_array_clear(json_object_get(copy, "servers")))
+        fail("a copy of a frozen value can't be changed");
+    json_decref(copy);
+
+    /* Frozen values can be added to others, which stay mutable */
+    copy = json_object();
+    if (json_object_set(copy, "limits", limits) || json_object_del(copy, "limits"))
+        fail("adding a frozen value failed");
+    json_decref(copy);
+}
+
+static void frozen_scalars() {
+    json_t *integer, *string, *array;
+
+    integer = json_integer(5);
+    string = json_string("text");
+    if (json_freeze(integer) || json_freeze(string) || json_freeze(json_true()))
+        fail("json_freeze failed on a scalar");
+    frozen[1] = integer;
+    frozen[2] = string;
+    if (!json_integer_set(integer, 6) || !json_string_set(string, "other") ||
+        json_integer_value(integer) != 5 || strcmp(json_string_value(string), "text"))
+        fail("a frozen scalar was changed");
+
+    /* Values that are already immortal can be in a frozen value */
+    array = json_loads("[1, 2, 3, \"\"]", JSON_SHARE_VALUES, NULL);
+    json_array_append(array, integer);
+    if (json_freeze(array) || json_array_size(array) != 5)
+        fail("json_freeze failed with immortal values");
+    frozen[3] = array;
+}
+
+static void not_frozen() {
+    json_t *json, *shared, *array, *loop;
+    json_arena_t *arena;
+
+    /* A value that's also referenced elsewhere */
+    shared = json_string("shared");
+    json = json_pack("{s:O, s:[i]}", "a", shared, "b", 1);
+    if (!json_freeze(json))
+        fail("json_freeze froze a shared value");
+    if (json_object_set_new(json, "c", json_true()) || json_string_set(shared, "changed"))
+        fail("a value that wasn't frozen can't be changed");
+    json_decref(shared);
+    json_decref(json);
+
+    /* A circular reference */
+    json = json_array();
+    array = json_array();
+    json_array_append_new(json, array);
+    json_array_append(array, json);
+    if (!json_freeze(json) || !json_freeze(array))
+        fail("json_freeze froze a circular reference");
+    json_array_clear(array);
+    json_decref(json);
+
+    /* The same value twice */
+    loop = json_object();
+    json = json_array();
+    json_array_append(json, loop);
+    json_array_append_new(json, loop);
+    if (!json_freeze(json))
+        fail("json_freeze froze a value referenced twice");
+    json_decref(json);
+
+    arena = json_arena_create(0);
+    json = json_loadb_arena(arena, "[1]", 3, 0, NULL);
+    if (!json_freeze(json))
+        fail("json_freeze froze an arena value");
+    json_arena_destroy(arena);
+
+    if (!json_freeze(NULL))
+        fail("json_freeze accepted NULL");
+}
+
+static void run_tests() {
+    frozen_values();
+    frozen_scalars();
+    not_frozen();
+}
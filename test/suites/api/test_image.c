@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"name\": \"catalog\", \"version\": 3, \"ratio\": 0.25, \"enabled\": true,"
+    " \"disabled\": false, \"none\": null, \"empty\": {}, \"list\": [],"
+    " \"long\": \"a string that is too long to be stored inline in the node\","
+    " \"items\": [{\"id\": 1, \"tags\": [\"a\", \"b\"]}, {\"id\": 2, \"tags\": []}],"
+    " \"b\": 1, \"a\": 2, \"ab\": 3, \"\": 4}";
+
+/* Return the image of json in a buffer that's aligned for it */
+static char *image_of(const json_t *json, size_t flags, size_t *size) {
+    char *buffer;
+
+    *size = json_image_dumpb(json, NULL, 0, flags);
+    if (*size == 0)
+        return NULL;
+
+    buffer = malloc(*size);
+    if (!buffer)
+        fail("malloc failed");
+    if (json_image_dumpb(json, buffer, *size, flags) != *size)
+        fail("json_image_dumpb returned a different size");
+    return buffer;
+}
+
+static void accessors() {
+    json_t *json, *root, *items, *value, *copy;
+    json_error_t error;
+    const char *key;
+    char *buffer, *other, *text, *expected;
+    size_t size, other_size, i = 0;
+    json_key_t *handle;
+
+    json = json_loads(document, 0, NULL);
+    buffer = image_of(json, 0, &size);
+    if (!buffer)
+        fail("json_image_dumpb failed");
+
+    root = json_image_load(buffer, size, &error);
+    if (!root)
+        fail("json_image_load failed");
+    if (!json_equal(root, json) || !json_equal(json, root))
+        fail("the image is not equal to the value");
+    if (json_hash(root) != json_hash(json) ||
+        json_hash(json_object_get(root, "items")) !=
+            json_hash(json_object_get(json, "items")))
+        fail("the cached hash of an image is wrong");
+
+    if (json_object_size(root) != 14 ||
+        strcmp(json_string_value(json_object_get(root, "name")), "catalog") ||
+        json_string_length(json_object_get(root, "long")) != 57 ||
+        json_integer_value(json_object_get(root, "version")) != 3 ||
+        json_real_value(json_object_get(root, "ratio")) != 0.25 ||
+        !json_is_true(json_object_get(root, "enabled")) ||
+        !json_is_false(json_object_get(root, "disabled")) ||
+        !json_is_null(json_object_get(root, "none")) ||
+        json_integer_value(json_object_get(root, "")) != 4 ||
+        json_object_get(root, "missing") || json_object_get(root, "nam"))
+        fail("image accessors returned wrong values");
+
+    items = json_object_get(root, "items");
+    if (json_array_size(items) != 2 || json_array_get(items, 2) ||
+        json_integer_value(json_object_get(json_array_get(items, 1), "id")) != 2 ||
+        strcmp(json_string_value(
+                   json_array_get(json_object_get(json_array_get(items, 0), "tags"), 1)),
+               "b"))
+        fail("image arrays returned wrong values");
+
+    /* Iteration is in insertion order */
+    json_object_foreach(root, key, value) {
+        void *iter = json_object_iter_at(json, key);
+        if (!iter || strcmp(json_object_iter_key(iter), key))
+            fail("image iteration returned a wrong key");
+        if (i == 0 && strcmp(key, "name"))
+            fail("image iteration is not in insertion order");
+        if (!json_equal(json_object_iter_value(iter), value))
+            fail("image iteration returned a wrong value");
+        i++;
+    }
+    if (i != 14 || !json_object_iter_at(root, "ab") ||
+        json_object_iter_value(json_object_iter_at(root, "ab")) !=
+            json_object_get(root, "ab"))
+        fail("image iteration failed");
+
+    handle = json_key_create("version");
+    if (json_object_get_key(root, handle) != json_object_get(root, "version"))
+        fail("json_object_get_key failed on an image");
+    json_key_destroy(handle);
+
+    /* Encoding is the same */
+    text = json_dumps(root, JSON_SORT_KEYS);
+    expected = json_dumps(json, JSON_SORT_KEYS);
+    if (!text || strcmp(text, expected))
+        fail("an image is encoded differently with JSON_SORT_KEYS");
+    free(text);
+    free(expected);
+
+    text = json_dumps(root, JSON_COMPACT);
+    expected = json_dumps(json, JSON_COMPACT);
+    if (!text || strcmp(text, expected))
+        fail("an image is encoded differently");
+    free(text);
+    free(expected);
+
+    /* Images with different hashes are unequal */
+    value = json_deep_copy(json);
+    json_object_set_new(json_array_get(json_object_get(value, "items"), 1), "id",
+                        json_integer(3));
+    other = image_of(value, 0, &other_size);
+    copy = json_image_load(other, other_size, NULL);
+    if (json_equal(root, copy) ||
+        !json_equal(json_array_get(json_object_get(root, "items"), 0),
+                    json_array_get(json_object_get(copy, "items"), 0)))
+        fail("json_equal failed on images");
+    free(other);
+    json_decref(value);
+
+    /* A deep copy is independent of the image */
+    value = json_deep_copy(root);
+    free(buffer);
+    if (!json_equal(value, json))
+        fail("json_deep_copy of an image failed");
+    json_decref(value);
+
+    json_decref(json);
+}
+
+static void read_only() {
+    json_t *json, *root, *array, *copy;
+    char *buffer;
+    size_t size;
+
+    json = json_pack("{s:[i, s], s:s, s:i, s:f}", "a", 1, "x", "s", "text", "i", 1, "f",
+                     0.5);
+    buffer = image_of(json, 0, &size);
+    root = json_image_load(buffer, size, NULL);
+    array = json_object_get(root, "a");
+
+    /* References are no-ops, and changes are rejected */
+    json_incref(root);
+    json_decref(root);
+    json_decref(root);
+    if (!json_object_set_new(root, "b", json_true()) ||
+        !json_object_del(root, "a") || !json_object_clear(root) ||
+        !json_object_iter_set(root, json_object_iter(root), json_null()) ||
+        !json_array_append_new(array, json_true()) ||
+        !json_array_set_new(array, 0, json_true()) ||
+        !json_array_insert_new(array, 0, json_true()) ||
+        !json_array_remove(array, 0) || !json_array_clear(array) ||
+        !json_array_extend(array, array) ||
+        !json_string_set(json_object_get(root, "s"), "other") ||
+        !json_integer_set(json_object_get(root, "i"), 2) ||
+        !json_real_set(json_object_get(root, "f"), 1.0))
+        fail("an image was changed");
+    if (!json_equal(root, json))
+        fail("the image changed after a rejected change");
+
+    /* Image values can be used in other values while the image lives */
+    copy = json_array();
+    if (json_array_extend(copy, array) || json_array_size(copy) != 2 ||
+        json_object_update(json, root) || !json_equal(json_object_get(json, "a"), copy))
+        fail("adding image values to a value failed");
+    json_decref(copy);
+
+    json_decref(json);
+    free(buffer);
+}
+
+static void invalid_images() {
+    json_t *json, *array;
+    json_error_t error;
+    char *buffer;
+    size_t size;
+
+    json = json_integer(7);
+    if (json_image_dumpb(json, NULL, 0, 0))
+        fail("json_image_dumpb encoded a scalar without JSON_ENCODE_ANY");
+    buffer = image_of(json, JSON_ENCODE_ANY, &size);
+    if (json_integer_value(json_image_load(buffer, size, NULL)) != 7)
+        fail("json_image_load failed on a scalar");
+
+    if (json_image_load(buffer, size - 1, &error) ||
+        json_error_code(&error) != json_error_premature_end_of_input)
+        fail("json_image_load accepted a truncated image");
+    buffer[0] = 'X';
+    if (json_image_load(buffer, size, &error) ||
+        json_error_code(&error) != json_error_invalid_syntax)
+        fail("json_image_load accepted a wrong magic");
+    if (json_image_load(buffer + 1, size - 1, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_image_load accepted a misaligned image");
+    if (json_image_load(NULL, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_image_load accepted NULL");
+    free(buffer);
+    json_decref(json);
+
+    json = json_array();
+    array = json_array();
+    json_array_append_new(json, array);
+    json_array_append(array, json);
+    if (json_image_dumpb(json, NULL, 0, 0))
+        fail("json_image_dumpb encoded a circular reference");
+    json_array_clear(array);
+    json_decref(json);
+}
+
+static void files() {
+    const char *path = "test_image.img";
+    json_image_t *image, *other;
+    json_t *json;
+    json_error_t error;
+
+    json = json_loads(document, 0, NULL);
+    if (json_image_dump_file(json, path, 0))
+        fail("json_image_dump_file failed");
+
+    image = json_image_open(path, &error);
+    other = json_image_open(path, &error);
+    if (!image || !other)
+        fail("json_image_open failed");
+    if (!json_equal(json_image_root(image), json) ||
+        !json_equal(json_image_root(image), json_image_root(other)))
+        fail("json_image_open returned a different value");
+    json_image_close(image);
+    json_image_close(other);
+    json_image_close(NULL);
+
+    /* Not an image */
+    if (json_dump_file(json, path, 0))
+        fail("json_dump_file failed");
+    if (json_image_open(path, &error) ||
+        json_error_code(&error) != json_error_invalid_syntax ||
+        strcmp(error.source, path))
+        fail("json_image_open opened a JSON file");
+
+    remove(path);
+    if (json_image_open(path, &error) ||
+        json_error_code(&error) != json_error_cannot_open_file)
+        fail("json_image_open opened a missing file");
+
+    json_decref(json);
+}
+
+static void run_tests() {
+    accessors();
+    read_only();
+    invalid_images();
+    files();
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int frees = 0;
+
+static void counting_free(void *ptr) {
+    frees++;
+    free(ptr);
+}
+
+static const char document[] =
+    "{\"short\": \"abc\", \"long\": \"a string that is longer than the inline limit\","
+    " \"escaped\": \"\\\"quoted\\\" with \\\\ and \\n and \\u00e4\\ud834\\udd1e in it\","
+    " \"shrinks\": \"\\u00e4\\u00e4\\u00e4\\u00e4\\u00e4\\u00e4\\u00e4\","
+    " \"a key that is longer than the inline \\\"limit\\\"\": [\"x\","
+    " \"another long string, \\/ in an array\", {\"nested\": \"\"}], \"n\": 1}";
+
+static char *copy_text(const char *text, size_t length) {
+    char *copy = malloc(length + 1);
+    if (!copy)
+        fail("malloc failed");
+    memcpy(copy, text, length + 1);
+    return copy;
+}
+
+static int points_into(const char *value, const char *buffer, size_t length) {
+    return value >= buffer && value < buffer + length;
+}
+
+static void decode_in_place() {
+    size_t length = strlen(document);
+    char *buffer = copy_text(document, length);
+    json_t *json, *expected, *array;
+    json_error_t error;
+
+    expected = json_loads(document, 0, &error);
+    json = json_loadb_insitu(NULL, buffer, length, 0, &error);
+    if (!json)
+        fail("json_loadb_insitu failed on a valid document");
+    if (!json_equal(json, expected))
+        fail("json_loadb_insitu produced a different value");
+    if (error.position != (int)length)
+        fail("json_loadb_insitu didn't save the position");
+
+    /* Long strings refer to the buffer, and short ones are copied */
+    if (!points_into(json_string_value(json_object_get(json, "long")), buffer, length) ||
+        !points_into(json_string_value(json_object_get(json, "escaped")), buffer,
+                     length))
+        fail("json_loadb_insitu copied a long string");
+    if (points_into(json_string_value(json_object_get(json, "short")), buffer, length) ||
+        points_into(json_string_value(json_object_get(json, "shrinks")), buffer, length))
+        fail("json_loadb_insitu didn't copy a short string");
+
+    /* Keys are always copied */
+    if (points_into(json_object_iter_key(json_object_iter(json)), buffer, length))
+        fail("json_loadb_insitu didn't copy a key");
+
+    /* Setting a string stops referring to the buffer */
+    array = json_object_get(json, "a key that is longer than the inline \"limit\"");
+    if (json_string_set(json_array_get(array, 1), "x") ||
+        json_string_set(json_object_get(json, "long"),
+                        "a new string that is longer than the inline limit"))
+        fail("json_string_set failed on a string in the buffer");
+    if (points_into(json_string_value(json_object_get(json, "long")), buffer, length))
+        fail("json_string_set kept referring to the buffer");
+
+    memset(buffer, 'x', length);
+    if (strcmp(json_string_value(json_array_get(array, 1)), "x") ||
+        strcmp(json_string_value(json_object_get(json, "long")),
+               "a new string that is longer than the inline limit"))
+        fail("json_string_set didn't copy the new value");
+
+    json_decref(json);
+    json_decref(expected);
+    free(buffer);
+}
+
+static void decode_flags() {
+    const char text[] = "[\"a string with \\u0000 that is longer than the limit\"]";
+    char *buffer = copy_text(text, strlen(text));
+    json_error_t error;
+    json_t *json;
+
+    if (json_loadb_insitu(NULL, buffer, strlen(text), 0, &error))
+        fail("json_loadb_insitu accepted \\u0000 without JSON_ALLOW_NUL");
+    if (json_error_code(&error) != json_error_null_character)
+        fail("json_loadb_insitu returned a wrong error for \\u0000");
+
+    memcpy(buffer, text, sizeof(text));
+    json = json_loadb_insitu(NULL, buffer, strlen(text), JSON_ALLOW_NUL, &error);
+    if (json_string_length(json_array_get(json, 0)) != 45 ||
+        memcmp(json_string_value(json_array_get(json, 0)), "a string with \0 that", 20))
+        fail("json_loadb_insitu failed with JSON_ALLOW_NUL");
+    json_decref(json);
+
+    free(buffer);
+}
+
+static void invalid_input() {
+    static const char *const inputs[] = {
+        "[\"a string that is longer than the limit, \\ud800\"]",
+        "[\"a string that is longer than the limit, \\q\"]",
+        "{\"a key that is longer than the inline limit\" 1}",
+        "{\"a key that is longer than the inline limit\": 1, "
+        "\"a key that is longer than the inline limit\": 2}",
+        "[\"a string that is longer than the limit\"] x", "[\"unterminated"};
+    json_error_t error, expected;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        char *buffer = copy_text(inputs[i], strlen(inputs[i]));
+
+        if (json_loads(inputs[i], JSON_REJECT_DUPLICATES, &expected) ||
+            json_loadb_insitu(NULL, buffer, strlen(inputs[i]), JSON_REJECT_DUPLICATES,
+                              &error))
+            fail("json_loadb_insitu accepted invalid input");
+
+        /* Errors are reported as by json_loadb() */
+        if (json_error_code(&error) != json_error_code(&expected) ||
+            strcmp(error.text, expected.text) || error.line != expected.line ||
+            error.column != expected.column || error.position != expected.position)
+            fail("json_loadb_insitu returned a different error than json_loads");
+
+        free(buffer);
+    }
+
+    if (json_loadb_insitu(NULL, NULL, 0, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_loadb_insitu accepted a NULL buffer");
+}
+
+static void hand_over_to_arena() {
+    json_malloc_t malloc_fn;
+    json_free_t free_fn;
+    json_arena_t *arena;
+    json_error_t error;
+    json_t *json, *expected;
+    size_t length = strlen(document);
+    char *buffer;
+
+    json_get_alloc_funcs(&malloc_fn, &free_fn);
+    json_set_alloc_funcs(malloc, counting_free);
+
+    arena = json_arena_create(0);
+    buffer = copy_text(document, length);
+    if (json_arena_adopt_buffer(arena, buffer))
+        fail("json_arena_adopt_buffer failed");
+
+    json = json_loadb_insitu(arena, buffer, length, 0, &error);
+    expected = json_loads(document, 0, &error);
+    if (!json || !json_equal(json, expected))
+        fail("json_loadb_insitu produced a different value in an arena");
+    json_decref(expected);
+
+    /* The buffer is released with the arena */
+    frees = 0;
+    json_arena_reset(arena);
+    if (frees != 1)
+        fail("json_arena_reset didn't release the buffer");
+
+    if (!json_arena_adopt_buffer(arena, NULL) || !json_arena_adopt_buffer(NULL, &error))
+        fail("json_arena_adopt_buffer accepted a NULL argument");
+
+    json_arena_destroy(arena);
+    json_set_alloc_funcs(malloc_fn, free_fn);
+}
+
+static void run_tests() {
+    decode_in_place();
+    decode_flags();
+    invalid_input();
+    hand_over_to_arena();
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_KEYS 100
+
+/* Runs first, before the seed is set */
+static void seed_after_create() {
+    json_key_t *keys[NUM_KEYS];
+    json_t *object;
+    char buf[32];
+    int i;
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        keys[i] = json_key_create(buf);
+        if (!keys[i])
+            fail("json_key_create failed");
+    }
+
+    /* The handles are hashed with the old seed */
+    json_object_seed(12345);
+
+    object = json_object();
+    for (i = 0; i < NUM_KEYS; i++) {
+        if (i % 2 == 0) {
+            if (json_object_set_key_new(object, keys[i], json_integer(i)))
+                fail("json_object_set_key_new failed after seeding");
+        } else {
+            snprintf(buf, sizeof(buf), "key%d", i);
+            json_object_set_new(object, buf, json_integer(i));
+        }
+    }
+
+    for (i = 0; i < NUM_KEYS; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        if (json_integer_value(json_object_get_key(object, keys[i])) != i ||
+            json_integer_value(json_object_get(object, buf)) != i)
+            fail("a key created before seeding wasn't found");
+        json_key_destroy(keys[i]);
+    }
+    if (json_object_size(object) != NUM_KEYS)
+        fail("json_object_set_key_new added a key twice");
+
+    json_decref(object);
+}
+
+static void get_and_set() {
+    json_key_t *key, *other, *nul;
+    json_t *object, *value;
+    char buf[32];
+    int i;
+
+    key = json_key_create("foo");
+    other = json_key_createn("fo", 2);
+    nul = json_key_createn("foo\0bar", 7);
+    value = json_integer(1);
+
+    /* Small and large objects */
+    object = json_object();
+    for (i = 0; i < NUM_KEYS; i++) {
+        if (json_object_set_key(object, key, value) ||
+            json_object_set_key(object, nul, value))
+            fail("json_object_set_key failed");
+        if (json_object_get_key(object, key) != value ||
+            json_object_get(object, "foo") != value ||
+            json_object_getn(object, "foo\0bar", 7) != value ||
+            json_object_get_key(object, other))
+            fail("json_object_get_key returned a wrong value");
+        if (json_object_size(object) != (size_t)i + 2)
+            fail("json_object_set_key added a key twice");
+
+        snprintf(buf, sizeof(buf), "key%d", i);
+        json_object_set_new(object, buf, json_null());
+    }
+
+    if (json_object_set_key_new(object, other, json_integer(2)) ||
+        json_integer_value(json_object_get(object, "fo")) != 2)
+        fail("json_object_set_key_new failed");
+    if (value->refcount != 3)
+        fail("json_object_set_key didn't keep a reference");
+
+    json_decref(object);
+    json_decref(value);
+    json_key_destroy(key);
+    json_key_destroy(other);
+    json_key_destroy(nul);
+}
+
+static void bad_args() {
+    json_key_t *key = json_key_create("foo");
+    json_t *object = json_object();
+    json_t *value = json_integer(1);
+
+    if (json_key_create(NULL) || json_key_createn(NULL, 0) ||
+        json_key_createn("\xff", 1))
+        fail("json_key_create accepted an invalid key");
+
+    if (json_object_get_key(object, NULL) || json_object_get_key(NULL, key) ||
+        json_object_get_key(value, key))
+        fail("json_object_get_key accepted an invalid argument");
+
+    if (!json_object_set_key(object, NULL, value) ||
+        !json_object_set_key(value, key, value) ||
+        !json_object_set_key(object, key, NULL) ||
+        !json_object_set_key(object, key, object))
+        fail("json_object_set_key accepted an invalid argument");
+    if (value->refcount != 1 || object->refcount != 1)
+        fail("json_object_set_key leaked a reference");
+
+    json_decref(object);
+    json_decref(value);
+    json_key_destroy(key);
+
+    /* Passing NULL is allowed */
+    json_key_destroy(NULL);
+}
+
+static void run_tests() {
+    seed_after_create();
+    get_and_set();
+    bad_args();
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"a \\\"quoted\\\", name\", \"ratio\": -0.5e-3,\n"
+    " \"tags\": [\"a\", true, false, null, [], {}, [1, [2, [3]]]],\n"
+    " \"nested\": {\"x\": {\"y\": [{\"z\": \"}]\"}]}, \"empty\": \"\"},\n"
+    " \"utf8\": \"\xc3\xa4\xe2\x82\xac\", \"big\": 12345678901, \"last\": 1}";
+
+/* Check that the lazy value matches the decoded one, and recurse into
+   it */
+static void check_lazy(json_lazy_t lazy, json_t *json) {
+    json_error_t error;
+    json_t *value;
+    const char *key;
+    size_t i;
+
+    if (!json_lazy_found(lazy))
+        fail("a lazy value wasn't found");
+    if (json_lazy_typeof(lazy) != json_typeof(json))
+        fail("json_lazy_typeof returned a wrong type");
+
+    value = json_lazy_value(lazy, &error);
+    if (!value || !json_equal(value, json))
+        fail("json_lazy_value returned a different value");
+    if (json_lazy_value(lazy, &error) != value)
+        fail("json_lazy_value decoded a value twice");
+
+    if (json_is_object(json)) {
+        if (json_lazy_size(lazy) != json_object_size(json))
+            fail("json_lazy_size returned a wrong size for an object");
+        json_object_foreach(json, key, value) {
+            check_lazy(json_lazy_object_get(lazy, key), value);
+        }
+        if (json_lazy_found(json_lazy_object_get(lazy, "missing")))
+            fail("json_lazy_object_get found a missing key");
+    } else if (json_is_array(json)) {
+        if (json_lazy_size(lazy) != json_array_size(json))
+            fail("json_lazy_size returned a wrong size for an array");
+        json_array_foreach(json, i, value) {
+            check_lazy(json_lazy_array_get(lazy, i), value);
+        }
+        if (json_lazy_found(json_lazy_array_get(lazy, json_array_size(json))))
+            fail("json_lazy_array_get found an element past the end");
+    } else if (json_lazy_size(lazy) != 0)
+        fail("json_lazy_size returned a size for a scalar");
+}
+
+static void lazy_access() {
+    json_doc_t *doc;
+    json_error_t error;
+    json_t *json;
+    json_lazy_t root;
+
+    json = json_loads(document, 0, &error);
+    if (!json)
+        fail("json_loads failed");
+
+    doc = json_doc_loadb(document, strlen(document), 0, &error);
+    if (!doc)
+        fail("json_doc_loadb failed on a valid document");
+    if (error.position != (int)strlen(document))
+        fail("json_doc_loadb didn't save the position");
+
+    root = json_doc_root(doc);
+    check_lazy(root, json);
+
+    /* Access to the wrong type */
+    if (json_lazy_found(json_lazy_array_get(root, 0)) ||
+        json_lazy_found(json_lazy_object_get(json_lazy_object_get(root, "tags"), "a")) ||
+        json_lazy_found(json_lazy_object_get(root, NULL)))
+        fail("json_lazy accessors accepted a wrong type");
+
+    json_doc_destroy(doc);
+    json_decref(json);
+}
+
+static json_int_t get_integer(json_lazy_t object, const char *key) {
+    json_error_t error;
+    return json_integer_value(json_lazy_value(json_lazy_object_get(object, key), &error));
+}
+
+static void keys() {
+    const char input[] = "{\"a\": 1, \"a\\u0062\": 2, \"a\": 3, \"\": 4}";
+    json_doc_t *doc;
+    json_error_t error;
+    json_lazy_t root;
+
+    doc = json_doc_loadb(input, strlen(input), 0, &error);
+    root = json_doc_root(doc);
+
+    /* The last duplicate wins, as when decoding */
+    if (get_integer(root, "a") != 3)
+        fail("json_lazy_object_get didn't return the last duplicate");
+    if (get_integer(root, "ab") != 2)
+        fail("json_lazy_object_get didn't match an escaped key");
+    if (get_integer(root, "") != 4)
+        fail("json_lazy_object_get didn't match an empty key");
+    if (json_lazy_size(root) != 4)
+        fail("json_lazy_size didn't count duplicates");
+
+    json_doc_destroy(doc);
+}
+
+static void structural_errors() {
+    static const char *const inputs[] = {
+        "[1,]",     "{\"a\" 1}",  "[1 2]", "{\"a\": 1,}", "[}", "{]", "[",
+        "[\"abc", "",          "1",      "[1] x",        "{1: 2}", "[x]"};
+    json_error_t error, expected;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        if (json_loadb(inputs[i], strlen(inputs[i]), 0, &expected))
+            fail("json_loadb accepted invalid input");
+        if (json_doc_loadb(inputs[i], strlen(inputs[i]), 0, &error))
+            fail("json_doc_loadb accepted a structural error");
+        if (json_error_code(&error) != json_error_code(&expected) ||
+            strcmp(error.text, expected.text) || error.line != expected.line ||
+            error.column != expected.column || error.position != expected.position)
+            fail("json_doc_loadb returned a different error than json_loadb");
+    }
+
+    if (json_doc_loadb(NULL, 0, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_doc_loadb accepted a NULL buffer");
+}
+
+static void lazy_errors() {
+    const char input[] = "[1,\n  \"\\q\", tru, 1e999]";
+    json_doc_t *doc;
+    json_error_t error, expected;
+    json_lazy_t root;
+
+    /* Values are only checked when they are decoded */
+    doc = json_doc_loadb(input, strlen(input), 0, &error);
+    if (!doc)
+        fail("json_doc_loadb checked values");
+    root = json_doc_root(doc);
+
+    if (json_integer_value(json_lazy_value(json_lazy_array_get(root, 0), &error)) != 1)
+        fail("json_lazy_value failed before an invalid value");
+
+    /* Errors are located in the whole buffer */
+    if (json_lazy_value(json_lazy_array_get(root, 1), &error))
+        fail("json_lazy_value accepted an invalid escape");
+    if (json_loadb(input, strlen(input), 0, &expected))
+        fail("json_loadb accepted invalid input");
+    if (strcmp(error.text, expected.text) || error.line != expected.line ||
+        error.column != expected.column || error.position != expected.position)
+        fail("json_lazy_value returned a different error than json_loadb");
+
+    if (json_lazy_value(json_lazy_array_get(root, 2), &error) ||
+        json_lazy_value(json_lazy_array_get(root, 3), &error))
+        fail("json_lazy_value accepted an invalid value");
+    if (json_lazy_value(root, &error))
+        fail("json_lazy_value accepted an invalid array");
+    if (json_lazy_value(json_lazy_array_get(root, 4), &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_lazy_value accepted a missing value");
+
+    json_doc_destroy(doc);
+
+    /* Passing NULL is allowed */
+    json_doc_destroy(NULL);
+}
+
+static void decode_flags() {
+    json_doc_t *doc;
+    json_error_t error;
+    json_lazy_t root;
+
+    doc = json_doc_loadb("[1] [2]", 7, JSON_DISABLE_EOF_CHECK | JSON_DECODE_INT_AS_REAL,
+                         &error);
+    if (!doc)
+        fail("json_doc_loadb failed with JSON_DISABLE_EOF_CHECK");
+    root = json_doc_root(doc);
+    if (json_lazy_size(root) != 1 ||
+        json_lazy_typeof(json_lazy_array_get(root, 0)) != JSON_REAL ||
+        json_real_value(json_lazy_value(json_lazy_array_get(root, 0), &error)) != 1.0)
+        fail("json_doc_loadb failed with JSON_DECODE_INT_AS_REAL");
+    json_doc_destroy(doc);
+
+    doc = json_doc_loadb(" \"str\" ", 7, JSON_DECODE_ANY, &error);
+    root = json_doc_root(doc);
+    if (json_lazy_typeof(root) != JSON_STRING ||
+        strcmp(json_string_value(json_lazy_value(root, &error)), "str"))
+        fail("json_doc_loadb failed with JSON_DECODE_ANY");
+    json_doc_destroy(doc);
+}
+
+static void run_tests() {
+    lazy_access();
+    keys();
+    structural_errors();
+    lazy_errors();
+    decode_flags();
+}
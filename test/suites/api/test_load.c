@@ -7,6 +7,8 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void file_not_found() {
@@ -145,6 +147,40 @@ static void decode_int_as_real() {
     json_decref(json);
 }
 
+static void decode_reals() {
+    static const struct {
+        const char *text;
+        double expected;
+    } cases[] = {
+        {"0.1", 0.1},
+        {"-65.613616999999977", -65.613616999999977},
+        {"0.000123e3", 0.123},
+        {"12345678901234567890123.0", 1.2345678901234568e22},
+        {"1.2345678901234567890123", 1.2345678901234568},
+        {"1.00000000000000000000000000", 1.0},
+        {"9007199254740993.0", 9007199254740992.0},
+        {"1.7976931348623157E+308", 1.7976931348623157e308},
+        {"2.2250738585072011e-308", 2.2250738585072011e-308},
+        {"4.9406564584124654e-324", 4.9406564584124654e-324},
+        {"1e-400", 0.0},
+    };
+    json_t *json;
+    json_error_t error;
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        json = json_loads(cases[i].text, JSON_DECODE_ANY, &error);
+        if (!json || json_real_value(json) != cases[i].expected)
+            fail("json_loads decoded a real number to a wrong value");
+        json_decref(json);
+    }
+
+    json = json_loads("-0.0", JSON_DECODE_ANY, &error);
+    if (!json || json_real_value(json) != 0.0 || !(1 / json_real_value(json) < 0))
+        fail("json_loads didn't keep the sign of -0.0");
+    json_decref(json);
+}
+
 static void allow_nul() {
     const char *text = "\"nul byte \\u0000 in string\"";
     const char *expected = "nul byte \0 in string";
@@ -164,6 +200,37 @@ static void allow_nul() {
     json_decref(json);
 }
 
+static void share_values() {
+    const char *text = "[0, 1, -128, 1023, -129, 1024, \"\", 1, \"\"]";
+    json_t *json, *other, *expected;
+    json_arena_t *arena;
+    size_t i;
+
+    json = json_loads(text, JSON_SHARE_VALUES, NULL);
+    expected = json_loads(text, 0, NULL);
+    if (!json || !json_equal(json, expected))
+        fail("JSON_SHARE_VALUES changed the decoded value");
+
+    if (json_array_get(json, 1) != json_array_get(json, 7) ||
+        json_array_get(json, 6) != json_array_get(json, 8))
+        fail("JSON_SHARE_VALUES didn't share equal values");
+    for (i = 0; i < json_array_size(json); i++) {
+        size_t refcount = json_array_get(json, i)->refcount;
+        if ((i == 4 || i == 5) != (refcount == 1))
+            fail("JSON_SHARE_VALUES shared a wrong set of values");
+    }
+
+    /* Values are shared between documents, also with arenas */
+    arena = json_arena_create(0);
+    other = json_loadb_arena(arena, text, strlen(text), JSON_SHARE_VALUES, NULL);
+    if (!other || json_array_get(other, 0) != json_array_get(json, 0))
+        fail("JSON_SHARE_VALUES didn't share values between documents");
+    json_arena_destroy(arena);
+
+    json_decref(json);
+    json_decref(expected);
+}
+
 static void load_wrong_args() {
     json_t *json;
     json_error_t error;
@@ -224,6 +291,304 @@ static void error_code() {
         fail("json_loads returned incorrect error code");
 }
 
+/* A number in nested arrays with an object at each other level */
+static char *nested_text(size_t depth) {
+    char *text = malloc(depth * 8 + 2), *p = text;
+    size_t i;
+
+    for (i = 0; i < depth; i++) {
+        if (i % 2) {
+            memcpy(p, "{\"k\":", 5);
+            p += 5;
+        } else
+            *p++ = '[';
+    }
+    *p++ = '1';
+    for (i = depth; i-- > 0;)
+        *p++ = i % 2 ? '}' : ']';
+    *p = '\0';
+    return text;
+}
+
+static void max_depth() {
+    json_sax_handler_t handler;
+    json_parser_t *parser;
+    json_error_t error;
+    json_t *json;
+    char *text, *dumped;
+
+    text = nested_text(3000);
+    if (json_loads(text, 0, &error) ||
+        json_error_code(&error) != json_error_stack_overflow || error.position != 6145)
+        fail("json_loads decoded more than JSON_PARSER_MAX_DEPTH levels");
+
+    json = json_loads(text, JSON_MAX_DEPTH(3001), &error);
+    dumped = json_dumps(json, JSON_COMPACT);
+    if (!json || !dumped || strcmp(dumped, text))
+        fail("json_loads failed with JSON_MAX_DEPTH");
+    free(dumped);
+    json_decref(json);
+
+    if (json_loads(text, JSON_MAX_DEPTH(3000), &error) ||
+        json_error_code(&error) != json_error_stack_overflow || error.position != 9001)
+        fail("json_loads exceeded JSON_MAX_DEPTH");
+    free(text);
+
+    if (json_loads("[[1]]", JSON_MAX_DEPTH(1), &error) ||
+        json_error_code(&error) != json_error_stack_overflow || error.column != 2)
+        fail("json_loads exceeded a small JSON_MAX_DEPTH");
+
+    memset(&handler, 0, sizeof(handler));
+    if (!json_sax_loadb("[[1]]", 5, &handler, NULL, JSON_MAX_DEPTH(1), &error) ||
+        json_error_code(&error) != json_error_stack_overflow)
+        fail("json_sax_loadb exceeded JSON_MAX_DEPTH");
+
+    parser = json_parser_create(JSON_MAX_DEPTH(1));
+    if (json_parser_feed(parser, "[[1]]", 5, &error) != json_parser_error ||
+        json_error_code(&error) != json_error_stack_overflow)
+        fail("json_parser_feed exceeded JSON_MAX_DEPTH");
+    json_parser_destroy(parser);
+}
+
+/* JSON_MAX_DEPTH(n) limits the depth of values, scalars included */
+static void max_depth_boundary() {
+    static const char *const deep[] = {"[[1]]", "{\"a\":{\"b\":1}}", "[{\"a\":\"x\"}]"};
+    const char *pointer = "/x";
+    json_sax_handler_t handler;
+    json_parser_t *parser;
+    json_error_t error;
+    json_doc_t *doc;
+    json_t *json;
+    size_t i, len;
+
+    memset(&handler, 0, sizeof(handler));
+    for (i = 0; i < sizeof(deep) / sizeof(deep[0]); i++) {
+        len = strlen(deep[i]);
+
+        if (json_loads(deep[i], JSON_MAX_DEPTH(2), &error) ||
+            json_error_code(&error) != json_error_stack_overflow)
+            fail("json_loads decoded a scalar below JSON_MAX_DEPTH");
+        if (!json_sax_loadb(deep[i], len, &handler, NULL, JSON_MAX_DEPTH(2), &error))
+            fail("json_sax_loadb decoded a scalar below JSON_MAX_DEPTH");
+        if (json_doc_loadb(deep[i], len, JSON_MAX_DEPTH(2), &error) ||
+            json_error_code(&error) != json_error_stack_overflow)
+            fail("json_doc_loadb indexed a scalar below JSON_MAX_DEPTH");
+        if (!json_loadb_select(deep[i], len, JSON_MAX_DEPTH(2), &pointer, &json, 1,
+                               &error) ||
+            json_error_code(&error) != json_error_stack_overflow)
+            fail("json_loadb_select skipped a scalar below JSON_MAX_DEPTH");
+        if (!json_loadb_select(deep[i], len, JSON_MAX_DEPTH(2), NULL, NULL, 0, &error))
+            fail("json_loadb_select skipped a scalar below JSON_MAX_DEPTH");
+
+        parser = json_parser_create(JSON_MAX_DEPTH(2));
+        if (json_parser_feed(parser, deep[i], len, &error) != json_parser_error)
+            fail("json_parser_feed decoded a scalar below JSON_MAX_DEPTH");
+        json_parser_destroy(parser);
+
+        json = json_loads(deep[i], JSON_MAX_DEPTH(3), &error);
+        if (!json)
+            fail("json_loads failed at JSON_MAX_DEPTH");
+        json_decref(json);
+        if (json_sax_loadb(deep[i], len, &handler, NULL, JSON_MAX_DEPTH(3), &error))
+            fail("json_sax_loadb failed at JSON_MAX_DEPTH");
+        doc = json_doc_loadb(deep[i], len, JSON_MAX_DEPTH(3), &error);
+        if (!doc)
+            fail("json_doc_loadb failed at JSON_MAX_DEPTH");
+        json_doc_destroy(doc);
+        if (json_loadb_select(deep[i], len, JSON_MAX_DEPTH(3), &pointer, &json, 1,
+                              &error) ||
+            json_loadb_select(deep[i], len, JSON_MAX_DEPTH(3), NULL, NULL, 0, &error))
+            fail("json_loadb_select failed at JSON_MAX_DEPTH");
+    }
+
+    /* Empty containers are values of their own depth */
+    json = json_loads("[[]]", JSON_MAX_DEPTH(2), &error);
+    if (!json)
+        fail("json_loads failed with an empty container at JSON_MAX_DEPTH");
+    json_decref(json);
+    doc = json_doc_loadb("[[]]", 4, JSON_MAX_DEPTH(2), &error);
+    if (!doc)
+        fail("json_doc_loadb failed with an empty container at JSON_MAX_DEPTH");
+    json_doc_destroy(doc);
+    if (json_loadb_select("[[]]", 4, JSON_MAX_DEPTH(2), &pointer, &json, 1, &error) ||
+        json_loadb_select("[[]]", 4, JSON_MAX_DEPTH(2), NULL, NULL, 0, &error))
+        fail("json_loadb_select failed with an empty container at JSON_MAX_DEPTH");
+}
+
+/* Errors and keys of any length deep in the explicit stack */
+static void deep_errors() {
+    const char *long_key = "a key that is too long to be inline";
+    json_error_t error, expected;
+    json_t *json, *value;
+    char text[2048], *p = text;
+    int i;
+
+    for (i = 0; i < 40; i++)
+        p += sprintf(p, "{\"%s%d\": ", i % 2 ? long_key : "k", i);
+    p += sprintf(p, "[1, 2]");
+    for (i = 0; i < 40; i++)
+        *p++ = '}';
+    *p = '\0';
+
+    json = json_loads(text, 0, &error);
+    value = json;
+    for (i = 0; i < 40; i++)
+        value = json_object_iter_value(json_object_iter(value));
+    if (json_array_size(value) != 2)
+        fail("json_loads failed on deep objects");
+    json_decref(json);
+
+    /* Truncated input */
+    text[strlen(text) - 3] = '\0';
+    if (json_loads(text, 0, &error) ||
+        json_error_code(&error) != json_error_premature_end_of_input ||
+        strcmp(error.text, "'}' expected near end of file"))
+        fail("json_loads didn't fail on deep truncated input");
+
+    strcpy(text, "[[[[[[[[[[{\"a\": [1, {\"b\" 2}]}]]]]]]]]]]");
+    if (json_loads(text, 0, &error) || strcmp(error.text, "':' expected near '2'") ||
+        error.column != 26)
+        fail("json_loads reported a wrong error in deep input");
+    expected = error;
+    if (json_loadb(text, strlen(text), 0, &error) || error.position != expected.position)
+        fail("json_loadb reported a wrong error in deep input");
+}
+
+static void large_stream() {
+    /* Larger than the read buffer of the stream loaders, with multi-byte
+       UTF-8 sequences crossing the buffer boundaries */
+    const size_t count = 20000;
+    char *text, *pos;
+    json_t *expected, *json;
+    json_error_t error;
+    FILE *fp;
+    size_t i, len;
+
+    text = malloc(count * 8 + 3);
+    if (!text)
+        fail("malloc failed");
+
+    pos = text;
+    *pos++ = '[';
+    for (i = 0; i < count; i++) {
+        memcpy(pos, i ? ",\"\xe2\x82\xac\"\n" : "\"\xe2\x82\xac\"\n", i ? 7 : 6);
+        pos += i ? 7 : 6;
+    }
+    *pos++ = ']';
+    len = pos - text;
+
+    expected = json_loadb(text, len, 0, &error);
+    if (!expected || json_array_size(expected) != count)
+        fail("json_loadb failed on a large buffer");
+
+    fp = tmpfile();
+    if (!fp || fwrite(text, 1, len, fp) != len)
+        fail("unable to write a temporary file");
+
+    rewind(fp);
+    json = json_loadf(fp, 0, &error);
+    if (!json || !json_equal(json, expected))
+        fail("json_loadf failed on a large stream");
+    if (error.position != (int)len)
+        fail("json_loadf returned a wrong position for a large stream");
+    json_decref(json);
+
+    rewind(fp);
+    json = json_loadfd(fileno(fp), 0, &error);
+    if (!json || !json_equal(json, expected))
+        fail("json_loadfd failed on a large stream");
+    json_decref(json);
+
+    fclose(fp);
+
+    /* Errors at the end of a large stream are reported like for buffers */
+    fp = tmpfile();
+    if (!fp || fwrite(text, 1, len - 1, fp) != len - 1)
+        fail("unable to write a temporary file");
+    rewind(fp);
+
+    json = json_loadf(fp, 0, &error);
+    if (json || error.line != (int)count + 1 || error.position != (int)len - 1)
+        fail("json_loadf returned a wrong error for an unterminated array");
+    fclose(fp);
+
+    json_decref(expected);
+    free(text);
+}
+
+static void consecutive_texts() {
+    FILE *fp;
+    json_t *json;
+    json_error_t error;
+    const char text[] = "[1] {\"a\": 2}\n[3]";
+
+    fp = tmpfile();
+    if (!fp || fwrite(text, 1, sizeof(text) - 1, fp) != sizeof(text) - 1)
+        fail("unable to write a temporary file");
+    rewind(fp);
+
+    json = json_loadf(fp, JSON_DISABLE_EOF_CHECK, &error);
+    if (!json_is_array(json) || json_integer_value(json_array_get(json, 0)) != 1)
+        fail("json_loadf failed to read the first of consecutive texts");
+    json_decref(json);
+
+    json = json_loadf(fp, JSON_DISABLE_EOF_CHECK, &error);
+    if (!json_is_object(json) || json_integer_value(json_object_get(json, "a")) != 2)
+        fail("json_loadf failed to read the second of consecutive texts");
+    json_decref(json);
+
+    json = json_loadf(fp, 0, &error);
+    if (!json_is_array(json) || json_integer_value(json_array_get(json, 0)) != 3)
+        fail("json_loadf failed to read the last of consecutive texts");
+    json_decref(json);
+
+    fclose(fp);
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp || fwrite(text, 1, strlen(text), fp) != strlen(text) || fclose(fp))
+        fail("unable to write a file");
+}
+
+static void load_file() {
+    static const char *const texts[] = {"{\"a\": [1, 2.5, \"\xc3\xa4\"],\n\"b\": null}\n",
+                                        "[1, 2,\n 3", "[1] [2]", ""};
+    const char *path = "test_load_file.json";
+    json_t *json, *expected;
+    json_error_t error, expected_error;
+    size_t i;
+
+    /* Regular files are mapped and decoded as a buffer, and the results
+       are the same as with json_loadb() */
+    for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        write_file(path, texts[i]);
+
+        expected = json_loadb(texts[i], strlen(texts[i]), 0, &expected_error);
+        json = json_load_file(path, 0, &error);
+        if (expected ? !json_equal(json, expected) : json != NULL)
+            fail("json_load_file returned a different value than json_loadb");
+        if (strcmp(error.text, expected_error.text) ||
+            error.line != expected_error.line || error.column != expected_error.column ||
+            error.position != expected_error.position)
+            fail("json_load_file returned a different error than json_loadb");
+        if (strcmp(error.source, path))
+            fail("json_load_file returned a wrong error source");
+
+        json_decref(json);
+        json_decref(expected);
+    }
+
+    write_file(path, "[1] [2]");
+    json = json_load_file(path, JSON_DISABLE_EOF_CHECK, &error);
+    if (json_integer_value(json_array_get(json, 0)) != 1 || error.position != 3)
+        fail("json_load_file failed with JSON_DISABLE_EOF_CHECK");
+    json_decref(json);
+
+    remove(path);
+}
+
 static void run_tests() {
     file_not_found();
     very_long_file_name();
@@ -231,8 +596,16 @@ static void run_tests() {
     disable_eof_check();
     decode_any();
     decode_int_as_real();
+    decode_reals();
     allow_nul();
+    share_values();
     load_wrong_args();
     position();
     error_code();
+    max_depth();
+    max_depth_boundary();
+    deep_errors();
+    large_stream();
+    consecutive_texts();
+    load_file();
 }
@@ -9,6 +9,74 @@
 #include <jansson.h>
 #include <string.h>
 
+static const char *current;
+
+static size_t byte_callback(void *buffer, size_t buflen, void *arg) {
+    size_t *pos = (size_t *)arg;
+
+    /* Feed one byte at a time to keep json_load_callback off the
+       buffered fast path */
+    if (buflen == 0 || current[*pos] == '\0')
+        return 0;
+
+    *(char *)buffer = current[(*pos)++];
+    return 1;
+}
+
+static void same_as_callback(const char *str) {
+    /* json_load_callback() goes through the regular scanner, so
+       json_loadb() must produce identical results and errors */
+    json_t *json1, *json2;
+    json_error_t error1, error2;
+    size_t pos = 0;
+
+    json1 = json_loadb(str, strlen(str), 0, &error1);
+    json2 = json_load_callback(byte_callback, &pos, 0, &error2);
+
+    if (!json1 != !json2)
+        fail("json_loadb and json_load_callback disagree");
+
+    if (json1) {
+        if (!json_equal(json1, json2))
+            fail("json_loadb and json_load_callback produced different values");
+    } else {
+        if (strcmp(error1.text, error2.text) != 0 || error1.line != error2.line ||
+            error1.column != error2.column || error1.position != error2.position)
+            fail("json_loadb and json_load_callback produced different errors");
+    }
+
+    json_decref(json1);
+    json_decref(json2);
+}
+
+static void fast_path() {
+    static const char *const cases[] = {
+        "[1, -2, 3.5e1, \"a\\nb\", \"\\u00e4\", true, false, null]",
+        "{\"key\": \"\xe2\x82\xac\", \"x\":\n  [\"\xe2\x82\xac\", 0]}",
+        "[123456789012345678901234]",
+        "[9223372036854775808]",
+        "[-9223372036854775808, 9223372036854775807]",
+        "[-9223372036854775809]",
+        "[1e999]",
+        "[012]",
+        "[1.]",
+        "[\"a\\xb\"]",
+        "[\"a\tb\"]",
+        "[\"\xe2\x82\"]",
+        "[truth]",
+        "{\"a\": 1,\n \"b\": nul}",
+        "[1,\n\"\xe2\x82\xac\xe2\x82\xac\", tru",
+        NULL};
+    int i;
+
+    for (i = 0; cases[i]; i++) {
+        current = cases[i];
+        same_as_callback(cases[i]);
+    }
+
+    current = NULL;
+}
+
 static void run_tests() {
     json_t *json;
     json_error_t error;
@@ -34,4 +102,6 @@ static void run_tests() {
         fail("json_loadb returned an invalid error message for an unclosed "
              "top-level array");
     }
+
+    fast_path();
 }
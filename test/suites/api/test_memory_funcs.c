@@ -11,8 +11,9 @@ static size_t malloc_used = 0;
 static void create_and_free_complex_object() {
     json_t *obj;
 
-    obj = json_pack("{s:i,s:n,s:b,s:b,s:{s:s},s:[i,i,i]}", "foo", 42, "bar", "baz", 1,
-                    "qux", 0, "alice", "bar", "baz", "bob", 9, 8, 7);
+    obj = json_pack("{s:i,s:n,s:b,s:b,s:{s:s},s:[i,i,i],s:s}", "foo", 42, "bar", "baz", 1,
+                    "qux", 0, "alice", "bar", "baz", "bob", 9, 8, 7, "long",
+                    "a string that is too long to be stored inline");
 
     json_decref(obj);
 }
@@ -102,6 +103,32 @@ static void test_secure_funcs(void) {
     create_and_free_complex_object();
 }
 
+static int mallocs = 0;
+
+static void *counting_malloc(size_t size) {
+    mallocs++;
+    return malloc(size);
+}
+
+static void test_inline_strings(void) {
+    json_t *json;
+
+    json_set_alloc_funcs(counting_malloc, free);
+
+    /* Short strings share the allocation with the value node */
+    mallocs = 0;
+    json = json_string("a short id");
+    if (!json || mallocs > 1)
+        fail("short string was not stored inline");
+    json_decref(json);
+
+    mallocs = 0;
+    json = json_loads("[\"a\", \"b\", \"c\", \"d\"]", 0, NULL);
+    if (!json || mallocs > 7)
+        fail("decoded short strings were not stored inline");
+    json_decref(json);
+}
+
 static void test_bad_args(void) {
     /* The result of this test is not crashing. */
     json_get_alloc_funcs(NULL, NULL);
@@ -111,5 +138,6 @@ static void run_tests() {
     test_simple();
     test_secure_funcs();
     test_oom();
+    test_inline_strings();
     test_bad_args();
 }
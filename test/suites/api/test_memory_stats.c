@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"name\": \"a string that is too long to be stored in the node\","
+    " \"list\": [1, 2.5, true, null, \"short\"], \"nested\": {\"x\": 1}}";
+
+/* Deeper than the parser's inline stack, and without long strings */
+static const char nested[] = "[[[[[[[[[[[[[[[[{\"a\": [1, 2.5, \"b\"]}]]]]]]]]]]]]]]]]";
+
+/* Frozen values are never released */
+static json_t *frozen;
+static json_t *frozen_integers[2];
+
+static void usage() {
+    json_t *json, *string, *array;
+    size_t size;
+
+    if (json_memory_usage(NULL) != 0 || json_memory_usage(json_true()) != 0 ||
+        json_memory_usage(json_null()) != 0)
+        fail("static values use memory");
+
+    string = json_string("a string that is too long to be stored in the node");
+    if (json_memory_usage(string) <= strlen(json_string_value(string)))
+        fail("json_memory_usage is too small for a long string");
+
+    /* Shared values are counted once */
+    array = json_array();
+    json_array_append(array, string);
+    size = json_memory_usage(array);
+    if (size <= json_memory_usage(string))
+        fail("json_memory_usage doesn't count the array");
+    json_array_append(array, string);
+    if (json_memory_usage(array) != size)
+        fail("json_memory_usage counted a shared value twice");
+    json_decref(string);
+
+    /* Circular references */
+    json = json_array();
+    json_array_append(json, array);
+    json_array_append(array, json);
+    if (json_memory_usage(json) <= size)
+        fail("json_memory_usage failed with a circular reference");
+    json_array_clear(array);
+    json_decref(array);
+    json_decref(json);
+
+    json = json_loads(document, 0, NULL);
+    size = json_memory_usage(json);
+    json_object_set_new(json, "more", json_integer(1000000));
+    if (json_memory_usage(json) <= size)
+        fail("json_memory_usage doesn't count a new member");
+    json_decref(json);
+
+    frozen = json_loads(document, 0, NULL);
+    size = json_memory_usage(frozen);
+    if (json_freeze(frozen) || json_memory_usage(frozen) != size)
+        fail("json_memory_usage changed when freezing");
+
+    /* The payload of a scalar is not mistaken for the mark of an image */
+    frozen_integers[0] = json_integer(-1);
+    frozen_integers[1] = json_integer(-2);
+    if (json_freeze(frozen_integers[0]) || json_freeze(frozen_integers[1]) ||
+        json_memory_usage(frozen_integers[0]) == 0 ||
+        json_memory_usage(frozen_integers[0]) != json_memory_usage(frozen_integers[1]))
+        fail("json_memory_usage treated a frozen integer as static");
+}
+
+static void stats() {
+    json_memory_stats_t before, after;
+    json_t *json;
+    char *text;
+    size_t i;
+
+    if (json_memory_stats(&before)) {
+        /* Built without the counters */
+        for (i = 0; i < JSON_MEMORY_CATEGORIES; i++) {
+            if (before.allocs[i] || before.frees[i] || before.bytes[i])
+                fail("json_memory_stats reported counts without the counters");
+        }
+        if (before.live_bytes || before.peak_bytes)
+            fail("json_memory_stats reported bytes without the counters");
+        return;
+    }
+
+    json_memory_stats_reset();
+    json_memory_stats(&before);
+    for (i = 0; i < JSON_MEMORY_CATEGORIES; i++) {
+        if (before.allocs[i] || before.frees[i])
+            fail("json_memory_stats_reset didn't reset the counts");
+    }
+    if (before.peak_bytes != before.live_bytes)
+        fail("json_memory_stats_reset didn't reset the peak");
+
+    json = json_loads(nested, 0, NULL);
+    json_memory_stats(&after);
+    if (!after.allocs[json_memory_node] || !after.allocs[json_memory_array] ||
+        !after.allocs[json_memory_pair] || !after.allocs[json_memory_parser] ||
+        after.frees[json_memory_parser] != after.allocs[json_memory_parser])
+        fail("json_memory_stats didn't count the decoding");
+    if (after.live_bytes - before.live_bytes != json_memory_usage(json))
+        fail("the live bytes don't match json_memory_usage");
+    if (after.peak_bytes <= after.live_bytes)
+        fail("the peak doesn't include the parser");
+    json_decref(json);
+
+    /* Decoded long strings may have some room to spare */
+    json = json_loads(document, 0, NULL);
+    json_memory_stats(&after);
+    if (!after.allocs[json_memory_string] ||
+        after.live_bytes - before.live_bytes < json_memory_usage(json))
+        fail("json_memory_usage is larger than the live bytes");
+
+    /* Results of json_dumps() are released by the caller */
+    text = json_dumps(json, JSON_SORT_KEYS);
+    free(text);
+    json_memory_stats(&after);
+    if (!after.allocs[json_memory_encoder] ||
+        after.bytes[json_memory_encoder] != before.bytes[json_memory_encoder])
+        fail("json_memory_stats didn't count the encoding");
+
+    json_decref(json);
+    json_memory_stats(&after);
+    if (after.live_bytes != before.live_bytes)
+        fail("json_memory_stats didn't count everything released");
+    for (i = 0; i < JSON_MEMORY_CATEGORIES; i++) {
+        if (after.bytes[i] != before.bytes[i])
+            fail("live bytes of a category weren't released");
+    }
+}
+
+static void run_tests() {
+    usage();
+    stats();
+}
@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void test_clear() {
@@ -325,6 +326,66 @@ static void test_recursive_updates() {
     json_decref(other);
 }
 
+static void test_recursive_copy_updates() {
+    json_t *object, *other, *result, *before;
+    char *text;
+
+    object = json_pack("{s{s{si}s{si}}s[i]si}", "a", "b", "x", 1, "c", "y", 2, "d", 3,
+                       "e", 4);
+    other = json_pack("{s{s{si}}s{si}}", "a", "b", "x", 5, "f", "z", 6);
+    before = json_deep_copy(object);
+
+    if (json_object_update_recursive_copy(json_object_get(object, "d"), other) ||
+        json_object_update_recursive_copy(object, json_object_get(object, "e")))
+        fail("json_object_update_recursive_copy accepted non-object argument");
+
+    result = json_object_update_recursive_copy(object, other);
+    if (!result)
+        fail("json_object_update_recursive_copy failed");
+
+    /* The original is unchanged */
+    if (!json_equal(object, before))
+        fail("json_object_update_recursive_copy changed the original");
+
+    /* The result is as if updated in place */
+    json_object_update_recursive(before, other);
+    if (!json_equal(result, before))
+        fail("json_object_update_recursive_copy returned a wrong value");
+
+    /* Only the updated path is copied */
+    if (result == object ||
+        json_object_get(result, "a") == json_object_get(object, "a") ||
+        json_object_get(json_object_get(result, "a"), "b") ==
+            json_object_get(json_object_get(object, "a"), "b") ||
+        json_object_get(json_object_get(result, "a"), "c") !=
+            json_object_get(json_object_get(object, "a"), "c") ||
+        json_object_get(result, "d") != json_object_get(object, "d") ||
+        json_object_get(result, "f") != json_object_get(other, "f"))
+        fail("json_object_update_recursive_copy copied a wrong path");
+
+    /* Insertion order is kept */
+    text = json_dumps(result, JSON_COMPACT);
+    if (!text || strcmp(text, "{\"a\":{\"b\":{\"x\":5},\"c\":{\"y\":2}},\"d\":[3],"
+                              "\"e\":4,\"f\":{\"z\":6}}"))
+        fail("json_object_update_recursive_copy changed the order of keys");
+    free(text);
+
+    json_decref(result);
+    json_decref(before);
+
+    /* A circular reference */
+    json_object_set(json_object_get(json_object_get(other, "a"), "b"), "x",
+                    json_object_get(other, "a"));
+    json_object_set_new(json_object_get(json_object_get(object, "a"), "b"), "x",
+                        json_object());
+    if (json_object_update_recursive_copy(object, other))
+        fail("json_object_update_recursive_copy updated a circular reference");
+    json_object_clear(json_object_get(other, "a"));
+
+    json_decref(object);
+    json_decref(other);
+}
+
 static void test_circular() {
     json_t *object1, *object2;
 
@@ -643,6 +704,165 @@ static void test_object_foreach_safe() {
     json_decref(object);
 }
 
+static void test_small_to_large() {
+    json_t *object, *value;
+    const char *key;
+    char buf[8];
+    int i;
+
+    object = json_object();
+    if (json_object_get(object, "a") || json_object_iter(object))
+        fail("empty object has a key");
+
+    /* Delete and re-add keys around the size where the object starts
+       to be hashed */
+    for (i = 0; i < 12; i++) {
+        snprintf(buf, sizeof(buf), "%c", 'a' + i);
+        json_object_set_new(object, buf, json_integer(i));
+        if (i % 3 == 2 && json_object_del(object, "a"))
+            fail("unable to delete a key");
+        if (i % 3 == 2)
+            json_object_set_new(object, "a", json_integer(0));
+    }
+    json_object_del(object, "c");
+
+    if (json_object_size(object) != 11)
+        fail("object has a wrong size");
+    for (i = 0; i < 12; i++) {
+        snprintf(buf, sizeof(buf), "%c", 'a' + i);
+        value = json_object_get(object, buf);
+        if (i == 2 ? value != NULL : json_integer_value(value) != i)
+            fail("object returned a wrong value");
+    }
+
+    key = json_object_iter_key(json_object_iter(object));
+    if (strcmp(key, "b"))
+        fail("object iteration starts with a wrong key");
+    key = json_object_iter_key(json_object_iter_at(object, "d"));
+    key = json_object_iter_key(json_object_iter_next(object, json_object_key_to_iter(key)));
+    if (!key || strcmp(key, "e"))
+        fail("json_object_key_to_iter returned a wrong iterator");
+
+    json_object_clear(object);
+    if (json_object_size(object) != 0 || json_object_get(object, "b"))
+        fail("unable to clear a large object");
+
+    json_decref(object);
+}
+
+static void test_large_object() {
+    json_t *object, *value;
+    const char *key;
+    void *tmp;
+    char buf[32];
+    int i, expected;
+
+    object = json_object();
+
+    for (i = 0; i < 20000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        if (json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set a key in a large object");
+    }
+
+    /* delete every other key, both directly and while iterating */
+    for (i = 0; i < 10000; i += 2) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        if (json_object_del(object, buf))
+            fail("unable to delete a key from a large object");
+    }
+    json_object_foreach_safe(object, tmp, key, value) {
+        if (json_integer_value(value) >= 10000 && json_integer_value(value) % 2 == 0)
+            json_object_del(object, key);
+    }
+
+    if (json_object_size(object) != 10000)
+        fail("large object has a wrong size");
+
+    for (i = 0; i < 20000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        value = json_object_get(object, buf);
+        if (i % 2 == 0 ? value != NULL : json_integer_value(value) != i)
+            fail("large object returned a wrong value");
+    }
+
+    /* re-adding a deleted key puts it last */
+    json_object_set_new(object, "key0", json_integer(0));
+
+    expected = 1;
+    json_object_foreach(object, key, value) {
+        if (json_integer_value(value) != expected)
+            fail("large object iterated in a wrong order");
+        expected = expected == 19999 ? 0 : expected + 2;
+    }
+    if (expected != 2)
+        fail("large object iteration stopped early");
+
+    json_decref(object);
+}
+
+static void test_reserve() {
+    /* frozen values are never freed, keep them reachable */
+    static json_t *frozen;
+    json_t *object;
+    const char *key;
+    json_t *value;
+    char buf[32];
+    int i, expected;
+
+    object = json_object();
+    if (json_object_reserve(object, 4) || json_object_reserve(object, 100) ||
+        json_object_size(object) != 0)
+        fail("json_object_reserve failed");
+
+    for (i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        if (json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set a key in a reserved object");
+    }
+
+    /* reserve again with deleted keys */
+    for (i = 0; i < 50; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        json_object_del(object, buf);
+    }
+    if (json_object_reserve(object, 10) || json_object_reserve(object, 5000))
+        fail("json_object_reserve failed on a large object");
+    for (i = 100; i < 5000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        if (json_object_set_new(object, buf, json_integer(i)))
+            fail("unable to set a key in a reserved object");
+    }
+
+    expected = 50;
+    json_object_foreach(object, key, value) {
+        if (json_integer_value(value) != expected ||
+            json_object_get(object, key) != value)
+            fail("reserved object iterated in a wrong order");
+        expected++;
+    }
+    if (expected != 5000 || json_object_size(object) != 4950)
+        fail("reserved object has a wrong size");
+    json_decref(object);
+
+    /* a small object switching to hashing */
+    object = json_pack("{s:i, s:i}", "a", 1, "b", 2);
+    if (json_object_reserve(object, 9) ||
+        json_object_set_new(object, "c", json_integer(3)) ||
+        json_integer_value(json_object_get(object, "a")) != 1 ||
+        json_integer_value(json_object_get(object, "c")) != 3)
+        fail("json_object_reserve failed on a small object");
+    json_decref(object);
+
+    frozen = json_object();
+    json_freeze(frozen);
+    object = json_array();
+    if (!json_object_reserve(NULL, 1) || !json_object_reserve(frozen, 10) ||
+        !json_object_reserve(object, 1))
+        fail("json_object_reserve succeeded with invalid arguments");
+    json_decref(object);
+}
+
 static void test_bad_args(void) {
     json_t *obj = json_object();
     json_t *num = json_integer(1);
@@ -787,11 +1007,15 @@ static void run_tests() {
     test_set_many_keys();
     test_conditional_updates();
     test_recursive_updates();
+    test_recursive_copy_updates();
     test_circular();
     test_set_nocheck();
     test_iterators();
     test_preserve_order();
     test_object_foreach();
     test_object_foreach_safe();
+    test_small_to_large();
+    test_large_object();
+    test_reserve();
     test_bad_args();
 }
@@ -50,6 +50,35 @@ static void test_inifity() {
 }
 #endif // INFINITY
 
+static void test_share_values() {
+    json_t *value, *copy;
+
+    value = json_pack_ex(NULL, JSON_SHARE_VALUES, "[i,I,i,s,s#,s]", 200, (json_int_t)200,
+                         100000, "", "", 0, "x");
+    if (!value || json_array_get(value, 0) != json_array_get(value, 1))
+        fail("json_pack JSON_SHARE_VALUES didn't share a small integer");
+    if (json_array_get(value, 0)->refcount != (size_t)-1)
+        fail("json_pack JSON_SHARE_VALUES shared integer has a refcount");
+    if (json_array_get(value, 2)->refcount != 1)
+        fail("json_pack JSON_SHARE_VALUES shared a large integer");
+    if (json_array_get(value, 3) != json_array_get(value, 4) ||
+        json_array_get(value, 3)->refcount != (size_t)-1)
+        fail("json_pack JSON_SHARE_VALUES didn't share the empty string");
+    if (json_array_get(value, 5)->refcount != 1)
+        fail("json_pack JSON_SHARE_VALUES shared a non-empty string");
+
+    /* Shared values can't be modified, but their copies can */
+    if (!json_integer_set(json_array_get(value, 0), 1))
+        fail("json_integer_set modified a shared integer");
+    if (!json_string_set(json_array_get(value, 3), "x"))
+        fail("json_string_set modified a shared string");
+    copy = json_copy(json_array_get(value, 0));
+    if (json_integer_set(copy, 1) || json_integer_value(json_array_get(value, 1)) != 200)
+        fail("unable to modify a copy of a shared integer");
+    json_decref(copy);
+    json_decref(value);
+}
+
 static void run_tests() {
     json_t *value;
     int i;
@@ -544,4 +573,6 @@ static void run_tests() {
     if (json_pack_ex(&error, 0, "[so]", NULL, json_object()))
         fail("json_pack failed to catch NULL value");
     check_error(json_error_null_value, "NULL string", "<args>", 1, 2, 2);
+
+    test_share_values();
 }
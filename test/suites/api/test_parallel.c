@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const elements[] = {
+    "1", "-2.5e3", "\"a, [string] with {brackets}\"", "\"esc\\\"aped, \\\\\"",
+    "\"caf\xc3\xa9, \xe2\x82\xac\"", "[1, [2, 3], {\"a\": [4, 5]}]",
+    "{\"x\": \"]\", \"y\": {\"z\": null}}", "true", "false", "null", "[]", "{}"};
+
+#define NUM_ELEMENTS (sizeof(elements) / sizeof(elements[0]))
+
+struct text {
+    char *value;
+    size_t length;
+    size_t size;
+};
+
+static void append(struct text *text, const char *value) {
+    size_t length = strlen(value);
+
+    if (text->length + length + 1 > text->size) {
+        text->size = (text->length + length + 1) * 2;
+        text->value = realloc(text->value, text->size);
+        if (!text->value)
+            fail("realloc failed");
+    }
+    memcpy(text->value + text->length, value, length + 1);
+    text->length += length;
+}
+
+/* Build an array of count elements, with a newline every 7 elements */
+static void build_array(struct text *text, size_t count) {
+    size_t i;
+
+    memset(text, 0, sizeof(*text));
+    append(text, " \n[");
+    for (i = 0; i < count; i++) {
+        if (i)
+            append(text, i % 7 ? ", " : ",\n  ");
+        append(text, elements[i % NUM_ELEMENTS]);
+    }
+    append(text, "]\n");
+}
+
+/* Build count records, one per line, with some empty lines */
+static void build_lines(struct text *text, size_t count) {
+    size_t i;
+
+    memset(text, 0, sizeof(*text));
+    for (i = 0; i < count; i++) {
+        append(text, i % 2 ? "[" : "{\"v\": ");
+        append(text, elements[i % NUM_ELEMENTS]);
+        append(text, i % 2 ? "]\n" : "}\n");
+        if (i % 13 == 0)
+            append(text, "\n");
+    }
+}
+
+/* Run the tasks in reverse order to catch any dependencies between
+   them */
+static void run_reversed(json_task_t task, void *arg, size_t count, void *data) {
+    int *calls = data;
+
+    (*calls)++;
+    while (count-- > 0)
+        task(arg, count);
+}
+
+static void check_same_error(const json_error_t *error, const json_error_t *expected,
+                             const char *msg) {
+    if (json_error_code(error) != json_error_code(expected) ||
+        strcmp(error->text, expected->text) || strcmp(error->source, expected->source) ||
+        error->line != expected->line || error->column != expected->column ||
+        error->position != expected->position)
+        fail(msg);
+}
+
+static void load_arrays() {
+    static const size_t jobs[] = {0, 1, 2, 3, 8, 64};
+    struct text text;
+    json_t *expected, *value;
+    json_error_t error, expected_error;
+    size_t i;
+    int calls = 0;
+
+    build_array(&text, 40000);
+    expected = json_loadb(text.value, text.length, 0, &expected_error);
+    if (!expected)
+        fail("json_loadb failed");
+
+    for (i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        value = json_loadb_parallel(text.value, text.length, 0, jobs[i], run_reversed,
+                                    &calls, &error);
+        if (!value || !json_equal(value, expected))
+            fail("json_loadb_parallel returned a different value");
+        if (error.position != expected_error.position)
+            fail("json_loadb_parallel didn't save the position");
+        json_decref(value);
+
+        value =
+            json_loadb_parallel(text.value, text.length, 0, jobs[i], NULL, NULL, &error);
+        if (!value || !json_equal(value, expected))
+            fail("json_loadb_parallel returned a different value without a runner");
+        json_decref(value);
+    }
+    if (calls != 4)
+        fail("json_loadb_parallel didn't split the input");
+
+    json_decref(expected);
+    free(text.value);
+}
+
+static void invalid_arrays() {
+    static const char *const errors[] = {"x", "[", "]", ",", "\"\\q\"", "\n\"",
+                                         "1.", "{\"a\" 1}"};
+    struct text text;
+    json_t *expected, *value;
+    json_error_t error, expected_error;
+    size_t i, j, offset;
+
+    build_array(&text, 20000);
+
+    /* Break the input at different places of the chunks. The first
+       error must be reported as by json_loadb(). */
+    for (i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        for (j = 1; j < 16; j++) {
+            char *copy = malloc(text.length + 16);
+            if (!copy)
+                fail("malloc failed");
+
+            offset = text.length / 16 * j;
+            memcpy(copy, text.value, offset);
+            strcpy(copy + offset, errors[i]);
+            strcat(copy + offset, text.value + offset);
+
+            /* Some of the errors are valid inside strings */
+            expected = json_loadb(copy, strlen(copy), 0, &expected_error);
+            value = json_loadb_parallel(copy, strlen(copy), 0, 8, NULL, NULL, &error);
+            if (expected) {
+                if (!json_equal(value, expected))
+                    fail("json_loadb_parallel returned a different value");
+            } else {
+                if (value)
+                    fail("json_loadb_parallel accepted invalid input");
+                check_same_error(&error, &expected_error,
+                                 "json_loadb_parallel returned a different error");
+            }
+            json_decref(expected);
+            json_decref(value);
+            free(copy);
+        }
+    }
+
+    /* Trailing garbage, and the same without the check */
+    append(&text, "x");
+    if (json_loadb(text.value, text.length, 0, &expected_error) ||
+        json_loadb_parallel(text.value, text.length, 0, 8, NULL, NULL, &error))
+        fail("trailing garbage was accepted");
+    check_same_error(&error, &expected_error,
+                     "json_loadb_parallel returned a different error at the end");
+    json_decref(json_loadb(text.value, text.length, JSON_DISABLE_EOF_CHECK,
+                           &expected_error));
+    json_decref(json_loadb_parallel(text.value, text.length, JSON_DISABLE_EOF_CHECK, 8,
+                                    NULL, NULL, &error));
+    if (error.position != expected_error.position)
+        fail("json_loadb_parallel returned a wrong position with JSON_DISABLE_EOF_CHECK");
+
+    free(text.value);
+}
+
+static void other_values() {
+    json_error_t error;
+    json_t *value;
+    char *text;
+    size_t length = 200000;
+
+    /* Values other than arrays are decoded as by json_loadb() */
+    text = malloc(length + 1);
+    if (!text)
+        fail("malloc failed");
+    memset(text, ' ', length);
+    memcpy(text, "{\"a\": [1, 2]", 12);
+    text[length - 1] = '}';
+    text[length] = '\0';
+
+    value = json_loadb_parallel(text, length, 0, 8, NULL, NULL, &error);
+    if (!json_is_object(value) || json_array_size(json_object_get(value, "a")) != 2)
+        fail("json_loadb_parallel failed on an object");
+    json_decref(value);
+
+    memcpy(text, "\"str\"", 5);
+    memset(text + 5, ' ', length - 5);
+    if (json_loadb_parallel(text, length, 0, 8, NULL, NULL, &error))
+        fail("json_loadb_parallel accepted a scalar without JSON_DECODE_ANY");
+    value = json_loadb_parallel(text, length, JSON_DECODE_ANY, 8, NULL, NULL, &error);
+    if (strcmp(json_string_value(value), "str"))
+        fail("json_loadb_parallel failed on a string with JSON_DECODE_ANY");
+    json_decref(value);
+
+    /* An empty array */
+    memcpy(text, "[]", 2);
+    memset(text + 2, ' ', length - 2);
+    value = json_loadb_parallel(text, length, 0, 8, NULL, NULL, &error);
+    if (!json_is_array(value) || json_array_size(value) != 0)
+        fail("json_loadb_parallel failed on an empty array");
+    json_decref(value);
+
+    free(text);
+
+    if (json_loadb_parallel(NULL, 0, 0, 8, NULL, NULL, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_loadb_parallel accepted a NULL buffer");
+}
+
+static void load_lines() {
+    struct text text;
+    json_reader_t *reader;
+    json_error_t error, expected_error;
+    json_t *value, *expected, *record;
+    size_t i;
+    int calls = 0;
+
+    build_lines(&text, 30000);
+
+    expected = json_array();
+    reader = json_reader_create_buffer(text.value, text.length, 0);
+    while (json_reader_next(reader, &record, &error) > 0)
+        json_array_append_new(expected, record);
+    json_reader_destroy(reader);
+
+    for (i = 1; i <= 16; i *= 2) {
+        value = json_loadb_lines_parallel(text.value, text.length, 0, i, run_reversed,
+                                          &calls, &error);
+        if (!value || !json_equal(value, expected))
+            fail("json_loadb_lines_parallel returned different records");
+        if (error.position != (int)text.length)
+            fail("json_loadb_lines_parallel didn't save the position");
+        json_decref(value);
+    }
+    if (calls != 4)
+        fail("json_loadb_lines_parallel didn't split the input");
+
+    /* Errors are reported as by json_reader_next() */
+    text.value[text.length / 3 * 2] = '}';
+    reader = json_reader_create_buffer(text.value, text.length, 0);
+    while (json_reader_next(reader, &record, &expected_error) > 0)
+        json_decref(record);
+    json_reader_destroy(reader);
+
+    if (json_loadb_lines_parallel(text.value, text.length, 0, 8, NULL, NULL, &error))
+        fail("json_loadb_lines_parallel accepted an invalid record");
+    check_same_error(&error, &expected_error,
+                     "json_loadb_lines_parallel returned a different error");
+
+    /* Small inputs are a single chunk */
+    value =
+        json_loadb_lines_parallel("[1]\n2", 5, JSON_DECODE_ANY, 8, NULL, NULL, &error);
+    if (json_array_size(value) != 2 || json_integer_value(json_array_get(value, 1)) != 2)
+        fail("json_loadb_lines_parallel failed on a small input");
+    json_decref(value);
+
+    json_decref(expected);
+    free(text.value);
+}
+
+static void run_tests() {
+    load_arrays();
+    invalid_arrays();
+    other_values();
+    load_lines();
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"a \\\"quoted\\\" name that is longer than a chunk\","
+    " \"ratio\": -0.5e-3, \"utf8\": \"\xc3\xa4\xe2\x82\xac\xf0\x9d\x84\x9e\","
+    " \"escapes\": \"\\u00e4\\ud834\\udd1e\\\\\\n\", \"tags\": [\"a\", true, false,"
+    " null, [], {}], \"nested\": {\"x\": [1, 2, {\"y\": 12345678901}]}}\n";
+
+/* Feed input in chunks of the given size, and finish it */
+static json_t *feed_chunks(const char *input, size_t chunk, size_t flags,
+                           json_error_t *error) {
+    json_parser_t *parser;
+    enum json_parser_status status = json_parser_need_more;
+    size_t length = strlen(input), offset = 0;
+    json_t *value = NULL;
+
+    parser = json_parser_create(flags);
+    if (!parser)
+        fail("json_parser_create failed");
+
+    while (offset < length && status == json_parser_need_more) {
+        size_t n = length - offset < chunk ? length - offset : chunk;
+        status = json_parser_feed(parser, input + offset, n, error);
+        offset += n;
+    }
+    if (status == json_parser_complete)
+        fail("json_parser_feed completed a value before the end of input");
+    if (status == json_parser_need_more)
+        status = json_parser_finish(parser, error);
+
+    if (status == json_parser_complete) {
+        value = json_parser_value(parser);
+        if (!value)
+            fail("json_parser_value returned NULL after completion");
+        if (json_parser_value(parser))
+            fail("json_parser_value returned the value twice");
+    } else if (status != json_parser_error)
+        fail("json_parser_finish needed more input");
+
+    json_parser_destroy(parser);
+    return value;
+}
+
+static void decode_in_chunks() {
+    json_t *expected, *value;
+    json_error_t error;
+    size_t chunk;
+
+    expected = json_loads(document, 0, &error);
+    if (!expected)
+        fail("json_loads failed");
+
+    for (chunk = 1; chunk <= sizeof(document); chunk++) {
+        value = feed_chunks(document, chunk, 0, &error);
+        if (!value)
+            fail("json_parser_feed failed on a valid document");
+        if (!json_equal(value, expected))
+            fail("json_parser_feed produced a different value");
+        if (error.position != (int)strlen(document))
+            fail("json_parser_finish didn't save the position");
+        json_decref(value);
+    }
+
+    json_decref(expected);
+}
+
+static void decode_scalars() {
+    json_parser_t *parser;
+    json_error_t error;
+    json_t *value;
+
+    /* A number at the end of a chunk may continue in the next one */
+    parser = json_parser_create(JSON_DECODE_ANY);
+    if (json_parser_feed(parser, "12", 2, &error) != json_parser_need_more ||
+        json_parser_feed(parser, "3", 1, &error) != json_parser_need_more)
+        fail("json_parser_feed didn't need more input for a number");
+    if (json_parser_finish(parser, &error) != json_parser_complete)
+        fail("json_parser_finish failed on a number");
+    value = json_parser_value(parser);
+    if (json_integer_value(value) != 123)
+        fail("json_parser_feed decoded a wrong number");
+    json_decref(value);
+    json_parser_destroy(parser);
+
+    value = feed_chunks("  \"str\"  ", 1, JSON_DECODE_ANY, &error);
+    if (!value || strcmp(json_string_value(value), "str"))
+        fail("json_parser_feed failed on a string");
+    json_decref(value);
+
+    if (feed_chunks("true", 1, 0, &error))
+        fail("json_parser_feed accepted a scalar without JSON_DECODE_ANY");
+    if (strcmp(error.text, "'[' or '{' expected near 'true'"))
+        fail("json_parser_feed returned a wrong error for a scalar");
+}
+
+static void disable_eof_check() {
+    json_parser_t *parser;
+    json_error_t error;
+    json_t *value;
+    const char input[] = "[1][2]\n{\"a\"";
+
+    parser = json_parser_create(JSON_DISABLE_EOF_CHECK);
+
+    /* Each value is complete when it ends, and the rest of the input
+       is kept for the next call */
+    if (json_parser_feed(parser, input, strlen(input), &error) != json_parser_complete)
+        fail("json_parser_feed didn't complete the first value");
+    if (error.position != 3)
+        fail("json_parser_feed returned a wrong position for the first value");
+    value = json_parser_value(parser);
+    if (json_integer_value(json_array_get(value, 0)) != 1)
+        fail("json_parser_feed returned a wrong first value");
+    json_decref(value);
+
+    if (json_parser_feed(parser, NULL, 0, &error) != json_parser_complete)
+        fail("json_parser_feed didn't complete the second value");
+    value = json_parser_value(parser);
+    if (json_integer_value(json_array_get(value, 0)) != 2)
+        fail("json_parser_feed returned a wrong second value");
+    json_decref(value);
+
+    if (json_parser_feed(parser, NULL, 0, &error) != json_parser_need_more)
+        fail("json_parser_feed completed an incomplete value");
+    if (json_parser_feed(parser, ": 3}", 4, &error) != json_parser_complete)
+        fail("json_parser_feed didn't complete the third value");
+    value = json_parser_value(parser);
+    if (json_integer_value(json_object_get(value, "a")) != 3)
+        fail("json_parser_feed returned a wrong third value");
+    json_decref(value);
+
+    json_parser_destroy(parser);
+}
+
+static void invalid_input() {
+    static const char *const inputs[] = {"{\"a\": [1, 2, \"three\"",
+                                         "[1, 2,]",
+                                         "{\"a\" 1}",
+                                         "{\"a\": 1,}",
+                                         "[\"\\u0000\"]",
+                                         "{\"\\u0000\": 1}",
+                                         "[1] x",
+                                         "[\"\\uD800\"]",
+                                         "[\"a\xc3\"]",
+                                         "[\"a\nb\"]",
+                                         "[tru]",
+                                         "[\"\\x\"]",
+                                         "[-]",
+                                         ""};
+    json_error_t error, expected;
+    size_t i, chunk;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        if (json_loads(inputs[i], 0, &expected))
+            fail("json_loads accepted invalid input");
+
+        for (chunk = 1; chunk <= 4; chunk++) {
+            if (feed_chunks(inputs[i], chunk, 0, &error))
+                fail("json_parser_feed accepted invalid input");
+
+            /* Errors are reported as by json_loads() */
+            if (json_error_code(&error) != json_error_code(&expected) ||
+                strcmp(error.text, expected.text) || error.line != expected.line ||
+                error.column != expected.column || error.position != expected.position)
+                fail("json_parser_feed returned a different error than json_loads");
+        }
+    }
+}
+
+static void sticky_errors() {
+    json_parser_t *parser;
+    json_error_t error;
+
+    parser = json_parser_create(0);
+    if (json_parser_feed(parser, "[1,,", 4, &error) != json_parser_error)
+        fail("json_parser_feed accepted invalid input");
+    if (json_parser_feed(parser, "2]", 2, &error) != json_parser_error ||
+        json_parser_finish(parser, &error) != json_parser_error)
+        fail("json_parser_feed continued after an error");
+    if (strcmp(error.text, "unexpected token near ','"))
+        fail("json_parser_feed returned a wrong error after an error");
+    if (json_parser_value(parser))
+        fail("json_parser_value returned a value after an error");
+    json_parser_destroy(parser);
+
+    parser = json_parser_create(0);
+    if (json_parser_feed(parser, NULL, 1, &error) != json_parser_error ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_parser_feed accepted a NULL buffer");
+    if (json_parser_feed(parser, "[]", 2, &error) != json_parser_need_more ||
+        json_parser_finish(parser, &error) != json_parser_complete)
+        fail("json_parser_feed failed after a wrong argument");
+    if (json_parser_feed(parser, "[]", 2, &error) != json_parser_error ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_parser_feed accepted input after json_parser_finish");
+    json_decref(json_parser_value(parser));
+    json_parser_destroy(parser);
+
+    if (json_parser_feed(NULL, "[]", 2, &error) != json_parser_error ||
+        json_parser_finish(NULL, &error) != json_parser_error ||
+        json_parser_value(NULL))
+        fail("json_parser functions accepted a NULL parser");
+
+    /* Passing NULL is allowed */
+    json_parser_destroy(NULL);
+}
+
+static void depth_limit() {
+    char buffer[JSON_PARSER_MAX_DEPTH + 2];
+    json_parser_t *parser;
+    json_error_t error;
+
+    memset(buffer, '[', sizeof(buffer));
+
+    parser = json_parser_create(0);
+    if (json_parser_feed(parser, buffer, sizeof(buffer), &error) != json_parser_error)
+        fail("json_parser_feed accepted a too deep document");
+    if (json_error_code(&error) != json_error_stack_overflow)
+        fail("json_parser_feed returned a wrong error code for a too deep document");
+    json_parser_destroy(parser);
+
+    /* Destroying a parser in the middle of a document */
+    parser = json_parser_create(0);
+    if (json_parser_feed(parser, "{\"a\": [{\"b\": [1, ", 17, &error) !=
+        json_parser_need_more)
+        fail("json_parser_feed failed on a partial document");
+    json_parser_destroy(parser);
+}
+
+static void load_many() {
+    static const char *const inputs[] = {
+        "{\"id\": 1, \"name\": \"a string that is too long to be stored inline\"}",
+        "{\"id\": 2, \"name\": \"b\"}",
+        "{\"id\": 3, \"name\": \"\\u00e4 unterminated",
+        "{\"name\": \"swapped\", \"id\": 4}",
+        "[1, 2,]",
+        "{\"id\": 5,\n \"name\": [true, null, {\"nested\": -1.5e3}]}",
+        "",
+        "[1] x",
+        "\"scalar\""};
+    json_parser_t *parser;
+    json_error_t error, expected;
+    json_t *value, *loaded;
+    size_t round, i;
+
+    parser = json_parser_create(0);
+    if (!parser)
+        fail("json_parser_create failed");
+
+    /* Each call decodes like json_loadb(), errors included */
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+            size_t length = strlen(inputs[i]);
+
+            loaded = json_loadb(inputs[i], length, 0, &expected);
+            value = json_parser_loadb(parser, inputs[i], length, &error);
+            if (!loaded != !value || (value && !json_equal(value, loaded)))
+                fail("json_parser_loadb decoded differently than json_loadb");
+            if (error.position != expected.position || strcmp(error.text, expected.text))
+                fail("json_parser_loadb returned a different error than json_loadb");
+            if (!value && (json_error_code(&error) != json_error_code(&expected) ||
+                           strcmp(error.source, "<buffer>") ||
+                           error.line != expected.line || error.column != expected.column))
+                fail("json_parser_loadb returned a different error than json_loadb");
+            json_decref(value);
+            json_decref(loaded);
+        }
+    }
+
+    /* Only part of the buffer is used */
+    value = json_parser_loadb(parser, "[1][2]", 3, &error);
+    if (!value || json_integer_value(json_array_get(value, 0)) != 1)
+        fail("json_parser_loadb didn't stop at the end of the buffer");
+    json_decref(value);
+
+    if (json_parser_loadb(parser, NULL, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_parser_loadb accepted a NULL buffer");
+    if (json_parser_loadb(NULL, "[]", 2, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_parser_loadb accepted a NULL parser");
+    json_parser_destroy(parser);
+
+    /* The flags of the parser are used */
+    parser = json_parser_create(JSON_DECODE_ANY);
+    value = json_parser_loadb(parser, "42", 2, &error);
+    if (json_integer_value(value) != 42)
+        fail("json_parser_loadb didn't use the flags of the parser");
+    json_decref(value);
+    json_parser_destroy(parser);
+
+    /* Fed parsers can't decode whole documents */
+    parser = json_parser_create(0);
+    if (json_parser_feed(parser, "[1, ", 4, &error) != json_parser_need_more)
+        fail("json_parser_feed failed on a partial document");
+    if (json_parser_loadb(parser, "[]", 2, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_parser_loadb accepted a fed parser");
+    json_parser_destroy(parser);
+}
+
+static void run_tests() {
+    decode_in_chunks();
+    decode_scalars();
+    disable_eof_check();
+    invalid_input();
+    sticky_errors();
+    depth_limit();
+    load_many();
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+static void check_same_error(const json_error_t *error, const json_error_t *expected,
+                             const char *msg) {
+    if (json_error_code(error) != json_error_code(expected) ||
+        strcmp(error->text, expected->text) || strcmp(error->source, expected->source) ||
+        error->line != expected->line || error->column != expected->column ||
+        error->position != expected->position)
+        fail(msg);
+}
+
+static void pack_plans() {
+    json_plan_t *plan;
+    json_error_t error, expected_error;
+    json_t *value, *expected, *object;
+    int i;
+
+    plan = json_pack_compile(&error, 0, "{s:i, s:s#, s:[f, b, n], s:s++, s:o*, s:O?}");
+    if (!plan)
+        fail("json_pack_compile failed on a valid format");
+
+    /* A plan can be used any number of times */
+    object = json_object();
+    for (i = 0; i < 3; i++) {
+        value = json_pack_plan(&error, plan, "a", i, "b", "xyz", 2, "c", 0.5, 1, "d",
+                               "x", "y", "z", "e", NULL, "f", object);
+        expected = json_pack("{s:i, s:s#, s:[f, b, n], s:s++, s:o*, s:O?}", "a", i, "b",
+                             "xyz", 2, "c", 0.5, 1, "d", "x", "y", "z", "e", NULL, "f",
+                             object);
+        if (!value || !json_equal(value, expected))
+            fail("json_pack_plan returned a different value than json_pack");
+        json_decref(value);
+        json_decref(expected);
+    }
+
+    /* Argument errors are reported as by json_pack_ex() */
+    if (json_pack_plan(&error, plan, "a", 1, "b", NULL, 0, "c", 0.5, 1, "d", "x", "y",
+                       "z", "e", NULL, "f", object))
+        fail("json_pack_plan accepted a NULL string");
+    if (json_pack_ex(&expected_error, 0, "{s:i, s:s#, s:[f, b, n], s:s++, s:o*, s:O?}",
+                     "a", 1, "b", NULL, 0, "c", 0.5, 1, "d", "x", "y", "z", "e", NULL,
+                     "f", object))
+        fail("json_pack_ex accepted a NULL string");
+    if (json_error_code(&error) != json_error_null_value)
+        fail("json_pack_plan returned a wrong error code for a NULL string");
+    check_same_error(&error, &expected_error,
+                     "json_pack_plan returned a different error than json_pack_ex");
+
+    json_decref(object);
+    json_plan_destroy(plan);
+
+    /* Flags are given when compiling */
+    plan = json_pack_compile(&error, JSON_SHARE_VALUES, "[i, i]");
+    value = json_pack_plan(&error, plan, 1, 1);
+    if (json_array_get(value, 0) != json_array_get(value, 1))
+        fail("json_pack_plan didn't share values");
+    json_decref(value);
+    json_plan_destroy(plan);
+}
+
+static void unpack_plans() {
+    json_plan_t *plan;
+    json_error_t error, expected_error;
+    json_t *root, *other, *obj = NULL;
+    const char *str = NULL;
+    size_t len = 0;
+    int i1 = 0, b = 0;
+    double f = 0;
+    json_int_t big = 0;
+
+    root = json_pack("{s:i, s:s, s:[f, b, I], s:{s:n}}", "a", 1, "b", "xy", "c", 0.5, 1,
+                     (json_int_t)1 << 40, "d", "e");
+
+    plan = json_unpack_compile(&error, 0, "{s:i, s:s%, s:[f, b, I!], s?o, s:{s:n}}");
+    if (!plan)
+        fail("json_unpack_compile failed on a valid format");
+
+    if (json_unpack_plan(root, &error, plan, "a", &i1, "b", &str, &len, "c", &f, &b,
+                         &big, "x", &obj, "d", "e"))
+        fail("json_unpack_plan failed");
+    if (i1 != 1 || strcmp(str, "xy") || len != 2 || f != 0.5 || !b ||
+        big != (json_int_t)1 << 40 || obj)
+        fail("json_unpack_plan unpacked wrong values");
+
+    /* Validation errors are reported as by json_unpack_ex() */
+    json_object_set_new(root, "a", json_string("1"));
+    if (!json_unpack_plan(root, &error, plan, "a", &i1, "b", &str, &len, "c", &f, &b,
+                          &big, "x", &obj, "d", "e"))
+        fail("json_unpack_plan accepted a wrong type");
+    if (!json_unpack_ex(root, &expected_error, 0,
+                        "{s:i, s:s%, s:[f, b, I!], s?o, s:{s:n}}", "a", &i1, "b", &str,
+                        &len, "c", &f, &b, &big, "x", &obj, "d", "e"))
+        fail("json_unpack_ex accepted a wrong type");
+    if (json_error_code(&error) != json_error_wrong_type)
+        fail("json_unpack_plan returned a wrong error code for a wrong type");
+    check_same_error(&error, &expected_error,
+                     "json_unpack_plan returned a different error than json_unpack_ex");
+    json_plan_destroy(plan);
+
+    /* Strict objects and flags */
+    plan = json_unpack_compile(&error, 0, "{s:s !}");
+    if (!json_unpack_plan(root, &error, plan, "b", &str) ||
+        json_error_code(&error) != json_error_end_of_input_expected)
+        fail("json_unpack_plan didn't check for unpacked keys");
+    json_plan_destroy(plan);
+
+    plan = json_unpack_compile(&error, JSON_STRICT, "{s:s, s?{s:n}}");
+    if (!json_unpack_plan(root, &error, plan, "b", &str, "d", "e") ||
+        strcmp(error.text, "2 object item(s) left unpacked: a, c"))
+        fail("json_unpack_plan didn't check for unpacked keys with JSON_STRICT");
+    json_plan_destroy(plan);
+
+    plan = json_unpack_compile(&error, JSON_STRICT, "{s:s, s:s, *}");
+    if (json_unpack_plan(root, &error, plan, "b", &str, "b", &str))
+        fail("json_unpack_plan checked for unpacked keys with '*'");
+    json_plan_destroy(plan);
+
+    plan = json_unpack_compile(&error, JSON_VALIDATE_ONLY, "{s:i}");
+    other = json_pack("{s:i}", "a", 1);
+    if (json_unpack_plan(other, &error, plan, "a") ||
+        !json_unpack_plan(root, &error, plan, "a"))
+        fail("json_unpack_plan failed with JSON_VALIDATE_ONLY");
+    json_decref(other);
+    json_plan_destroy(plan);
+
+    json_decref(root);
+}
+
+static void format_errors() {
+    static const char *const pack_formats[] = {"{s:i", "[i, i", "{i:i}",  "s#?",
+                                               "x",    "[i] i", "{s:s*#}"};
+    /* Unpack formats with a value that matches them up to the error */
+    static const char *const unpack_formats[][2] = {
+        {"{s:i", "{\"a\": 1}"}, {"[i, i", "[1, 2]"},        {"{i:i}", "{}"},
+        {"[i] i", "[1]"},       {"{s!s}", "{\"a\": 1}"},      {"[i*i]", "[1]"},
+        {"{s:[ix]}", "{\"a\": [1]}"}, {"[", "[]"}};
+    json_error_t error, expected;
+    size_t i;
+
+    /* Format errors are reported when compiling, as they would be at
+       the first use */
+    for (i = 0; i < sizeof(pack_formats) / sizeof(pack_formats[0]); i++) {
+        if (json_pack_compile(&error, 0, pack_formats[i]))
+            fail("json_pack_compile accepted an invalid format");
+        if (json_pack_ex(&expected, 0, pack_formats[i], "a", 1, 2))
+            fail("json_pack_ex accepted an invalid format");
+        check_same_error(&error, &expected,
+                         "json_pack_compile returned a different error");
+    }
+
+    for (i = 0; i < sizeof(unpack_formats) / sizeof(unpack_formats[0]); i++) {
+        json_t *root = json_loads(unpack_formats[i][1], 0, NULL);
+
+        if (json_unpack_compile(&error, 0, unpack_formats[i][0]))
+            fail("json_unpack_compile accepted an invalid format");
+        if (!json_unpack_ex(root, &expected, JSON_VALIDATE_ONLY, unpack_formats[i][0],
+                            "a"))
+            fail("json_unpack_ex accepted an invalid format");
+        check_same_error(&error, &expected,
+                         "json_unpack_compile returned a different error");
+        json_decref(root);
+    }
+
+    if (json_pack_compile(&error, 0, "") ||
+        json_error_code(&error) != json_error_invalid_argument ||
+        json_unpack_compile(&error, 0, NULL) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("compiling accepted an empty format");
+}
+
+static void wrong_plans() {
+    json_plan_t *pack_plan, *unpack_plan;
+    json_error_t error;
+    json_t *root = json_object();
+
+    pack_plan = json_pack_compile(&error, 0, "{}");
+    unpack_plan = json_unpack_compile(&error, 0, "{}");
+
+    if (json_pack_plan(&error, unpack_plan) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_pack_plan accepted an unpack plan");
+    if (!json_unpack_plan(root, &error, pack_plan) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_unpack_plan accepted a pack plan");
+    if (json_pack_plan(&error, NULL) || !json_unpack_plan(root, &error, NULL) ||
+        !json_unpack_plan(NULL, &error, unpack_plan))
+        fail("plans accepted NULL arguments");
+
+    json_plan_destroy(pack_plan);
+    json_plan_destroy(unpack_plan);
+    json_decref(root);
+
+    /* Passing NULL is allowed */
+    json_plan_destroy(NULL);
+}
+
+static void run_tests() {
+    pack_plans();
+    unpack_plans();
+    format_errors();
+    wrong_plans();
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+/* The example document of RFC 6901, and a nested object */
+static const char document[] =
+    "{\"foo\": [\"bar\", \"baz\"], \"\": 0, \"a/b\": 1, \"c%d\": 2, \"e^f\": 3,"
+    " \"g|h\": 4, \"i\\\\j\": 5, \"k\\\"l\": 6, \" \": 7, \"m~n\": 8,"
+    " \"nested\": {\"list\": [{\"x\": 1}, {\"x\": 2}], \"10\": \"ten\"}}";
+
+static void check_get(const json_t *json, const char *pointer, const char *expected) {
+    json_pointer_t *compiled;
+    json_error_t error;
+    json_t *value, *other;
+
+    value = json_pointer_get(json, pointer);
+    compiled = json_pointer_compile(pointer, &error);
+    if (!compiled)
+        fail("json_pointer_compile failed");
+    other = json_pointer_get_compiled(json, compiled);
+    json_pointer_destroy(compiled);
+
+    if (value != other)
+        fail("a compiled pointer refers to a different value");
+
+    if (!expected) {
+        if (value)
+            fail("json_pointer_get found a missing value");
+        return;
+    }
+
+    other = json_loads(expected, JSON_DECODE_ANY, NULL);
+    if (!json_equal(value, other))
+        fail("json_pointer_get returned a wrong value");
+    json_decref(other);
+}
+
+static void get() {
+    json_t *json = json_loads(document, 0, NULL);
+
+    if (json_pointer_get(json, "") != json)
+        fail("the empty pointer doesn't refer to the whole document");
+
+    check_get(json, "/foo", "[\"bar\", \"baz\"]");
+    check_get(json, "/foo/0", "\"bar\"");
+    check_get(json, "/foo/1", "\"baz\"");
+    check_get(json, "/", "0");
+    check_get(json, "/a~1b", "1");
+    check_get(json, "/c%d", "2");
+    check_get(json, "/e^f", "3");
+    check_get(json, "/g|h", "4");
+    check_get(json, "/i\\j", "5");
+    check_get(json, "/k\"l", "6");
+    check_get(json, "/ ", "7");
+    check_get(json, "/m~0n", "8");
+    check_get(json, "/nested/list/1/x", "2");
+    check_get(json, "/nested/10", "\"ten\"");
+
+    /* Missing values */
+    check_get(json, "/missing", NULL);
+    check_get(json, "/foo/2", NULL);
+    check_get(json, "/foo/-", NULL);
+    check_get(json, "/foo/01", NULL);
+    check_get(json, "/foo/+1", NULL);
+    check_get(json, "/foo/bar", NULL);
+    check_get(json, "/foo/99999999999999999999999", NULL);
+    check_get(json, "/nested/list/0/x/y", NULL);
+    check_get(json, "/m~1n", NULL);
+
+    /* Invalid pointers */
+    if (json_pointer_get(json, "foo") || json_pointer_get(json, "/m~2n") ||
+        json_pointer_get(json, "/m~") || json_pointer_get(json, NULL) ||
+        json_pointer_get(NULL, "/foo"))
+        fail("json_pointer_get accepted an invalid pointer");
+
+    json_decref(json);
+}
+
+static void set_and_del() {
+    json_t *json = json_loads(document, 0, NULL);
+    json_pointer_t *compiled;
+
+    if (json_pointer_set_new(json, "/new", json_integer(9)) ||
+        json_integer_value(json_object_get(json, "new")) != 9)
+        fail("json_pointer_set_new failed to add a key");
+    if (json_pointer_set_new(json, "/a~1b", json_integer(10)) ||
+        json_integer_value(json_object_get(json, "a/b")) != 10)
+        fail("json_pointer_set_new failed to replace a value");
+    if (json_pointer_set_new(json, "/foo/-", json_string("qux")) ||
+        json_pointer_set_new(json, "/foo/3", json_string("quux")) ||
+        json_pointer_set_new(json, "/foo/0", json_string("first")) ||
+        json_array_size(json_object_get(json, "foo")) != 4 ||
+        strcmp(json_string_value(json_pointer_get(json, "/foo/0")), "first") ||
+        strcmp(json_string_value(json_pointer_get(json, "/foo/3")), "quux"))
+        fail("json_pointer_set_new failed on an array");
+
+    /* The parent must exist */
+    if (!json_pointer_set_new(json, "/missing/x", json_true()) ||
+        !json_pointer_set_new(json, "/foo/5", json_true()) ||
+        !json_pointer_set_new(json, "/foo/x", json_true()) ||
+        !json_pointer_set_new(json, "", json_true()) ||
+        !json_pointer_set_new(json, "/m~2", json_true()) ||
+        !json_pointer_set_new(json, "/ok", NULL) || !json_pointer_set(NULL, "/x", json))
+        fail("json_pointer_set_new accepted an invalid pointer or value");
+
+    if (json_pointer_del(json, "/nested/list/0") || json_pointer_del(json, "/m~0n") ||
+        json_object_get(json, "m~n") ||
+        json_integer_value(json_pointer_get(json, "/nested/list/0/x")) != 2)
+        fail("json_pointer_del failed");
+    if (!json_pointer_del(json, "/missing") || !json_pointer_del(json, "/foo/-") ||
+        !json_pointer_del(json, "/foo/9") || !json_pointer_del(json, ""))
+        fail("json_pointer_del removed a missing value");
+
+    /* Compiled pointers */
+    compiled = json_pointer_compile("/nested/list/-", NULL);
+    if (json_pointer_set_compiled(json, compiled, json_true()) ||
+        json_pointer_set_compiled_new(json, compiled, json_false()) ||
+        json_array_size(json_pointer_get(json, "/nested/list")) != 3)
+        fail("json_pointer_set_compiled_new failed");
+    json_pointer_destroy(compiled);
+
+    compiled = json_pointer_compile("/nested/10", NULL);
+    if (json_pointer_set_compiled_new(json, compiled, json_integer(10)) ||
+        json_integer_value(json_pointer_get_compiled(json, compiled)) != 10 ||
+        json_pointer_del_compiled(json, compiled) ||
+        json_pointer_get(json, "/nested/10") ||
+        !json_pointer_del_compiled(json, compiled))
+        fail("compiled pointers failed on an object");
+    json_pointer_destroy(compiled);
+
+    compiled = json_pointer_compile("", NULL);
+    if (json_pointer_get_compiled(json, compiled) != json ||
+        !json_pointer_set_compiled_new(json, compiled, json_true()) ||
+        !json_pointer_del_compiled(json, compiled))
+        fail("the empty compiled pointer was changed");
+    json_pointer_destroy(compiled);
+
+    json_decref(json);
+}
+
+static void invalid_pointers() {
+    json_error_t error;
+
+    if (json_pointer_compile("foo", &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_pointer_compile accepted a pointer without a '/'");
+    if (json_pointer_compile(NULL, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_pointer_compile accepted NULL");
+    if (json_pointer_compile("/a/b~2", &error) ||
+        json_error_code(&error) != json_error_invalid_syntax || error.position != 4)
+        fail("json_pointer_compile accepted an invalid escape");
+    if (json_pointer_compile("/a/\xff", &error) ||
+        json_error_code(&error) != json_error_invalid_utf8)
+        fail("json_pointer_compile accepted invalid UTF-8");
+    json_pointer_destroy(NULL);
+}
+
+static void batches() {
+    static const char *const pointers[] = {
+        "/nested/list/1/x", "/foo/1", "/missing/x", "/nested/list/0/x", "",
+        "/nested/list/0/y", "/nested/10", "/foo/0", "/nested/list/1/x", "/foo/1/z"};
+    const size_t count = sizeof(pointers) / sizeof(pointers[0]);
+    static const char *deep[] = {"/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a",
+                                 "/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/a/b"};
+    json_pointer_batch_t *batch;
+    json_t *json, *values[10];
+    json_error_t error;
+    const char *bad[2];
+    size_t i;
+
+    json = json_loads(document, 0, NULL);
+    batch = json_pointer_batch_compile(pointers, count, &error);
+    if (!batch)
+        fail("json_pointer_batch_compile failed");
+
+    if (json_pointer_batch_get(json, batch, values) != 7)
+        fail("json_pointer_batch_get found a wrong number of values");
+    for (i = 0; i < count; i++) {
+        if (values[i] != json_pointer_get(json, pointers[i]))
+            fail("json_pointer_batch_get returned a wrong value");
+    }
+    json_pointer_batch_destroy(batch);
+    json_decref(json);
+
+    /* Deeper than the inline path */
+    json = json_pack("{s:i, s:i}", "a", 1, "b", 2);
+    for (i = 0; i < 19; i++)
+        json = json_pack("{s:o}", "a", json);
+    batch = json_pointer_batch_compile(deep, 2, &error);
+    if (!batch || json_pointer_batch_get(json, batch, values) != 2 ||
+        json_integer_value(values[0]) != 1 || json_integer_value(values[1]) != 2)
+        fail("json_pointer_batch_get failed on deep pointers");
+    json_pointer_batch_destroy(batch);
+    json_decref(json);
+
+    bad[0] = "/ok";
+    bad[1] = "/a~3";
+    if (json_pointer_batch_compile(bad, 2, &error) ||
+        json_error_code(&error) != json_error_invalid_syntax)
+        fail("json_pointer_batch_compile accepted an invalid pointer");
+
+    batch = json_pointer_batch_compile(NULL, 0, &error);
+    if (!batch || json_pointer_batch_get(NULL, batch, values))
+        fail("json_pointer_batch_compile failed without pointers");
+    json_pointer_batch_destroy(batch);
+    json_pointer_batch_destroy(NULL);
+}
+
+static void run_tests() {
+    get();
+    set_and_del();
+    invalid_pointers();
+    batches();
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static json_t *frozen;
+
+static void check_dump(const json_t *json, size_t flags, const char *expected) {
+    char *result = json_dumps(json, flags);
+
+    if (!result || strcmp(result, expected))
+        fail("unexpected encoding");
+    free(result);
+}
+
+static void test_raw_values() {
+    json_t *raw, *copy;
+
+    raw = json_raw("{\"a\": [1, 2.5, \"x\"]}");
+    if (!json_is_raw(raw) || json_typeof(raw) != JSON_RAW)
+        fail("json_raw didn't return a raw value");
+    if (strcmp(json_raw_value(raw), "{\"a\": [1, 2.5, \"x\"]}") ||
+        json_raw_length(raw) != 20)
+        fail("json_raw_value returned a wrong text");
+
+    copy = json_deep_copy(raw);
+    if (!json_is_raw(copy) || !json_equal(copy, raw) || json_hash(copy) != json_hash(raw))
+        fail("a copy of a raw value is different");
+    json_decref(copy);
+
+    copy = json_raw("{\"a\":[1,2.5,\"x\"]}");
+    if (json_equal(copy, raw))
+        fail("raw values with different texts are equal");
+    json_decref(copy);
+    json_decref(raw);
+
+    raw = json_rawn("[1, 2] trailing bytes", 6);
+    if (!raw || json_raw_length(raw) != 6 || strcmp(json_raw_value(raw), "[1, 2]"))
+        fail("json_rawn didn't use the given length");
+    json_decref(raw);
+
+    raw = json_raw(" \r\n\t{\"a\": 1}\n");
+    if (!raw || json_raw_length(raw) != 8 || strcmp(json_raw_value(raw), "{\"a\": 1}"))
+        fail("json_raw kept the white space around the text");
+    json_decref(raw);
+
+    raw = json_rawn_nocheck("  1\n", 4);
+    if (!raw || strcmp(json_raw_value(raw), "1"))
+        fail("json_rawn_nocheck kept the white space around the text");
+    json_decref(raw);
+
+    if (json_raw(NULL) || json_raw("") || json_raw("[1,") || json_raw("1 2") ||
+        json_raw("{\"a\" 1}") || json_rawn("[1]", 2))
+        fail("json_raw accepted invalid JSON");
+
+    raw = json_rawn_nocheck("not checked", 11);
+    if (!raw || strcmp(json_raw_value(raw), "not checked"))
+        fail("json_rawn_nocheck failed");
+    json_decref(raw);
+
+    copy = json_string("a");
+    if (json_raw_value(json_null()) || json_raw_length(copy) != 0)
+        fail("the raw accessors accepted other values");
+    json_decref(copy);
+}
+
+static void test_dump_raw() {
+    json_t *json, *raw;
+    char buffer[8];
+
+    raw = json_raw("[1,  2]");
+    json = json_pack("{s:O, s:[O]}", "a", raw, "b", raw);
+
+    /* The text is copied as is, whatever the flags */
+    check_dump(json, JSON_COMPACT | JSON_SORT_KEYS, "{\"a\":[1,  2],\"b\":[[1,  2]]}");
+    check_dump(json, JSON_INDENT(2) | JSON_SORT_KEYS,
+               "{\n  \"a\": [1,  2],\n  \"b\": [\n    [1,  2]\n  ]\n}");
+
+    /* Whether JSON_ENCODE_ANY is needed depends on the text */
+    check_dump(raw, 0, "[1,  2]");
+    check_dump(raw, JSON_ENCODE_ANY, "[1,  2]");
+    json_decref(raw);
+    raw = json_raw("\"text\"");
+    if (json_dumps(raw, 0))
+        fail("a raw string was encoded without JSON_ENCODE_ANY");
+    check_dump(raw, JSON_ENCODE_ANY, "\"text\"");
+
+    if (json_dumpb(json, buffer, sizeof(buffer), JSON_COMPACT | JSON_SORT_KEYS) != 27)
+        fail("json_dumpb returned a wrong size");
+    if (json_cbor_dumpb(json, NULL, 0, 0) != 0)
+        fail("json_cbor_dumpb encoded a raw value");
+
+    json_decref(json);
+    json_decref(raw);
+}
+
+static void test_frozen_cache() {
+    static const size_t flag_sets[] = {0,
+                                       JSON_COMPACT,
+                                       JSON_INDENT(2),
+                                       JSON_INDENT(4) | JSON_SORT_KEYS,
+                                       JSON_COMPACT | JSON_ENSURE_ASCII,
+                                       JSON_SORT_KEYS | JSON_ESCAPE_SLASH,
+                                       JSON_REAL_PRECISION(3)};
+    json_t *outer, *copy;
+    size_t i, round;
+
+    frozen = json_pack("{s:s, s:[f, i, {s:s}], s:{}, s:o}", "name", "fr\xc3\xa4ulein/x",
+                       "values", 3.14159, 42, "z", "last", "empty", "raw",
+                       json_raw("{\"b\": 1}"));
+    if (!frozen || json_freeze(frozen))
+        fail("unable to freeze");
+
+    /* A mutable parent with the frozen value at different depths */
+    outer = json_pack("{s:O, s:[O, {s:O}]}", "a", frozen, "b", frozen, "c", frozen);
+    copy = json_deep_copy(outer);
+
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]); i++) {
+            char *expected = json_dumps(copy, flag_sets[i]);
+            char *cached = json_dumps(outer, flag_sets[i] | JSON_CACHE_FROZEN);
+            char *embedded = json_dumps(frozen, flag_sets[i] | JSON_CACHE_FROZEN |
+                                                    JSON_EMBED);
+            char *plain = json_dumps(frozen, flag_sets[i] | JSON_EMBED);
+
+            if (!expected || !cached || strcmp(expected, cached))
+                fail("the cached encoding is different");
+            if (!embedded || !plain || strcmp(embedded, plain))
+                fail("the cached encoding ignored JSON_EMBED");
+
+            free(expected);
+            free(cached);
+            free(embedded);
+            free(plain);
+        }
+
+        /* The cache can be dropped at any time */
+        if (round == 1)
+            json_dump_cache_clear();
+    }
+
+    if (json_dump_size(outer, JSON_CACHE_FROZEN) != json_dump_size(copy, 0))
+        fail("json_dump_size returned a wrong size with the cache");
+
+    json_dump_cache_clear();
+    json_dump_cache_clear();
+    json_decref(outer);
+    json_decref(copy);
+}
+
+static void run_tests() {
+    test_raw_values();
+    test_dump_raw();
+    test_frozen_cache();
+}
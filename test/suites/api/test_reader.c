@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char records[] = "{\"id\": 1}\n"
+                              "\n"
+                              "  \n"
+                              "{\"id\": 2, \"tags\": [\"a\", \n"
+                              "[3]\n"
+                              "[4] [5]\r\n"
+                              "[\"\xff\"]\n"
+                              "6\n"
+                              "{\"id\": 7} x\n"
+                              "{\"id\": 8}";
+
+/* The first value of each valid record, or 0 for an error, and the
+   line of the record */
+static const int expected_ids[] = {1, 0, 3, 4, 5, 0, 0, 7, 0, 8};
+static const int expected_lines[] = {1, 4, 5, 6, 6, 7, 8, 9, 9, 10};
+
+static int first_id(json_t *value) {
+    if (json_is_object(value))
+        return (int)json_integer_value(json_object_get(value, "id"));
+    return (int)json_integer_value(json_array_get(value, 0));
+}
+
+/* Return the start of the given line of records */
+static const char *line_start(int line) {
+    const char *p = records;
+
+    while (--line > 0)
+        p = strchr(p, '\n') + 1;
+    return p;
+}
+
+static void check_record_error(const json_error_t *error, int line) {
+    const char *start = line_start(line);
+    const char *end = strchr(start, '\n');
+    json_error_t expected;
+    size_t length = end ? (size_t)(end - start) : strlen(start);
+
+    /* Skip the valid value before the error on line 9 */
+    if (line == 9) {
+        start += 10;
+        length -= 10;
+    }
+    if (json_loadb(start, length, 0, &expected))
+        fail("json_loadb accepted an invalid record");
+
+    /* Errors are reported as by json_loadb(), at the right position in
+       the whole input */
+    if (json_error_code(error) != json_error_code(&expected) ||
+        strcmp(error->text, expected.text))
+        fail("json_reader_next returned a different error than json_loadb");
+    if (error->line != line || error->column != expected.column + (line == 9 ? 10 : 0))
+        fail("json_reader_next returned a wrong line or column");
+    if (error->position != (int)(start - records) + expected.position)
+        fail("json_reader_next returned a wrong position");
+}
+
+static void read_records(json_reader_t *reader, const char *source) {
+    const size_t count = sizeof(expected_ids) / sizeof(expected_ids[0]);
+    json_error_t error;
+    json_t *value;
+    size_t i;
+    int res;
+
+    if (!reader)
+        fail("creating a json_reader failed");
+
+    for (i = 0; i < count; i++) {
+        res = json_reader_next(reader, &value, &error);
+        if (strcmp(error.source, source))
+            fail("json_reader_next returned a wrong source");
+
+        if (expected_ids[i]) {
+            if (res != 1)
+                fail("json_reader_next failed on a valid record");
+            if (first_id(value) != expected_ids[i])
+                fail("json_reader_next returned a wrong value");
+            json_decref(value);
+        } else {
+            if (res != -1 || value)
+                fail("json_reader_next accepted an invalid record");
+            check_record_error(&error, expected_lines[i]);
+        }
+    }
+
+    if (json_reader_next(reader, &value, &error) != 0 || value)
+        fail("json_reader_next didn't end after the last record");
+    if (json_reader_next(reader, &value, &error) != 0)
+        fail("json_reader_next didn't end twice");
+
+    json_reader_destroy(reader);
+}
+
+struct chunks {
+    const char *text;
+    size_t length;
+    size_t pos;
+    size_t size;
+};
+
+/* Deliver the input in chunks of a given size */
+static size_t in_chunks(void *buffer, size_t buflen, void *data) {
+    struct chunks *chunks = data;
+    size_t n = chunks->length - chunks->pos;
+
+    if (n > chunks->size)
+        n = chunks->size;
+    if (n > buflen)
+        n = buflen;
+    memcpy(buffer, chunks->text + chunks->pos, n);
+    chunks->pos += n;
+    return n;
+}
+
+static void from_sources() {
+    struct chunks chunks;
+    FILE *fp;
+    size_t size;
+
+    read_records(json_reader_create_buffer(records, strlen(records), 0), "<buffer>");
+
+    for (size = 1; size <= 8; size++) {
+        chunks.text = records;
+        chunks.length = strlen(records);
+        chunks.pos = 0;
+        chunks.size = size;
+        read_records(json_reader_create_callback(in_chunks, &chunks, 0), "<callback>");
+    }
+
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    fputs(records, fp);
+    rewind(fp);
+    read_records(json_reader_create_file(fp, 0), "<stream>");
+    fclose(fp);
+}
+
+static void long_lines() {
+    const size_t count = 20000;
+    struct chunks chunks;
+    json_reader_t *reader;
+    json_error_t error;
+    json_t *value;
+    char *text;
+    size_t i, length;
+
+    /* A line that is longer than the read buffer, and a short one */
+    text = malloc(count * 4 + 16);
+    if (!text)
+        fail("malloc failed");
+    text[0] = '[';
+    for (i = 0; i < count; i++)
+        memcpy(text + 1 + i * 4, "123,", 4);
+    length = 1 + count * 4;
+    memcpy(text + length, "4]\n[5]\n", 7);
+    length += 7;
+
+    chunks.text = text;
+    chunks.length = length;
+    chunks.pos = 0;
+    chunks.size = length;
+    reader = json_reader_create_callback(in_chunks, &chunks, 0);
+
+    if (json_reader_next(reader, &value, &error) != 1)
+        fail("json_reader_next failed on a long line");
+    if (json_array_size(value) != count + 1 ||
+        json_integer_value(json_array_get(value, count)) != 4)
+        fail("json_reader_next returned a wrong value for a long line");
+    json_decref(value);
+
+    if (json_reader_next(reader, &value, &error) != 1 ||
+        json_integer_value(json_array_get(value, 0)) != 5)
+        fail("json_reader_next failed after a long line");
+    if (error.position != (int)length - 1)
+        fail("json_reader_next returned a wrong position after a long line");
+    json_decref(value);
+
+    if (json_reader_next(reader, &value, &error) != 0)
+        fail("json_reader_next didn't end after a long line");
+    json_reader_destroy(reader);
+    free(text);
+}
+
+static void decode_flags() {
+    json_reader_t *reader;
+    json_error_t error;
+    json_t *value;
+    const char input[] = "1\n\"two\"\n[3]\n";
+
+    reader = json_reader_create_buffer(input, strlen(input), JSON_DECODE_ANY);
+    if (json_reader_next(reader, &value, &error) != 1 || json_integer_value(value) != 1)
+        fail("json_reader_next failed on an integer with JSON_DECODE_ANY");
+    json_decref(value);
+    if (json_reader_next(reader, &value, &error) != 1 ||
+        strcmp(json_string_value(value), "two"))
+        fail("json_reader_next failed on a string with JSON_DECODE_ANY");
+    json_decref(value);
+    if (json_reader_next(reader, &value, &error) != 1 || !json_is_array(value))
+        fail("json_reader_next failed on an array with JSON_DECODE_ANY");
+    json_decref(value);
+    json_reader_destroy(reader);
+
+    reader = json_reader_create_buffer(input, strlen(input), JSON_REJECT_DUPLICATES);
+    if (json_reader_next(reader, &value, &error) != -1 ||
+        strcmp(error.text, "'[' or '{' expected near '1'"))
+        fail("json_reader_next accepted a scalar without JSON_DECODE_ANY");
+    json_reader_destroy(reader);
+}
+
+static void invalid_arguments() {
+    json_error_t error;
+    json_t *value;
+
+    if (json_reader_create_buffer(NULL, 0, 0) || json_reader_create_file(NULL, 0) ||
+        json_reader_create_fd(-1, 0) || json_reader_create_callback(NULL, NULL, 0))
+        fail("json_reader_create accepted invalid arguments");
+
+    if (json_reader_next(NULL, &value, &error) != -1 ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_reader_next accepted a NULL reader");
+
+    /* Passing NULL is allowed */
+    json_reader_destroy(NULL);
+}
+
+static void run_tests() {
+    from_sources();
+    long_lines();
+    decode_flags();
+    invalid_arguments();
+}
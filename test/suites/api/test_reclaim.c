@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMBERS 10
+#define LENGTH  100
+
+/* An object of MEMBERS arrays of LENGTH integers, and a shared value
+   in each array */
+static json_t *create_tree(json_t *shared) {
+    json_t *object, *array;
+    char key[16];
+    size_t i, j;
+
+    object = json_object();
+    for (i = 0; i < MEMBERS; i++) {
+        array = json_array();
+        for (j = 0; j < LENGTH - 1; j++)
+            json_array_append_new(array, json_integer((json_int_t)j));
+        json_array_append(array, shared);
+
+        snprintf(key, sizeof(key), "key%d", (int)i);
+        json_object_set_new(object, key, array);
+    }
+    return object;
+}
+
+static void test_scalars(void) {
+    json_t *json = json_string("a string that is freed right away");
+
+    json_decref_deferred(json);
+    json_decref_deferred(json_array());
+    json_decref_deferred(json_true());
+    json_decref_deferred(NULL);
+    if (json_reclaim(0) != 0)
+        fail("scalars and empty containers were queued");
+}
+
+static void test_steps(void) {
+    json_t *shared, *tree;
+    size_t steps, total = 0;
+
+    shared = json_string("shared");
+    tree = create_tree(shared);
+    if (shared->refcount != MEMBERS + 1)
+        fail("unexpected refcount");
+
+    json_decref_deferred(tree);
+    if (shared->refcount != MEMBERS + 1)
+        fail("the tree was destroyed right away");
+
+    /* Each member is released in a step of its own, and so is each
+       container once it's empty */
+    while ((steps = json_reclaim(7)) == 7)
+        total += steps;
+    total += steps;
+    if (total != MEMBERS + MEMBERS * (LENGTH + 1) + 1)
+        fail("json_reclaim() took a wrong number of steps");
+
+    if (shared->refcount != 1)
+        fail("json_reclaim() didn't release the shared value");
+    if (json_reclaim(1) != 0)
+        fail("the queue isn't empty");
+    json_decref(shared);
+}
+
+static void test_shared_container(void) {
+    json_t *shared, *tree, *member;
+
+    shared = json_pack("[i, s, {s:i}]", 1, "two", "three", 3);
+    tree = json_pack("{s:O, s:[O]}", "a", shared, "b", shared);
+    json_decref_deferred(tree);
+    json_reclaim(0);
+
+    /* A container that still has references is not torn down */
+    member = json_object_get(json_array_get(shared, 2), "three");
+    if (shared->refcount != 1 || json_array_size(shared) != 3 ||
+        json_integer_value(member) != 3)
+        fail("json_reclaim() changed a container that's still in use");
+    json_decref(shared);
+}
+
+static void test_deep_nesting(void) {
+    json_t *root, *json;
+    size_t i;
+
+    root = json = json_array();
+    for (i = 0; i < 100000; i++) {
+        json_t *child = json_array();
+        json_array_append_new(json, child);
+        json = child;
+    }
+
+    /* Doesn't recurse. The innermost array is empty, so it's freed
+       when it's released. */
+    json_decref_deferred(root);
+    if (json_reclaim(0) != 2 * 100000)
+        fail("json_reclaim() didn't free a deep tree");
+}
+
+/* Values allocated by an allocator of their own bypass the slab
+   allocator, so the live bytes are exact */
+static void test_allocator(void) {
+    json_allocator_t allocator;
+    counter_t counter;
+    json_t *tree, *json;
+
+    counter_init(&counter, &allocator);
+    tree = create_tree(json_null());
+    json = json_deep_copy_ex(&allocator, tree);
+    json_decref(tree);
+    if (!json || counter.live == 0)
+        fail("json_deep_copy_ex() failed");
+
+    json_decref_deferred(json);
+    json_reclaim(MEMBERS);
+    if (counter.live == 0)
+        fail("the tree was freed too early");
+
+    json_reclaim(0);
+    if (counter.live != 0)
+        fail("json_reclaim() didn't free everything");
+}
+
+static void run_tests() {
+    test_scalars();
+    test_steps();
+    test_shared_container();
+    test_deep_nesting();
+    test_allocator();
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Records the events as text, and aborts after a given number of
+   them if limit is nonzero */
+struct recorder {
+    char text[1024];
+    size_t length;
+    int events;
+    int limit;
+};
+
+static int record(struct recorder *r, const char *event, const char *value,
+                  size_t length) {
+    int n = snprintf(r->text + r->length, sizeof(r->text) - r->length, "%s%.*s ", event,
+                     (int)length, value);
+    if (n < 0 || (size_t)n >= sizeof(r->text) - r->length)
+        fail("too many events");
+    r->length += n;
+    r->events++;
+    return r->limit && r->events >= r->limit;
+}
+
+static int on_start_object(void *data) { return record(data, "{", "", 0); }
+
+static int on_end_object(void *data) { return record(data, "}", "", 0); }
+
+static int on_start_array(void *data) { return record(data, "[", "", 0); }
+
+static int on_end_array(void *data) { return record(data, "]", "", 0); }
+
+static int on_key(const char *key, size_t length, void *data) {
+    return record(data, "k:", key, length);
+}
+
+static int on_string(const char *value, size_t length, void *data) {
+    return record(data, "s:", value, length);
+}
+
+static int on_integer(json_int_t value, void *data) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" JSON_INTEGER_FORMAT, value);
+    return record(data, "i:", buf, strlen(buf));
+}
+
+static int on_real(double value, void *data) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", value);
+    return record(data, "r:", buf, strlen(buf));
+}
+
+static int on_boolean(int value, void *data) {
+    return record(data, value ? "true" : "false", "", 0);
+}
+
+static int on_null(void *data) { return record(data, "null", "", 0); }
+
+static const json_sax_handler_t handler = {
+    on_start_object, on_end_object, on_start_array, on_end_array, on_key,
+    on_string,       on_integer,    on_real,        on_boolean,   on_null};
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"a \\\"quoted\\\" name that is longer than the small buffer\","
+    " \"ratio\": 0.5, \"tags\": [\"a\", true, false, null, []], \"nested\": {}}";
+
+static const char events[] =
+    "{ k:id i:42 k:name s:a \"quoted\" name that is longer than the small buffer "
+    "k:ratio r:0.5 k:tags [ s:a true false null [ ] ] k:nested { } } ";
+
+static void init_recorder(struct recorder *r, int limit) {
+    memset(r, 0, sizeof(*r));
+    r->limit = limit;
+}
+
+static void sax_events() {
+    struct recorder r;
+    json_error_t error;
+
+    init_recorder(&r, 0);
+    if (json_sax_loadb(document, strlen(document), &handler, &r, 0, &error))
+        fail("json_sax_loadb failed on a valid document");
+    if (strcmp(r.text, events))
+        fail("json_sax_loadb produced wrong events");
+    if (error.position != (int)strlen(document))
+        fail("json_sax_loadb didn't save the position");
+
+    init_recorder(&r, 0);
+    if (json_sax_loadb("\"str\"", 5, &handler, &r, JSON_DECODE_ANY, &error) ||
+        strcmp(r.text, "s:str "))
+        fail("json_sax_loadb failed with JSON_DECODE_ANY");
+
+    init_recorder(&r, 0);
+    if (json_sax_loadb("[1, 2]", 6, &handler, &r, JSON_DECODE_INT_AS_REAL, &error) ||
+        strcmp(r.text, "[ r:1 r:2 ] "))
+        fail("json_sax_loadb failed with JSON_DECODE_INT_AS_REAL");
+
+    init_recorder(&r, 0);
+    if (json_sax_loadb("[1] [2]", 7, &handler, &r, JSON_DISABLE_EOF_CHECK, &error) ||
+        strcmp(r.text, "[ i:1 ] ") || error.position != 3)
+        fail("json_sax_loadb failed with JSON_DISABLE_EOF_CHECK");
+}
+
+static void null_members() {
+    json_sax_handler_t partial;
+    struct recorder r;
+    json_error_t error;
+
+    /* Events without a handler function are skipped */
+    memset(&partial, 0, sizeof(partial));
+    partial.key = on_key;
+
+    init_recorder(&r, 0);
+    if (json_sax_loadb(document, strlen(document), &partial, &r, 0, &error))
+        fail("json_sax_loadb failed with a partial handler");
+    if (strcmp(r.text, "k:id k:name k:ratio k:tags k:nested "))
+        fail("json_sax_loadb produced wrong events with a partial handler");
+}
+
+static void abort_early() {
+    struct recorder r;
+    json_error_t error;
+
+    init_recorder(&r, 3);
+    if (!json_sax_loadb(document, strlen(document), &handler, &r, 0, &error))
+        fail("json_sax_loadb didn't abort");
+    if (r.events != 3)
+        fail("json_sax_loadb called the handler after it aborted");
+    if (json_error_code(&error) != json_error_aborted)
+        fail("json_sax_loadb returned a wrong error code after an abort");
+    if (strcmp(error.text, "aborted by handler near '42'"))
+        fail("json_sax_loadb returned a wrong error message after an abort");
+
+    /* Aborting on the last event still fails */
+    init_recorder(&r, 2);
+    if (!json_sax_loadb("[]", 2, &handler, &r, 0, &error) ||
+        json_error_code(&error) != json_error_aborted)
+        fail("json_sax_loadb didn't abort on the last event");
+}
+
+static void invalid_input() {
+    static const char *const inputs[] = {
+        "{\"a\": [1, 2, \"three\"", "[1, 2,]", "{\"a\" 1}", "[\"\\u0000\"]",
+        "{\"\\u0000\": 1}",         "[1] x",   "1",        "[\"\\uD800\"]"};
+    struct recorder r;
+    json_error_t error, expected;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        init_recorder(&r, 0);
+        if (json_loadb(inputs[i], strlen(inputs[i]), 0, &expected))
+            fail("json_loadb accepted invalid input");
+        if (!json_sax_loadb(inputs[i], strlen(inputs[i]), &handler, &r, 0, &error))
+            fail("json_sax_loadb accepted invalid input");
+
+        /* Errors are reported as by the tree parser */
+        if (json_error_code(&error) != json_error_code(&expected) ||
+            strcmp(error.text, expected.text) || error.line != expected.line ||
+            error.column != expected.column || error.position != expected.position)
+            fail("json_sax_loadb returned a different error than json_loadb");
+    }
+
+    if (!json_sax_loadb(NULL, 0, &handler, &r, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_sax_loadb accepted a NULL buffer");
+    if (!json_sax_loadb("[]", 2, NULL, &r, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_sax_loadb accepted a NULL handler");
+    if (!json_sax_loadf(NULL, &handler, &r, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_sax_loadf accepted a NULL file");
+    if (!json_sax_loadfd(-1, &handler, &r, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_sax_loadfd accepted an invalid descriptor");
+    if (!json_sax_load_callback(NULL, NULL, &handler, &r, 0, &error) ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_sax_load_callback accepted a NULL callback");
+}
+
+static void depth_limit() {
+    char buffer[JSON_PARSER_MAX_DEPTH + 2];
+    json_sax_handler_t empty;
+    json_error_t error;
+
+    memset(&empty, 0, sizeof(empty));
+    memset(buffer, '[', sizeof(buffer));
+
+    if (!json_sax_loadb(buffer, sizeof(buffer), &empty, NULL, 0, &error))
+        fail("json_sax_loadb accepted a too deep document");
+    if (json_error_code(&error) != json_error_stack_overflow)
+        fail("json_sax_loadb returned a wrong error code for a too deep document");
+}
+
+/* The parser keeps the open containers on the heap, so the deepest
+   document JSON_MAX_DEPTH allows doesn't exhaust the C stack */
+static int count_arrays(void *data) {
+    (*(size_t *)data)++;
+    return 0;
+}
+
+static void deep_nesting() {
+    const size_t depth = 0xFFFF;
+    json_sax_handler_t counter;
+    json_error_t error;
+    size_t arrays = 0;
+    char *buffer;
+
+    buffer = malloc(2 * depth);
+    if (!buffer)
+        fail("malloc failed");
+    memset(buffer, '[', depth);
+    memset(buffer + depth, ']', depth);
+
+    memset(&counter, 0, sizeof(counter));
+    counter.start_array = count_arrays;
+    if (json_sax_loadb(buffer, 2 * depth, &counter, &arrays, JSON_MAX_DEPTH(depth), &error))
+        fail("json_sax_loadb failed on a deep document");
+    if (arrays != depth)
+        fail("json_sax_loadb reported a wrong number of arrays");
+
+    free(buffer);
+}
+
+struct chunks {
+    const char *text;
+    size_t pos;
+};
+
+/* Deliver the input one byte at a time */
+static size_t one_byte(void *buffer, size_t buflen, void *data) {
+    struct chunks *chunks = data;
+    (void)buflen;
+
+    if (!chunks->text[chunks->pos])
+        return 0;
+    *(char *)buffer = chunks->text[chunks->pos++];
+    return 1;
+}
+
+static void load_from_streams() {
+    struct recorder r;
+    struct chunks chunks;
+    json_error_t error;
+    FILE *fp;
+
+    chunks.text = document;
+    chunks.pos = 0;
+    init_recorder(&r, 0);
+    if (json_sax_load_callback(one_byte, &chunks, &handler, &r, 0, &error))
+        fail("json_sax_load_callback failed on a valid document");
+    if (strcmp(r.text, events) || strcmp(error.source, "<callback>"))
+        fail("json_sax_load_callback produced wrong events");
+
+    fp = tmpfile();
+    if (!fp)
+        fail("tmpfile() failed");
+    fputs(document, fp);
+    rewind(fp);
+
+    init_recorder(&r, 0);
+    if (json_sax_loadf(fp, &handler, &r, 0, &error))
+        fail("json_sax_loadf failed on a valid document");
+    if (strcmp(r.text, events) || strcmp(error.source, "<stream>"))
+        fail("json_sax_loadf produced wrong events");
+
+    fclose(fp);
+}
+
+static void run_tests() {
+    sax_events();
+    null_members();
+    abort_early();
+    invalid_input();
+    depth_limit();
+    deep_nesting();
+    load_from_streams();
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"a \\\"quoted\\\", name\", \"ratio\": -0.5e-3,\n"
+    " \"tags\": [\"a\", true, false, null, [], {}, [1, [2, [3]]]],\n"
+    " \"nested\": {\"x\": {\"y\": [{\"z\": \"}]\"}]}, \"empty\": \"\"},\n"
+    " \"a/b\": 1, \"m~n\": 2, \"\": 3, \"last\": [\"\\u00e4\", 1e3]}";
+
+static const char *const pointers[] = {"/id",
+                                       "/name",
+                                       "/tags/6/1/0",
+                                       "/nested/x/y/0/z",
+                                       "/nested",
+                                       "/nested/x/y",
+                                       "/missing",
+                                       "/tags/99",
+                                       "/tags/-",
+                                       "/tags/01",
+                                       "/tags/0",
+                                       "/id/0",
+                                       "/a~1b",
+                                       "/m~0n",
+                                       "/",
+                                       "/last/1",
+                                       ""};
+
+#define NUM_POINTERS (sizeof(pointers) / sizeof(pointers[0]))
+
+/* Resolve pointer in a decoded value */
+static json_t *resolve(json_t *json, const char *pointer) {
+    char token[64];
+
+    while (json && *pointer) {
+        size_t len = 0;
+
+        for (pointer++; *pointer && *pointer != '/'; pointer++) {
+            if (*pointer == '~')
+                token[len++] = *++pointer == '0' ? '~' : '/';
+            else
+                token[len++] = *pointer;
+        }
+        token[len] = '\0';
+
+        if (json_is_object(json))
+            json = json_object_get(json, token);
+        else if (json_is_array(json) && len && (len == 1 || token[0] != '0') &&
+                 strspn(token, "0123456789") == len)
+            json = json_array_get(json, strtoul(token, NULL, 10));
+        else
+            json = NULL;
+    }
+    return json;
+}
+
+static void select_values() {
+    json_t *values[NUM_POINTERS], *json;
+    json_error_t error;
+    size_t i;
+
+    json = json_loads(document, 0, &error);
+    if (!json)
+        fail("json_loads failed");
+
+    if (json_loadb_select(document, strlen(document), 0, pointers, values, NUM_POINTERS,
+                          &error))
+        fail("json_loadb_select failed on a valid document");
+    if (error.position != (int)strlen(document))
+        fail("json_loadb_select didn't save the position");
+
+    for (i = 0; i < NUM_POINTERS; i++) {
+        json_t *expected = resolve(json, pointers[i]);
+        if (!expected != !values[i] || (expected && !json_equal(expected, values[i])))
+            fail("json_loadb_select returned a wrong value");
+        json_decref(values[i]);
+    }
+
+    /* Only the root */
+    if (json_loadb_select(document, strlen(document), 0, pointers + NUM_POINTERS - 1,
+                          values, 1, &error) ||
+        !json_equal(values[0], json))
+        fail("json_loadb_select failed to select the root");
+    json_decref(values[0]);
+
+    /* Nothing */
+    if (json_loadb_select(document, strlen(document), 0, NULL, NULL, 0, &error))
+        fail("json_loadb_select failed without pointers");
+
+    json_decref(json);
+}
+
+static void duplicates() {
+    const char input[] = "{\"a\": {\"b\": 1}, \"x\": 0, \"a\": {\"c\": 2}}";
+    const char *const paths[] = {"/a/b", "/a/c", "/a/c"};
+    json_t *values[3];
+    json_error_t error;
+
+    /* The last duplicate wins, as when decoding */
+    if (json_loadb_select(input, strlen(input), 0, paths, values, 3, &error))
+        fail("json_loadb_select failed with duplicate keys");
+    if (values[0] || json_integer_value(values[1]) != 2 || values[1] != values[2])
+        fail("json_loadb_select didn't use the last duplicate key");
+    json_decref(values[1]);
+    json_decref(values[2]);
+}
+
+static void skipped_values() {
+    const char input[] = "{\"skip\": [\"\\q\", 1e999, {\"a\"}], \"x\": 1}";
+    const char *const paths[] = {"/x"};
+    json_t *value;
+    json_error_t error;
+
+    /* Values that are stepped over are only checked for nesting */
+    if (json_loadb_select(input, strlen(input), 0, paths, &value, 1, &error) ||
+        json_integer_value(value) != 1)
+        fail("json_loadb_select decoded a skipped value");
+    json_decref(value);
+
+    if (json_loadb_select(input, strlen(input), 0, NULL, NULL, 0, &error))
+        fail("json_loadb_select failed without pointers");
+}
+
+static void invalid_input() {
+    static const char *const inputs[] = {
+        "{\"skip\": [1, 2,\n 3], \"x\": tru}", "{\"skip\": [1, {]}, \"x\": 1}",
+        "{\"skip\": \"abc", "{\"skip\": [1,\n 2]\n \"x\": 1}", "[1, 2] x", "1",
+        "{\"skip\": ]}", "{\"x\" 1}"};
+    const char *const paths[] = {"/x"};
+    json_t *value;
+    json_error_t error, expected;
+    size_t i;
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        if (json_loadb(inputs[i], strlen(inputs[i]), 0, &expected))
+            fail("json_loadb accepted invalid input");
+        if (!json_loadb_select(inputs[i], strlen(inputs[i]), 0, paths, &value, 1, &error))
+            fail("json_loadb_select accepted invalid input");
+        if (value)
+            fail("json_loadb_select returned a value on error");
+        if (json_error_code(&error) != json_error_code(&expected) ||
+            error.line != expected.line)
+            fail("json_loadb_select returned a wrong error");
+    }
+
+    /* Errors in the values that are walked are reported as by
+       json_loadb(), with the lines and columns stepped over counted */
+    if (json_loadb(inputs[0], strlen(inputs[0]), 0, &expected) ||
+        !json_loadb_select(inputs[0], strlen(inputs[0]), 0, paths, &value, 1, &error))
+        fail("invalid input was accepted");
+    if (strcmp(error.text, expected.text) || error.column != expected.column ||
+        error.position != expected.position)
+        fail("json_loadb_select returned a different error than json_loadb");
+}
+
+static void invalid_arguments() {
+    const char *const invalid[] = {"x", "/~2", "/a~"};
+    const char *const null_path[] = {NULL};
+    json_t *value;
+    json_error_t error;
+    size_t i;
+
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        if (!json_loadb_select("{}", 2, 0, invalid + i, &value, 1, &error) ||
+            json_error_code(&error) != json_error_invalid_argument)
+            fail("json_loadb_select accepted an invalid pointer");
+    }
+
+    if (!json_loadb_select("{}", 2, 0, null_path, &value, 1, &error) ||
+        !json_loadb_select(NULL, 0, 0, NULL, NULL, 0, &error) ||
+        !json_loadb_select("{}", 2, 0, NULL, &value, 1, &error))
+        fail("json_loadb_select accepted invalid arguments");
+}
+
+static void run_tests() {
+    select_values();
+    duplicates();
+    skipped_values();
+    invalid_input();
+    invalid_arguments();
+}
@@ -7,6 +7,7 @@
 
 #include "util.h"
 #include <jansson.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void test_bad_args(void) {
@@ -58,6 +59,83 @@ static void test_bad_args(void) {
     json_decref(txt);
 }
 
+static void test_long_utf8(void) {
+    /* Strings long enough to be validated in blocks, with an invalid
+       byte or a truncated sequence at each offset */
+    static const char *const bad[] = {"\xff", "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+                                      "\x80", "\xe2\x82"};
+    char str[128];
+    size_t i, j, k, len;
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        for (j = 0; j < 60; j++) {
+            json_t *value;
+            char *dumped;
+
+            /* "\xe2\x82\xac" is the euro sign */
+            len = 0;
+            for (k = 0; k < j / 3; k++) {
+                memcpy(str + len, "\xe2\x82\xac", 3);
+                len += 3;
+            }
+            for (k = 0; k < j % 3; k++)
+                str[len++] = 'a';
+
+            value = json_stringn(str, len);
+            if (!value)
+                fail("json_stringn failed on valid UTF-8");
+
+            dumped = json_dumps(value, JSON_ENCODE_ANY);
+            if (!dumped || strlen(dumped) != len + 2 || memcmp(dumped + 1, str, len))
+                fail("json_dumps failed on valid UTF-8");
+            free(dumped);
+            json_decref(value);
+
+            memcpy(str + len, bad[i], strlen(bad[i]));
+            memcpy(str + len + strlen(bad[i]), "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb", 36);
+            len += strlen(bad[i]) + 36;
+
+            if (json_stringn(str, len))
+                fail("json_stringn accepted invalid UTF-8");
+
+            value = json_stringn_nocheck(str, len);
+            if (json_dumps(value, JSON_ENCODE_ANY))
+                fail("json_dumps accepted invalid UTF-8");
+            json_decref(value);
+        }
+    }
+}
+
+static void test_inline_strings(void) {
+    /* Strings move between the node and a separate buffer when they
+       are set to values of different lengths */
+    static const char *const values[] = {
+        "short", "a value that is too long to be stored inline", "", "x",
+        "exactly twenty-three by", "exactly twenty-four byte", "short again"};
+    json_t *value, *copy;
+    size_t i;
+
+    value = json_string("initial");
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        if (json_string_set(value, values[i]))
+            fail("json_string_set failed");
+        if (strcmp(json_string_value(value), values[i]) ||
+            json_string_length(value) != strlen(values[i]))
+            fail("json_string_set set a wrong value");
+
+        copy = json_copy(value);
+        if (!json_equal(copy, value))
+            fail("json_copy returned a different string");
+        json_decref(copy);
+    }
+
+    /* The new value may point into the old one */
+    if (json_string_set(value, json_string_value(value) + 6) ||
+        strcmp(json_string_value(value), "again"))
+        fail("json_string_set failed on a part of the old value");
+    json_decref(value);
+}
+
 /* Call the simple functions not covered by other tests of the public API */
 static void run_tests() {
     json_t *value;
@@ -284,4 +362,6 @@ static void run_tests() {
 #endif
 
     test_bad_args();
+    test_long_utf8();
+    test_inline_strings();
 }
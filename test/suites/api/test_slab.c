@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* The same conditions as in slab.c */
+#if defined(USE_SLAB_ALLOCATOR) && defined(HAVE___THREAD) &&                               \
+    (defined(HAVE_ATOMIC_BUILTINS) || defined(HAVE_SYNC_BUILTINS)) &&                      \
+    (defined(_WIN32) || defined(HAVE_PTHREAD_H))
+
+/* The size of the chunks that the slab allocator carves nodes from.
+   With memory statistics, a header is added to it. */
+#define CHUNK_SIZE 8192
+#define ROUNDS     100
+#define VALUES     200
+
+static size_t chunks = 0;
+
+static void *counting_malloc(size_t size) {
+    if (size >= CHUNK_SIZE)
+        chunks++;
+    return malloc(size);
+}
+
+static void *create_and_free(void *arg) {
+    json_t *array = json_array();
+    size_t i;
+
+    (void)arg;
+    for (i = 0; i < VALUES; i++)
+        json_array_append_new(array, json_integer((json_int_t)i));
+    json_decref(array);
+    return NULL;
+}
+
+static void *free_only(void *arg) {
+    json_decref((json_t *)arg);
+    return NULL;
+}
+
+static void run_thread(void *(*func)(void *), void *arg) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, func, arg) || pthread_join(thread, NULL))
+        fail("unable to run a thread");
+}
+
+/* The nodes cached by a thread go back to the shared pools when it
+   exits, so that threads started later reuse them instead of carving
+   new chunks */
+static void test_thread_exit(void) {
+    size_t i, warm;
+
+    json_set_alloc_funcs(counting_malloc, free);
+
+    run_thread(create_and_free, NULL);
+    run_thread(free_only, json_pack("[i, i, i]", 1, 2, 3));
+    warm = chunks;
+    if (warm == 0)
+        fail("the nodes weren't carved from chunks");
+
+    for (i = 0; i < ROUNDS; i++) {
+        run_thread(create_and_free, NULL);
+        run_thread(free_only, json_pack("[i, i, i]", 1, 2, 3));
+    }
+    if (chunks != warm)
+        fail("the nodes of exited threads weren't reused");
+
+    json_set_alloc_funcs(malloc, free);
+}
+
+/* A freed node is handed out again by the next allocation of its size */
+static void test_reuse(void) {
+    json_t *json;
+    void *freed;
+
+    json = json_integer(1);
+    freed = json;
+    json_decref(json);
+
+    json = json_integer(2);
+    if ((void *)json != freed)
+        fail("a freed node wasn't reused");
+    json_decref(json);
+}
+
+static void run_tests() {
+    test_reuse();
+    test_thread_exit();
+}
+
+#else
+
+/* Skipped without the slab allocator */
+static void run_tests() { exit(77); }
+
+#endif
@@ -24,6 +24,15 @@ static void test_sprintf() {
 
     if (json_sprintf("%s", "\xff\xff"))
         fail("json_sprintf unexpected success with invalid UTF");
+
+    /* too long to be stored inline */
+    s = json_sprintf("%s %s %d", "a longer string", "built by json_sprintf", 42);
+    if (!s || strcmp(json_string_value(s), "a longer string built by json_sprintf 42"))
+        fail("json_sprintf generated an unexpected long string");
+    json_decref(s);
+
+    if (json_sprintf("%s %s", "a longer string with invalid UTF-8", "\xff\xff"))
+        fail("json_sprintf unexpected success with invalid UTF in a long string");
 }
 
 static void run_tests() { test_sprintf(); }
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2009-2016 Petri Lehtinen <petri@digip.org>
+ *
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "util.h"
+#include <jansson.h>
+#include <string.h>
+
+struct output {
+    char text[4096];
+    size_t length;
+    int calls;
+    int fail;
+};
+
+static int collect(const char *buffer, size_t size, void *data) {
+    struct output *out = data;
+
+    out->calls++;
+    if (out->fail)
+        return -1;
+    if (size >= sizeof(out->text) - out->length)
+        fail("too much output");
+    memcpy(out->text + out->length, buffer, size);
+    out->length += size;
+    out->text[out->length] = '\0';
+    return 0;
+}
+
+static void init_output(struct output *out) { memset(out, 0, sizeof(*out)); }
+
+/* Write json with the writer calls for each value */
+static int write_value(json_writer_t *writer, json_t *json) {
+    const char *key;
+    json_t *value;
+    size_t i;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            if (json_writer_begin_object(writer))
+                return -1;
+            json_object_foreach(json, key, value) {
+                if (json_writer_key(writer, key) || write_value(writer, value))
+                    return -1;
+            }
+            return json_writer_end_object(writer);
+
+        case JSON_ARRAY:
+            if (json_writer_begin_array(writer))
+                return -1;
+            json_array_foreach(json, i, value) {
+                if (write_value(writer, value))
+                    return -1;
+            }
+            return json_writer_end_array(writer);
+
+        case JSON_STRING:
+            return json_writer_stringn(writer, json_string_value(json),
+                                       json_string_length(json));
+        case JSON_INTEGER:
+            return json_writer_integer(writer, json_integer_value(json));
+        case JSON_REAL:
+            return json_writer_real(writer, json_real_value(json));
+        case JSON_TRUE:
+            return json_writer_boolean(writer, 1);
+        case JSON_FALSE:
+            return json_writer_boolean(writer, 0);
+        default:
+            return json_writer_null(writer);
+    }
+}
+
+static const char document[] =
+    "{\"id\": 42, \"name\": \"caf\\u00e9 / \\\"bar\\\"\\n\", \"ratio\": 0.1,"
+    " \"pi\": 3.141592653589793, \"empty\": {}, \"none\": [], \"ok\": true,"
+    " \"tags\": [\"a\", false, null, [1, [2, {}]], {\"x\": -1e100}],"
+    " \"nested\": {\"k\": {\"l\": [\"\\ud834\\udd1e\"]}}}";
+
+static void same_as_dumps() {
+    static const size_t flags[] = {0,
+                                   JSON_INDENT(2),
+                                   JSON_INDENT(31),
+                                   JSON_COMPACT,
+                                   JSON_INDENT(3) | JSON_COMPACT,
+                                   JSON_ENSURE_ASCII,
+                                   JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(4),
+                                   JSON_EMBED,
+                                   JSON_EMBED | JSON_INDENT(1)};
+    json_t *json, *array;
+    json_error_t error;
+    size_t i;
+
+    json = json_loads(document, 0, &error);
+    if (!json)
+        fail("json_loads failed");
+
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        struct output out;
+        json_writer_t *writer;
+        char *expected;
+
+        init_output(&out);
+        writer = json_writer_create(collect, &out, flags[i]);
+        if (!writer)
+            fail("json_writer_create failed");
+        if (write_value(writer, json))
+            fail("writing a document failed");
+
+        expected = json_dumps(json, flags[i]);
+        if (strcmp(out.text, expected))
+            fail("json_writer output differs from json_dumps");
+        free(expected);
+
+        /* Embedding a tree gives the same output */
+        init_output(&out);
+        json_writer_destroy(writer);
+        writer = json_writer_create(collect, &out, flags[i]);
+        if (json_writer_begin_array(writer) || json_writer_value(writer, json) ||
+            json_writer_integer(writer, 1) || json_writer_end_array(writer))
+            fail("writing a tree failed");
+
+        array = json_pack("[Oi]", json, 1);
+        expected = json_dumps(array, flags[i]);
+        if (strcmp(out.text, expected))
+            fail("json_writer_value output differs from json_dumps");
+        free(expected);
+        json_decref(array);
+
+        json_writer_destroy(writer);
+    }
+
+    json_decref(json);
+}
+
+static void buffered_output() {
+    struct output out;
+    json_writer_t *writer;
+    int i;
+
+    init_output(&out);
+    writer = json_writer_create(collect, &out, JSON_COMPACT);
+    json_writer_begin_array(writer);
+    for (i = 0; i < 100; i++)
+        json_writer_integer(writer, i);
+
+    /* Nothing is written before the buffer fills up or it's flushed */
+    if (out.calls != 0)
+        fail("json_writer didn't buffer the output");
+    if (json_writer_flush(writer) || out.calls != 1 || strncmp(out.text, "[0,1,2", 6))
+        fail("json_writer_flush didn't pass the output on");
+    if (json_writer_flush(writer) || out.calls != 1)
+        fail("json_writer_flush passed on empty output");
+
+    /* Completing the top level value passes the output on */
+    if (json_writer_end_array(writer) || out.calls != 2 ||
+        out.text[out.length - 1] != ']')
+        fail("json_writer didn't pass on the complete value");
+
+    json_writer_destroy(writer);
+}
+
+static void deep_nesting() {
+    struct output out;
+    json_writer_t *writer;
+    int i;
+
+    init_output(&out);
+    writer = json_writer_create(collect, &out, 0);
+    for (i = 0; i < 1000; i++) {
+        if (json_writer_begin_array(writer))
+            fail("json_writer_begin_array failed");
+    }
+    for (i = 0; i < 1000; i++) {
+        if (json_writer_end_array(writer))
+            fail("json_writer_end_array failed");
+    }
+    if (out.length != 2000 || out.text[999] != '[' || out.text[1000] != ']')
+        fail("json_writer produced wrong nested arrays");
+    json_writer_destroy(writer);
+}
+
+static void scalars() {
+    struct output out;
+    json_writer_t *writer;
+    json_t *raw;
+
+    init_output(&out);
+    writer = json_writer_create(collect, &out, 0);
+    if (!json_writer_integer(writer, 1))
+        fail("json_writer wrote a top level scalar without JSON_ENCODE_ANY");
+    json_writer_destroy(writer);
+
+    init_output(&out);
+    writer = json_writer_create(collect, &out, JSON_ENCODE_ANY);
+    if (json_writer_string(writer, "foo") || strcmp(out.text, "\"foo\""))
+        fail("json_writer failed with JSON_ENCODE_ANY");
+    if (!json_writer_string(writer, "bar"))
+        fail("json_writer wrote two top level values");
+    json_writer_destroy(writer);
+
+    /* Raw values need JSON_ENCODE_ANY unless they hold a container */
+    raw = json_raw("1");
+    init_output(&out);
+    writer = json_writer_create(collect, &out, 0);
+    if (!json_writer_value(writer, raw))
+        fail("json_writer wrote a top level raw scalar without JSON_ENCODE_ANY");
+    json_writer_destroy(writer);
+    json_decref(raw);
+
+    raw = json_raw("[1]");
+    init_output(&out);
+    writer = json_writer_create(collect, &out, 0);
+    if (json_writer_value(writer, raw) || strcmp(out.text, "[1]"))
+        fail("json_writer didn't write a top level raw array");
+    json_writer_destroy(writer);
+    json_decref(raw);
+}
+
+static void invalid_calls() {
+    struct output out;
+    json_writer_t *writer;
+
+    if (json_writer_create(NULL, NULL, 0))
+        fail("json_writer_create accepted a NULL callback");
+
+#define check_invalid(calls, msg)                                                        \
+    do {                                                                                 \
+        init_output(&out);                                                               \
+        writer = json_writer_create(collect, &out, 0);                                   \
+        if (!(calls))                                                                    \
+            fail(msg);                                                                   \
+        /* Errors are sticky */                                                          \
+        if (!json_writer_flush(writer) || !json_writer_begin_array(writer))              \
+            fail("json_writer continued after an error: " msg);                          \
+        json_writer_destroy(writer);                                                     \
+    } while (0)
+
+    check_invalid(json_writer_begin_object(writer) || json_writer_integer(writer, 1),
+                  "json_writer accepted a value without a key");
+    check_invalid(json_writer_begin_array(writer) || json_writer_key(writer, "a"),
+                  "json_writer accepted a key in an array");
+    check_invalid(json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+                      json_writer_key(writer, "b"),
+                  "json_writer accepted two keys in a row");
+    check_invalid(json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+                      json_writer_end_object(writer),
+                  "json_writer accepted a key without a value");
+    check_invalid(json_writer_begin_array(writer) || json_writer_end_object(writer),
+                  "json_writer accepted a mismatched end");
+    check_invalid(json_writer_end_array(writer), "json_writer accepted an unmatched end");
+    check_invalid(json_writer_begin_array(writer) || json_writer_string(writer, "\xff"),
+                  "json_writer accepted invalid UTF-8");
+    check_invalid(json_writer_begin_array(writer) || json_writer_string(writer, NULL),
+                  "json_writer accepted a NULL string");
+    check_invalid(json_writer_begin_array(writer) || json_writer_value(writer, NULL),
+                  "json_writer accepted a NULL value");
+    check_invalid(json_writer_begin_array(writer) || json_writer_end_array(writer) ||
+                      json_writer_begin_array(writer),
+                  "json_writer accepted two top level values");
+
+    /* Callback errors */
+    init_output(&out);
+    out.fail = 1;
+    writer = json_writer_create(collect, &out, 0);
+    if (json_writer_begin_array(writer) || json_writer_null(writer))
+        fail("json_writer failed before passing the output on");
+    if (!json_writer_end_array(writer))
+        fail("json_writer ignored a callback error");
+    if (!json_writer_flush(writer) || out.calls != 1)
+        fail("json_writer called the callback after an error");
+    json_writer_destroy(writer);
+
+    if (!json_writer_begin_array(NULL) || !json_writer_null(NULL) ||
+        !json_writer_flush(NULL))
+        fail("json_writer functions accepted a NULL writer");
+
+    /* Passing NULL is allowed */
+    json_writer_destroy(NULL);
+}
+
+static void check_same_error(const json_error_t *error, const json_error_t *expected,
+                             const char *msg) {
+    if (json_error_code(error) != json_error_code(expected) ||
+        strcmp(error->text, expected->text) || strcmp(error->source, expected->source) ||
+        error->line != expected->line || error->column != expected->column ||
+        error->position != expected->position)
+        fail(msg);
+}
+
+static void pack_same_as_dumps() {
+    static const size_t flags[] = {0, JSON_INDENT(2), JSON_COMPACT,
+                                   JSON_ENSURE_ASCII | JSON_ESCAPE_SLASH,
+                                   JSON_REAL_PRECISION(3)};
+    static const char format[] = "{s:i, s:I, s:f, s:b, s:n, s:s#, s:s++, "
+                                 "s:[s?, s*, o*, O?, {}], s:o, s:O, s:s*, s:{s:[]}}";
+    json_t *inner, *json;
+    json_error_t error;
+    char *text, *expected;
+    size_t i;
+
+    inner = json_pack("[i, {s:s}]", 1, "x", "y");
+
+    /* Members are written in the order given */
+    for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        text = json_pack_dumps(&error, flags[i], format, "a", 1, "b", (json_int_t)1 << 40,
+                               "c", 0.1, "d", 1, "e", "f", "caf\xc3\xa9/x", 6, "g", "x",
+                               "y", "z", "h", NULL, NULL, NULL, NULL, "i",
+                               json_incref(inner), "j", inner, "k", NULL, "l", "m");
+        if (!text)
+            fail("json_pack_dumps failed");
+
+        json = json_pack(format, "a", 1, "b", (json_int_t)1 << 40, "c", 0.1, "d", 1, "e",
+                         "f", "caf\xc3\xa9/x", 6, "g", "x", "y", "z", "h", NULL, NULL,
+                         NULL, NULL, "i", json_incref(inner), "j", inner, "k", NULL, "l",
+                         "m");
+        expected = json_dumps(json, flags[i] | JSON_PRESERVE_ORDER);
+        if (strcmp(text, expected))
+            fail("json_pack_dumps output differs from json_dumps");
+
+        free(text);
+        free(expected);
+        json_decref(json);
+    }
+
+    if (inner->refcount != 1)
+        fail("json_pack_dumps didn't release a stolen value");
+    json_decref(inner);
+
+    /* Top level scalars need JSON_ENCODE_ANY */
+    if (json_pack_dumps(&error, 0, "i", 1) ||
+        json_error_code(&error) != json_error_aborted)
+        fail("json_pack_dumps wrote a top level scalar without JSON_ENCODE_ANY");
+    text = json_pack_dumps(&error, JSON_ENCODE_ANY, "s", "foo");
+    if (!text || strcmp(text, "\"foo\""))
+        fail("json_pack_dumps failed with JSON_ENCODE_ANY");
+    free(text);
+}
+
+static void pack_to_writer() {
+    struct output out;
+    json_writer_t *writer;
+    json_error_t error;
+
+    /* Packed values can be mixed with other writer calls */
+    init_output(&out);
+    writer = json_writer_create(collect, &out, JSON_COMPACT);
+    if (json_writer_begin_object(writer) || json_writer_key(writer, "a") ||
+        json_writer_pack(writer, &error, "[i, s]", 1, "x") ||
+        json_writer_key(writer, "b") || json_writer_pack(writer, &error, "n") ||
+        json_writer_end_object(writer))
+        fail("json_writer_pack failed");
+    if (strcmp(out.text, "{\"a\":[1,\"x\"],\"b\":null}"))
+        fail("json_writer_pack wrote a wrong value");
+    json_writer_destroy(writer);
+
+    /* A failing callback */
+    init_output(&out);
+    out.fail = 1;
+    writer = json_writer_create(collect, &out, 0);
+    if (!json_writer_pack(writer, &error, "{s:i}", "a", 1) ||
+        json_error_code(&error) != json_error_aborted)
+        fail("json_writer_pack didn't report a failing callback");
+    json_writer_destroy(writer);
+
+    if (!json_writer_pack(NULL, &error, "[]") ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_writer_pack accepted a NULL writer");
+}
+
+static void pack_errors() {
+    json_error_t error, expected;
+    json_t *value;
+    double zero = 0.0;
+
+    /* Errors are reported as by json_pack_ex() */
+    if (json_pack_dumps(&error, 0, "[i, s]", 1, NULL) ||
+        json_pack_ex(&expected, 0, "[i, s]", 1, NULL))
+        fail("json_pack_dumps accepted a NULL string");
+    check_same_error(&error, &expected, "json_pack_dumps returned a different error");
+
+    if (json_pack_dumps(&error, 0, "{s:f}", "a", 1.0 / zero) ||
+        json_pack_ex(&expected, 0, "{s:f}", "a", 1.0 / zero))
+        fail("json_pack_dumps accepted an infinite real");
+    check_same_error(&error, &expected, "json_pack_dumps returned a different error");
+
+    if (json_pack_dumps(&error, 0, "{s:s}", "a", "\xff") ||
+        json_pack_ex(&expected, 0, "{s:s}", "a", "\xff"))
+        fail("json_pack_dumps accepted invalid UTF-8");
+    check_same_error(&error, &expected, "json_pack_dumps returned a different error");
+
+    if (json_pack_dumps(&error, 0, "[i", 1) || json_pack_ex(&expected, 0, "[i", 1))
+        fail("json_pack_dumps accepted an invalid format");
+    check_same_error(&error, &expected, "json_pack_dumps returned a different error");
+
+    if (json_pack_dumps(&error, 0, "[] i", 1) || json_pack_ex(&expected, 0, "[] i", 1))
+        fail("json_pack_dumps accepted garbage after the format");
+    check_same_error(&error, &expected, "json_pack_dumps returned a different error");
+
+    if (json_pack_dumps(&error, 0, "") ||
+        json_error_code(&error) != json_error_invalid_argument)
+        fail("json_pack_dumps accepted an empty format");
+
+    /* Stolen values are released after an error */
+    value = json_object();
+    if (json_pack_dumps(&error, 0, "[s, o, o]", NULL, json_incref(value),
+                        json_incref(value)))
+        fail("json_pack_dumps accepted a NULL string");
+    if (value->refcount != 1)
+        fail("json_pack_dumps didn't release stolen values after an error");
+    json_decref(value);
+}
+
+static void run_tests() {
+    same_as_dumps();
+    buffered_output();
+    deep_nesting();
+    scalars();
+    invalid_calls();
+    pack_same_as_dumps();
+    pack_to_writer();
+    pack_errors();
+}
@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #if HAVE_LOCALE_H
 #include <locale.h>
 #endif
@@ -80,6 +81,59 @@
 #define check_error(code_, text_, source_, line_, column_, position_)                    \
     check_errors(code_, &text_, 1, source_, line_, column_, position_)
 
+/* An allocator that counts its blocks, and checks the sizes of the
+   sized frees against the sizes that were allocated. Set it up with
+   counter_init(). */
+typedef struct {
+    size_t allocs;
+    size_t frees;
+    size_t sized_frees;
+    size_t wrong_sizes;
+    size_t live;
+} counter_t;
+
+typedef union {
+    size_t size;
+    char align[16];
+} counter_block_t;
+
+static JSON_INLINE void *counter_malloc(size_t size, void *ctx) {
+    counter_t *counter = ctx;
+    counter_block_t *block = malloc(sizeof(counter_block_t) + size);
+
+    if (!block)
+        return NULL;
+    block->size = size;
+    counter->allocs++;
+    counter->live += size;
+    return block + 1;
+}
+
+static JSON_INLINE void counter_free(void *ptr, size_t size, void *ctx) {
+    counter_t *counter = ctx;
+    counter_block_t *block;
+
+    if (!ptr)
+        return;
+
+    block = (counter_block_t *)ptr - 1;
+    if (size) {
+        counter->sized_frees++;
+        if (size != block->size)
+            counter->wrong_sizes++;
+    }
+    counter->frees++;
+    counter->live -= block->size;
+    free(block);
+}
+
+static JSON_INLINE void counter_init(counter_t *counter, json_allocator_t *allocator) {
+    memset(counter, 0, sizeof(*counter));
+    allocator->malloc = counter_malloc;
+    allocator->free = counter_free;
+    allocator->ctx = counter;
+}
+
 static void run_tests();
 
 int main() {